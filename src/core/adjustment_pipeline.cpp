@@ -0,0 +1,533 @@
+#include "adjustment_pipeline.h"
+#include "point_kernels.h"
+#include <algorithm>
+#include <cmath>
+
+namespace core {
+
+namespace {
+
+uint8_t toByte(float value)
+{
+    return static_cast<uint8_t>(std::clamp(value, 0.0f, 255.0f) + 0.5f);
+}
+
+// Table of f over [0, 1]
+template <typename Func>
+AdjustmentPipeline::ChannelLut tabulate(Func&& f)
+{
+    AdjustmentPipeline::ChannelLut lut;
+    for (int i = 0; i < 256; ++i) {
+        lut[i] = toByte(f(i / 255.0f) * 255.0f);
+    }
+    return lut;
+}
+
+AdjustmentPipeline::ChannelLut identityLut()
+{
+    AdjustmentPipeline::ChannelLut lut;
+    for (int i = 0; i < 256; ++i) {
+        lut[i] = static_cast<uint8_t>(i);
+    }
+    return lut;
+}
+
+// Monotone cubic (Fritsch-Carlson) through the control points, so curves
+// never overshoot between points the way a plain spline does
+AdjustmentPipeline::ChannelLut curveLut(std::vector<QPointF> points)
+{
+    if (points.size() < 2) return identityLut();
+
+    std::sort(points.begin(), points.end(),
+              [](const QPointF& a, const QPointF& b) { return a.x() < b.x(); });
+    const size_t n = points.size();
+
+    std::vector<double> slopes(n - 1);
+    for (size_t i = 0; i + 1 < n; ++i) {
+        const double dx = points[i + 1].x() - points[i].x();
+        slopes[i] = dx > 0.0 ? (points[i + 1].y() - points[i].y()) / dx : 0.0;
+    }
+    std::vector<double> tangents(n);
+    tangents[0] = slopes[0];
+    tangents[n - 1] = slopes[n - 2];
+    for (size_t i = 1; i + 1 < n; ++i) {
+        tangents[i] = slopes[i - 1] * slopes[i] <= 0.0 ? 0.0 : (slopes[i - 1] + slopes[i]) / 2.0;
+    }
+    for (size_t i = 0; i + 1 < n; ++i) {
+        if (slopes[i] == 0.0) {
+            tangents[i] = tangents[i + 1] = 0.0;
+            continue;
+        }
+        const double a = tangents[i] / slopes[i];
+        const double b = tangents[i + 1] / slopes[i];
+        const double h = a * a + b * b;
+        if (h > 9.0) {
+            const double t = 3.0 / std::sqrt(h);
+            tangents[i] = t * a * slopes[i];
+            tangents[i + 1] = t * b * slopes[i];
+        }
+    }
+
+    return tabulate([&](float x) {
+        if (x <= points.front().x()) return static_cast<float>(points.front().y());
+        if (x >= points.back().x()) return static_cast<float>(points.back().y());
+        size_t i = 0;
+        while (points[i + 1].x() < x) ++i;
+        const double h = points[i + 1].x() - points[i].x();
+        if (h <= 0.0) return static_cast<float>(points[i + 1].y());
+        const double t = (x - points[i].x()) / h;
+        const double t2 = t * t;
+        const double t3 = t2 * t;
+        const double y = (2 * t3 - 3 * t2 + 1) * points[i].y() + (t3 - 2 * t2 + t) * h * tangents[i]
+                       + (-2 * t3 + 3 * t2) * points[i + 1].y() + (t3 - t2) * h * tangents[i + 1];
+        return static_cast<float>(y);
+    });
+}
+
+float luma(float r, float g, float b)
+{
+    return 0.299f * r + 0.587f * g + 0.114f * b;
+}
+
+// Shift all channels so the colour keeps the given luma
+void keepLuma(float& r, float& g, float& b, float target)
+{
+    const float shift = target - luma(r, g, b);
+    r += shift;
+    g += shift;
+    b += shift;
+}
+
+// Whether a colour matrix maps every 8-bit colour into [0, 255] already,
+// so that the clamp after it changes nothing
+bool staysInRange(const float (&matrix)[3][4])
+{
+    for (const auto& row : matrix) {
+        float low = row[3];
+        float high = row[3];
+        for (int k = 0; k < 3; ++k) {
+            (row[k] < 0.0f ? low : high) += row[k] * 255.0f;
+        }
+        if (low < -0.5f || high > 255.5f) return false;
+    }
+    return true;
+}
+
+// Straight RGB of a colour, in [0, 1]
+void channels(const QColor& color, float* out)
+{
+    out[0] = static_cast<float>(color.redF());
+    out[1] = static_cast<float>(color.greenF());
+    out[2] = static_cast<float>(color.blueF());
+}
+
+} // namespace
+
+void AdjustmentPipeline::addLevels(const adjust::Levels& levels)
+{
+    addCurve(blend::toneTable(blend::ToneParams::levels(levels.inputBlack, levels.inputWhite, levels.gamma,
+                                                        levels.outputBlack, levels.outputWhite)));
+}
+
+void AdjustmentPipeline::addCurves(const adjust::Curves& curves)
+{
+    addCurve(curveLut(curves.red), curveLut(curves.green), curveLut(curves.blue));
+    addCurve(curveLut(curves.master));
+}
+
+void AdjustmentPipeline::addBrightnessContrast(const adjust::BrightnessContrast& params)
+{
+    // Same curve as the destructive adjustment, so both look alike
+    addCurve(blend::toneTable(blend::ToneParams::brightnessContrast(params.brightness, params.contrast)));
+}
+
+void AdjustmentPipeline::addInvert()
+{
+    addCurve(tabulate([](float x) { return 1.0f - x; }));
+}
+
+void AdjustmentPipeline::addThreshold(const adjust::Threshold& threshold)
+{
+    // Luminance into every channel, then a step
+    adjust::ChannelMixer luminance;
+    const float weights[4] = {0.299f, 0.587f, 0.114f, 0.0f};
+    std::copy(weights, weights + 4, luminance.red);
+    std::copy(weights, weights + 4, luminance.green);
+    std::copy(weights, weights + 4, luminance.blue);
+    addChannelMixer(luminance);
+    addCurve(tabulate([&](float x) { return x >= threshold.level ? 1.0f : 0.0f; }));
+}
+
+void AdjustmentPipeline::addPosterize(const adjust::Posterize& posterize)
+{
+    const float steps = static_cast<float>(std::clamp(posterize.levels, 2, 255) - 1);
+    addCurve(tabulate([&](float x) {
+        return std::min(std::floor(x * (steps + 1.0f)), steps) / steps;
+    }));
+}
+
+void AdjustmentPipeline::addChannelMixer(const adjust::ChannelMixer& mixer)
+{
+    Op op;
+    op.kind = OpKind::Matrix;
+    const float* rows[3] = {mixer.red, mixer.monochrome ? mixer.red : mixer.green,
+                            mixer.monochrome ? mixer.red : mixer.blue};
+    for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 3; ++col) {
+            op.matrix[row][col] = rows[row][col];
+        }
+        op.matrix[row][3] = rows[row][3] * 255.0f;
+    }
+    push(op);
+}
+
+void AdjustmentPipeline::addHueSaturation(const adjust::HueSaturation& params)
+{
+    Op op;
+    op.kind = OpKind::HueSaturation;
+    op.hsl = params;
+    push(op);
+}
+
+void AdjustmentPipeline::addColorBalance(const adjust::ColorBalance& params, int lutSize)
+{
+    addBaked(lutSize, [params](float& r, float& g, float& b) {
+        // Overlapping tonal weights, peaking in each third of the range
+        const float l = luma(r, g, b);
+        const float shadows = std::clamp(0.5f - (l - 0.333f) / 0.25f, 0.0f, 1.0f) * 0.7f;
+        const float highlights = std::clamp(0.5f + (l - 0.667f) / 0.25f, 0.0f, 1.0f) * 0.7f;
+        const float midtones = std::clamp(0.5f + (l - 0.333f) / 0.25f, 0.0f, 1.0f)
+                             * std::clamp(0.5f - (l - 0.667f) / 0.25f, 0.0f, 1.0f) * 0.7f;
+
+        float rgb[3] = {r, g, b};
+        for (int c = 0; c < 3; ++c) {
+            rgb[c] += shadows * params.shadows[c] + midtones * params.midtones[c]
+                    + highlights * params.highlights[c];
+        }
+        if (params.preserveLuminosity) {
+            keepLuma(rgb[0], rgb[1], rgb[2], l);
+        }
+        r = rgb[0];
+        g = rgb[1];
+        b = rgb[2];
+    });
+}
+
+void AdjustmentPipeline::addPhotoFilter(const adjust::PhotoFilter& params, int lutSize)
+{
+    float filter[3];
+    channels(params.color, filter);
+    const float density = std::clamp(params.density, 0.0f, 1.0f);
+    const bool preserve = params.preserveLuminosity;
+    addBaked(lutSize, [filter, density, preserve](float& r, float& g, float& b) {
+        // Multiply through the filter colour, blended by density
+        const float l = luma(r, g, b);
+        r += (r * filter[0] - r) * density;
+        g += (g * filter[1] - g) * density;
+        b += (b * filter[2] - b) * density;
+        if (preserve) {
+            keepLuma(r, g, b, l);
+        }
+    });
+}
+
+void AdjustmentPipeline::addGradientMap(const adjust::GradientMap& params, int lutSize)
+{
+    std::vector<std::pair<float, QColor>> stops = params.stops;
+    if (stops.size() < 2) {
+        stops = {{0.0f, QColor(Qt::black)}, {1.0f, QColor(Qt::white)}};
+    }
+    std::stable_sort(stops.begin(), stops.end(),
+                     [](const auto& a, const auto& c) { return a.first < c.first; });
+    const bool reverse = params.reverse;
+
+    addBaked(lutSize, [stops, reverse](float& r, float& g, float& b) {
+        float t = std::clamp(luma(r, g, b), 0.0f, 1.0f);
+        if (reverse) t = 1.0f - t;
+
+        size_t i = 0;
+        while (i + 1 < stops.size() && stops[i + 1].first < t) ++i;
+        float from[3];
+        float to[3];
+        channels(stops[i].second, from);
+        if (t <= stops.front().first || i + 1 == stops.size()) {
+            r = from[0];
+            g = from[1];
+            b = from[2];
+            return;
+        }
+        channels(stops[i + 1].second, to);
+        const float span = stops[i + 1].first - stops[i].first;
+        const float f = span > 0.0f ? (t - stops[i].first) / span : 1.0f;
+        r = from[0] + (to[0] - from[0]) * f;
+        g = from[1] + (to[1] - from[1]) * f;
+        b = from[2] + (to[2] - from[2]) * f;
+    });
+}
+
+void AdjustmentPipeline::addSelectiveColor(const adjust::SelectiveColor& params, int lutSize)
+{
+    using Range = adjust::SelectiveColor::Range;
+    addBaked(lutSize, [params](float& r, float& g, float& b) {
+        const float rgb[3] = {r, g, b};
+        const float maxC = std::max({r, g, b});
+        const float minC = std::min({r, g, b});
+        const float midC = r + g + b - maxC - minC;
+
+        // How much of each range the colour belongs to
+        float weights[Range::RangeCount] = {};
+        weights[Range::Reds] = r == maxC ? maxC - midC : 0.0f;
+        weights[Range::Yellows] = b == minC ? midC - minC : 0.0f;
+        weights[Range::Greens] = g == maxC && r != maxC ? maxC - midC : 0.0f;
+        weights[Range::Cyans] = r == minC && b != minC ? midC - minC : 0.0f;
+        weights[Range::Blues] = b == maxC && r != maxC && g != maxC ? maxC - midC : 0.0f;
+        weights[Range::Magentas] = g == minC && b != minC && r != minC ? midC - minC : 0.0f;
+        weights[Range::Whites] = std::max(0.0f, (minC - 0.5f) * 2.0f);
+        weights[Range::Blacks] = std::max(0.0f, (0.5f - maxC) * 2.0f);
+        weights[Range::Neutrals] = std::max(0.0f, 1.0f - std::abs(maxC - 0.5f) - std::abs(minC - 0.5f));
+
+        // Work in inks: cyan, magenta and yellow are the complements of
+        // red, green and blue; black adds to all three
+        float out[3];
+        for (int c = 0; c < 3; ++c) {
+            const float ink = 1.0f - rgb[c];
+            float change = 0.0f;
+            for (int range = 0; range < Range::RangeCount; ++range) {
+                if (weights[range] <= 0.0f) continue;
+                const float amount = params.inks[range][c] + params.inks[range][3];
+                change += weights[range] * amount * (params.relative ? ink : 1.0f);
+            }
+            out[c] = 1.0f - std::clamp(ink + change, 0.0f, 1.0f);
+        }
+        r = out[0];
+        g = out[1];
+        b = out[2];
+    });
+}
+
+void AdjustmentPipeline::addLut(std::shared_ptr<const ColorLut3D> lut)
+{
+    if (!lut || lut->isNull()) return;
+
+    Op op;
+    op.kind = OpKind::Lut3D;
+    op.lut3d = std::move(lut);
+    push(op);
+}
+
+void AdjustmentPipeline::addBaked(int lutSize, const ColorLut3D::ColorFunc& func)
+{
+    auto lut = std::make_shared<ColorLut3D>(ColorLut3D::fromFunction(lutSize, func));
+    addLut(std::move(lut));
+}
+
+void AdjustmentPipeline::addCurve(const ChannelLut& red, const ChannelLut& green, const ChannelLut& blue)
+{
+    Op op;
+    op.kind = OpKind::Curve;
+    op.lut[0] = red;
+    op.lut[1] = green;
+    op.lut[2] = blue;
+    push(op);
+}
+
+void AdjustmentPipeline::append(const AdjustmentPipeline& next)
+{
+    for (const Op& op : next.m_ops) {
+        push(op);
+    }
+}
+
+void AdjustmentPipeline::push(const Op& op)
+{
+    m_baked.slots.clear();
+    if (isIdentity(op)) return;
+
+    // Matrices only fuse when the earlier one cannot leave the colour cube,
+    // as the product would skip the clamp between them
+    const bool fusable = !m_ops.empty() && m_ops.back().kind == op.kind
+        && (op.kind == OpKind::Curve || (op.kind == OpKind::Matrix && staysInRange(m_ops.back().matrix)));
+    if (fusable) {
+        Op& last = m_ops.back();
+        if (op.kind == OpKind::Curve) {
+            // Tables compose exactly: later[earlier[x]]
+            for (int c = 0; c < 3; ++c) {
+                for (int i = 0; i < 256; ++i) {
+                    last.lut[c][i] = op.lut[c][last.lut[c][i]];
+                }
+            }
+        } else {
+            // later * earlier, including the constant column
+            float fused[3][4];
+            for (int row = 0; row < 3; ++row) {
+                for (int col = 0; col < 4; ++col) {
+                    float sum = col == 3 ? op.matrix[row][3] : 0.0f;
+                    for (int k = 0; k < 3; ++k) {
+                        sum += op.matrix[row][k] * last.matrix[k][col];
+                    }
+                    fused[row][col] = sum;
+                }
+            }
+            std::copy(&fused[0][0], &fused[0][0] + 12, &last.matrix[0][0]);
+        }
+        if (isIdentity(last)) {
+            m_ops.pop_back();
+        }
+        return;
+    }
+    m_ops.push_back(op);
+}
+
+bool AdjustmentPipeline::isIdentity(const Op& op)
+{
+    switch (op.kind) {
+        case OpKind::Curve:
+            for (int c = 0; c < 3; ++c) {
+                for (int i = 0; i < 256; ++i) {
+                    if (op.lut[c][i] != i) return false;
+                }
+            }
+            return true;
+        case OpKind::Matrix:
+            for (int row = 0; row < 3; ++row) {
+                for (int col = 0; col < 4; ++col) {
+                    const float expected = row == col ? 1.0f : 0.0f;
+                    if (std::abs(op.matrix[row][col] - expected) > 1e-6f) return false;
+                }
+            }
+            return true;
+        case OpKind::HueSaturation:
+            return op.hsl.hue == 0.0f && op.hsl.saturation == 0.0f && op.hsl.lightness == 0.0f;
+        case OpKind::Lut3D:
+            return false;
+    }
+    return false;
+}
+
+bool AdjustmentPipeline::prefersLut() const
+{
+    if (m_ops.size() > 2) return true;
+    if (m_ops.size() < 2) return false;
+    for (const Op& op : m_ops) {
+        if (op.kind == OpKind::HueSaturation || op.kind == OpKind::Lut3D) return true;
+    }
+    return false;
+}
+
+ColorLut3D AdjustmentPipeline::bake(int size) const
+{
+    ColorLut3D lut(size);
+    if (m_ops.empty()) return lut;
+
+    // Run the lattice through the chain as one opaque row
+    float* table = lut.data();
+    const int points = lut.size() * lut.size() * lut.size();
+    std::vector<QRgb> row(points);
+    for (int i = 0; i < points; ++i) {
+        const float* point = table + i * 3;
+        row[i] = qRgb(toByte(point[0] * 255.0f), toByte(point[1] * 255.0f), toByte(point[2] * 255.0f));
+    }
+    applyRow(row.data(), points);
+    for (int i = 0; i < points; ++i) {
+        float* point = table + i * 3;
+        point[0] = qRed(row[i]) / 255.0f;
+        point[1] = qGreen(row[i]) / 255.0f;
+        point[2] = qBlue(row[i]) / 255.0f;
+    }
+    return lut;
+}
+
+std::shared_ptr<const AdjustmentPipeline> AdjustmentPipeline::baked(int size) const
+{
+    std::shared_ptr<BakeSlot> slot;
+    {
+        std::lock_guard<std::mutex> lock(m_baked.mutex);
+        std::shared_ptr<BakeSlot>& entry = m_baked.slots[size];
+        if (!entry) entry = std::make_shared<BakeSlot>();
+        slot = entry;
+    }
+    std::call_once(slot->once, [&] {
+        auto pipeline = std::make_shared<AdjustmentPipeline>();
+        pipeline->addLut(std::make_shared<const ColorLut3D>(bake(size)));
+        slot->pipeline = std::move(pipeline);
+    });
+    return slot->pipeline;
+}
+
+void AdjustmentPipeline::applyRow(QRgb* pixels, int count) const
+{
+    if (m_ops.empty()) return;
+
+    // A lone table runs on the SIMD kernel
+    if (m_ops.size() == 1 && m_ops.front().kind == OpKind::Lut3D) {
+        m_ops.front().lut3d->applyRow(pixels, count);
+        return;
+    }
+
+    // Each stage runs over a whole chunk of straight colours, made opaque so
+    // the point kernels skip their own premultiplication; the alpha goes
+    // back on at the end
+    const blend::HslRowFunc hsl = blend::hslRowFunction();
+    constexpr int ChunkSize = 256;
+    QRgb straight[ChunkSize];
+    for (int start = 0; start < count; start += ChunkSize) {
+        QRgb* chunk = pixels + start;
+        const int n = std::min(ChunkSize, count - start);
+        for (int i = 0; i < n; ++i) {
+            const int alpha = qAlpha(chunk[i]);
+            straight[i] = alpha == 255 ? chunk[i] : alpha == 0 ? 0xff000000u : qUnpremultiply(chunk[i]) | 0xff000000u;
+        }
+
+        for (const Op& op : m_ops) {
+            switch (op.kind) {
+                case OpKind::Curve:
+                    for (int i = 0; i < n; ++i) {
+                        const QRgb p = straight[i];
+                        straight[i] = qRgb(op.lut[0][qRed(p)], op.lut[1][qGreen(p)], op.lut[2][qBlue(p)]);
+                    }
+                    break;
+                case OpKind::Matrix: {
+                    const float* m = &op.matrix[0][0];
+                    for (int i = 0; i < n; ++i) {
+                        const QRgb p = straight[i];
+                        const float r = qRed(p);
+                        const float g = qGreen(p);
+                        const float b = qBlue(p);
+                        straight[i] = qRgb(toByte(m[0] * r + m[1] * g + m[2] * b + m[3]),
+                                           toByte(m[4] * r + m[5] * g + m[6] * b + m[7]),
+                                           toByte(m[8] * r + m[9] * g + m[10] * b + m[11]));
+                    }
+                    break;
+                }
+                case OpKind::HueSaturation:
+                    hsl(straight, n, blend::HslParams{op.hsl.hue, op.hsl.saturation, op.hsl.lightness});
+                    break;
+                case OpKind::Lut3D:
+                    op.lut3d->applyRow(straight, n);
+                    break;
+            }
+        }
+
+        for (int i = 0; i < n; ++i) {
+            const int alpha = qAlpha(chunk[i]);
+            if (alpha == 255) {
+                chunk[i] = straight[i];
+            } else if (alpha != 0) {
+                chunk[i] = qPremultiply((straight[i] & 0x00ffffffu) | (static_cast<QRgb>(alpha) << 24));
+            }
+        }
+    }
+}
+
+void AdjustmentPipeline::apply(QImage& image, const QRect& area) const
+{
+    const QRect clipped = area & image.rect();
+    if (m_ops.empty() || clipped.isEmpty()) return;
+
+    for (int y = clipped.top(); y <= clipped.bottom(); ++y) {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y)) + clipped.left();
+        applyRow(line, clipped.width());
+    }
+}
+
+} // namespace core
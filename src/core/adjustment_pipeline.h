@@ -0,0 +1,242 @@
+#pragma once
+
+#include <QImage>
+#include <QPointF>
+#include <QRect>
+#include <QRgb>
+#include <QColor>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "color_lut.h"
+
+namespace core {
+namespace adjust {
+
+// Typed adjustment parameters. Tone values are normalised to [0, 1];
+// signed amounts are in [-1, 1] with 0 meaning "no change".
+
+struct Levels {
+    float inputBlack = 0.0f;
+    float inputWhite = 1.0f;
+    float gamma = 1.0f;
+    float outputBlack = 0.0f;
+    float outputWhite = 1.0f;
+};
+
+struct Curves {
+    // Control points (input, output); a channel with fewer than two points
+    // is left unchanged. The master curve applies after the channel curves.
+    std::vector<QPointF> master;
+    std::vector<QPointF> red;
+    std::vector<QPointF> green;
+    std::vector<QPointF> blue;
+};
+
+struct BrightnessContrast {
+    float brightness = 0.0f;
+    float contrast = 0.0f;
+};
+
+struct Threshold {
+    float level = 0.5f;     // Luminance at or above which pixels turn white
+};
+
+struct Posterize {
+    int levels = 4;         // Tones per channel, at least 2
+};
+
+struct ChannelMixer {
+    // Output channel rows of (red, green, blue, constant) weights
+    float red[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+    float green[4] = {0.0f, 1.0f, 0.0f, 0.0f};
+    float blue[4] = {0.0f, 0.0f, 1.0f, 0.0f};
+    bool monochrome = false;    // Use the red row for all three channels
+};
+
+struct HueSaturation {
+    float hue = 0.0f;           // Degrees, [-180, 180]
+    float saturation = 0.0f;
+    float lightness = 0.0f;
+};
+
+// Cross-channel grades below are baked into a 3D LUT when added
+
+struct ColorBalance {
+    // (cyan-red, magenta-green, yellow-blue) shifts per tonal range
+    float shadows[3] = {0.0f, 0.0f, 0.0f};
+    float midtones[3] = {0.0f, 0.0f, 0.0f};
+    float highlights[3] = {0.0f, 0.0f, 0.0f};
+    bool preserveLuminosity = true;
+};
+
+struct PhotoFilter {
+    QColor color{236, 138, 0};  // Warming filter
+    float density = 0.25f;      // [0, 1]
+    bool preserveLuminosity = true;
+};
+
+struct GradientMap {
+    // Colours at positions in [0, 1], sorted by position; luminance picks
+    // the colour. Fewer than two stops maps black to white.
+    std::vector<std::pair<float, QColor>> stops;
+    bool reverse = false;
+};
+
+struct SelectiveColor {
+    enum Range { Reds, Yellows, Greens, Cyans, Blues, Magentas, Whites, Neutrals, Blacks, RangeCount };
+    // (cyan, magenta, yellow, black) ink changes per range, in [-1, 1]
+    float inks[RangeCount][4] = {};
+    bool relative = true;       // Scale changes by the ink already present
+};
+
+} // namespace adjust
+
+/**
+ * @brief A chain of per-pixel adjustments compiled for a single pass
+ *
+ * Stages are appended bottom to top. Adjacent per-channel stages (levels,
+ * curves, brightness/contrast, invert, posterize) are composed into one set
+ * of 8-bit lookup tables, and adjacent channel mixes into one matrix where
+ * the first keeps colours in range (the product cannot clip in between), so
+ * a long stack usually runs as one or two operations per pixel. Rows are
+ * unpremultiplied once into a scratch chunk, each operation runs over the
+ * whole chunk (hue/saturation and 3D LUTs on the SIMD point kernels) and
+ * the result is premultiplied again, so any chain costs one read and one
+ * write of the image.
+ *
+ * Cross-channel grades that have no cheap closed form are baked into 3D
+ * lookup tables when added; a whole chain can also be baked into a single
+ * table with bake().
+ *
+ * A compiled pipeline is immutable in use and can be shared between the
+ * compositing threads.
+ */
+class AdjustmentPipeline {
+public:
+    using ChannelLut = std::array<uint8_t, 256>;
+
+    AdjustmentPipeline() = default;
+
+    // === Building ===
+
+    void addLevels(const adjust::Levels& levels);
+    void addCurves(const adjust::Curves& curves);
+    void addBrightnessContrast(const adjust::BrightnessContrast& params);
+    void addInvert();
+    void addThreshold(const adjust::Threshold& threshold);
+    void addPosterize(const adjust::Posterize& posterize);
+    void addChannelMixer(const adjust::ChannelMixer& mixer);
+    void addHueSaturation(const adjust::HueSaturation& params);
+    
+    // Cross-channel grades, baked at `lutSize` points per axis
+    void addColorBalance(const adjust::ColorBalance& params, int lutSize = ColorLut3D::DefaultSize);
+    void addPhotoFilter(const adjust::PhotoFilter& params, int lutSize = ColorLut3D::DefaultSize);
+    void addGradientMap(const adjust::GradientMap& params, int lutSize = ColorLut3D::DefaultSize);
+    void addSelectiveColor(const adjust::SelectiveColor& params, int lutSize = ColorLut3D::DefaultSize);
+    
+    /**
+     * @brief Add a 3D lookup table, e.g. one read from a .cube file
+     */
+    void addLut(std::shared_ptr<const ColorLut3D> lut);
+
+    /**
+     * @brief Add the same lookup table curve to red, green and blue
+     */
+    void addCurve(const ChannelLut& lut) { addCurve(lut, lut, lut); }
+    void addCurve(const ChannelLut& red, const ChannelLut& green, const ChannelLut& blue);
+
+    /**
+     * @brief Append another pipeline, fusing the stages where they meet
+     */
+    void append(const AdjustmentPipeline& next);
+
+    // === Evaluation ===
+
+    bool isIdentity() const { return m_ops.empty(); }
+
+    /**
+     * @brief Operations left after fusion, i.e. the work done per pixel
+     */
+    int operationCount() const { return static_cast<int>(m_ops.size()); }
+
+    /**
+     * @brief Whether a 3D LUT would evaluate this chain faster
+     *
+     * True for chains that mix hue/saturation or LUT stages with anything
+     * else, or that are left with more than two operations after fusion.
+     */
+    bool prefersLut() const;
+
+    /**
+     * @brief Sample the whole chain into one 3D lookup table
+     *
+     * The table reproduces smooth grades closely; hard steps such as
+     * Threshold or Posterize are softened between lattice points.
+     */
+    ColorLut3D bake(int size = ColorLut3D::DefaultSize) const;
+
+    /**
+     * @brief The chain as a pipeline of one table baked at `size`
+     *
+     * Baked on the first call for each size and kept with the pipeline,
+     * which is rebuilt whenever its parameters change, so each size is baked
+     * once per version of them (the canvas asks for two: one for the view
+     * and a coarser one for the overview). Thread-safe; callers wanting a
+     * size being baked wait for it, other sizes bake alongside.
+     */
+    std::shared_ptr<const AdjustmentPipeline> baked(int size) const;
+
+    /**
+     * @brief Adjust premultiplied ARGB32 pixels in place
+     */
+    void applyRow(QRgb* pixels, int count) const;
+
+    /**
+     * @brief Adjust an area of a premultiplied ARGB32 image in place
+     */
+    void apply(QImage& image, const QRect& area) const;
+
+private:
+    enum class OpKind {
+        Curve,          // Per-channel 8-bit tables
+        Matrix,         // 3x4 affine colour matrix, 0..255 domain
+        HueSaturation,
+        Lut3D
+    };
+
+    struct Op {
+        OpKind kind = OpKind::Curve;
+        ChannelLut lut[3];
+        float matrix[3][4] = {};
+        adjust::HueSaturation hsl;
+        std::shared_ptr<const ColorLut3D> lut3d;
+    };
+
+    // Tables made by baked(), by size; copies of the pipeline start without
+    struct BakeSlot {
+        std::once_flag once;
+        std::shared_ptr<const AdjustmentPipeline> pipeline;
+    };
+
+    struct BakeCache {
+        std::mutex mutex;
+        std::map<int, std::shared_ptr<BakeSlot>> slots;
+
+        BakeCache() = default;
+        BakeCache(const BakeCache&) {}
+        BakeCache& operator=(const BakeCache&) { return *this; }
+    };
+
+    std::vector<Op> m_ops;
+    mutable BakeCache m_baked;
+
+    void push(const Op& op);
+    void addBaked(int lutSize, const ColorLut3D::ColorFunc& func);
+    static bool isIdentity(const Op& op);
+};
+
+} // namespace core
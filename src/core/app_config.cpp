@@ -0,0 +1,79 @@
+#include "app_config.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QSettings>
+
+namespace core {
+
+namespace {
+
+QString findConfigFile()
+{
+    QStringList candidates;
+    if (QCoreApplication::instance()) {
+        candidates << QDir(QCoreApplication::applicationDirPath()).filePath("config/config.ini");
+    }
+    candidates << QDir::current().filePath("config/config.ini");
+
+    for (const QString& candidate : candidates) {
+        if (QFileInfo(candidate).exists()) {
+            return candidate;
+        }
+    }
+    return QString();
+}
+
+} // namespace
+
+AppConfig AppConfig::load(const QString& path)
+{
+    AppConfig config;
+    const QString file = path.isEmpty() ? findConfigFile() : path;
+    if (file.isEmpty()) return config;
+
+    QSettings settings(file, QSettings::IniFormat);
+
+    const qint64 maxMemory = parseByteSize(settings.value("Performance/MaxMemoryUsage").toString());
+    if (maxMemory > 0) {
+        config.maxMemoryUsage = maxMemory;
+    }
+
+    const QString cachePath = settings.value("Storage/CachePath").toString();
+    if (!cachePath.isEmpty()) {
+        config.cachePath = cachePath;
+    }
+
+    return config;
+}
+
+const AppConfig& AppConfig::global()
+{
+    static const AppConfig config = load();
+    return config;
+}
+
+qint64 AppConfig::parseByteSize(const QString& text)
+{
+    QString value = text.trimmed().toUpper();
+    if (value.isEmpty()) return -1;
+
+    qint64 multiplier = 1;
+    static const struct { const char* suffix; qint64 multiplier; } units[] = {
+        { "TB", 1LL << 40 }, { "GB", 1LL << 30 }, { "MB", 1LL << 20 }, { "KB", 1LL << 10 }, { "B", 1 }
+    };
+    for (const auto& unit : units) {
+        if (value.endsWith(unit.suffix)) {
+            multiplier = unit.multiplier;
+            value.chop(static_cast<int>(qstrlen(unit.suffix)));
+            break;
+        }
+    }
+
+    bool ok = false;
+    const double amount = value.trimmed().toDouble(&ok);
+    if (!ok || amount < 0) return -1;
+    return static_cast<qint64>(amount * multiplier);
+}
+
+} // namespace core
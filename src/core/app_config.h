@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QString>
+#include <QtGlobal>
+
+namespace core {
+
+/**
+ * @brief Settings read from config/config.ini
+ *
+ * Only the values the core consults are exposed. Missing files or keys
+ * fall back to the defaults shipped in config.ini.
+ */
+struct AppConfig {
+    qint64 maxMemoryUsage = 4LL * 1024 * 1024 * 1024;   // [Performance] MaxMemoryUsage
+    QString cachePath = "cache/";                       // [Storage] CachePath
+
+    /**
+     * @brief Read settings from an ini file
+     * @param path File to read; empty searches config/config.ini next to the
+     *             executable, then under the working directory
+     */
+    static AppConfig load(const QString& path = QString());
+
+    /**
+     * @brief Settings loaded once on first use
+     */
+    static const AppConfig& global();
+
+    /**
+     * @brief Parse sizes such as "4GB", "512MB", "64KB" or plain bytes
+     * @return The size in bytes, or -1 if the text is not a size
+     */
+    static qint64 parseByteSize(const QString& text);
+};
+
+} // namespace core
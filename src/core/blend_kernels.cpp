@@ -0,0 +1,70 @@
+#include "blend_kernels.h"
+
+namespace core {
+
+const char* blendModeName(BlendMode mode)
+{
+    switch (mode) {
+        case BlendMode::Normal: return "Normal";
+        case BlendMode::Multiply: return "Multiply";
+        case BlendMode::Screen: return "Screen";
+        case BlendMode::Overlay: return "Overlay";
+        case BlendMode::SoftLight: return "Soft Light";
+        case BlendMode::HardLight: return "Hard Light";
+        case BlendMode::ColorDodge: return "Color Dodge";
+        case BlendMode::ColorBurn: return "Color Burn";
+        case BlendMode::Darken: return "Darken";
+        case BlendMode::Lighten: return "Lighten";
+        case BlendMode::Difference: return "Difference";
+        case BlendMode::Exclusion: return "Exclusion";
+        case BlendMode::Hue: return "Hue";
+        case BlendMode::Saturation: return "Saturation";
+        case BlendMode::Color: return "Color";
+        case BlendMode::Luminosity: return "Luminosity";
+        case BlendMode::Dissolve: return "Dissolve";
+        case BlendMode::Behind: return "Behind";
+        case BlendMode::Clear: return "Clear";
+        case BlendMode::Add: return "Add";
+        case BlendMode::Subtract: return "Subtract";
+        case BlendMode::Divide: return "Divide";
+        case BlendMode::LinearBurn: return "Linear Burn";
+        case BlendMode::LinearDodge: return "Linear Dodge";
+        case BlendMode::VividLight: return "Vivid Light";
+        case BlendMode::LinearLight: return "Linear Light";
+        case BlendMode::PinLight: return "Pin Light";
+        case BlendMode::HardMix: return "Hard Mix";
+    }
+    return "Unknown";
+}
+
+namespace blend {
+
+RowFunc rowFunction(BlendMode mode, SimdLevel level)
+{
+    const int index = static_cast<int>(mode);
+    if (index < 0 || index >= BlendModeCount) {
+        return detail::scalarKernels()[static_cast<int>(BlendMode::Normal)];
+    }
+
+#if defined(CORE_X86_SIMD)
+    if (level > supportedSimdLevel()) {
+        level = supportedSimdLevel();
+    }
+    switch (level) {
+        case SimdLevel::AVX2: return detail::avx2Kernels()[index];
+        case SimdLevel::SSE41: return detail::sse41Kernels()[index];
+        case SimdLevel::Scalar: break;
+    }
+#else
+    (void)level;
+#endif
+    return detail::scalarKernels()[index];
+}
+
+RowFunc rowFunction(BlendMode mode)
+{
+    return rowFunction(mode, activeSimdLevel());
+}
+
+} // namespace blend
+} // namespace core
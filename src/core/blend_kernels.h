@@ -0,0 +1,45 @@
+#pragma once
+
+#include "blend_mode.h"
+#include "cpu_features.h"
+#include <cstdint>
+
+namespace core {
+namespace blend {
+
+/**
+ * @brief Composite one row of source pixels over destination pixels
+ *
+ * Both rows are premultiplied ARGB32 (QImage::Format_ARGB32_Premultiplied).
+ * The source is scaled by opacity before blending. x and y are the document
+ * coordinates of the first pixel and only matter for Dissolve, whose noise
+ * must stay put as the canvas is recomposited.
+ */
+using RowFunc = void (*)(uint32_t* dst, const uint32_t* src, int count,
+                         float opacity, int x, int y);
+
+/**
+ * @brief Row kernel for a mode at the active SIMD level
+ */
+RowFunc rowFunction(BlendMode mode);
+
+/**
+ * @brief Row kernel for a mode at a specific level (falls back to scalar)
+ */
+RowFunc rowFunction(BlendMode mode, SimdLevel level);
+
+inline void compositeRow(BlendMode mode, uint32_t* dst, const uint32_t* src, int count,
+                         float opacity, int x = 0, int y = 0)
+{
+    rowFunction(mode)(dst, src, count, opacity, x, y);
+}
+
+namespace detail {
+// Kernel tables indexed by BlendMode, one per instruction set
+const RowFunc* scalarKernels();
+const RowFunc* sse41Kernels();
+const RowFunc* avx2Kernels();
+} // namespace detail
+
+} // namespace blend
+} // namespace core
@@ -0,0 +1,186 @@
+#include <immintrin.h>
+#include <cstdint>
+#include <cstring>
+
+// AVX2 implementation, eight pixels per step. Built with -mavx2 -mfma or /arch:AVX2.
+
+namespace core {
+namespace blend {
+namespace {
+
+struct MaskF {
+    __m256 v;
+};
+
+struct VecF {
+    static constexpr int Width = 8;
+
+    __m256 v;
+
+    VecF() : v(_mm256_setzero_ps()) {}
+    VecF(__m256 value) : v(value) {}
+    VecF(float value) : v(_mm256_set1_ps(value)) {}
+    static VecF load(const float* values) { return _mm256_loadu_ps(values); }
+    void store(float* values) const { _mm256_storeu_ps(values, v); }
+};
+
+inline VecF operator+(VecF a, VecF b) { return _mm256_add_ps(a.v, b.v); }
+inline VecF operator-(VecF a, VecF b) { return _mm256_sub_ps(a.v, b.v); }
+inline VecF operator*(VecF a, VecF b) { return _mm256_mul_ps(a.v, b.v); }
+inline VecF operator/(VecF a, VecF b) { return _mm256_div_ps(a.v, b.v); }
+inline MaskF operator<(VecF a, VecF b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline MaskF operator>(VecF a, VecF b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline MaskF operator<=(VecF a, VecF b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline MaskF operator>=(VecF a, VecF b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+
+inline VecF select(MaskF mask, VecF a, VecF b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+inline VecF vmin(VecF a, VecF b) { return _mm256_min_ps(a.v, b.v); }
+inline VecF vmax(VecF a, VecF b) { return _mm256_max_ps(a.v, b.v); }
+inline VecF vsqrt(VecF a) { return _mm256_sqrt_ps(a.v); }
+
+inline void loadPixels(const uint32_t* p, VecF& r, VecF& g, VecF& b, VecF& a)
+{
+    const __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256 scale = _mm256_set1_ps(1.0f / 255.0f);
+    r = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask)), scale);
+    g = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask)), scale);
+    b = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(px, mask)), scale);
+    a = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(px, 24)), scale);
+}
+
+inline __m256i toBytes(VecF v)
+{
+    return _mm256_cvtps_epi32(_mm256_mul_ps(v.v, _mm256_set1_ps(255.0f)));
+}
+
+inline void storePixels(uint32_t* p, VecF r, VecF g, VecF b, VecF a)
+{
+    __m256i px = _mm256_slli_epi32(toBytes(a), 24);
+    px = _mm256_or_si256(px, _mm256_slli_epi32(toBytes(r), 16));
+    px = _mm256_or_si256(px, _mm256_slli_epi32(toBytes(g), 8));
+    px = _mm256_or_si256(px, toBytes(b));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), px);
+}
+
+inline VecF loadCoverage(const uint8_t* c)
+{
+    const __m256i values = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c)));
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(values), _mm256_set1_ps(1.0f / 255.0f));
+}
+
+inline VecF loadCoverage(const uint16_t* c)
+{
+    const __m256i values = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c)));
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(values), _mm256_set1_ps(1.0f / 65535.0f));
+}
+
+inline VecF vfloor(VecF v)
+{
+    return _mm256_floor_ps(v.v);
+}
+
+inline VecF gather(const float* base, VecF index)
+{
+    return _mm256_i32gather_ps(base, _mm256_cvttps_epi32(index.v), 4);
+}
+
+inline VecF mantissa(VecF x, VecF& exponent)
+{
+    const __m256i bits = _mm256_castps_si256(x.v);
+    exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+    return _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+                                               _mm256_set1_epi32(0x3f800000)));
+}
+
+inline VecF pow2i(VecF n)
+{
+    return _mm256_castsi256_ps(_mm256_slli_epi32(
+        _mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127)), 23));
+}
+
+struct VecB {
+    static constexpr int Width = 32;
+
+    __m256i v;
+
+    VecB(__m256i value) : v(value) {}
+    VecB(uint8_t value) : v(_mm256_set1_epi8(static_cast<char>(value))) {}
+    static VecB load(const uint8_t* values) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values)); }
+    void store(uint8_t* values) const { _mm256_storeu_si256(reinterpret_cast<__m256i*>(values), v); }
+};
+
+inline VecB minBytes(VecB a, VecB b) { return _mm256_min_epu8(a.v, b.v); }
+inline VecB maxBytes(VecB a, VecB b) { return _mm256_max_epu8(a.v, b.v); }
+inline VecB subBytes(VecB a, VecB b) { return _mm256_subs_epu8(a.v, b.v); }
+
+// Packing works within each 128-bit half, so the halves are written apart
+inline void storeChannelMax(VecB v, uint8_t* out)
+{
+    __m256i m = _mm256_max_epu8(v.v, _mm256_srli_epi32(v.v, 8));
+    m = _mm256_and_si256(_mm256_max_epu8(m, _mm256_srli_epi32(m, 16)), _mm256_set1_epi32(0xff));
+    m = _mm256_packus_epi16(_mm256_packus_epi32(m, m), m);
+    const int32_t low = _mm_cvtsi128_si32(_mm256_castsi256_si128(m));
+    const int32_t high = _mm_cvtsi128_si32(_mm256_extracti128_si256(m, 1));
+    std::memcpy(out, &low, sizeof(low));
+    std::memcpy(out + 4, &high, sizeof(high));
+}
+
+} // namespace
+} // namespace blend
+} // namespace core
+
+#include "blend_kernels_impl.h"
+#include "dab_kernels_impl.h"
+#include "lut_kernels_impl.h"
+#include "point_kernels_impl.h"
+#include "blur_kernels_impl.h"
+#include "selection_kernels_impl.h"
+
+namespace core {
+namespace blend {
+namespace detail {
+
+const RowFunc* avx2Kernels()
+{
+    return kernelTable();
+}
+
+const DabKernel* avx2DabKernels()
+{
+    return dabKernelTable();
+}
+
+LutRowFunc avx2LutKernel()
+{
+    return &lutRowKernel;
+}
+
+ToneRowFunc avx2ToneKernel()
+{
+    return &toneRowKernel;
+}
+
+HslRowFunc avx2HslKernel()
+{
+    return &hslRowKernel;
+}
+
+BoxColumnsFunc avx2BoxKernel()
+{
+    return &boxColumnsKernel;
+}
+
+const MaskRowFunc* avx2MaskKernels()
+{
+    return maskKernelTable();
+}
+
+ColorDistanceFunc avx2DistanceKernel()
+{
+    return &colorDistanceKernel<VecB>;
+}
+
+} // namespace detail
+} // namespace blend
+} // namespace core
@@ -0,0 +1,351 @@
+#pragma once
+
+// Blend-mode formulas shared by every instruction set.
+//
+// This header is included by exactly one translation unit per instruction
+// set (blend_kernels_scalar.cpp, _sse41.cpp, _avx2.cpp). Before including
+// it, the unit defines inside an anonymous namespace:
+//   VecF                 Width float lanes with + - * / and VecF(float)
+//   MaskF                result of <, <=, >=
+//   select(m, a, b)      a where m is set, b elsewhere
+//   vmin, vmax, vsqrt    lane-wise helpers
+//   VecF::load(const float*)
+//   loadPixels / storePixels  ARGB32 <-> channels in [0, 1]
+// Everything below is also in an anonymous namespace, so each unit gets its
+// own copy compiled for its own target and the linker never mixes them.
+
+#include "blend_kernels.h"
+#include <cstring>
+#include <utility>
+
+namespace core {
+namespace blend {
+namespace {
+
+struct Rgba {
+    VecF r, g, b, a;
+};
+
+struct Rgb {
+    VecF r, g, b;
+};
+
+constexpr float kEpsilon = 1e-6f;
+
+inline VecF clamp01(VecF v)
+{
+    return vmin(vmax(v, VecF(0.0f)), VecF(1.0f));
+}
+
+inline VecF unpremultiply(VecF c, VecF a)
+{
+    return vmin(c / vmax(a, VecF(kEpsilon)), VecF(1.0f));
+}
+
+// === Separable modes: B(cb, cs) from the W3C compositing spec ===
+
+inline VecF multiply(VecF d, VecF s) { return d * s; }
+inline VecF screen(VecF d, VecF s) { return d + s - d * s; }
+
+inline VecF hardLight(VecF d, VecF s)
+{
+    const VecF s2 = s + s;
+    return select(s <= VecF(0.5f), multiply(d, s2), screen(d, s2 - VecF(1.0f)));
+}
+
+inline VecF softLight(VecF d, VecF s)
+{
+    const VecF one(1.0f);
+    const VecF dd = select(d <= VecF(0.25f),
+                           ((VecF(16.0f) * d - VecF(12.0f)) * d + VecF(4.0f)) * d,
+                           vsqrt(d));
+    const VecF s2 = s + s;
+    return select(s <= VecF(0.5f),
+                  d - (one - s2) * d * (one - d),
+                  d + (s2 - one) * (dd - d));
+}
+
+inline VecF colorDodge(VecF d, VecF s)
+{
+    const VecF one(1.0f);
+    VecF r = vmin(one, d / vmax(one - s, VecF(kEpsilon)));
+    r = select(s >= one, one, r);
+    return select(d <= VecF(0.0f), VecF(0.0f), r);
+}
+
+inline VecF colorBurn(VecF d, VecF s)
+{
+    const VecF one(1.0f);
+    VecF r = one - vmin(one, (one - d) / vmax(s, VecF(kEpsilon)));
+    r = select(s <= VecF(0.0f), VecF(0.0f), r);
+    return select(d >= one, one, r);
+}
+
+inline VecF divide(VecF d, VecF s)
+{
+    const VecF one(1.0f);
+    VecF r = vmin(one, d / vmax(s, VecF(kEpsilon)));
+    r = select(s <= VecF(0.0f), one, r);
+    return select(d <= VecF(0.0f), VecF(0.0f), r);
+}
+
+template <BlendMode M>
+inline VecF blendChannel(VecF d, VecF s)
+{
+    const VecF zero(0.0f);
+    const VecF one(1.0f);
+    const VecF half(0.5f);
+
+    if constexpr (M == BlendMode::Multiply) {
+        return multiply(d, s);
+    } else if constexpr (M == BlendMode::Screen) {
+        return screen(d, s);
+    } else if constexpr (M == BlendMode::Overlay) {
+        return hardLight(s, d);
+    } else if constexpr (M == BlendMode::SoftLight) {
+        return softLight(d, s);
+    } else if constexpr (M == BlendMode::HardLight) {
+        return hardLight(d, s);
+    } else if constexpr (M == BlendMode::ColorDodge) {
+        return colorDodge(d, s);
+    } else if constexpr (M == BlendMode::ColorBurn) {
+        return colorBurn(d, s);
+    } else if constexpr (M == BlendMode::Darken) {
+        return vmin(d, s);
+    } else if constexpr (M == BlendMode::Lighten) {
+        return vmax(d, s);
+    } else if constexpr (M == BlendMode::Difference) {
+        return vmax(d - s, s - d);
+    } else if constexpr (M == BlendMode::Exclusion) {
+        return d + s - VecF(2.0f) * d * s;
+    } else if constexpr (M == BlendMode::Add || M == BlendMode::LinearDodge) {
+        return vmin(one, d + s);
+    } else if constexpr (M == BlendMode::Subtract) {
+        return vmax(zero, d - s);
+    } else if constexpr (M == BlendMode::Divide) {
+        return divide(d, s);
+    } else if constexpr (M == BlendMode::LinearBurn) {
+        return vmax(zero, d + s - one);
+    } else if constexpr (M == BlendMode::VividLight) {
+        const VecF s2 = s + s;
+        return select(s <= half, colorBurn(d, s2), colorDodge(d, s2 - one));
+    } else if constexpr (M == BlendMode::LinearLight) {
+        return clamp01(d + s + s - one);
+    } else if constexpr (M == BlendMode::PinLight) {
+        const VecF s2 = s + s;
+        return select(s <= half, vmin(d, s2), vmax(d, s2 - one));
+    } else if constexpr (M == BlendMode::HardMix) {
+        return select(d + s >= one, one, zero);
+    } else {
+        return s;
+    }
+}
+
+// === Non-separable modes ===
+
+inline VecF lum(const Rgb& c)
+{
+    return VecF(0.3f) * c.r + VecF(0.59f) * c.g + VecF(0.11f) * c.b;
+}
+
+inline VecF sat(const Rgb& c)
+{
+    return vmax(c.r, vmax(c.g, c.b)) - vmin(c.r, vmin(c.g, c.b));
+}
+
+inline Rgb clipColor(const Rgb& c)
+{
+    const VecF l = lum(c);
+    const VecF n = vmin(c.r, vmin(c.g, c.b));
+    const VecF x = vmax(c.r, vmax(c.g, c.b));
+    const VecF zero(0.0f);
+    const VecF one(1.0f);
+
+    // Scale towards the luminosity when a channel leaves [0, 1]
+    const VecF low = l / vmax(l - n, VecF(kEpsilon));
+    const VecF high = (one - l) / vmax(x - l, VecF(kEpsilon));
+    auto clip = [&](VecF v) {
+        v = select(n < zero, l + (v - l) * low, v);
+        return select(x > one, l + (v - l) * high, v);
+    };
+    return { clip(c.r), clip(c.g), clip(c.b) };
+}
+
+inline Rgb setLum(const Rgb& c, VecF l)
+{
+    const VecF d = l - lum(c);
+    return clipColor({ c.r + d, c.g + d, c.b + d });
+}
+
+inline Rgb setSat(const Rgb& c, VecF s)
+{
+    const VecF n = vmin(c.r, vmin(c.g, c.b));
+    const VecF x = vmax(c.r, vmax(c.g, c.b));
+    const VecF range = x - n;
+    const VecF scale = s / vmax(range, VecF(kEpsilon));
+    const VecF zero(0.0f);
+    auto adjust = [&](VecF v) { return select(range > zero, (v - n) * scale, zero); };
+    return { adjust(c.r), adjust(c.g), adjust(c.b) };
+}
+
+template <BlendMode M>
+inline Rgb blendColor(const Rgb& d, const Rgb& s)
+{
+    if constexpr (M == BlendMode::Hue) {
+        return setLum(setSat(s, sat(d)), lum(d));
+    } else if constexpr (M == BlendMode::Saturation) {
+        return setLum(setSat(d, sat(s)), lum(d));
+    } else if constexpr (M == BlendMode::Color) {
+        return setLum(s, lum(d));
+    } else if constexpr (M == BlendMode::Luminosity) {
+        return setLum(d, lum(s));
+    } else {
+        return { blendChannel<M>(d.r, s.r), blendChannel<M>(d.g, s.g), blendChannel<M>(d.b, s.b) };
+    }
+}
+
+// === Compositing ===
+
+/**
+ * Blend premultiplied src into premultiplied dst in place.
+ * noise is only read by Dissolve.
+ */
+template <BlendMode M>
+inline void blendPixels(Rgba& dst, const Rgba& src, VecF noise)
+{
+    const VecF one(1.0f);
+
+    if constexpr (M == BlendMode::Normal) {
+        const VecF inv = one - src.a;
+        dst.r = src.r + dst.r * inv;
+        dst.g = src.g + dst.g * inv;
+        dst.b = src.b + dst.b * inv;
+        dst.a = src.a + dst.a * inv;
+    } else if constexpr (M == BlendMode::Behind) {
+        const VecF inv = one - dst.a;
+        dst.r = dst.r + src.r * inv;
+        dst.g = dst.g + src.g * inv;
+        dst.b = dst.b + src.b * inv;
+        dst.a = dst.a + src.a * inv;
+    } else if constexpr (M == BlendMode::Clear) {
+        // Source coverage erases the destination
+        const VecF inv = one - src.a;
+        dst.r = dst.r * inv;
+        dst.g = dst.g * inv;
+        dst.b = dst.b * inv;
+        dst.a = dst.a * inv;
+    } else if constexpr (M == BlendMode::Dissolve) {
+        // A pixel either shows the source at full strength or not at all
+        const auto hit = noise < src.a;
+        dst.r = select(hit, unpremultiply(src.r, src.a), dst.r);
+        dst.g = select(hit, unpremultiply(src.g, src.a), dst.g);
+        dst.b = select(hit, unpremultiply(src.b, src.a), dst.b);
+        dst.a = select(hit, one, dst.a);
+    } else {
+        const Rgb s = { unpremultiply(src.r, src.a), unpremultiply(src.g, src.a), unpremultiply(src.b, src.a) };
+        const Rgb d = { unpremultiply(dst.r, dst.a), unpremultiply(dst.g, dst.a), unpremultiply(dst.b, dst.a) };
+        const Rgb b = blendColor<M>(d, s);
+
+        // co = cs * (1 - ab) + cb * (1 - as) + as * ab * B(cb, cs)
+        const VecF both = src.a * dst.a;
+        const VecF srcOnly = one - dst.a;
+        const VecF dstOnly = one - src.a;
+        dst.r = src.r * srcOnly + dst.r * dstOnly + both * b.r;
+        dst.g = src.g * srcOnly + dst.g * dstOnly + both * b.g;
+        dst.b = src.b * srcOnly + dst.b * dstOnly + both * b.b;
+        dst.a = src.a + dst.a - both;
+    }
+}
+
+inline float dissolveNoise(int x, int y)
+{
+    uint32_t h = static_cast<uint32_t>(x) * 0x8da6b343u ^ static_cast<uint32_t>(y) * 0xd8163841u;
+    h ^= h >> 13;
+    h *= 0x85ebca6bu;
+    h ^= h >> 16;
+    return static_cast<float>(h >> 8) * (1.0f / 16777216.0f);
+}
+
+inline bool isTransparent(const uint32_t* src, int count)
+{
+    uint32_t alpha = 0;
+    for (int i = 0; i < count; ++i) {
+        alpha |= src[i];
+    }
+    return (alpha >> 24) == 0;
+}
+
+template <BlendMode M>
+inline void blendBlock(uint32_t* dst, const uint32_t* src, VecF opacity, int x, int y)
+{
+    Rgba s, d;
+    loadPixels(src, s.r, s.g, s.b, s.a);
+    loadPixels(dst, d.r, d.g, d.b, d.a);
+
+    s.r = s.r * opacity;
+    s.g = s.g * opacity;
+    s.b = s.b * opacity;
+    s.a = s.a * opacity;
+
+    VecF noise(0.0f);
+    if constexpr (M == BlendMode::Dissolve) {
+        float values[VecF::Width];
+        for (int i = 0; i < VecF::Width; ++i) {
+            values[i] = dissolveNoise(x + i, y);
+        }
+        noise = VecF::load(values);
+    }
+
+    blendPixels<M>(d, s, noise);
+
+    // Keep the result a valid premultiplied colour
+    d.a = clamp01(d.a);
+    d.r = vmin(vmax(d.r, VecF(0.0f)), d.a);
+    d.g = vmin(vmax(d.g, VecF(0.0f)), d.a);
+    d.b = vmin(vmax(d.b, VecF(0.0f)), d.a);
+    storePixels(dst, d.r, d.g, d.b, d.a);
+}
+
+template <BlendMode M>
+void compositeRowKernel(uint32_t* dst, const uint32_t* src, int count, float opacity, int x, int y)
+{
+    if (count <= 0 || opacity <= 0.0f) return;
+
+    constexpr int W = VecF::Width;
+    const VecF alpha(opacity > 1.0f ? 1.0f : opacity);
+
+    int i = 0;
+    for (; i + W <= count; i += W) {
+        // With no source coverage every mode leaves the destination alone
+        if (isTransparent(src + i, W)) continue;
+        blendBlock<M>(dst + i, src + i, alpha, x + i, y);
+    }
+
+    if (i < count) {
+        const int rest = count - i;
+        if (isTransparent(src + i, rest)) return;
+
+        uint32_t d[W] = {};
+        uint32_t s[W] = {};
+        std::memcpy(d, dst + i, rest * sizeof(uint32_t));
+        std::memcpy(s, src + i, rest * sizeof(uint32_t));
+        blendBlock<M>(d, s, alpha, x + i, y);
+        std::memcpy(dst + i, d, rest * sizeof(uint32_t));
+    }
+}
+
+template <std::size_t... I>
+const RowFunc* kernelTable(std::index_sequence<I...>)
+{
+    static const RowFunc table[] = { &compositeRowKernel<static_cast<BlendMode>(I)>... };
+    return table;
+}
+
+const RowFunc* kernelTable()
+{
+    return kernelTable(std::make_index_sequence<BlendModeCount>());
+}
+
+} // namespace
+} // namespace blend
+} // namespace core
@@ -0,0 +1,161 @@
+#include <cmath>
+#include <cstdint>
+
+// Portable single-lane implementation, also the reference for the SIMD units
+
+namespace core {
+namespace blend {
+namespace {
+
+struct VecF {
+    static constexpr int Width = 1;
+
+    float v;
+
+    VecF() : v(0.0f) {}
+    VecF(float value) : v(value) {}
+    static VecF load(const float* values) { return VecF(values[0]); }
+    void store(float* values) const { values[0] = v; }
+};
+
+using MaskF = bool;
+
+inline VecF operator+(VecF a, VecF b) { return a.v + b.v; }
+inline VecF operator-(VecF a, VecF b) { return a.v - b.v; }
+inline VecF operator*(VecF a, VecF b) { return a.v * b.v; }
+inline VecF operator/(VecF a, VecF b) { return a.v / b.v; }
+inline MaskF operator<(VecF a, VecF b) { return a.v < b.v; }
+inline MaskF operator>(VecF a, VecF b) { return a.v > b.v; }
+inline MaskF operator<=(VecF a, VecF b) { return a.v <= b.v; }
+inline MaskF operator>=(VecF a, VecF b) { return a.v >= b.v; }
+
+inline VecF select(MaskF mask, VecF a, VecF b) { return mask ? a : b; }
+inline VecF vmin(VecF a, VecF b) { return a.v < b.v ? a : b; }
+inline VecF vmax(VecF a, VecF b) { return a.v > b.v ? a : b; }
+inline VecF vsqrt(VecF a) { return std::sqrt(a.v); }
+
+inline void loadPixels(const uint32_t* p, VecF& r, VecF& g, VecF& b, VecF& a)
+{
+    constexpr float scale = 1.0f / 255.0f;
+    const uint32_t px = *p;
+    r = static_cast<float>((px >> 16) & 0xff) * scale;
+    g = static_cast<float>((px >> 8) & 0xff) * scale;
+    b = static_cast<float>(px & 0xff) * scale;
+    a = static_cast<float>(px >> 24) * scale;
+}
+
+inline uint32_t toByte(VecF v)
+{
+    return static_cast<uint32_t>(std::lrint(v.v * 255.0f));
+}
+
+inline void storePixels(uint32_t* p, VecF r, VecF g, VecF b, VecF a)
+{
+    *p = (toByte(a) << 24) | (toByte(r) << 16) | (toByte(g) << 8) | toByte(b);
+}
+
+inline VecF loadCoverage(const uint8_t* c)
+{
+    return static_cast<float>(*c) * (1.0f / 255.0f);
+}
+
+inline VecF loadCoverage(const uint16_t* c)
+{
+    return static_cast<float>(*c) * (1.0f / 65535.0f);
+}
+
+inline VecF vfloor(VecF v)
+{
+    return std::floor(v.v);
+}
+
+inline VecF gather(const float* base, VecF index)
+{
+    return base[static_cast<int>(index.v)];
+}
+
+inline VecF mantissa(VecF x, VecF& exponent)
+{
+    int e = 0;
+    const float m = std::frexp(x.v, &e);
+    exponent = static_cast<float>(e - 1);
+    return m * 2.0f;
+}
+
+inline VecF pow2i(VecF n)
+{
+    return std::ldexp(1.0f, static_cast<int>(n.v));
+}
+
+struct VecB {
+    static constexpr int Width = 1;
+
+    uint8_t v;
+
+    VecB(uint8_t value = 0) : v(value) {}
+    static VecB load(const uint8_t* values) { return VecB(values[0]); }
+    void store(uint8_t* values) const { values[0] = v; }
+};
+
+inline VecB minBytes(VecB a, VecB b) { return a.v < b.v ? a : b; }
+inline VecB maxBytes(VecB a, VecB b) { return a.v > b.v ? a : b; }
+inline VecB subBytes(VecB a, VecB b) { return a.v > b.v ? VecB(static_cast<uint8_t>(a.v - b.v)) : VecB(0); }
+
+} // namespace
+} // namespace blend
+} // namespace core
+
+#include "blend_kernels_impl.h"
+#include "dab_kernels_impl.h"
+#include "lut_kernels_impl.h"
+#include "point_kernels_impl.h"
+#include "blur_kernels_impl.h"
+#include "selection_kernels_impl.h"
+
+namespace core {
+namespace blend {
+namespace detail {
+
+const RowFunc* scalarKernels()
+{
+    return kernelTable();
+}
+
+const DabKernel* scalarDabKernels()
+{
+    return dabKernelTable();
+}
+
+LutRowFunc scalarLutKernel()
+{
+    return &lutRowKernel;
+}
+
+ToneRowFunc scalarToneKernel()
+{
+    return &toneRowKernel;
+}
+
+HslRowFunc scalarHslKernel()
+{
+    return &hslRowKernel;
+}
+
+BoxColumnsFunc scalarBoxKernel()
+{
+    return &boxColumnsKernel;
+}
+
+const MaskRowFunc* scalarMaskKernels()
+{
+    return maskKernelTable();
+}
+
+ColorDistanceFunc scalarDistanceKernel()
+{
+    return &colorDistanceKernel<VecB>;
+}
+
+} // namespace detail
+} // namespace blend
+} // namespace core
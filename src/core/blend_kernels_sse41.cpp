@@ -0,0 +1,187 @@
+#include <smmintrin.h>
+#include <cstdint>
+#include <cstring>
+
+// SSE4.1 implementation, four pixels per step. Built with -msse4.1 (GCC/Clang).
+
+namespace core {
+namespace blend {
+namespace {
+
+struct MaskF {
+    __m128 v;
+};
+
+struct VecF {
+    static constexpr int Width = 4;
+
+    __m128 v;
+
+    VecF() : v(_mm_setzero_ps()) {}
+    VecF(__m128 value) : v(value) {}
+    VecF(float value) : v(_mm_set1_ps(value)) {}
+    static VecF load(const float* values) { return _mm_loadu_ps(values); }
+    void store(float* values) const { _mm_storeu_ps(values, v); }
+};
+
+inline VecF operator+(VecF a, VecF b) { return _mm_add_ps(a.v, b.v); }
+inline VecF operator-(VecF a, VecF b) { return _mm_sub_ps(a.v, b.v); }
+inline VecF operator*(VecF a, VecF b) { return _mm_mul_ps(a.v, b.v); }
+inline VecF operator/(VecF a, VecF b) { return _mm_div_ps(a.v, b.v); }
+inline MaskF operator<(VecF a, VecF b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+inline MaskF operator>(VecF a, VecF b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+inline MaskF operator<=(VecF a, VecF b) { return { _mm_cmple_ps(a.v, b.v) }; }
+inline MaskF operator>=(VecF a, VecF b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+
+inline VecF select(MaskF mask, VecF a, VecF b) { return _mm_blendv_ps(b.v, a.v, mask.v); }
+inline VecF vmin(VecF a, VecF b) { return _mm_min_ps(a.v, b.v); }
+inline VecF vmax(VecF a, VecF b) { return _mm_max_ps(a.v, b.v); }
+inline VecF vsqrt(VecF a) { return _mm_sqrt_ps(a.v); }
+
+inline void loadPixels(const uint32_t* p, VecF& r, VecF& g, VecF& b, VecF& a)
+{
+    const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+    r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask)), scale);
+    g = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask)), scale);
+    b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(px, mask)), scale);
+    a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(px, 24)), scale);
+}
+
+inline __m128i toBytes(VecF v)
+{
+    return _mm_cvtps_epi32(_mm_mul_ps(v.v, _mm_set1_ps(255.0f)));
+}
+
+inline void storePixels(uint32_t* p, VecF r, VecF g, VecF b, VecF a)
+{
+    __m128i px = _mm_slli_epi32(toBytes(a), 24);
+    px = _mm_or_si128(px, _mm_slli_epi32(toBytes(r), 16));
+    px = _mm_or_si128(px, _mm_slli_epi32(toBytes(g), 8));
+    px = _mm_or_si128(px, toBytes(b));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), px);
+}
+
+inline VecF loadCoverage(const uint8_t* c)
+{
+    int32_t bytes;
+    std::memcpy(&bytes, c, sizeof(bytes));
+    const __m128i values = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+    return _mm_mul_ps(_mm_cvtepi32_ps(values), _mm_set1_ps(1.0f / 255.0f));
+}
+
+inline VecF loadCoverage(const uint16_t* c)
+{
+    const __m128i values = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c)));
+    return _mm_mul_ps(_mm_cvtepi32_ps(values), _mm_set1_ps(1.0f / 65535.0f));
+}
+
+inline VecF vfloor(VecF v)
+{
+    return _mm_floor_ps(v.v);
+}
+
+// No gather instruction before AVX2: load the four lanes one by one
+inline VecF gather(const float* base, VecF index)
+{
+    alignas(16) int32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), _mm_cvttps_epi32(index.v));
+    return _mm_setr_ps(base[lanes[0]], base[lanes[1]], base[lanes[2]], base[lanes[3]]);
+}
+
+inline VecF mantissa(VecF x, VecF& exponent)
+{
+    const __m128i bits = _mm_castps_si128(x.v);
+    exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    return _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+                                         _mm_set1_epi32(0x3f800000)));
+}
+
+inline VecF pow2i(VecF n)
+{
+    return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n.v), _mm_set1_epi32(127)), 23));
+}
+
+struct VecB {
+    static constexpr int Width = 16;
+
+    __m128i v;
+
+    VecB(__m128i value) : v(value) {}
+    VecB(uint8_t value) : v(_mm_set1_epi8(static_cast<char>(value))) {}
+    static VecB load(const uint8_t* values) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(values)); }
+    void store(uint8_t* values) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(values), v); }
+};
+
+inline VecB minBytes(VecB a, VecB b) { return _mm_min_epu8(a.v, b.v); }
+inline VecB maxBytes(VecB a, VecB b) { return _mm_max_epu8(a.v, b.v); }
+inline VecB subBytes(VecB a, VecB b) { return _mm_subs_epu8(a.v, b.v); }
+
+inline void storeChannelMax(VecB v, uint8_t* out)
+{
+    __m128i m = _mm_max_epu8(v.v, _mm_srli_epi32(v.v, 8));
+    m = _mm_and_si128(_mm_max_epu8(m, _mm_srli_epi32(m, 16)), _mm_set1_epi32(0xff));
+    m = _mm_packus_epi16(_mm_packus_epi32(m, m), m);
+    const int32_t bytes = _mm_cvtsi128_si32(m);
+    std::memcpy(out, &bytes, sizeof(bytes));
+}
+
+} // namespace
+} // namespace blend
+} // namespace core
+
+#include "blend_kernels_impl.h"
+#include "dab_kernels_impl.h"
+#include "lut_kernels_impl.h"
+#include "point_kernels_impl.h"
+#include "blur_kernels_impl.h"
+#include "selection_kernels_impl.h"
+
+namespace core {
+namespace blend {
+namespace detail {
+
+const RowFunc* sse41Kernels()
+{
+    return kernelTable();
+}
+
+const DabKernel* sse41DabKernels()
+{
+    return dabKernelTable();
+}
+
+LutRowFunc sse41LutKernel()
+{
+    return &lutRowKernel;
+}
+
+ToneRowFunc sse41ToneKernel()
+{
+    return &toneRowKernel;
+}
+
+HslRowFunc sse41HslKernel()
+{
+    return &hslRowKernel;
+}
+
+BoxColumnsFunc sse41BoxKernel()
+{
+    return &boxColumnsKernel;
+}
+
+const MaskRowFunc* sse41MaskKernels()
+{
+    return maskKernelTable();
+}
+
+ColorDistanceFunc sse41DistanceKernel()
+{
+    return &colorDistanceKernel<VecB>;
+}
+
+} // namespace detail
+} // namespace blend
+} // namespace core
@@ -0,0 +1,44 @@
+#pragma once
+
+namespace core {
+
+// Enhanced blend mode enumeration
+enum class BlendMode {
+    Normal,
+    Multiply,
+    Screen,
+    Overlay,
+    SoftLight,
+    HardLight,
+    ColorDodge,
+    ColorBurn,
+    Darken,
+    Lighten,
+    Difference,
+    Exclusion,
+    Hue,
+    Saturation,
+    Color,
+    Luminosity,
+    Dissolve,
+    Behind,
+    Clear,
+    Add,
+    Subtract,
+    Divide,
+    LinearBurn,
+    LinearDodge,
+    VividLight,
+    LinearLight,
+    PinLight,
+    HardMix
+};
+
+constexpr int BlendModeCount = static_cast<int>(BlendMode::HardMix) + 1;
+
+/**
+ * @brief Display name of a blend mode
+ */
+const char* blendModeName(BlendMode mode);
+
+} // namespace core
@@ -0,0 +1,187 @@
+#include "blur.h"
+#include "blur_kernels.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+
+namespace core {
+
+AlphaPlane::AlphaPlane(const QRect& rect, float value)
+    : m_rect(rect.isValid() ? rect : QRect())
+    , m_values(static_cast<size_t>(std::max(0, m_rect.width())) * std::max(0, m_rect.height()), value)
+{
+}
+
+AlphaPlane AlphaPlane::fromTiles(const TileStorage& tiles, const QRect& rect)
+{
+    AlphaPlane plane(rect);
+    const QRect clipped = rect & tiles.rect();
+    const QRect range = tiles.tileRange(clipped);
+    if (range.isNull()) return plane;
+
+    const int columns = range.width();
+    ThreadPool::global().parallelFor(0, columns * range.height(), [&](int index) {
+        const int tx = range.left() + index % columns;
+        const int ty = range.top() + index / columns;
+        const QRect tileRect = tiles.tileRect(tx, ty);
+        const QRect part = tileRect & clipped;
+        const TileStorage::Tile& tile = tiles.tileAt(tx, ty);
+
+        if (tile.isUniform()) {
+            const float alpha = qAlpha(tile.uniformColor()) / 255.0f;
+            for (int y = part.top(); y <= part.bottom(); ++y) {
+                std::fill(plane.row(y) + part.left(), plane.row(y) + part.right() + 1, alpha);
+            }
+            return;
+        }
+
+        const QImage& image = tile.image();
+        for (int y = part.top(); y <= part.bottom(); ++y) {
+            const QRgb* src = reinterpret_cast<const QRgb*>(image.constScanLine(y - tileRect.top()))
+                + (part.left() - tileRect.left());
+            float* dst = plane.row(y) + part.left();
+            for (int x = 0; x < part.width(); ++x) {
+                dst[x] = qAlpha(src[x]) * (1.0f / 255.0f);
+            }
+        }
+    });
+    return plane;
+}
+
+AlphaPlane AlphaPlane::copy(const QRect& rect, float outside) const
+{
+    AlphaPlane result(rect, outside);
+    const QRect overlap = rect & m_rect;
+    for (int y = overlap.top(); y <= overlap.bottom(); ++y) {
+        std::copy(row(y) + overlap.left(), row(y) + overlap.right() + 1, result.row(y) + overlap.left());
+    }
+    return result;
+}
+
+void AlphaPlane::paste(const AlphaPlane& source)
+{
+    const QRect overlap = source.rect() & m_rect;
+    for (int y = overlap.top(); y <= overlap.bottom(); ++y) {
+        std::copy(source.row(y) + overlap.left(), source.row(y) + overlap.right() + 1, row(y) + overlap.left());
+    }
+}
+
+void AlphaPlane::invert()
+{
+    for (float& value : m_values) {
+        value = 1.0f - value;
+    }
+}
+
+namespace blur {
+
+namespace {
+
+constexpr int StripWidth = 64;      // Columns per task in a column pass
+constexpr int RowBlock = 16;        // Rows per task in a row pass
+
+// Run every radius in turn down all columns, one strip per task so each
+// strip stays in cache across the passes
+void columnPasses(float* data, int width, int height, const std::vector<int>& radii)
+{
+    const blend::BoxColumnsFunc kernel = blend::boxColumnsFunction();
+    const int strips = (width + StripWidth - 1) / StripWidth;
+    ThreadPool::global().parallelFor(0, strips, [&](int strip) {
+        std::vector<float> scratch(static_cast<size_t>(height) * blend::BoxKernelLanes);
+        const int x = strip * StripWidth;
+        const int w = std::min(StripWidth, width - x);
+        for (int radius : radii) {
+            kernel(data + x, w, height, width, radius, scratch.data());
+        }
+    });
+}
+
+// Rows go through the same column kernel: each task turns a block of rows
+// into columns of a small buffer, runs every radius and writes them back
+void rowPasses(float* data, int width, int height, const std::vector<int>& radii)
+{
+    const blend::BoxColumnsFunc kernel = blend::boxColumnsFunction();
+    const int blocks = (height + RowBlock - 1) / RowBlock;
+    ThreadPool::global().parallelFor(0, blocks, [&](int block) {
+        const int y0 = block * RowBlock;
+        const int rows = std::min(RowBlock, height - y0);
+        std::vector<float> columns(static_cast<size_t>(width) * rows);
+        std::vector<float> scratch(static_cast<size_t>(width) * blend::BoxKernelLanes);
+
+        for (int r = 0; r < rows; ++r) {
+            const float* line = data + static_cast<size_t>(y0 + r) * width;
+            for (int x = 0; x < width; ++x) {
+                columns[static_cast<size_t>(x) * rows + r] = line[x];
+            }
+        }
+        for (int radius : radii) {
+            kernel(columns.data(), rows, width, rows, radius, scratch.data());
+        }
+        for (int r = 0; r < rows; ++r) {
+            float* line = data + static_cast<size_t>(y0 + r) * width;
+            for (int x = 0; x < width; ++x) {
+                line[x] = columns[static_cast<size_t>(x) * rows + r];
+            }
+        }
+    });
+}
+
+void separable(AlphaPlane& plane, const std::vector<int>& radiiX, const std::vector<int>& radiiY)
+{
+    if (plane.isNull()) return;
+    const int width = plane.rect().width();
+    const int height = plane.rect().height();
+
+    if (!radiiY.empty()) {
+        columnPasses(plane.data(), width, height, radiiY);
+    }
+    if (!radiiX.empty()) {
+        rowPasses(plane.data(), width, height, radiiX);
+    }
+}
+
+} // namespace
+
+std::array<int, 3> gaussianBoxes(float sigma)
+{
+    if (!(sigma >= 0.3f)) return {0, 0, 0};
+
+    // Three boxes of widths lower or lower + 2 whose variances add up to sigma^2
+    const float variance = 12.0f * sigma * sigma;
+    int lower = static_cast<int>(std::floor(std::sqrt(variance / 3.0f + 1.0f)));
+    if (lower % 2 == 0) --lower;
+    const int wider = static_cast<int>(std::round(
+        (variance - 3.0f * lower * lower - 12.0f * lower - 9.0f) / (-4.0f * lower - 4.0f)));
+
+    std::array<int, 3> radii;
+    for (int i = 0; i < 3; ++i) {
+        radii[i] = ((i < wider ? lower : lower + 2) - 1) / 2;
+    }
+    return radii;
+}
+
+int reach(float sigma)
+{
+    const std::array<int, 3> radii = gaussianBoxes(sigma);
+    return radii[0] + radii[1] + radii[2];
+}
+
+void gaussian(AlphaPlane& plane, float sigma)
+{
+    std::vector<int> radii;
+    for (int radius : gaussianBoxes(sigma)) {
+        if (radius > 0) radii.push_back(radius);
+    }
+    separable(plane, radii, radii);
+}
+
+void box(AlphaPlane& plane, int radiusX, int radiusY)
+{
+    separable(plane,
+              radiusX > 0 ? std::vector<int>{radiusX} : std::vector<int>(),
+              radiusY > 0 ? std::vector<int>{radiusY} : std::vector<int>());
+}
+
+} // namespace blur
+
+} // namespace core
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <QPoint>
+#include <QRect>
+#include <array>
+#include <vector>
+#include "tile_storage.h"
+
+namespace core {
+
+/**
+ * @brief Single-channel float coverage over a rectangle
+ *
+ * Values are nominally in [0, 1]; rows are rect().width() floats apart and
+ * addressed in the coordinates of rect(), so planes cut from the same
+ * source line up without offset bookkeeping.
+ */
+class AlphaPlane {
+public:
+    AlphaPlane() = default;
+
+    /**
+     * @brief Plane over `rect`, filled with `value`
+     */
+    explicit AlphaPlane(const QRect& rect, float value = 0.0f);
+
+    /**
+     * @brief Alpha of `tiles` over `rect`; pixels outside the storage are 0
+     */
+    static AlphaPlane fromTiles(const TileStorage& tiles, const QRect& rect);
+
+    bool isNull() const { return m_values.empty(); }
+    QRect rect() const { return m_rect; }
+    int stride() const { return m_rect.width(); }
+
+    float* data() { return m_values.data(); }
+    const float* data() const { return m_values.data(); }
+    float* row(int y) { return m_values.data() + static_cast<size_t>(y - m_rect.top()) * stride() - m_rect.left(); }
+    const float* row(int y) const { return m_values.data() + static_cast<size_t>(y - m_rect.top()) * stride() - m_rect.left(); }
+
+    /**
+     * @brief Value at a point, or `outside` beyond rect()
+     */
+    float value(int x, int y, float outside = 0.0f) const
+    {
+        return m_rect.contains(x, y) ? row(y)[x] : outside;
+    }
+
+    /**
+     * @brief Values over `rect`, with `outside` beyond this plane
+     */
+    AlphaPlane copy(const QRect& rect, float outside = 0.0f) const;
+
+    /**
+     * @brief Overwrite the values where `source` overlaps this plane
+     */
+    void paste(const AlphaPlane& source);
+
+    /**
+     * @brief Replace every value v with 1 - v
+     */
+    void invert();
+
+    size_t memoryUsage() const { return m_values.size() * sizeof(float); }
+
+private:
+    QRect m_rect;
+    std::vector<float> m_values;
+};
+
+/**
+ * @brief Separable blurs whose cost per pixel does not depend on the radius
+ *
+ * Each pass is a box filter evaluated with running sums, first down the
+ * columns (vectorised across columns by blur_kernels.h) and then along the
+ * rows, which are turned into columns a small block at a time so they can
+ * use the same column kernel. Column strips and row blocks are spread over
+ * the global ThreadPool.
+ *
+ * Values beyond the plane count as zero. To blur part of a larger image
+ * exactly, cut the plane with a halo of reach() pixels around the part and
+ * use only the inside.
+ */
+namespace blur {
+
+/**
+ * @brief Box radii of a three-pass cascade approximating a Gaussian
+ */
+std::array<int, 3> gaussianBoxes(float sigma);
+
+/**
+ * @brief How far a Gaussian blur of `sigma` spreads a single pixel
+ */
+int reach(float sigma);
+
+/**
+ * @brief Gaussian blur in place, approximated by three box passes
+ */
+void gaussian(AlphaPlane& plane, float sigma);
+
+/**
+ * @brief One box pass of the given radii in place
+ */
+void box(AlphaPlane& plane, int radiusX, int radiusY);
+
+} // namespace blur
+
+} // namespace core
@@ -0,0 +1,29 @@
+#include "blur_kernels.h"
+
+namespace core {
+namespace blend {
+
+BoxColumnsFunc boxColumnsFunction(SimdLevel level)
+{
+#if defined(CORE_X86_SIMD)
+    if (level > supportedSimdLevel()) {
+        level = supportedSimdLevel();
+    }
+    switch (level) {
+        case SimdLevel::AVX2: return detail::avx2BoxKernel();
+        case SimdLevel::SSE41: return detail::sse41BoxKernel();
+        case SimdLevel::Scalar: break;
+    }
+#else
+    (void)level;
+#endif
+    return detail::scalarBoxKernel();
+}
+
+BoxColumnsFunc boxColumnsFunction()
+{
+    return boxColumnsFunction(activeSimdLevel());
+}
+
+} // namespace blend
+} // namespace core
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "cpu_features.h"
+
+namespace core {
+namespace blend {
+
+/**
+ * @brief Widest SIMD step of the box kernels, in columns
+ */
+constexpr int BoxKernelLanes = 8;
+
+/**
+ * @brief Box-blur every column of a float plane in place
+ *
+ * Each of the `width` columns, whose rows are `stride` floats apart, is
+ * replaced by its mean over 2 * radius + 1 rows, treating rows outside the
+ * plane as zero. A running sum makes the cost per pixel independent of the
+ * radius. `scratch` holds at least height * BoxKernelLanes floats.
+ */
+using BoxColumnsFunc = void (*)(float* data, int width, int height, int stride, int radius,
+                                float* scratch);
+
+/**
+ * @brief Box kernel at the active SIMD level
+ */
+BoxColumnsFunc boxColumnsFunction();
+
+/**
+ * @brief Box kernel at a specific level (falls back to scalar)
+ */
+BoxColumnsFunc boxColumnsFunction(SimdLevel level);
+
+namespace detail {
+// One kernel per instruction set
+BoxColumnsFunc scalarBoxKernel();
+BoxColumnsFunc sse41BoxKernel();
+BoxColumnsFunc avx2BoxKernel();
+} // namespace detail
+
+} // namespace blend
+} // namespace core
@@ -0,0 +1,63 @@
+#pragma once
+
+// Box blur shared by every instruction set.
+//
+// Included after blend_kernels_impl.h by the same per-instruction-set
+// units, so it reuses their VecF. Each unit also gives VecF a
+// store(float*) member writing Width lanes.
+
+#include "blur_kernels.h"
+#include <algorithm>
+
+namespace core {
+namespace blend {
+namespace {
+
+// Blur `lanes` columns starting at `column`. The columns are first copied
+// into `scratch` as rows of Width floats, so the running sum reads the
+// original values after the output has overwritten them.
+inline void boxBlock(float* column, int lanes, int height, int stride, int radius, float* scratch)
+{
+    constexpr int W = VecF::Width;
+    for (int y = 0; y < height; ++y) {
+        float* line = scratch + y * W;
+        std::copy(column + y * stride, column + y * stride + lanes, line);
+        std::fill(line + lanes, line + W, 0.0f);
+    }
+
+    const VecF scale(1.0f / (2 * radius + 1));
+    VecF sum(0.0f);
+    for (int y = 0; y <= std::min(radius, height - 1); ++y) {
+        sum = sum + VecF::load(scratch + y * W);
+    }
+
+    float out[W];
+    for (int y = 0; y < height; ++y) {
+        if (lanes == W) {
+            (sum * scale).store(column + y * stride);
+        } else {
+            (sum * scale).store(out);
+            std::copy(out, out + lanes, column + y * stride);
+        }
+        if (y + radius + 1 < height) {
+            sum = sum + VecF::load(scratch + (y + radius + 1) * W);
+        }
+        if (y - radius >= 0) {
+            sum = sum - VecF::load(scratch + (y - radius) * W);
+        }
+    }
+}
+
+void boxColumnsKernel(float* data, int width, int height, int stride, int radius, float* scratch)
+{
+    if (width <= 0 || height <= 0 || radius <= 0) return;
+
+    constexpr int W = VecF::Width;
+    for (int x = 0; x < width; x += W) {
+        boxBlock(data + x, std::min(W, width - x), height, stride, radius, scratch);
+    }
+}
+
+} // namespace
+} // namespace blend
+} // namespace core
@@ -5,38 +5,88 @@
 
 namespace core {
 
+void DamageRect::unite(const DamageRect& other)
+{
+    if (other.isEmpty()) return;
+    if (isEmpty()) {
+        *this = other;
+        return;
+    }
+    
+    int right = std::max(x + width, other.x + other.width);
+    int bottom = std::max(y + height, other.y + other.height);
+    x = std::min(x, other.x);
+    y = std::min(y, other.y);
+    width = right - x;
+    height = bottom - y;
+}
+
 BrushEngine::BrushEngine()
-    : m_strokeActive(false)
+    : m_distanceToNextDab(0.0f)
+    , m_strokeActive(false)
 {
 }
 
-void BrushEngine::beginStroke(float x, float y, float pressure, float tilt)
+DamageRect BrushEngine::beginStroke(float x, float y, float pressure, float tilt)
 {
     m_currentStroke.clear();
+    m_pendingDabs.clear();
     m_strokeActive = true;
+    m_strokeStart = std::chrono::steady_clock::now();
     
     BrushStroke stroke;
     stroke.x = x;
     stroke.y = y;
     stroke.pressure = pressure;
     stroke.tilt = tilt;
-    stroke.timestamp = 0.0f; // TODO: Add proper timing
+    stroke.timestamp = 0.0f;
     
     m_currentStroke.push_back(stroke);
+    
+    // The first dab lands on the press position
+    m_distanceToNextDab = dabSpacing(pressure);
+    return emitDab({x, y, pressure, tilt});
 }
 
-void BrushEngine::addPoint(float x, float y, float pressure, float tilt)
+DamageRect BrushEngine::addPoint(float x, float y, float pressure, float tilt)
 {
-    if (!m_strokeActive) return;
+    if (!m_strokeActive || m_currentStroke.empty()) return DamageRect();
+    
+    const BrushStroke prev = m_currentStroke.back();
     
     BrushStroke stroke;
     stroke.x = x;
     stroke.y = y;
     stroke.pressure = pressure;
     stroke.tilt = tilt;
-    stroke.timestamp = 0.0f; // TODO: Add proper timing
+    stroke.timestamp = std::chrono::duration<float>(std::chrono::steady_clock::now() - m_strokeStart).count();
     
     m_currentStroke.push_back(stroke);
+    
+    // Walk the new segment only, continuing the spacing left over from the
+    // previous one, so the cost is independent of the stroke length
+    float dx = x - prev.x;
+    float dy = y - prev.y;
+    float length = std::sqrt(dx * dx + dy * dy);
+    
+    DamageRect damage;
+    float travelled = 0.0f;
+    while (length - travelled >= m_distanceToNextDab) {
+        travelled += m_distanceToNextDab;
+        float t = travelled / length;
+        
+        BrushDab dab;
+        dab.x = prev.x + dx * t;
+        dab.y = prev.y + dy * t;
+        dab.pressure = prev.pressure + (pressure - prev.pressure) * t;
+        dab.tilt = prev.tilt + (tilt - prev.tilt) * t;
+        
+        damage.unite(emitDab(dab));
+        m_distanceToNextDab = dabSpacing(dab.pressure);
+    }
+    m_distanceToNextDab -= length - travelled;
+    
+    return damage;
 }
 
 void BrushEngine::endStroke()
@@ -48,120 +98,133 @@ void BrushEngine::endStroke()
 void BrushEngine::paintOnLayer(unsigned char* layerData, int layerWidth, int layerHeight,
                                unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
-    if (m_currentStroke.size() < 2) return;
+    if (m_pendingDabs.empty()) return;
     
-    // Draw brush points along the stroke path
-    for (size_t i = 0; i < m_currentStroke.size(); ++i) {
-        const auto& stroke = m_currentStroke[i];
-        drawBrushPoint(layerData, layerWidth, layerHeight, 
-                      stroke.x, stroke.y, stroke.pressure, stroke.tilt, r, g, b, a);
-    }
+    const blend::DabKernel kernel = blend::dabKernel(m_settings.mode);
+    const blend::DabSource source = dabSource(r, g, b, a);
     
-    // Interpolate between points for smooth strokes
-    for (size_t i = 1; i < m_currentStroke.size(); ++i) {
-        const auto& prev = m_currentStroke[i - 1];
-        const auto& curr = m_currentStroke[i];
-        
-        float dx = curr.x - prev.x;
-        float dy = curr.y - prev.y;
-        float distance = std::sqrt(dx * dx + dy * dy);
-        
-        if (distance > m_settings.spacing * m_settings.size) {
-            int steps = static_cast<int>(distance / (m_settings.spacing * m_settings.size));
-            for (int j = 1; j < steps; ++j) {
-                float t = static_cast<float>(j) / steps;
-                float x = prev.x + dx * t;
-                float y = prev.y + dy * t;
-                float pressure = prev.pressure + (curr.pressure - prev.pressure) * t;
-                float tilt = prev.tilt + (curr.tilt - prev.tilt) * t;
-                
-                drawBrushPoint(layerData, layerWidth, layerHeight, x, y, pressure, tilt, r, g, b, a);
-            }
-        }
+    // Each dab is stamped exactly once; earlier dabs were painted by earlier calls
+    uint32_t* pixels = reinterpret_cast<uint32_t*>(layerData);
+    for (const auto& dab : m_pendingDabs) {
+        drawBrushPoint(pixels, layerWidth, layerHeight, layerWidth, 0, 0,
+                       dab.x, dab.y, dab.pressure, dab.tilt, kernel, source);
     }
+    m_pendingDabs.clear();
 }
 
-void BrushEngine::drawBrushPoint(unsigned char* layerData, int layerWidth, int layerHeight,
-                                float x, float y, float pressure, float tilt,
-                                unsigned char r, unsigned char g, unsigned char b, unsigned char a)
-{
-    int centerX = static_cast<int>(x);
-    int centerY = static_cast<int>(y);
-    int brushSize = static_cast<int>(m_settings.size * pressure);
-    
-    if (brushSize <= 0) return;
-    
-    // Create brush mask
-    std::vector<float> brushMask;
-    createBrushMask(brushMask, brushSize, m_settings.hardness);
-    
-    // Apply brush to layer
-    for (int dy = -brushSize; dy <= brushSize; ++dy) {
-        for (int dx = -brushSize; dx <= brushSize; ++dx) {
-            int layerX = centerX + dx;
-            int layerY = centerY + dy;
-            
-            if (layerX >= 0 && layerX < layerWidth && layerY >= 0 && layerY < layerHeight) {
-                int maskIndex = (dy + brushSize) * (2 * brushSize + 1) + (dx + brushSize);
-                if (maskIndex >= 0 && maskIndex < static_cast<int>(brushMask.size())) {
-                    float maskValue = brushMask[maskIndex];
-                    if (maskValue > 0.0f) {
-                        int pixelIndex = (layerY * layerWidth + layerX) * 4;
-                        
-                        // Blend with existing pixel
-                        float alpha = maskValue * m_settings.opacity * (a / 255.0f);
-                        float invAlpha = 1.0f - alpha;
-                        
-                        layerData[pixelIndex] = static_cast<unsigned char>(r * alpha + layerData[pixelIndex] * invAlpha);
-                        layerData[pixelIndex + 1] = static_cast<unsigned char>(g * alpha + layerData[pixelIndex + 1] * invAlpha);
-                        layerData[pixelIndex + 2] = static_cast<unsigned char>(b * alpha + layerData[pixelIndex + 2] * invAlpha);
-                        layerData[pixelIndex + 3] = static_cast<unsigned char>(255 * alpha + layerData[pixelIndex + 3] * invAlpha);
-                    }
-                }
-            }
+void BrushEngine::paintOnTile(uint32_t* pixels, int width, int height, int stride, int originX, int originY,
+                              unsigned char r, unsigned char g, unsigned char b, unsigned char a,
+                              const DabClip& clip)
+{
+    paintDabs(m_pendingDabs.data(), m_pendingDabs.size(), pixels, width, height, stride, originX, originY,
+              r, g, b, a, clip);
+}
+
+void BrushEngine::paintDabs(const BrushDab* dabs, size_t count,
+                            uint32_t* pixels, int width, int height, int stride, int originX, int originY,
+                            unsigned char r, unsigned char g, unsigned char b, unsigned char a,
+                            const DabClip& clip)
+{
+    if (count == 0) return;
+    
+    const blend::DabKernel kernel = blend::dabKernel(m_settings.mode);
+    const blend::DabSource source = dabSource(r, g, b, a);
+    
+    for (const BrushDab* dab = dabs; dab != dabs + count; ++dab) {
+        const DamageRect bounds = dabBounds(*dab);
+        if (bounds.x >= originX + width || bounds.x + bounds.width <= originX ||
+            bounds.y >= originY + height || bounds.y + bounds.height <= originY) {
+            continue;
         }
+        drawBrushPoint(pixels, width, height, stride, originX, originY,
+                       dab->x, dab->y, dab->pressure, dab->tilt, kernel, source, clip);
     }
 }
 
-float BrushEngine::calculateBrushAlpha(float distance, float pressure, float tilt)
-{
-    float normalizedDistance = distance / m_settings.size;
-    if (normalizedDistance >= 1.0f) return 0.0f;
-    
-    // Simple circular falloff
-    float alpha = 1.0f - normalizedDistance;
-    alpha *= pressure; // Apply pressure sensitivity
-    
-    return std::clamp(alpha, 0.0f, 1.0f);
-}
-
-void BrushEngine::createBrushMask(std::vector<float>& mask, float size, float hardness)
-{
-    int brushSize = static_cast<int>(size);
-    int maskSize = 2 * brushSize + 1;
-    mask.resize(maskSize * maskSize);
-    
-    for (int y = 0; y < maskSize; ++y) {
-        for (int x = 0; x < maskSize; ++x) {
-            float dx = static_cast<float>(x - brushSize) / size;
-            float dy = static_cast<float>(y - brushSize) / size;
-            float distance = std::sqrt(dx * dx + dy * dy);
-            
-            if (distance <= 1.0f) {
-                float alpha = calculateBrushAlpha(distance * size, 1.0f, 0.0f);
-                
-                // Apply hardness
-                if (hardness < 1.0f) {
-                    float softness = 1.0f - hardness;
-                    if (distance > hardness) {
-                        alpha *= (1.0f - distance) / softness;
-                    }
-                }
-                
-                mask[y * maskSize + x] = alpha;
-            } else {
-                mask[y * maskSize + x] = 0.0f;
+blend::DabSource BrushEngine::dabSource(unsigned char r, unsigned char g, unsigned char b, unsigned char a) const
+{
+    blend::DabSource source;
+    source.r = r / 255.0f;
+    source.g = g / 255.0f;
+    source.b = b / 255.0f;
+    source.a = a / 255.0f;
+    source.opacity = m_settings.opacity;
+    source.flow = m_settings.flow;
+    return source;
+}
+
+DamageRect BrushEngine::dabBounds(const BrushDab& dab) const
+{
+    int extent = BrushTipCache::extent(dabRadius(dab.pressure));
+    if (extent <= 0) return DamageRect();
+    
+    DamageRect rect;
+    rect.x = static_cast<int>(std::floor(dab.x)) - extent;
+    rect.y = static_cast<int>(std::floor(dab.y)) - extent;
+    rect.width = 2 * extent + 2;
+    rect.height = 2 * extent + 2;
+    return rect;
+}
+
+DamageRect BrushEngine::emitDab(const BrushDab& dab)
+{
+    m_pendingDabs.push_back(dab);
+    return dabBounds(dab);
+}
+
+float BrushEngine::dabRadius(float pressure) const
+{
+    return m_settings.size * (m_settings.pressureSensitive ? pressure : 1.0f);
+}
+
+float BrushEngine::dabSpacing(float pressure) const
+{
+    // Never closer than half a pixel, so tiny or zero-pressure dabs can't stall
+    return std::max(0.5f, m_settings.spacing * dabRadius(pressure));
+}
+
+void BrushEngine::drawBrushPoint(uint32_t* pixels, int width, int height, int stride, int originX, int originY,
+                                 float x, float y, float pressure, float tilt,
+                                 const blend::DabKernel& kernel, const blend::DabSource& source,
+                                 const DabClip& clip)
+{
+    (void)tilt;
+    
+    const BrushTip& tip = m_tipCache.tip(dabRadius(pressure), m_settings.hardness, x, y);
+    if (tip.width == 0) return;
+    
+    const int left = static_cast<int>(std::floor(x)) + tip.offsetX - originX;
+    const int top = static_cast<int>(std::floor(y)) + tip.offsetY - originY;
+    
+    // Clip the mask to the target once; the kernels then run whole rows
+    const int x0 = std::max(0, -left);
+    const int x1 = std::min(tip.width, width - left);
+    const int y0 = std::max(0, -top);
+    const int y1 = std::min(tip.height, height - top);
+    if (x0 >= x1 || y0 >= y1) return;
+    
+    const int count = x1 - x0;
+    if (clip.coverage) {
+        m_clippedRow.resize(static_cast<size_t>(count));
+    }
+    for (int row = y0; row < y1; ++row) {
+        uint32_t* dst = pixels + static_cast<size_t>(top + row) * stride + left + x0;
+        const size_t offset = static_cast<size_t>(row) * tip.stride + x0;
+        if (clip.coverage) {
+            // Tip times clip, kept at 16 bits so soft edges stay smooth
+            const uint8_t* values = clip.coverage + static_cast<size_t>(top + row) * clip.stride + left + x0;
+            uint16_t* clipped = m_clippedRow.data();
+            uint32_t any = 0;
+            for (int i = 0; i < count; ++i) {
+                const uint32_t c = tip.coverage16 ? tip.coverage16[offset + i] : tip.coverage8[offset + i] * 257u;
+                clipped[i] = static_cast<uint16_t>((c * values[i] + 127) / 255);
+                any |= values[i];
             }
+            if (any) kernel.row16(dst, clipped, count, source);
+        } else if (tip.coverage16) {
+            kernel.row16(dst, tip.coverage16 + offset, count, source);
+        } else {
+            kernel.row8(dst, tip.coverage8 + offset, count, source);
         }
     }
 }
@@ -2,7 +2,11 @@
 
 #include <vector>
 #include <algorithm>
+#include <cstdint>
+#include <chrono>
 #include <string>
+#include "brush_tip_cache.h"
+#include "dab_kernels.h"
 
 namespace core {
 
@@ -22,13 +26,48 @@ struct BrushSettings {
     float spacing = 0.25f;
     bool pressureSensitive = true;
     bool tiltSensitive = false;
+    blend::DabMode mode = blend::DabMode::Normal;
+    
+    bool operator==(const BrushSettings& other) const {
+        return size == other.size && hardness == other.hardness && opacity == other.opacity
+            && flow == other.flow && spacing == other.spacing
+            && pressureSensitive == other.pressureSensitive
+            && tiltSensitive == other.tiltSensitive && mode == other.mode;
+    }
+    bool operator!=(const BrushSettings& other) const { return !(*this == other); }
 };
 
 struct BrushStroke {
     float x, y;
     float pressure;
     float tilt;
-    float timestamp;
+    float timestamp;    // Seconds since the stroke began
+};
+
+// A single stamp of the brush tip along a stroke
+struct BrushDab {
+    float x, y;
+    float pressure;
+    float tilt;
+};
+
+// Coverage the dabs are scaled by, e.g. a selection, laid over the same
+// area as the target pixels: one byte per pixel, rows `stride` bytes apart.
+// 0 leaves a pixel untouched; no coverage means no clipping.
+struct DabClip {
+    const uint8_t* coverage = nullptr;
+    int stride = 0;
+};
+
+// Pixel rectangle touched by one or more dabs (empty when width or height is 0)
+struct DamageRect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+
+    bool isEmpty() const { return width <= 0 || height <= 0; }
+    void unite(const DamageRect& other);
 };
 
 class BrushEngine {
@@ -45,16 +84,47 @@ public:
     void setHardness(float hardness) { m_settings.hardness = std::clamp(hardness, 0.0f, 1.0f); }
     void setOpacity(float opacity) { m_settings.opacity = std::clamp(opacity, 0.0f, 1.0f); }
     void setFlow(float flow) { m_settings.flow = std::clamp(flow, 0.0f, 1.0f); }
+    void setMode(blend::DabMode mode) { m_settings.mode = mode; }
 
-    // Stroke handling
-    void beginStroke(float x, float y, float pressure = 1.0f, float tilt = 0.0f);
-    void addPoint(float x, float y, float pressure = 1.0f, float tilt = 0.0f);
+    // Stroke handling. Dabs are emitted as points arrive: each call queues
+    // only the dabs its segment adds, at arc-length spacing carried over from
+    // the previous segment, and returns the area they cover. endStroke()
+    // keeps queued dabs so a last paintOnLayer() can still flush them.
+    DamageRect beginStroke(float x, float y, float pressure = 1.0f, float tilt = 0.0f);
+    DamageRect addPoint(float x, float y, float pressure = 1.0f, float tilt = 0.0f);
     void endStroke();
+    bool isStrokeActive() const { return m_strokeActive; }
+    
+    // Dabs emitted since the last paintOnLayer()
+    const std::vector<BrushDab>& pendingDabs() const { return m_pendingDabs; }
     
-    // Painting
+    // Painting: stamps the pending dabs once each and clears the queue.
+    // layerData is premultiplied ARGB32 (QImage::Format_ARGB32_Premultiplied),
+    // the colour is straight.
     void paintOnLayer(unsigned char* layerData, int layerWidth, int layerHeight, 
                       unsigned char r, unsigned char g, unsigned char b, unsigned char a = 255);
     
+    // Stamps the pending dabs into one tile of a larger canvas and keeps the
+    // queue, so the same dabs can go to every tile they cross. pixels holds
+    // the width x height area whose top-left is at (originX, originY), with
+    // rows `stride` pixels apart; dabs outside it are skipped.
+    void paintOnTile(uint32_t* pixels, int width, int height, int stride, int originX, int originY,
+                     unsigned char r, unsigned char g, unsigned char b, unsigned char a = 255,
+                     const DabClip& clip = DabClip());
+    void clearPendingDabs() { m_pendingDabs.clear(); }
+    
+    // Stamps a given list of dabs the same way, e.g. when redoing a stroke
+    void paintDabs(const BrushDab* dabs, size_t count,
+                   uint32_t* pixels, int width, int height, int stride, int originX, int originY,
+                   unsigned char r, unsigned char g, unsigned char b, unsigned char a = 255,
+                   const DabClip& clip = DabClip());
+    
+    // Input points of the stroke in progress, with their timestamps
+    const std::vector<BrushStroke>& currentStroke() const { return m_currentStroke; }
+    
+    // Area a dab covers
+    DamageRect dabBounds(const BrushDab& dab) const;
+    
     // Brush presets
     void loadPreset(const String& name);
     void savePreset(const String& name);
@@ -63,15 +133,27 @@ public:
 private:
     BrushSettings m_settings;
     std::vector<BrushStroke> m_currentStroke;
+    std::vector<BrushDab> m_pendingDabs;
+    float m_distanceToNextDab;     // Arc length left before the next dab
     bool m_strokeActive;
+    std::chrono::steady_clock::time_point m_strokeStart;
+    
+    DamageRect emitDab(const BrushDab& dab);
+    float dabRadius(float pressure) const;
+    float dabSpacing(float pressure) const;
     
     // Brush algorithms
-    void drawBrushPoint(unsigned char* layerData, int layerWidth, int layerHeight,
-                       float x, float y, float pressure, float tilt,
-                       unsigned char r, unsigned char g, unsigned char b, unsigned char a);
+    void drawBrushPoint(uint32_t* pixels, int width, int height, int stride, int originX, int originY,
+                        float x, float y, float pressure, float tilt,
+                        const blend::DabKernel& kernel, const blend::DabSource& source,
+                        const DabClip& clip = DabClip());
+    blend::DabSource dabSource(unsigned char r, unsigned char g, unsigned char b, unsigned char a) const;
+    
+    // Masks for every dab come from here; a dab is a blit of a cached tip
+    BrushTipCache m_tipCache;
     
-    float calculateBrushAlpha(float distance, float pressure, float tilt);
-    void createBrushMask(std::vector<float>& mask, float size, float hardness);
+    // Tip rows scaled by a clip, at 16 bits
+    std::vector<uint16_t> m_clippedRow;
 };
 
 } // namespace core
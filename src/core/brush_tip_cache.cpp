@@ -0,0 +1,185 @@
+#include "brush_tip_cache.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+namespace core {
+
+namespace {
+
+constexpr size_t PoolAlignment = 64;
+constexpr size_t MinBlockSize = 1024 * 1024;
+constexpr int HardnessSteps = 127;
+
+// Quarter pixels for small tips, whole pixels for medium ones and 4 px
+// for very large ones: each step stays well under 1% of the radius
+float quantizeRadius(float radius)
+{
+    if (radius < BrushTipCache::SubpixelRadius) return std::round(radius * 4.0f) / 4.0f;
+    if (radius < 128.0f) return std::round(radius);
+    return std::round(radius / 4.0f) * 4.0f;
+}
+
+// Nearest sub-pixel phase of a position; `carry` is set to 1 when that is
+// the next whole pixel, i.e. phase 0 one pixel on
+int phaseOf(float position, int* carry)
+{
+    const float fraction = position - std::floor(position);
+    const int phase = static_cast<int>(std::round(fraction * BrushTipCache::SubpixelPhases));
+    *carry = phase / BrushTipCache::SubpixelPhases;
+    return phase % BrushTipCache::SubpixelPhases;
+}
+
+template <typename T>
+void fillMask(T* mask, int width, int height, int stride, int offset,
+              float radius, float hardness, float phaseX, float phaseY, float maxValue)
+{
+    const float invRadius = 1.0f / radius;
+    for (int y = 0; y < height; ++y) {
+        const float dy = (y + offset - phaseY) * invRadius;
+        T* row = mask + static_cast<size_t>(y) * stride;
+        for (int x = 0; x < width; ++x) {
+            const float dx = (x + offset - phaseX) * invRadius;
+            const float coverage = BrushTipCache::profile(std::sqrt(dx * dx + dy * dy), hardness);
+            row[x] = static_cast<T>(coverage * maxValue + 0.5f);
+        }
+    }
+}
+
+} // namespace
+
+void BrushTipCache::AlignedDelete::operator()(uint8_t* data) const
+{
+    ::operator delete(data, std::align_val_t(PoolAlignment));
+}
+
+BrushTipCache::BrushTipCache(size_t budget)
+    : m_budget(budget)
+{
+}
+
+BrushTipCache::~BrushTipCache() = default;
+
+float BrushTipCache::profile(float distance, float hardness)
+{
+    if (distance >= 1.0f) return 0.0f;
+
+    // Linear falloff, steepened outside the hard core
+    float alpha = 1.0f - distance;
+    if (hardness < 1.0f && distance > hardness) {
+        alpha *= (1.0f - distance) / (1.0f - hardness);
+    }
+    return std::clamp(alpha, 0.0f, 1.0f);
+}
+
+int BrushTipCache::extent(float radius)
+{
+    return static_cast<int>(std::ceil(quantizeRadius(radius)));
+}
+
+const BrushTip& BrushTipCache::tip(float radius, float hardness, float x, float y)
+{
+    static const BrushTip empty;
+
+    const float quantized = quantizeRadius(radius);
+    if (quantized <= 0.0f) return empty;
+
+    const int hardnessKey = static_cast<int>(std::round(std::clamp(hardness, 0.0f, 1.0f) * HardnessSteps));
+    const bool phased = quantized < SubpixelRadius;
+    int carryX = 0;
+    int carryY = 0;
+    const int phaseX = phased ? phaseOf(x, &carryX) : 0;
+    const int phaseY = phased ? phaseOf(y, &carryY) : 0;
+    const bool wide = quantized >= WideRadius && hardnessKey < HardnessSteps;
+
+    const uint64_t key = (static_cast<uint64_t>(quantized * 4.0f) << 20)
+                       | (static_cast<uint64_t>(hardnessKey) << 8)
+                       | (static_cast<uint64_t>(carryX) << 7)
+                       | (static_cast<uint64_t>(carryY) << 6)
+                       | (static_cast<uint64_t>(phaseX) << 4)
+                       | (static_cast<uint64_t>(phaseY) << 2)
+                       | (wide ? 1u : 0u);
+
+    auto found = m_tips.find(key);
+    if (found != m_tips.end()) {
+        return found->second;
+    }
+
+    // Rounded up to the next whole pixel: the phase 0 mask moved one pixel
+    // on, sharing its coverage
+    if (carryX || carryY) {
+        BrushTip carried = tip(radius, hardness,
+                               std::floor(x) + static_cast<float>(phaseX) / SubpixelPhases,
+                               std::floor(y) + static_cast<float>(phaseY) / SubpixelPhases);
+        carried.offsetX += carryX;
+        carried.offsetY += carryY;
+        return m_tips.emplace(key, carried).first->second;
+    }
+
+    if (m_used > m_budget) {
+        clear();
+    }
+
+    const BrushTip tip = build(quantized, static_cast<float>(hardnessKey) / HardnessSteps,
+                               static_cast<float>(phaseX) / SubpixelPhases,
+                               static_cast<float>(phaseY) / SubpixelPhases, wide);
+    return m_tips.emplace(key, tip).first->second;
+}
+
+void BrushTipCache::clear()
+{
+    m_tips.clear();
+    m_blocks.clear();
+    m_blockSize = 0;
+    m_blockUsed = 0;
+    m_used = 0;
+}
+
+void* BrushTipCache::allocate(size_t bytes)
+{
+    bytes = (bytes + PoolAlignment - 1) & ~(PoolAlignment - 1);
+
+    if (m_blocks.empty() || m_blockUsed + bytes > m_blockSize) {
+        const size_t size = std::max(MinBlockSize, bytes);
+        m_blocks.emplace_back(static_cast<uint8_t*>(::operator new(size, std::align_val_t(PoolAlignment))));
+        m_blockSize = size;
+        m_blockUsed = 0;
+    }
+
+    uint8_t* data = m_blocks.back().get() + m_blockUsed;
+    m_blockUsed += bytes;
+    m_used += bytes;
+    std::memset(data, 0, bytes);
+    return data;
+}
+
+BrushTip BrushTipCache::build(float radius, float hardness, float phaseX, float phaseY, bool wide)
+{
+    // With a phase the centre can sit up to 3/4 px right of floor(x), which
+    // needs one more column and row
+    const int half = static_cast<int>(std::ceil(radius));
+    const bool phased = radius < SubpixelRadius;
+    const int size = 2 * half + (phased ? 2 : 1);
+
+    BrushTip tip;
+    tip.width = size;
+    tip.height = size;
+    tip.offsetX = -half;
+    tip.offsetY = -half;
+
+    if (wide) {
+        tip.stride = ((size * 2 + 31) & ~31) / 2;
+        auto mask = static_cast<uint16_t*>(allocate(static_cast<size_t>(tip.stride) * size * 2));
+        fillMask(mask, size, size, tip.stride, -half, radius, hardness, phaseX, phaseY, 65535.0f);
+        tip.coverage16 = mask;
+    } else {
+        tip.stride = (size + 31) & ~31;
+        auto mask = static_cast<uint8_t*>(allocate(static_cast<size_t>(tip.stride) * size));
+        fillMask(mask, size, size, tip.stride, -half, radius, hardness, phaseX, phaseY, 255.0f);
+        tip.coverage8 = mask;
+    }
+    return tip;
+}
+
+} // namespace core
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace core {
+
+/**
+ * @brief Precomputed coverage mask for one brush dab
+ *
+ * Rows are `stride` elements apart and padded with zeros to a multiple of
+ * 32 bytes, so blitting may read whole padded rows. Only one of coverage8 /
+ * coverage16 is set.
+ */
+struct BrushTip {
+    int width = 0;
+    int height = 0;
+    int offsetX = 0;        // Mask top-left relative to floor() of the dab position
+    int offsetY = 0;
+    int stride = 0;         // Elements per row
+    const uint8_t* coverage8 = nullptr;
+    const uint16_t* coverage16 = nullptr;
+};
+
+/**
+ * @brief Cache of brush tip masks keyed by quantized radius, hardness and
+ * sub-pixel phase
+ *
+ * Small tips get SubpixelPhases x SubpixelPhases variants so dabs land on
+ * the nearest 1/SubpixelPhases pixel without resampling; larger ones snap
+ * to whole pixels, where the difference is invisible. Soft tips above
+ * WideRadius use 16-bit coverage to avoid banding in long gradients, the
+ * rest 8-bit. Masks live in 64-byte aligned blocks of a bump allocator, so
+ * a cache hit costs a hash lookup and no allocation.
+ */
+class BrushTipCache {
+public:
+    static constexpr int SubpixelPhases = 4;
+    static constexpr float SubpixelRadius = 16.0f;   // Phases are used below this
+    static constexpr float WideRadius = 32.0f;       // 16-bit coverage at and above this
+    static constexpr size_t DefaultBudget = 64 * 1024 * 1024;
+
+    explicit BrushTipCache(size_t budget = DefaultBudget);
+    ~BrushTipCache();
+
+    BrushTipCache(const BrushTipCache&) = delete;
+    BrushTipCache& operator=(const BrushTipCache&) = delete;
+
+    /**
+     * @brief Mask for a dab of `radius` centred at (x, y)
+     *
+     * The reference stays valid until the next call; when the cache is over
+     * budget a miss drops every cached mask before building the new one.
+     */
+    const BrushTip& tip(float radius, float hardness, float x, float y);
+
+    void clear();
+
+    size_t memoryUsage() const { return m_used; }
+    size_t tipCount() const { return m_tips.size(); }
+
+    /**
+     * @brief Coverage of the tip profile at a normalised distance from the centre
+     */
+    static float profile(float distance, float hardness);
+
+    /**
+     * @brief Half-size in pixels of the mask for a radius
+     *
+     * A dab at (x, y) touches at most the pixels from floor(x) - extent to
+     * floor(x) + extent + 1, and likewise vertically.
+     */
+    static int extent(float radius);
+
+private:
+    struct AlignedDelete {
+        void operator()(uint8_t* data) const;
+    };
+    using Block = std::unique_ptr<uint8_t[], AlignedDelete>;
+
+    void* allocate(size_t bytes);
+    BrushTip build(float radius, float hardness, float phaseX, float phaseY, bool wide);
+
+    size_t m_budget;
+    size_t m_used = 0;
+    std::vector<Block> m_blocks;
+    size_t m_blockSize = 0;
+    size_t m_blockUsed = 0;
+    std::unordered_map<uint64_t, BrushTip> m_tips;
+};
+
+} // namespace core
@@ -0,0 +1,264 @@
+#include "color_lut.h"
+#include "lut_kernels.h"
+#include <QFile>
+#include <QList>
+#include <QSaveFile>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+
+namespace core {
+
+ColorLut3D::ColorLut3D(int size)
+    : m_size(std::clamp(size, MinSize, MaxSize))
+    , m_table(static_cast<size_t>(m_size) * m_size * m_size * 3)
+{
+    const float scale = 1.0f / (m_size - 1);
+    float* out = m_table.data();
+    for (int b = 0; b < m_size; ++b) {
+        for (int g = 0; g < m_size; ++g) {
+            for (int r = 0; r < m_size; ++r) {
+                *out++ = r * scale;
+                *out++ = g * scale;
+                *out++ = b * scale;
+            }
+        }
+    }
+}
+
+ColorLut3D ColorLut3D::fromFunction(int size, const ColorFunc& func)
+{
+    ColorLut3D lut(size);
+    if (!func) return lut;
+
+    float* point = lut.m_table.data();
+    for (size_t i = 0; i < lut.m_table.size(); i += 3, point += 3) {
+        func(point[0], point[1], point[2]);
+        point[0] = std::clamp(point[0], 0.0f, 1.0f);
+        point[1] = std::clamp(point[1], 0.0f, 1.0f);
+        point[2] = std::clamp(point[2], 0.0f, 1.0f);
+    }
+    return lut;
+}
+
+void ColorLut3D::sample(float& r, float& g, float& b) const
+{
+    if (isNull()) return;
+
+    const float scale = static_cast<float>(m_size - 1);
+    const float x = std::clamp(r, 0.0f, 1.0f) * scale;
+    const float y = std::clamp(g, 0.0f, 1.0f) * scale;
+    const float z = std::clamp(b, 0.0f, 1.0f) * scale;
+    const int x0 = std::min(static_cast<int>(x), m_size - 2);
+    const int y0 = std::min(static_cast<int>(y), m_size - 2);
+    const int z0 = std::min(static_cast<int>(z), m_size - 2);
+    const float f[3] = {x - x0, y - y0, z - z0};
+    const int step[3] = {3, 3 * m_size, 3 * m_size * m_size};
+
+    // Visit the axes from largest fraction to smallest
+    int order[3] = {0, 1, 2};
+    std::stable_sort(order, order + 3, [&f](int a, int c) { return f[a] > f[c]; });
+
+    const float* corner = m_table.data() + x0 * step[0] + y0 * step[1] + z0 * step[2];
+    float out[3] = {0.0f, 0.0f, 0.0f};
+    float previous = 1.0f;
+    for (int i = 0; i < 3; ++i) {
+        const float weight = previous - f[order[i]];
+        for (int c = 0; c < 3; ++c) {
+            out[c] += corner[c] * weight;
+        }
+        corner += step[order[i]];
+        previous = f[order[i]];
+    }
+    for (int c = 0; c < 3; ++c) {
+        out[c] += corner[c] * previous;
+    }
+
+    r = out[0];
+    g = out[1];
+    b = out[2];
+}
+
+void ColorLut3D::applyRow(QRgb* pixels, int count) const
+{
+    if (isNull()) return;
+    blend::lutRowFunction()(pixels, count, m_table.data(), m_size);
+}
+
+void ColorLut3D::apply(QImage& image, const QRect& area) const
+{
+    const QRect clipped = area & image.rect();
+    if (isNull() || clipped.isEmpty()) return;
+
+    const blend::LutRowFunc row = blend::lutRowFunction();
+    for (int y = clipped.top(); y <= clipped.bottom(); ++y) {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y)) + clipped.left();
+        row(line, clipped.width(), m_table.data(), m_size);
+    }
+}
+
+bool ColorLut3D::readCube(const QString& filename, ColorLut3D& lut, QString* error)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error) *error = file.errorString();
+        return false;
+    }
+    return parseCube(file.readAll(), lut, error);
+}
+
+bool ColorLut3D::parseCube(const QByteArray& text, ColorLut3D& lut, QString* error)
+{
+    auto fail = [error](const QString& message) {
+        if (error) *error = message;
+        return false;
+    };
+
+    QString title;
+    int size = 0;
+    float domainMin[3] = {0.0f, 0.0f, 0.0f};
+    float domainMax[3] = {1.0f, 1.0f, 1.0f};
+    std::vector<float> values;
+
+    int lineNumber = 0;
+    for (const QByteArray& rawLine : text.split('\n')) {
+        ++lineNumber;
+        const QByteArray line = rawLine.trimmed();
+        if (line.isEmpty() || line.startsWith('#')) continue;
+
+        const QList<QByteArray> fields = line.simplified().split(' ');
+        const QByteArray& keyword = fields.front();
+        auto number = [&fields](int index, bool* ok) {
+            if (index >= fields.size()) {
+                *ok = false;
+                return 0.0f;
+            }
+            return fields[index].toFloat(ok);
+        };
+
+        bool ok = true;
+        if (keyword == "TITLE") {
+            QByteArray value = line.mid(5).trimmed();
+            if (value.size() >= 2 && value.startsWith('"') && value.endsWith('"')) {
+                value = value.mid(1, value.size() - 2);
+            }
+            title = QString::fromUtf8(value);
+        } else if (keyword == "LUT_3D_SIZE") {
+            size = fields.size() > 1 ? fields[1].toInt(&ok) : 0;
+            if (!ok || size < MinSize || size > MaxSize) {
+                return fail(QString("Unsupported LUT_3D_SIZE on line %1").arg(lineNumber));
+            }
+            values.reserve(static_cast<size_t>(size) * size * size * 3);
+        } else if (keyword == "LUT_1D_SIZE") {
+            return fail("1D lookup tables are not supported");
+        } else if (keyword == "DOMAIN_MIN" || keyword == "DOMAIN_MAX") {
+            float* target = keyword == "DOMAIN_MIN" ? domainMin : domainMax;
+            for (int c = 0; c < 3 && ok; ++c) {
+                target[c] = number(c + 1, &ok);
+            }
+        } else if (keyword == "LUT_3D_INPUT_RANGE") {
+            const float low = number(1, &ok);
+            const float high = ok ? number(2, &ok) : 0.0f;
+            std::fill(domainMin, domainMin + 3, low);
+            std::fill(domainMax, domainMax + 3, high);
+        } else if (QByteArray("0123456789+-.").contains(keyword[0])) {
+            for (int c = 0; c < 3 && ok; ++c) {
+                values.push_back(number(c, &ok));
+            }
+        }
+        // Other keywords (e.g. vendor extensions) are ignored
+        if (!ok) {
+            return fail(QString("Malformed line %1").arg(lineNumber));
+        }
+    }
+
+    if (size == 0) {
+        return fail("Missing LUT_3D_SIZE");
+    }
+    if (values.size() != static_cast<size_t>(size) * size * size * 3) {
+        return fail(QString("Expected %1 entries, found %2")
+                        .arg(size * size * size).arg(values.size() / 3));
+    }
+    for (int c = 0; c < 3; ++c) {
+        if (!(domainMax[c] > domainMin[c])) {
+            return fail("Invalid domain");
+        }
+    }
+
+    ColorLut3D parsed(size);
+    std::copy(values.begin(), values.end(), parsed.m_table.begin());
+    parsed.m_title = title;
+
+    bool unitDomain = true;
+    for (int c = 0; c < 3; ++c) {
+        unitDomain = unitDomain && domainMin[c] == 0.0f && domainMax[c] == 1.0f;
+    }
+    if (!unitDomain) {
+        // Resample so the lattice spans [0, 1] like every other table
+        lut = fromFunction(size, [&](float& r, float& g, float& b) {
+            float in[3] = {r, g, b};
+            for (int c = 0; c < 3; ++c) {
+                in[c] = (in[c] - domainMin[c]) / (domainMax[c] - domainMin[c]);
+            }
+            r = in[0];
+            g = in[1];
+            b = in[2];
+            parsed.sample(r, g, b);
+        });
+        lut.m_title = title;
+        return true;
+    }
+
+    lut = std::move(parsed);
+    return true;
+}
+
+QByteArray ColorLut3D::toCube() const
+{
+    QByteArray text;
+    QTextStream stream(&text);
+    // .cube titles have no escapes: a quote would end the title early and a
+    // line break start a new line, so quotes are dropped and breaks spaced
+    QString title = m_title;
+    title.remove(QLatin1Char('"'));
+    title.replace(QLatin1Char('\r'), QLatin1Char(' '));
+    title.replace(QLatin1Char('\n'), QLatin1Char(' '));
+    title = title.trimmed();
+    if (!title.isEmpty()) {
+        stream << "TITLE \"" << title << "\"\n";
+    }
+    stream << "LUT_3D_SIZE " << m_size << "\n";
+    stream << "DOMAIN_MIN 0.0 0.0 0.0\n";
+    stream << "DOMAIN_MAX 1.0 1.0 1.0\n";
+
+    stream.setRealNumberNotation(QTextStream::FixedNotation);
+    stream.setRealNumberPrecision(6);
+    for (size_t i = 0; i < m_table.size(); i += 3) {
+        stream << m_table[i] << ' ' << m_table[i + 1] << ' ' << m_table[i + 2] << '\n';
+    }
+    stream.flush();
+    return text;
+}
+
+bool ColorLut3D::writeCube(const QString& filename, QString* error) const
+{
+    if (isNull()) {
+        if (error) *error = "Empty lookup table";
+        return false;
+    }
+
+    // The target is only replaced once the whole table is written
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (error) *error = file.errorString();
+        return false;
+    }
+    const QByteArray text = toCube();
+    if (file.write(text) != text.size() || !file.commit()) {
+        if (error) *error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+} // namespace core
@@ -1,15 +1,33 @@
 #include "command.h"
 #include "document.h"
 #include "layer.h"
+#include "app_config.h"
 #include <QPainter>
+#include <QTransform>
 #include <QDebug>
+#include <QDir>
+#include <algorithm>
 
 namespace core {
 
+// Share of [Performance] MaxMemoryUsage the undo history may keep in RAM;
+// the rest is left to documents and render caches
+static constexpr qint64 HistoryMemoryShare = 4;
+
+// Run one command step with the document's notifications batched, so a
+// command that paints many segments or regions triggers a single repaint
+static bool inTransaction(Document* document, const std::function<bool()>& step)
+{
+    Document::Transaction transaction(document);
+    return step();
+}
+
 // CommandManager implementation
 CommandManager::CommandManager(QObject* parent)
     : QObject(parent)
     , m_macroActive(false)
+    , m_memoryBudget(AppConfig::global().maxMemoryUsage / HistoryMemoryShare)
+    , m_journal(QDir(AppConfig::global().cachePath).absolutePath())
 {
 }
 
@@ -20,24 +38,58 @@ bool CommandManager::executeCommand(std::unique_ptr<ICommand> command, Document*
     if (!command || !document) return false;
     
     // Execute the command and store it for undo
-    if (command->execute(document)) {
-        m_undoStack.push_back({std::move(command), command->description(), false});
+    if (inTransaction(document, [&]() { return command->execute(document); })) {
+        if (mergeIntoLast(command.get())) {
+            return true;
+        }
+        clearRedoStack();
+        QString description = command->description();
+        m_undoStack.push_back({std::move(command), description, false});
+        m_strokeEntryOpen = m_strokeActive;
+        track(m_undoStack.back());
+        enforceMemoryBudget();
         return true;
     }
     return false;
 }
 
+bool CommandManager::mergeIntoLast(ICommand* command)
+{
+    if (!m_strokeActive || !m_strokeEntryOpen || m_undoStack.empty()) return false;
+    
+    CommandEntry& last = m_undoStack.back();
+    if (!last.command->canMergeWith(command) || !pageIn(last)) return false;
+    
+    untrack(last);
+    bool merged = last.command->mergeWith(command);
+    track(last);
+    if (merged) {
+        // The copy on disk no longer matches
+        m_journal.release(last.journaled);
+        last.journaled = UndoJournal::Record();
+        enforceMemoryBudget();
+    }
+    return merged;
+}
+
 bool CommandManager::undo(Document* document)
 {
     if (m_undoStack.empty() || !document) return false;
     
     auto& entry = m_undoStack.back();
-    if (entry.command->undo(document)) {
+    if (!pageIn(entry)) return false;
+    m_strokeEntryOpen = false;
+    
+    untrack(entry);
+    if (inTransaction(document, [&]() { return entry.command->undo(document); })) {
         // Move to redo stack
-        m_redoStack.push_back({std::move(entry.command), entry.description, entry.isMacro});
+        m_redoStack.push_back(std::move(entry));
         m_undoStack.pop_back();
+        track(m_redoStack.back());
+        enforceMemoryBudget();
         return true;
     }
+    track(entry);
     return false;
 }
 
@@ -46,12 +98,19 @@ bool CommandManager::redo(Document* document)
     if (m_redoStack.empty() || !document) return false;
     
     auto& entry = m_redoStack.back();
-    if (entry.command->execute(document)) {
+    if (!pageIn(entry)) return false;
+    m_strokeEntryOpen = false;
+    
+    untrack(entry);
+    if (inTransaction(document, [&]() { return entry.command->execute(document); })) {
         // Move back to undo stack
-        m_undoStack.push_back({std::move(entry.command), entry.description, entry.isMacro});
+        m_undoStack.push_back(std::move(entry));
         m_redoStack.pop_back();
+        track(m_undoStack.back());
+        enforceMemoryBudget();
         return true;
     }
+    track(entry);
     return false;
 }
 
@@ -69,6 +128,18 @@ void CommandManager::clear()
 {
     m_undoStack.clear();
     m_redoStack.clear();
+    m_memoryUsage = 0;
+    m_journal.clear();
+    m_strokeEntryOpen = false;
+}
+
+void CommandManager::clearRedoStack()
+{
+    for (auto& entry : m_redoStack) {
+        untrack(entry);
+        m_journal.release(entry.journaled);
+    }
+    m_redoStack.clear();
 }
 
 void CommandManager::beginMacro(const QString& description)
@@ -89,78 +160,258 @@ bool CommandManager::isMacroActive() const
     return m_macroActive;
 }
 
-// BrushStrokeCommand implementation
-BrushStrokeCommand::BrushStrokeCommand(const QPoint& start, const QPoint& end, 
-                                     const QColor& color, int size, int layerIndex)
-    : m_start(start)
-    , m_end(end)
-    , m_color(color)
-    , m_size(size)
-    , m_layerIndex(layerIndex)
+void CommandManager::beginStroke()
 {
+    m_strokeActive = true;
+    m_strokeEntryOpen = false;
 }
 
-bool BrushStrokeCommand::execute(Document* document)
+void CommandManager::endStroke()
+{
+    m_strokeActive = false;
+    m_strokeEntryOpen = false;
+}
+
+void CommandManager::setMemoryBudget(qint64 bytes)
+{
+    m_memoryBudget = std::max<qint64>(0, bytes);
+    enforceMemoryBudget();
+}
+
+void CommandManager::track(CommandEntry& entry)
+{
+    entry.memory = entry.spilled ? 0 : static_cast<qint64>(entry.command->memoryUsage());
+    m_memoryUsage += entry.memory;
+}
+
+void CommandManager::untrack(CommandEntry& entry)
 {
-    if (!document) {
-        qDebug() << "BrushStrokeCommand: Document is null";
+    m_memoryUsage -= entry.memory;
+    entry.memory = 0;
+}
+
+bool CommandManager::pageIn(CommandEntry& entry)
+{
+    if (!entry.spilled) return true;
+    
+    QByteArray payload = m_journal.read(entry.journaled);
+    if (payload.isEmpty()) {
+        qDebug() << "CommandManager: Failed to read spilled history for" << entry.description;
         return false;
     }
     
-    auto layer = document->getLayer(m_layerIndex);
-    if (!layer) {
-        qDebug() << "BrushStrokeCommand: Layer is null at index" << m_layerIndex;
+    // Keep the record: undo and redo leave the payload as it is, so a
+    // later spill can point back at it
+    entry.spilled = false;
+    entry.command->restorePayload(payload);
+    track(entry);
+    return true;
+}
+
+bool CommandManager::spill(CommandEntry& entry)
+{
+    if (entry.spilled || entry.memory == 0) return false;
+    
+    // Spilled before and paged back in: the copy on disk is still good, so
+    // the data only has to go
+    if (entry.journaled.isValid()) {
+        if (!entry.command->dropPayload()) return false;
+        untrack(entry);
+        entry.spilled = true;
+        return true;
+    }
+    
+    QByteArray payload = entry.command->takePayload();
+    if (payload.isEmpty()) return false;
+    
+    UndoJournal::Record record = m_journal.append(payload);
+    if (!record.isValid()) {
+        // Out of disk: keep the payload in memory rather than lose it
+        entry.command->restorePayload(payload);
+        untrack(entry);
+        track(entry);
         return false;
     }
     
-    // Store original content for undo
-    if (auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(layer)) {
-        try {
-            m_originalLayerContent = rasterLayer->image();
-            
-            // Check if image is valid
-            if (rasterLayer->image().isNull()) {
-                qDebug() << "BrushStrokeCommand: Layer image is null";
-                return false;
-            }
-            
-            qDebug() << "BrushStrokeCommand: Drawing on layer" << m_layerIndex << "image size:" << rasterLayer->image().size();
-            
-            // Draw to the layer
-            QPainter painter(&rasterLayer->image());
-            if (!painter.isActive()) {
-                qDebug() << "BrushStrokeCommand: Failed to create painter";
-                return false;
-            }
-            
-            painter.setPen(QPen(m_color, m_size, Qt::SolidLine, Qt::RoundCap));
-            painter.drawLine(m_start, m_end);
-            painter.end();
-            
-            qDebug() << "BrushStrokeCommand: Successfully drew line from" << m_start << "to" << m_end;
-            return true;
-        } catch (const std::exception& e) {
-            qDebug() << "BrushStrokeCommand: Exception during drawing:" << e.what();
+    untrack(entry);
+    entry.journaled = record;
+    entry.spilled = true;
+    return true;
+}
+
+void CommandManager::enforceMemoryBudget()
+{
+    if (m_memoryUsage <= m_memoryBudget) return;
+    
+    // Oldest undo steps first, then the redo steps furthest from the present
+    for (auto& entry : m_undoStack) {
+        if (m_memoryUsage <= m_memoryBudget) return;
+        spill(entry);
+    }
+    for (auto& entry : m_redoStack) {
+        if (m_memoryUsage <= m_memoryBudget) return;
+        spill(entry);
+    }
+}
+
+namespace {
+
+// Bounds of a round-capped line, with a pixel of slack on each side
+QRect lineBounds(const QPoint& start, const QPoint& end, int size)
+{
+    const int margin = size / 2 + 1;
+    return QRect(start, end).normalized().adjusted(-margin, -margin, margin, margin);
+}
+
+// Bounds of an outlined shape after rotation about its centre
+QRect shapeBounds(const QRect& rect, int size, double rotation)
+{
+    QRectF bounds = rect;
+    if (rotation != 0.0) {
+        const QPointF center = rect.center();
+        QTransform transform;
+        transform.translate(center.x(), center.y());
+        transform.rotate(rotation);
+        transform.translate(-center.x(), -center.y());
+        bounds = transform.mapRect(bounds);
+    }
+    const qreal margin = size / 2.0 + 1.0;
+    return bounds.adjusted(-margin, -margin, margin, margin).toAlignedRect();
+}
+
+void rotateAboutCenter(QPainter& painter, const QRect& rect, double rotation)
+{
+    if (rotation != 0.0) {
+        QPoint center = rect.center();
+        painter.translate(center);
+        painter.rotate(rotation);
+        painter.translate(-center);
+    }
+}
+
+} // namespace
+
+// RasterPaintCommand implementation
+RasterPaintCommand::RasterPaintCommand(int layerIndex, const QRect& affectedRegion)
+    : m_layerIndex(layerIndex)
+    , m_affectedRegion(affectedRegion)
+{
+}
+
+bool RasterPaintCommand::paintRegion(Document* document, const QRect& region,
+                                     const std::function<void(QPainter&)>& paint)
+{
+    return editRegion(document, region, [&paint](RasterLayer::WriteAccess& access) {
+        if (!access.paint(paint)) {
+            qDebug() << "RasterPaintCommand: Failed to create painter";
             return false;
         }
-    } else {
-        qDebug() << "BrushStrokeCommand: Layer is not a RasterLayer";
+        return true;
+    });
+}
+
+bool RasterPaintCommand::editRegion(Document* document, const QRect& region,
+                                    const std::function<bool(RasterLayer::WriteAccess&)>& edit,
+                                    bool clipToSelection)
+{
+    if (!document) return false;
+    
+    auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(document->getLayerAt(m_layerIndex));
+    if (!rasterLayer) {
+        qDebug() << "RasterPaintCommand: No raster layer at index" << m_layerIndex;
+        return false;
     }
-    return false;
+    
+    const Selection* clip = nullptr;
+    if (clipToSelection) {
+        if (!m_selectionTaken) {
+            m_selection = rasterLayer->selection();
+            m_selectionTaken = true;
+        }
+        clip = &m_selection;
+    }
+    
+    QRect area = region & rasterLayer->tiles().rect();
+    if (clip && !clip->isEmpty()) {
+        area &= clip->bounds();
+    }
+    if (area.isEmpty()) return true;
+    
+    // Save only what is about to change; the edit then works in place
+    m_snapshot.merge(rasterLayer->snapshotRegion(area));
+    bool edited = false;
+    {
+        RasterLayer::WriteAccess access = rasterLayer->beginWrite(area, clip);
+        edited = edit(access);
+    }
+    
+    m_snapshot.compress();
+    return edited;
+}
+
+void RasterPaintCommand::mergeSnapshot(const RasterPaintCommand& later)
+{
+    m_snapshot.merge(later.m_snapshot);
+    m_snapshot.compress();
+    m_affectedRegion |= later.m_affectedRegion;
+}
+
+QByteArray RasterPaintCommand::takePayload()
+{
+    if (m_snapshot.isNull()) return QByteArray();
+    
+    QByteArray payload = m_snapshot.toByteArray();
+    m_snapshot = TileSnapshot();
+    return payload;
+}
+
+void RasterPaintCommand::restorePayload(const QByteArray& payload)
+{
+    m_snapshot = TileSnapshot::fromByteArray(payload);
+}
+
+bool RasterPaintCommand::dropPayload()
+{
+    if (m_snapshot.isNull()) return false;
+    
+    m_snapshot = TileSnapshot();
+    return true;
 }
 
-bool BrushStrokeCommand::undo(Document* document)
+bool RasterPaintCommand::undo(Document* document)
 {
     if (!document) return false;
     
-    auto layer = document->getLayer(m_layerIndex);
-    if (!layer) return false;
+    auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(document->getLayerAt(m_layerIndex));
+    if (!rasterLayer) return false;
     
-    if (auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(layer)) {
-        rasterLayer->setImage(m_originalLayerContent);
-        return true;
+    // A null snapshot means the command painted nothing on the canvas
+    rasterLayer->restoreSnapshot(m_snapshot);
+    return true;
+}
+
+// BrushStrokeCommand implementation
+BrushStrokeCommand::BrushStrokeCommand(const QPoint& start, const QPoint& end, 
+                                     const QColor& color, int size, int layerIndex)
+    : RasterPaintCommand(layerIndex, lineBounds(start, end, size))
+    , m_segments{QLine(start, end)}
+    , m_color(color)
+    , m_size(size)
+{
+}
+
+bool BrushStrokeCommand::execute(Document* document)
+{
+    m_snapshot = TileSnapshot();
+    for (const QLine& segment : m_segments) {
+        bool painted = paintRegion(document, lineBounds(segment.p1(), segment.p2(), m_size),
+            [this, &segment](QPainter& painter) {
+                painter.setPen(QPen(m_color, m_size, Qt::SolidLine, Qt::RoundCap));
+                painter.drawLine(segment);
+            });
+        if (!painted) return false;
     }
-    return false;
+    return true;
 }
 
 QString BrushStrokeCommand::description() const
@@ -170,59 +421,119 @@ QString BrushStrokeCommand::description() const
 
 bool BrushStrokeCommand::canMergeWith(const ICommand* other) const
 {
-    Q_UNUSED(other)
-    return false;
+    auto stroke = dynamic_cast<const BrushStrokeCommand*>(other);
+    return stroke && stroke->m_layerIndex == m_layerIndex
+        && stroke->m_color == m_color && stroke->m_size == m_size;
 }
 
 bool BrushStrokeCommand::mergeWith(const ICommand* other)
 {
-    Q_UNUSED(other)
-    return false;
+    if (!canMergeWith(other)) return false;
+    
+    auto stroke = static_cast<const BrushStrokeCommand*>(other);
+    m_segments.insert(m_segments.end(), stroke->m_segments.begin(), stroke->m_segments.end());
+    mergeSnapshot(*stroke);
+    return true;
+}
+
+// DabStrokeCommand
+namespace {
+
+QRect dabRegion(const BrushEngine& engine, const std::vector<BrushDab>& dabs, size_t begin, size_t end)
+{
+    DamageRect damage;
+    for (size_t i = begin; i < end; ++i) {
+        damage.unite(engine.dabBounds(dabs[i]));
+    }
+    return damage.isEmpty() ? QRect() : QRect(damage.x, damage.y, damage.width, damage.height);
+}
+
+} // namespace
+
+DabStrokeCommand::DabStrokeCommand(std::shared_ptr<BrushEngine> engine, std::vector<BrushDab> dabs,
+                                   const QColor& color, int layerIndex)
+    : RasterPaintCommand(layerIndex, dabRegion(*engine, dabs, 0, dabs.size()))
+    , m_engine(std::move(engine))
+    , m_settings(m_engine->settings())
+    , m_dabs(std::move(dabs))
+    , m_color(color)
+{
+    m_batches.push_back({m_affectedRegion, m_dabs.size()});
+}
+
+bool DabStrokeCommand::execute(Document* document)
+{
+    // The engine may have moved on to other settings since this was recorded
+    const BrushSettings current = m_engine->settings();
+    m_engine->setSettings(m_settings);
+    
+    m_snapshot = TileSnapshot();
+    bool painted = true;
+    size_t begin = 0;
+    for (const Batch& batch : m_batches) {
+        painted = editRegion(document, batch.bounds, [&](RasterLayer::WriteAccess& access) {
+            access.forEachTile([&](QRgb* pixels, const QRect& part, int stride, const uint8_t* clip,
+                                   int clipStride) {
+                m_engine->paintDabs(m_dabs.data() + begin, batch.end - begin,
+                                    pixels, part.width(), part.height(), stride,
+                                    part.left(), part.top(),
+                                    m_color.red(), m_color.green(), m_color.blue(), m_color.alpha(),
+                                    DabClip{clip, clipStride});
+            });
+            return true;
+        }, true);
+        if (!painted) break;
+        begin = batch.end;
+    }
+    
+    m_engine->setSettings(current);
+    return painted;
+}
+
+QString DabStrokeCommand::description() const
+{
+    return m_settings.mode == blend::DabMode::Erase ? "Erase" : "Brush Stroke";
+}
+
+bool DabStrokeCommand::canMergeWith(const ICommand* other) const
+{
+    auto stroke = dynamic_cast<const DabStrokeCommand*>(other);
+    return stroke && stroke->m_engine == m_engine && stroke->m_layerIndex == m_layerIndex
+        && stroke->m_color == m_color && stroke->m_settings == m_settings;
+}
+
+bool DabStrokeCommand::mergeWith(const ICommand* other)
+{
+    if (!canMergeWith(other)) return false;
+    
+    auto stroke = static_cast<const DabStrokeCommand*>(other);
+    const size_t offset = m_dabs.size();
+    m_dabs.insert(m_dabs.end(), stroke->m_dabs.begin(), stroke->m_dabs.end());
+    for (const Batch& batch : stroke->m_batches) {
+        m_batches.push_back({batch.bounds, batch.end + offset});
+    }
+    mergeSnapshot(*stroke);
+    return true;
 }
 
 // DrawLineCommand
 DrawLineCommand::DrawLineCommand(const QPoint& start, const QPoint& end, 
                                const QColor& color, int size, int layerIndex)
-    : m_start(start)
+    : RasterPaintCommand(layerIndex, lineBounds(start, end, size))
+    , m_start(start)
     , m_end(end)
     , m_color(color)
     , m_size(size)
-    , m_layerIndex(layerIndex)
 {
 }
 
 bool DrawLineCommand::execute(Document* document)
 {
-    if (!document) return false;
-    
-    auto layer = document->getLayer(m_layerIndex);
-    if (!layer) return false;
-    
-    if (auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(layer)) {
-        m_originalLayerContent = rasterLayer->image();
-        
-        QPainter painter(&rasterLayer->image());
+    m_snapshot = TileSnapshot();
+    return paintRegion(document, m_affectedRegion, [this](QPainter& painter) {
         painter.setPen(QPen(m_color, m_size, Qt::SolidLine, Qt::RoundCap));
         painter.drawLine(m_start, m_end);
-        painter.end();
-        
-        return true;
-    }
-    return false;
-}
-
-bool DrawLineCommand::undo(Document* document)
-{
-    if (!document) return false;
-    
-    auto layer = document->getLayer(m_layerIndex);
-    if (!layer) return false;
-    
-    if (auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(layer)) {
-        rasterLayer->setImage(m_originalLayerContent);
-        return true;
-    }
-    return false;
+    });
 }
 
 QString DrawLineCommand::description() const
@@ -245,55 +556,23 @@ bool DrawLineCommand::mergeWith(const ICommand* other)
 // DrawRectangleCommand
 DrawRectangleCommand::DrawRectangleCommand(const QRect& rect, const QColor& color, 
                                          int size, double rotation, int layerIndex)
-    : m_rect(rect)
+    : RasterPaintCommand(layerIndex, shapeBounds(rect, size, rotation))
+    , m_rect(rect)
     , m_color(color)
     , m_size(size)
     , m_rotation(rotation)
-    , m_layerIndex(layerIndex)
 {
 }
 
 bool DrawRectangleCommand::execute(Document* document)
 {
-    if (!document) return false;
-    
-    auto layer = document->getLayer(m_layerIndex);
-    if (!layer) return false;
-    
-    if (auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(layer)) {
-        m_originalLayerContent = rasterLayer->image();
-        
-        QPainter painter(&rasterLayer->image());
+    m_snapshot = TileSnapshot();
+    return paintRegion(document, m_affectedRegion, [this](QPainter& painter) {
         painter.setPen(QPen(m_color, m_size, Qt::SolidLine, Qt::RoundCap));
         painter.setBrush(Qt::NoBrush);
-        
-        if (m_rotation != 0.0) {
-            QPoint center = m_rect.center();
-            painter.translate(center);
-            painter.rotate(m_rotation);
-            painter.translate(-center);
-        }
-        
+        rotateAboutCenter(painter, m_rect, m_rotation);
         painter.drawRect(m_rect);
-        painter.end();
-        
-        return true;
-    }
-    return false;
-}
-
-bool DrawRectangleCommand::undo(Document* document)
-{
-    if (!document) return false;
-    
-    auto layer = document->getLayer(m_layerIndex);
-    if (!layer) return false;
-    
-    if (auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(layer)) {
-        rasterLayer->setImage(m_originalLayerContent);
-        return true;
-    }
-    return false;
+    });
 }
 
 QString DrawRectangleCommand::description() const
@@ -316,55 +595,23 @@ bool DrawRectangleCommand::mergeWith(const ICommand* other)
 // DrawEllipseCommand
 DrawEllipseCommand::DrawEllipseCommand(const QRect& rect, const QColor& color, 
                                      int size, double rotation, int layerIndex)
-    : m_rect(rect)
+    : RasterPaintCommand(layerIndex, shapeBounds(rect, size, rotation))
+    , m_rect(rect)
     , m_color(color)
     , m_size(size)
     , m_rotation(rotation)
-    , m_layerIndex(layerIndex)
 {
 }
 
 bool DrawEllipseCommand::execute(Document* document)
 {
-    if (!document) return false;
-    
-    auto layer = document->getLayer(m_layerIndex);
-    if (!layer) return false;
-    
-    if (auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(layer)) {
-        m_originalLayerContent = rasterLayer->image();
-        
-        QPainter painter(&rasterLayer->image());
+    m_snapshot = TileSnapshot();
+    return paintRegion(document, m_affectedRegion, [this](QPainter& painter) {
         painter.setPen(QPen(m_color, m_size, Qt::SolidLine, Qt::RoundCap));
         painter.setBrush(Qt::NoBrush);
-        
-        if (m_rotation != 0.0) {
-            QPoint center = m_rect.center();
-            painter.translate(center);
-            painter.rotate(m_rotation);
-            painter.translate(-center);
-        }
-        
+        rotateAboutCenter(painter, m_rect, m_rotation);
         painter.drawEllipse(m_rect);
-        painter.end();
-        
-        return true;
-    }
-    return false;
-}
-
-bool DrawEllipseCommand::undo(Document* document)
-{
-    if (!document) return false;
-    
-    auto layer = document->getLayer(m_layerIndex);
-    if (!layer) return false;
-    
-    if (auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(layer)) {
-        rasterLayer->setImage(m_originalLayerContent);
-        return true;
-    }
-    return false;
+    });
 }
 
 QString DrawEllipseCommand::description() const
@@ -386,59 +633,87 @@ bool DrawEllipseCommand::mergeWith(const ICommand* other)
 
 // EraseCommand implementation
 EraseCommand::EraseCommand(const QPoint& start, const QPoint& end, int size, int layerIndex)
-    : m_start(start)
-    , m_end(end)
+    : RasterPaintCommand(layerIndex, lineBounds(start, end, size))
+    , m_segments{QLine(start, end)}
     , m_size(size)
-    , m_layerIndex(layerIndex)
 {
 }
 
 bool EraseCommand::execute(Document* document)
 {
-    if (!document) return false;
-    
-    auto layer = document->getLayer(m_layerIndex);
-    if (!layer) return false;
-    
-    if (auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(layer)) {
-        m_originalLayerContent = rasterLayer->image();
-        
-        QPainter painter(&rasterLayer->image());
-        painter.setPen(QPen(Qt::white, m_size, Qt::SolidLine, Qt::RoundCap));
-        painter.drawLine(m_start, m_end);
-        painter.end();
-        
-        return true;
+    m_snapshot = TileSnapshot();
+    for (const QLine& segment : m_segments) {
+        bool painted = paintRegion(document, lineBounds(segment.p1(), segment.p2(), m_size),
+            [this, &segment](QPainter& painter) {
+                painter.setPen(QPen(Qt::white, m_size, Qt::SolidLine, Qt::RoundCap));
+                painter.drawLine(segment);
+            });
+        if (!painted) return false;
     }
-    return false;
+    return true;
 }
 
-bool EraseCommand::undo(Document* document)
+QString EraseCommand::description() const
 {
-    if (!document) return false;
+    return "Erase";
+}
+
+bool EraseCommand::canMergeWith(const ICommand* other) const
+{
+    auto erase = dynamic_cast<const EraseCommand*>(other);
+    return erase && erase->m_layerIndex == m_layerIndex && erase->m_size == m_size;
+}
+
+bool EraseCommand::mergeWith(const ICommand* other)
+{
+    if (!canMergeWith(other)) return false;
     
-    auto layer = document->getLayer(m_layerIndex);
-    if (!layer) return false;
+    auto erase = static_cast<const EraseCommand*>(other);
+    m_segments.insert(m_segments.end(), erase->m_segments.begin(), erase->m_segments.end());
+    mergeSnapshot(*erase);
+    return true;
+}
+
+// AdjustLayerCommand implementation
+AdjustLayerCommand::AdjustLayerCommand(const PointOperation& operation, int layerIndex)
+    : RasterPaintCommand(layerIndex, QRect())
+    , m_operation(operation)
+{
+}
+
+bool AdjustLayerCommand::execute(Document* document)
+{
+    auto rasterLayer = document
+        ? std::dynamic_pointer_cast<RasterLayer>(document->getLayerAt(m_layerIndex)) : nullptr;
+    if (!rasterLayer) return false;
     
-    if (auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(layer)) {
-        rasterLayer->setImage(m_originalLayerContent);
+    m_affectedRegion = rasterLayer->tiles().rect();
+    m_snapshot = TileSnapshot();
+    return editRegion(document, m_affectedRegion, [this](RasterLayer::WriteAccess& access) {
+        access.mapPixels([this](QRgb* pixels, int count) {
+            m_operation.applyRow(pixels, count);
+        });
         return true;
-    }
-    return false;
+    }, true);
 }
 
-QString EraseCommand::description() const
+QString AdjustLayerCommand::description() const
 {
-    return "Erase";
+    switch (m_operation.kind()) {
+        case PointOperation::Kind::BrightnessContrast: return "Brightness/Contrast";
+        case PointOperation::Kind::HueSaturation: return "Hue/Saturation";
+        case PointOperation::Kind::Levels: return "Levels";
+    }
+    return "Adjust";
 }
 
-bool EraseCommand::canMergeWith(const ICommand* other) const
+bool AdjustLayerCommand::canMergeWith(const ICommand* other) const
 {
     Q_UNUSED(other)
     return false;
 }
 
-bool EraseCommand::mergeWith(const ICommand* other)
+bool AdjustLayerCommand::mergeWith(const ICommand* other)
 {
     Q_UNUSED(other)
     return false;
@@ -456,15 +731,18 @@ AddLayerCommand::AddLayerCommand(const QString& name, int index, const QSize& si
 bool AddLayerCommand::execute(Document* document)
 {
     if (!document) return false;
-    auto newLayer = std::make_shared<RasterLayer>(m_name, m_size);
+    auto newLayer = std::make_shared<RasterLayer>(m_size.width(), m_size.height());
+    newLayer->setName(m_name);
     document->addLayer(newLayer, m_index);
+    m_actualIndex = (m_index < 0 || m_index >= document->getLayerCount())
+        ? document->getLayerCount() - 1 : m_index;
     return true;
 }
 
 bool AddLayerCommand::undo(Document* document)
 {
     if (!document) return false;
-    document->removeLayer(m_index);
+    document->removeLayer(m_actualIndex);
     return true;
 }
 
@@ -494,7 +772,7 @@ RemoveLayerCommand::RemoveLayerCommand(int index)
 bool RemoveLayerCommand::execute(Document* document)
 {
     if (!document) return false;
-    m_removedLayer = document->getLayer(m_index);
+    m_removedLayer = document->getLayerAt(m_index);
     m_originalIndex = m_index;
     document->removeLayer(m_index);
     return true;
@@ -580,7 +858,7 @@ bool LayerPropertyCommand::execute(Document* document)
 {
     if (!document) return false;
     
-    auto layer = document->getLayer(m_layerIndex);
+    auto layer = document->getLayerAt(m_layerIndex);
     if (!layer) return false;
     
     switch (m_property) {
@@ -603,7 +881,7 @@ bool LayerPropertyCommand::undo(Document* document)
 {
     if (!document) return false;
     
-    auto layer = document->getLayer(m_layerIndex);
+    auto layer = document->getLayerAt(m_layerIndex);
     if (!layer) return false;
     
     switch (m_property) {
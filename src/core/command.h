@@ -7,7 +7,17 @@
 #include <QColor>
 #include <QImage>
 #include <QVariant>
+#include <QByteArray>
+#include <QLine>
+#include <functional>
 #include <memory>
+#include <vector>
+#include "tile_snapshot.h"
+#include "undo_journal.h"
+#include "brush_engine.h"
+#include "layer.h"
+
+class QPainter;
 
 namespace core {
 
@@ -56,44 +66,152 @@ public:
      * @return true if merge was successful
      */
     virtual bool mergeWith(const ICommand* other) = 0;
+    
+    /**
+     * @brief Bytes of undo data the command holds in memory
+     */
+    virtual size_t memoryUsage() const { return 0; }
+    
+    /**
+     * @brief Hand over the undo data so it can be spilled to disk
+     *
+     * The command drops its in-memory copy. Commands without spillable
+     * data return an empty array and keep their state.
+     */
+    virtual QByteArray takePayload() { return QByteArray(); }
+    
+    /**
+     * @brief Give back data previously returned by takePayload()
+     */
+    virtual void restorePayload(const QByteArray& payload) { Q_UNUSED(payload) }
+    
+    /**
+     * @brief Drop the undo data whose payload is already on disk
+     *
+     * As takePayload() without encoding anything; returns whether there
+     * was data to drop.
+     */
+    virtual bool dropPayload() { return !takePayload().isEmpty(); }
+};
+
+/**
+ * @brief Base for commands that paint into a raster layer
+ *
+ * Only the area a command touches is saved before it paints, as a
+ * TileSnapshot that is compressed when large. Undo patches that area back
+ * rather than restoring a copy of the whole layer.
+ */
+class RasterPaintCommand : public ICommand {
+public:
+    bool undo(Document* document) override;
+    size_t memoryUsage() const override { return m_snapshot.memoryUsage(); }
+    QByteArray takePayload() override;
+    void restorePayload(const QByteArray& payload) override;
+    bool dropPayload() override;
+
+protected:
+    RasterPaintCommand(int layerIndex, const QRect& affectedRegion);
+
+    /**
+     * @brief Snapshot `region`, then paint it
+     *
+     * The painter works on the layer's tiles in place and is set up in
+     * layer coordinates. The snapshot is merged into m_snapshot, so several
+     * calls from one execute() undo together. Returns false if the layer is
+     * missing or could not be painted.
+     */
+    bool paintRegion(Document* document, const QRect& region,
+                     const std::function<void(QPainter&)>& paint);
+
+    /**
+     * @brief Snapshot `region`, then let `edit` change it in place
+     *
+     * Like paintRegion() for edits that write pixels directly through the
+     * layer's WriteAccess, which is limited to `region`. The layer reports
+     * the change once `edit` returns. With `clipToSelection` the access is
+     * clipped to the layer's selection as it was at the first execute, so a
+     * redo edits the same pixels.
+     */
+    bool editRegion(Document* document, const QRect& region,
+                    const std::function<bool(RasterLayer::WriteAccess& access)>& edit,
+                    bool clipToSelection = false);
+
+    /**
+     * @brief Fold the undo data of a later command on the same layer into ours
+     */
+    void mergeSnapshot(const RasterPaintCommand& later);
+
+    int m_layerIndex;
+    QRect m_affectedRegion;
+    TileSnapshot m_snapshot;
+    
+private:
+    Selection m_selection;      // Clip of editRegion(), taken on first use
+    bool m_selectionTaken = false;
 };
 
 /**
  * @brief Command for drawing a brush stroke
+ *
+ * Consecutive segments of one stroke merge into a single command that
+ * replays them in order on redo.
  */
-class BrushStrokeCommand : public ICommand {
+class BrushStrokeCommand : public RasterPaintCommand {
 public:
     BrushStrokeCommand(const QPoint& start, const QPoint& end, 
                       const QColor& color, int size, int layerIndex);
     
     bool execute(Document* document) override;
-    bool undo(Document* document) override;
     QString description() const override;
     bool canMergeWith(const ICommand* other) const override;
     bool mergeWith(const ICommand* other) override;
 
 private:
-    QPoint m_start;
-    QPoint m_end;
+    std::vector<QLine> m_segments;  // More than one after merging
     QColor m_color;
     int m_size;
-    int m_layerIndex;
+};
+
+/**
+ * @brief Command for a stroke rasterized by BrushEngine
+ *
+ * Keeps the dabs the engine emitted, grouped in the batches they were
+ * painted in, so redo stamps exactly the same pixels one small region at a
+ * time. The engine is shared with whoever produced the dabs, so its cached
+ * tip masks are reused. Batches of one stroke merge into a single command.
+ */
+class DabStrokeCommand : public RasterPaintCommand {
+public:
+    DabStrokeCommand(std::shared_ptr<BrushEngine> engine, std::vector<BrushDab> dabs,
+                     const QColor& color, int layerIndex);
     
-    // Store the original layer content for undo
-    QImage m_originalLayerContent;
-    QRect m_affectedRegion;
+    bool execute(Document* document) override;
+    QString description() const override;
+    bool canMergeWith(const ICommand* other) const override;
+    bool mergeWith(const ICommand* other) override;
+
+private:
+    struct Batch {
+        QRect bounds;
+        size_t end;         // One past the batch's last dab
+    };
+
+    std::shared_ptr<BrushEngine> m_engine;
+    BrushSettings m_settings;
+    std::vector<BrushDab> m_dabs;
+    std::vector<Batch> m_batches;
+    QColor m_color;
 };
 
 /**
  * @brief Command for drawing a line
  */
-class DrawLineCommand : public ICommand {
+class DrawLineCommand : public RasterPaintCommand {
 public:
     DrawLineCommand(const QPoint& start, const QPoint& end, 
                    const QColor& color, int size, int layerIndex);
     
     bool execute(Document* document) override;
-    bool undo(Document* document) override;
     QString description() const override;
     bool canMergeWith(const ICommand* other) const override;
     bool mergeWith(const ICommand* other) override;
@@ -103,22 +221,17 @@ private:
     QPoint m_end;
     QColor m_color;
     int m_size;
-    int m_layerIndex;
-    
-    QImage m_originalLayerContent;
-    QRect m_affectedRegion;
 };
 
 /**
  * @brief Command for drawing a rectangle
  */
-class DrawRectangleCommand : public ICommand {
+class DrawRectangleCommand : public RasterPaintCommand {
 public:
     DrawRectangleCommand(const QRect& rect, const QColor& color, 
                        int size, double rotation, int layerIndex);
     
     bool execute(Document* document) override;
-    bool undo(Document* document) override;
     QString description() const override;
     bool canMergeWith(const ICommand* other) const override;
     bool mergeWith(const ICommand* other) override;
@@ -128,22 +241,17 @@ private:
     QColor m_color;
     int m_size;
     double m_rotation;
-    int m_layerIndex;
-    
-    QImage m_originalLayerContent;
-    QRect m_affectedRegion;
 };
 
 /**
  * @brief Command for drawing an ellipse
  */
-class DrawEllipseCommand : public ICommand {
+class DrawEllipseCommand : public RasterPaintCommand {
 public:
     DrawEllipseCommand(const QRect& rect, const QColor& color, 
                       int size, double rotation, int layerIndex);
     
     bool execute(Document* document) override;
-    bool undo(Document* document) override;
     QString description() const override;
     bool canMergeWith(const ICommand* other) const override;
     bool mergeWith(const ICommand* other) override;
@@ -153,34 +261,45 @@ private:
     QColor m_color;
     int m_size;
     double m_rotation;
-    int m_layerIndex;
-    
-    QImage m_originalLayerContent;
-    QRect m_affectedRegion;
 };
 
 /**
  * @brief Command for erasing content
+ *
+ * Merges like BrushStrokeCommand.
  */
-class EraseCommand : public ICommand {
+class EraseCommand : public RasterPaintCommand {
 public:
     EraseCommand(const QPoint& start, const QPoint& end, 
                 int size, int layerIndex);
     
     bool execute(Document* document) override;
-    bool undo(Document* document) override;
     QString description() const override;
     bool canMergeWith(const ICommand* other) const override;
     bool mergeWith(const ICommand* other) override;
 
 private:
-    QPoint m_start;
-    QPoint m_end;
+    std::vector<QLine> m_segments;  // More than one after merging
     int m_size;
-    int m_layerIndex;
+};
+
+/**
+ * @brief Command for a destructive colour adjustment of a raster layer
+ *
+ * Adjusts every pixel of the layer in place; undo restores the saved
+ * tiles.
+ */
+class AdjustLayerCommand : public RasterPaintCommand {
+public:
+    AdjustLayerCommand(const PointOperation& operation, int layerIndex);
     
-    QImage m_originalLayerContent;
-    QRect m_affectedRegion;
+    bool execute(Document* document) override;
+    QString description() const override;
+    bool canMergeWith(const ICommand* other) const override;
+    bool mergeWith(const ICommand* other) override;
+
+private:
+    PointOperation m_operation;
 };
 
 /**
@@ -218,7 +337,7 @@ public:
 
 private:
     int m_index;
-    std::shared_ptr<class ILayer> m_removedLayer;
+    std::shared_ptr<class Layer> m_removedLayer;
     int m_originalIndex;
 };
 
@@ -335,6 +454,37 @@ public:
      * @return true if macro is active
      */
     bool isMacroActive() const;
+    
+    /**
+     * @brief Mark the start of a press/release interaction
+     *
+     * Until endStroke(), a command that the previous history entry
+     * canMergeWith() is folded into that entry instead of being pushed, so
+     * one stroke makes one undo step however many mouse moves it spans.
+     */
+    void beginStroke();
+    
+    /**
+     * @brief End the current press/release interaction
+     */
+    void endStroke();
+    
+    /**
+     * @brief Set how many bytes of undo data may stay in memory
+     *
+     * Past the budget the oldest payloads are compressed and spilled to the
+     * journal, and paged back in when undo()/redo() reaches them. The copy
+     * on disk outlives the page-in, so spilling the same step again costs
+     * no write; it is released when the step is merged into or dropped.
+     * Defaults to a quarter of [Performance] MaxMemoryUsage from config.ini.
+     */
+    void setMemoryBudget(qint64 bytes);
+    qint64 memoryBudget() const { return m_memoryBudget; }
+    
+    /**
+     * @brief Bytes of undo data currently held in memory
+     */
+    qint64 memoryUsage() const { return m_memoryUsage; }
 
 signals:
     void commandExecuted(ICommand* command);
@@ -347,16 +497,32 @@ private:
         std::unique_ptr<ICommand> command;
         QString description;
         bool isMacro;
+        qint64 memory = 0;              // In-memory undo data, 0 once spilled
+        UndoJournal::Record journaled;  // Copy of the payload on disk, if any
+        bool spilled = false;           // Payload only on disk
     };
     
     std::vector<CommandEntry> m_undoStack;
     std::vector<CommandEntry> m_redoStack;
     std::vector<CommandEntry> m_currentMacro;
     bool m_macroActive;
+    bool m_strokeActive = false;
+    bool m_strokeEntryOpen = false;     // Top of the undo stack came from this stroke
+    
+    qint64 m_memoryBudget;
+    qint64 m_memoryUsage = 0;
+    UndoJournal m_journal;
     
     void addToUndoStack(std::unique_ptr<ICommand> command, const QString& description = QString());
     void clearRedoStack();
     void executeMacro();
+    
+    bool mergeIntoLast(ICommand* command);
+    void track(CommandEntry& entry);
+    void untrack(CommandEntry& entry);
+    bool pageIn(CommandEntry& entry);
+    bool spill(CommandEntry& entry);
+    void enforceMemoryBudget();
 };
 
 } // namespace core
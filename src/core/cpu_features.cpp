@@ -0,0 +1,104 @@
+#include "cpu_features.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace core {
+
+namespace {
+
+SimdLevel detectSimdLevel()
+{
+#if !defined(CORE_X86_SIMD)
+    return SimdLevel::Scalar;
+#elif defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    if (maxLeaf < 1) return SimdLevel::Scalar;
+
+    __cpuid(info, 1);
+    const bool sse41 = (info[2] & (1 << 19)) != 0;
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!sse41) return SimdLevel::Scalar;
+
+    // AVX state must also be enabled by the OS
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && avx && fma && (_xgetbv(0) & 0x6) == 0x6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    return avx2 ? SimdLevel::AVX2 : SimdLevel::SSE41;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SimdLevel::SSE41;
+    }
+    return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel initialSimdLevel()
+{
+    SimdLevel level = supportedSimdLevel();
+    if (const char* env = std::getenv("IMAGEEDITOR_SIMD")) {
+        if (std::strcmp(env, "scalar") == 0) {
+            level = SimdLevel::Scalar;
+        } else if (std::strcmp(env, "sse41") == 0) {
+            level = std::min(level, SimdLevel::SSE41);
+        } else if (std::strcmp(env, "avx2") == 0) {
+            level = std::min(level, SimdLevel::AVX2);
+        }
+    }
+    return level;
+}
+
+std::atomic<SimdLevel>& activeLevel()
+{
+    static std::atomic<SimdLevel> level(initialSimdLevel());
+    return level;
+}
+
+} // namespace
+
+SimdLevel supportedSimdLevel()
+{
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+SimdLevel activeSimdLevel()
+{
+    return activeLevel().load(std::memory_order_relaxed);
+}
+
+void setActiveSimdLevel(SimdLevel level)
+{
+    if (level > supportedSimdLevel()) {
+        level = supportedSimdLevel();
+    }
+    activeLevel().store(level, std::memory_order_relaxed);
+}
+
+const char* simdLevelName(SimdLevel level)
+{
+    switch (level) {
+        case SimdLevel::Scalar: return "scalar";
+        case SimdLevel::SSE41: return "sse4.1";
+        case SimdLevel::AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+} // namespace core
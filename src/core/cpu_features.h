@@ -0,0 +1,37 @@
+#pragma once
+
+namespace core {
+
+/**
+ * @brief Instruction set levels that the pixel kernels are built for
+ */
+enum class SimdLevel {
+    Scalar,
+    SSE41,
+    AVX2
+};
+
+/**
+ * @brief Highest level supported by both this CPU and the build
+ */
+SimdLevel supportedSimdLevel();
+
+/**
+ * @brief Level the kernels currently dispatch to
+ *
+ * Defaults to supportedSimdLevel(). The IMAGEEDITOR_SIMD environment
+ * variable (scalar, sse41, avx2) caps it at that level at startup;
+ * levels the CPU lacks are never selected.
+ */
+SimdLevel activeSimdLevel();
+
+/**
+ * @brief Override the dispatch level (clamped to the supported level)
+ *
+ * Intended for benchmarks and for comparing kernel output across levels.
+ */
+void setActiveSimdLevel(SimdLevel level);
+
+const char* simdLevelName(SimdLevel level);
+
+} // namespace core
@@ -0,0 +1,34 @@
+#include "dab_kernels.h"
+
+namespace core {
+namespace blend {
+
+DabKernel dabKernel(DabMode mode, SimdLevel level)
+{
+    int index = static_cast<int>(mode);
+    if (index < 0 || index >= DabModeCount) {
+        index = static_cast<int>(DabMode::Normal);
+    }
+
+#if defined(CORE_X86_SIMD)
+    if (level > supportedSimdLevel()) {
+        level = supportedSimdLevel();
+    }
+    switch (level) {
+        case SimdLevel::AVX2: return detail::avx2DabKernels()[index];
+        case SimdLevel::SSE41: return detail::sse41DabKernels()[index];
+        case SimdLevel::Scalar: break;
+    }
+#else
+    (void)level;
+#endif
+    return detail::scalarDabKernels()[index];
+}
+
+DabKernel dabKernel(DabMode mode)
+{
+    return dabKernel(mode, activeSimdLevel());
+}
+
+} // namespace blend
+} // namespace core
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "cpu_features.h"
+#include <cstdint>
+
+namespace core {
+namespace blend {
+
+/**
+ * @brief How a brush dab combines with the pixels under it
+ */
+enum class DabMode {
+    Normal,     // Build-up: every dab is composited over what is there
+    Erase,      // Removes coverage from the layer
+    Wash        // Dabs build towards the brush opacity but never past it
+};
+
+constexpr int DabModeCount = 3;
+
+/**
+ * @brief Brush colour and strength for one run of dabs
+ *
+ * Colour is straight (not premultiplied), all values in [0, 1]. In Normal
+ * and Erase a dab at full coverage applies a * opacity * flow. In Wash a dab
+ * moves the pixel a fraction `flow` of the way towards the brush colour at
+ * alpha a * opacity, so overlapping dabs saturate at that alpha.
+ */
+struct DabSource {
+    float r = 0.0f;
+    float g = 0.0f;
+    float b = 0.0f;
+    float a = 1.0f;
+    float opacity = 1.0f;
+    float flow = 1.0f;
+};
+
+/**
+ * @brief Composite one row of a dab mask into premultiplied ARGB32 pixels
+ *
+ * `coverage` holds one value per pixel, 0 to 255 or 0 to 65535 depending on
+ * the mask depth. The caller clips the dab against the layer, so every
+ * pixel in the row is inside it.
+ */
+using DabRowFunc8 = void (*)(uint32_t* dst, const uint8_t* coverage, int count,
+                             const DabSource& source);
+using DabRowFunc16 = void (*)(uint32_t* dst, const uint16_t* coverage, int count,
+                              const DabSource& source);
+
+struct DabKernel {
+    DabRowFunc8 row8;
+    DabRowFunc16 row16;
+};
+
+/**
+ * @brief Dab kernels for a mode at the active SIMD level
+ */
+DabKernel dabKernel(DabMode mode);
+
+/**
+ * @brief Dab kernels for a mode at a specific level (falls back to scalar)
+ */
+DabKernel dabKernel(DabMode mode, SimdLevel level);
+
+namespace detail {
+// Kernel tables indexed by DabMode, one per instruction set
+const DabKernel* scalarDabKernels();
+const DabKernel* sse41DabKernels();
+const DabKernel* avx2DabKernels();
+} // namespace detail
+
+} // namespace blend
+} // namespace core
@@ -0,0 +1,122 @@
+#pragma once
+
+// Dab compositing shared by every instruction set.
+//
+// Included after blend_kernels_impl.h by the same per-instruction-set units,
+// so it reuses their VecF, loadPixels and storePixels. Each unit also
+// defines, inside its anonymous namespace:
+//   loadCoverage(const uint8_t*), loadCoverage(const uint16_t*)
+//                        Width mask values as floats in [0, 1]
+
+#include "dab_kernels.h"
+
+namespace core {
+namespace blend {
+namespace {
+
+// Per-row constants, broadcast once instead of once per block
+struct DabVec {
+    VecF r, g, b;
+    VecF strength;      // Alpha applied by a dab at full coverage
+    VecF flow;
+    VecF cap;           // Highest alpha Wash builds up to
+
+    explicit DabVec(const DabSource& s)
+        : r(s.r), g(s.g), b(s.b)
+        , strength(s.a * s.opacity * s.flow)
+        , flow(s.flow)
+        , cap(s.a * s.opacity)
+    {
+    }
+};
+
+template <DabMode M>
+inline void dabBlock(uint32_t* dst, VecF coverage, const DabVec& src)
+{
+    Rgba d;
+    loadPixels(dst, d.r, d.g, d.b, d.a);
+
+    const VecF one(1.0f);
+    if constexpr (M == DabMode::Normal) {
+        const VecF alpha = coverage * src.strength;
+        const VecF inv = one - alpha;
+        d.r = src.r * alpha + d.r * inv;
+        d.g = src.g * alpha + d.g * inv;
+        d.b = src.b * alpha + d.b * inv;
+        d.a = alpha + d.a * inv;
+    } else if constexpr (M == DabMode::Erase) {
+        const VecF inv = one - coverage * src.strength;
+        d.r = d.r * inv;
+        d.g = d.g * inv;
+        d.b = d.b * inv;
+        d.a = d.a * inv;
+    } else {
+        // Pull towards the brush colour at max(cap, current alpha): alpha
+        // rises to the cap and stops, colour keeps converging under it
+        const VecF alpha = coverage * src.flow;
+        const VecF target = vmax(src.cap, d.a);
+        d.r = d.r + (src.r * target - d.r) * alpha;
+        d.g = d.g + (src.g * target - d.g) * alpha;
+        d.b = d.b + (src.b * target - d.b) * alpha;
+        d.a = d.a + (target - d.a) * alpha;
+    }
+
+    storePixels(dst, d.r, d.g, d.b, d.a);
+}
+
+template <typename T>
+inline bool isUncovered(const T* coverage, int count)
+{
+    T any = 0;
+    for (int i = 0; i < count; ++i) {
+        any |= coverage[i];
+    }
+    return any == 0;
+}
+
+template <DabMode M, typename T>
+void dabRowKernel(uint32_t* dst, const T* coverage, int count, const DabSource& source)
+{
+    if (count <= 0) return;
+
+    constexpr int W = VecF::Width;
+    const DabVec src(source);
+
+    int i = 0;
+    for (; i + W <= count; i += W) {
+        // Soft tips are mostly empty towards their corners
+        if (isUncovered(coverage + i, W)) continue;
+        dabBlock<M>(dst + i, loadCoverage(coverage + i), src);
+    }
+
+    if (i < count) {
+        const int rest = count - i;
+        if (isUncovered(coverage + i, rest)) return;
+
+        uint32_t d[W] = {};
+        T c[W] = {};
+        std::memcpy(d, dst + i, rest * sizeof(uint32_t));
+        std::memcpy(c, coverage + i, rest * sizeof(T));
+        dabBlock<M>(d, loadCoverage(c), src);
+        std::memcpy(dst + i, d, rest * sizeof(uint32_t));
+    }
+}
+
+template <std::size_t... I>
+const DabKernel* dabKernelTable(std::index_sequence<I...>)
+{
+    static const DabKernel table[] = {
+        { &dabRowKernel<static_cast<DabMode>(I), uint8_t>,
+          &dabRowKernel<static_cast<DabMode>(I), uint16_t> }...
+    };
+    return table;
+}
+
+const DabKernel* dabKernelTable()
+{
+    return dabKernelTable(std::make_index_sequence<DabModeCount>());
+}
+
+} // namespace
+} // namespace blend
+} // namespace core
@@ -1,5 +1,7 @@
 #include "document.h"
 #include "layer.h"
+#include "thread_pool.h"
+#include "document_file.h"
 #include <QPainter>
 #include <QFileInfo>
 #include <QDebug>
@@ -7,6 +9,23 @@
 
 namespace core {
 
+namespace {
+
+// Area of the canvas a layer affects. Adjustment layers recolour whatever
+// is below them, so their own bounds don't matter.
+QRect footprint(const Layer& layer, const QRect& canvas)
+{
+    return layer.getType() == LayerType::Adjustment ? canvas : layer.getVisualBounds();
+}
+
+// Adjustments that replace the pixels below outright can share one pass
+bool isFusable(const RenderSnapshot::LayerState& state)
+{
+    return state.adjustment && state.blendMode == BlendMode::Normal && state.opacity >= 1.0f;
+}
+
+} // namespace
+
 Document::Document(int width, int height, QObject* parent)
     : QObject(parent)
     , m_width(width)
@@ -40,10 +59,11 @@ void Document::addLayer(LayerPtr layer, int index)
     // New layers become active
     m_activeLayer = layer;
     
-    invalidateCache();
+    trackLayer(layer);
+    invalidateRegion(footprint(*layer, QRect(0, 0, m_width, m_height)));
     updateModifiedDate();
     emit layerAdded(m_layers.size() - 1);
-    emit documentChanged();
+    notifyDocumentChanged();
 }
 
 void Document::removeLayer(int index)
@@ -61,6 +81,7 @@ void Document::removeLayer(int index)
     }
     
     m_layers.erase(m_layers.begin() + index);
+    untrackLayer(layer);
     
     // Set new active layer: prefer the next above, else below
     if (!m_activeLayer && !m_layers.empty()) {
@@ -68,10 +89,10 @@ void Document::removeLayer(int index)
         m_activeLayer = m_layers[pick];
     }
     
-    invalidateCache();
+    invalidateRegion(footprint(*layer, QRect(0, 0, m_width, m_height)));
     updateModifiedDate();
     emit layerRemoved(index);
-    emit documentChanged();
+    notifyDocumentChanged();
 }
 
 void Document::moveLayer(int from, int to)
@@ -86,7 +107,8 @@ void Document::moveLayer(int from, int to)
     m_layers.erase(m_layers.begin() + from);
     m_layers.insert(m_layers.begin() + to, layer);
     
-    invalidateCache();
+    // Only the moved layer's footprint changes stacking order
+    invalidateRegion(footprint(*layer, QRect(0, 0, m_width, m_height)));
     updateModifiedDate();
     emit layerMoved(from, to);
 }
@@ -121,38 +143,242 @@ void Document::setActiveLayer(int index)
 QImage Document::render(const QRect& viewport) const
 {
     QRect renderRect = viewport.isNull() ? QRect(0, 0, m_width, m_height) : viewport;
-    QImage result(renderRect.size(), QImage::Format_ARGB32_Premultiplied);
-    result.fill(Qt::transparent);
+    flushLayerDamage();
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    updateCache(renderRect);
+    return m_cachedRender.copy(renderRect);
+}
+
+void Document::render(QPainter* painter, const QRect& viewport) const
+{
+    if (!painter) return;
+    
+    QRect renderRect = viewport.isNull() ? QRect(0, 0, m_width, m_height) : viewport;
+    flushLayerDamage();
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    updateCache(renderRect);
+    m_cachedRender.draw(painter, renderRect.topLeft(), renderRect);
+}
+
+void Document::flushLayerDamage() const
+{
+    // Layers hold their damage back during a transaction; render() takes it
+    // only when asked for pixels, so edits in between cost no cache work
+    if (m_transactionDepth == 0) return;
+    for (const auto& layer : m_layers) {
+        layer->flushDamage();
+    }
+}
+
+void Document::updateCache(const QRect& area) const
+{
+    if (!m_cacheValid) {
+        m_cachedRender = TileStorage(m_width, m_height);
+        m_cachedTiles.assign(static_cast<size_t>(m_cachedRender.tilesX()) * m_cachedRender.tilesY(), 0);
+        m_dirtyRegion = QRegion();
+        m_cacheValid = true;
+    }
     
-    QPainter painter(&result);
-    painter.setRenderHint(QPainter::Antialiasing);
+    QRect range = m_cachedRender.tileRange(area);
+    if (range.isNull()) return;
+    
+    struct TileJob {
+        int x;
+        int y;
+        QRegion damage;
+    };
+    std::vector<TileJob> jobs;
+    
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            QRect tileRect = m_cachedRender.tileRect(tx, ty);
+            size_t index = static_cast<size_t>(ty) * m_cachedRender.tilesX() + tx;
+            
+            QRegion damage;
+            if (!m_cachedTiles[index]) {
+                damage = tileRect;
+                m_cachedTiles[index] = 1;
+            } else {
+                damage = m_dirtyRegion.intersected(tileRect);
+            }
+            if (damage.isEmpty()) continue;
+            
+            m_dirtyRegion -= QRegion(tileRect);
+            jobs.push_back({tx, ty, damage});
+        }
+    }
+    
+    if (jobs.empty()) return;
+    
+    // Cache tiles are disjoint, so workers write their results in place
+    // without any merge step or locking
+    const auto layers = snapshot();
+    ThreadPool::global().parallelFor(0, static_cast<int>(jobs.size()), [&](int i) {
+        compositeTile(*layers, jobs[i].x, jobs[i].y, jobs[i].damage);
+    });
+}
+
+void Document::compositeTile(const RenderSnapshot& snapshot, int tileX, int tileY, const QRegion& damage) const
+{
+    QImage& tile = m_cachedRender.detachTile(tileX, tileY);
+    const QPoint origin(tileX * TileStorage::TileSize, tileY * TileStorage::TileSize);
+    
+    for (const QRect& rect : damage) {
+        for (int y = rect.top(); y <= rect.bottom(); ++y) {
+            QRgb* line = reinterpret_cast<QRgb*>(tile.scanLine(y - origin.y())) + (rect.left() - origin.x());
+            std::fill(line, line + rect.width(), QRgb(0));
+        }
+        snapshot.composite(tile, origin, rect);
+    }
+    
+    // Flat areas (e.g. untouched background) collapse back to a single value
+    m_cachedRender.optimize(m_cachedRender.tileRect(tileX, tileY));
+}
+
+std::shared_ptr<const RenderSnapshot> Document::snapshot(int level, bool preview) const
+{
+    level = std::max(0, level);
+    const QSize size(std::max(1, (m_width + (1 << level) - 1) >> level),
+                     std::max(1, (m_height + (1 << level) - 1) >> level));
+    
+    std::vector<RenderSnapshot::LayerState> layers;
+    layers.reserve(m_layers.size());
+    // The layer pipelines fused into each entry, for adjustment entries
+    std::vector<std::vector<std::shared_ptr<const AdjustmentPipeline>>> parts;
+    parts.reserve(m_layers.size());
     
-    // Render layers from bottom to top
     for (const auto& layer : m_layers) {
-        if (!layer->isVisible()) continue;
+        if (!layer->isVisible() || layer->getOpacity() <= 0.0f) continue;
         
-        QImage layerImage = layer->render();
-        if (layerImage.isNull()) continue;
+        RenderSnapshot::LayerState state;
+        const QPoint position = layer->getBounds().toRect().topLeft();
+        state.position = QPoint(position.x() >> level, position.y() >> level);
+        state.blendMode = layer->getBlendMode();
+        state.opacity = layer->getOpacity();
         
-        // Apply blend mode and opacity
-        painter.setOpacity(layer->getOpacity());
-        painter.setCompositionMode(blendModeToQPainter(layer->getBlendMode()));
+        if (auto* adjustment = dynamic_cast<AdjustmentLayer*>(layer.get())) {
+            state.adjustment = adjustment->pipeline();
+            if (state.adjustment->isIdentity()) continue;
+            
+            // A run of plain adjustments compiles into one pass over the pixels
+            if (!layers.empty() && isFusable(layers.back()) && isFusable(state)) {
+                parts.back().push_back(std::move(state.adjustment));
+            } else {
+                parts.push_back({state.adjustment});
+                layers.push_back(std::move(state));
+            }
+            continue;
+        }
         
-        QRect layerBounds = layer->getBounds().toRect();
-        if (renderRect.intersects(layerBounds)) {
-            painter.drawImage(layerBounds.topLeft() - renderRect.topLeft(), layerImage);
+        // Mip levels and rasterized layers are made by the compositing threads
+        state.source = layer->renderSource(level);
+        if (!state.source) continue;
+        parts.emplace_back();
+        layers.push_back(std::move(state));
+    }
+    
+    // Runs fused by the previous snapshot are reused while none of their
+    // layers changed, so the tables baked for them are kept too
+    std::vector<FusedAdjustment> fusedRuns;
+    for (size_t i = 0; i < layers.size(); ++i) {
+        if (parts[i].size() < 2) continue;
+        auto cached = std::find_if(m_fusedAdjustments.begin(), m_fusedAdjustments.end(),
+                                   [&](const FusedAdjustment& run) { return run.parts == parts[i]; });
+        if (cached == m_fusedAdjustments.end()) {
+            auto fused = std::make_shared<AdjustmentPipeline>(*parts[i].front());
+            for (size_t part = 1; part < parts[i].size(); ++part) {
+                fused->append(*parts[i][part]);
+            }
+            fusedRuns.push_back({std::move(parts[i]), std::move(fused)});
+        } else {
+            fusedRuns.push_back(std::move(*cached));
+        }
+        layers[i].adjustment = fusedRuns.back().pipeline;
+    }
+    m_fusedAdjustments.swap(fusedRuns);
+    
+    if (preview) {
+        // One tetrahedral lookup per pixel instead of the whole chain; the
+        // compositing threads bake the table unless the pipeline has it
+        const int lutSize = level > 0 ? ColorLut3D::PreviewSize : ColorLut3D::DefaultSize;
+        for (auto& state : layers) {
+            if (state.adjustment && state.adjustment->prefersLut()) {
+                state.lutSize = lutSize;
+            }
         }
     }
     
-    return result;
+    return std::make_shared<const RenderSnapshot>(size, level, std::move(layers));
 }
 
-void Document::render(QPainter* painter, const QRect& viewport) const
+void Document::trackLayer(const LayerPtr& layer)
 {
-    if (!painter) return;
+    const bool global = layer->getType() == LayerType::Adjustment;
+    // Inside a transaction this arrives once at the commit, or earlier when
+    // render() flushes the layers
+    connect(layer.get(), &Layer::regionDamaged, this, [this, global](const QRect& rect) {
+        markDirty(global ? QRect(0, 0, m_width, m_height) : rect);
+    });
+    connect(layer.get(), &Layer::contentChanged, this, [this, global](const QRect& rect) {
+        notifyRegionChanged(global ? QRect(0, 0, m_width, m_height) : rect);
+        updateModifiedDate();
+    });
+    // Layers joining an open transaction batch their damage like the rest
+    if (m_transactionDepth > 0) {
+        layer->beginUpdate();
+    }
+}
+
+void Document::untrackLayer(const LayerPtr& layer)
+{
+    if (m_transactionDepth > 0) {
+        layer->endUpdate();
+    }
+    disconnect(layer.get(), nullptr, this, nullptr);
+}
+
+void Document::beginTransaction()
+{
+    if (m_transactionDepth++ > 0) return;
+    
+    for (const auto& layer : m_layers) {
+        layer->beginUpdate();
+    }
+}
+
+void Document::commitTransaction()
+{
+    if (m_transactionDepth == 0 || m_transactionDepth-- > 1) return;
+    
+    // Each layer sends its damage as one rectangle, merged into ours below
+    m_transactionDepth = 1;
+    for (const auto& layer : m_layers) {
+        layer->endUpdate();
+    }
+    m_transactionDepth = 0;
     
-    QImage rendered = render(viewport);
-    painter->drawImage(viewport.topLeft(), rendered);
+    const QRect damage = m_transactionDamage;
+    m_transactionDamage = QRect();
+    if (!damage.isEmpty()) {
+        emit regionChanged(damage);
+    }
+    if (m_modifiedPending) {
+        m_modifiedPending = false;
+        emit modifiedChanged(true);
+    }
+    if (m_documentChangePending) {
+        m_documentChangePending = false;
+        emit documentChanged();
+    }
+}
+
+void Document::notifyDocumentChanged()
+{
+    if (m_transactionDepth > 0) {
+        m_documentChangePending = true;
+        return;
+    }
+    emit documentChanged();
 }
 
 bool Document::loadFromFile(const QString& filename)
@@ -160,19 +386,65 @@ bool Document::loadFromFile(const QString& filename)
     QFileInfo info(filename);
     if (!info.exists()) return false;
     
-    // TODO: Implement actual file loading
-    // For now, just update metadata
+    DocumentFile::Contents contents;
+    if (DocumentFile::isDocumentFile(filename)) {
+        QString error;
+        if (!DocumentFile::read(filename, contents, &error)) {
+            qWarning() << "Failed to open" << filename << ":" << error;
+            return false;
+        }
+    } else {
+        // Flat images open as a single layer
+        QImage image(filename);
+        if (image.isNull()) return false;
+        contents.size = image.size();
+        contents.colorMode = ColorMode::RGBA8;
+        auto layer = std::make_shared<RasterLayer>(image);
+        layer->setName("Background");
+        contents.layers.push_back(layer);
+    }
+    
+    const bool resized = contents.size != size();
+    {
+        // One repaint for the whole swap, however many layers the file has
+        Transaction transaction(this);
+        for (const auto& layer : m_layers) {
+            untrackLayer(layer);
+        }
+        m_layers.clear();
+        m_activeLayer.reset();
+        
+        m_width = contents.size.width();
+        m_height = contents.size.height();
+        m_colorMode = contents.colorMode;
+        for (const auto& layer : contents.layers) {
+            addLayer(layer);
+        }
+        invalidateCache();
+        // The loaded file is the unmodified state
+        m_modifiedPending = false;
+    }
+    if (resized) {
+        emit sizeChanged(size());
+        emit documentSizeChanged(size());
+    }
+    
     m_filename = filename;
     m_name = info.baseName();
-    updateModifiedDate();
+    m_modified = false;
+    emit modifiedChanged(false);
     
     return true;
 }
 
 bool Document::saveToFile(const QString& filename) const
 {
-    // TODO: Implement actual file saving
-    // For now, just pretend it worked
+    QString error;
+    if (!DocumentFile::write(*this, filename, &error)) {
+        qWarning() << "Failed to save" << filename << ":" << error;
+        return false;
+    }
+    
     const_cast<Document*>(this)->m_filename = filename;
     const_cast<Document*>(this)->m_modified = false;
     
@@ -191,7 +463,7 @@ void Document::undo()
     
     // TODO: Implement undo
     invalidateCache();
-    emit documentChanged();
+    notifyDocumentChanged();
 }
 
 void Document::redo()
@@ -200,7 +472,7 @@ void Document::redo()
     
     // TODO: Implement redo
     invalidateCache();
-    emit documentChanged();
+    notifyDocumentChanged();
 }
 
 void Document::resize(int width, int height)
@@ -222,38 +494,58 @@ void Document::crop(const QRect& rect)
     // TODO: Implement cropping
     invalidateCache();
     updateModifiedDate();
-    emit documentChanged();
+    notifyDocumentChanged();
 }
 
-QPainter::CompositionMode Document::blendModeToQPainter(BlendMode mode) const
-{
-    switch (mode) {
-        case BlendMode::Normal: return QPainter::CompositionMode_SourceOver;
-        case BlendMode::Multiply: return QPainter::CompositionMode_Multiply;
-        case BlendMode::Screen: return QPainter::CompositionMode_Screen;
-        case BlendMode::Overlay: return QPainter::CompositionMode_Overlay;
-        case BlendMode::SoftLight: return QPainter::CompositionMode_SoftLight;
-        case BlendMode::HardLight: return QPainter::CompositionMode_HardLight;
-        case BlendMode::ColorDodge: return QPainter::CompositionMode_ColorDodge;
-        case BlendMode::ColorBurn: return QPainter::CompositionMode_ColorBurn;
-        case BlendMode::Darken: return QPainter::CompositionMode_Darken;
-        case BlendMode::Lighten: return QPainter::CompositionMode_Lighten;
-        case BlendMode::Difference: return QPainter::CompositionMode_Difference;
-        case BlendMode::Exclusion: return QPainter::CompositionMode_Exclusion;
-        default: return QPainter::CompositionMode_SourceOver;
+void Document::invalidateCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_cacheMutex);
+        m_cacheValid = false;
+        m_dirtyRegion = QRegion();
+    }
+    if (m_transactionDepth > 0) {
+        m_transactionDamage = QRect(0, 0, m_width, m_height);
+        return;
     }
+    emit regionChanged(QRect(0, 0, m_width, m_height));
 }
 
-void Document::invalidateCache()
+void Document::invalidateRegion(const QRect& rect)
+{
+    markDirty(rect);
+    notifyRegionChanged(rect);
+}
+
+void Document::markDirty(const QRect& rect)
+{
+    QRect clipped = rect & QRect(0, 0, m_width, m_height);
+    if (clipped.isEmpty()) return;
+    
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    m_dirtyRegion += clipped;
+}
+
+void Document::notifyRegionChanged(const QRect& rect)
 {
-    // Clear any cached render data
-    // This would be called when layers change
+    QRect clipped = rect & QRect(0, 0, m_width, m_height);
+    if (clipped.isEmpty()) return;
+    
+    if (m_transactionDepth > 0) {
+        m_transactionDamage |= clipped;
+        return;
+    }
+    emit regionChanged(clipped);
 }
 
 void Document::updateModifiedDate()
 {
     m_modifiedDate = QDateTime::currentDateTime();
     m_modified = true;
+    if (m_transactionDepth > 0) {
+        m_modifiedPending = true;
+        return;
+    }
     emit modifiedChanged(true);
 }
 
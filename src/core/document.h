@@ -7,8 +7,13 @@
 #include <QImage>
 #include <QDateTime>
 #include <QPainter>
+#include <QRegion>
 #include <memory>
+#include <mutex>
 #include <vector>
+#include "blend_mode.h"
+#include "tile_storage.h"
+#include "render_snapshot.h"
 
 namespace core {
 
@@ -31,9 +36,6 @@ enum class ColorMode {
     Grayscale   // Grayscale
 };
 
-// Blend modes (defined in layer.h)
-enum class BlendMode;
-
 /**
  * @brief Document class represents an image document with layers
  */
@@ -156,6 +158,22 @@ public:
      */
     void render(QPainter* painter, const QRect& viewport = QRect()) const;
     
+    /**
+     * @brief Capture the visible layers for compositing off the GUI thread
+     *
+     * Cheap: raster tiles are shared, not copied, and no pixels are
+     * produced here. At level > 0 raster layers contribute their mip level
+     * (scale 1/2^level), which the first thread to composite the snapshot
+     * brings up to date, as it rasterizes the other layers. Must be called
+     * from the thread that modifies the document.
+     *
+     * With `preview` set, adjustment chains that are costly per pixel are
+     * baked into 3D LUTs (coarser when zoomed out), by the compositing
+     * threads and once per set of parameters and table size. Close to the exact result but
+     * not bit-identical, so exports leave it off.
+     */
+    std::shared_ptr<const RenderSnapshot> snapshot(int level = 0, bool preview = false) const;
+    
     // === File Operations ===
     
     /**
@@ -217,6 +235,44 @@ public:
      */
     QDateTime getModifiedDate() const { return m_modifiedDate; }
     
+    // === Transactions ===
+    
+    /**
+     * @brief Collect change notifications until the matching commit
+     *
+     * Layer damage, modifiedChanged and documentChanged are held back and
+     * sent once at commit, with regionChanged carrying the union of the
+     * damage. Structural signals (layer added/removed/moved, size) are
+     * still sent at once. Transactions nest; only the outermost commits.
+     * The render cache is dirtied once per layer at commit too; render()
+     * inside a transaction collects the damage held back so far first, so
+     * it still shows the edits made.
+     */
+    void beginTransaction();
+    void commitTransaction();
+    bool inTransaction() const { return m_transactionDepth > 0; }
+    
+    /**
+     * @brief Scoped transaction, committed when it goes out of scope
+     */
+    class Transaction {
+    public:
+        explicit Transaction(Document* document) : m_document(document)
+        {
+            if (m_document) m_document->beginTransaction();
+        }
+        ~Transaction()
+        {
+            if (m_document) m_document->commitTransaction();
+        }
+        
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+        
+    private:
+        Document* m_document;
+    };
+    
     // === Document Operations ===
     
     /**
@@ -274,6 +330,11 @@ signals:
      * @brief General document change signal
      */
     void documentChanged();
+    
+    /**
+     * @brief Emitted when the composite changes inside a document-space rectangle
+     */
+    void regionChanged(const QRect& rect);
 
 protected:
     /**
@@ -281,16 +342,63 @@ protected:
      */
     void invalidateCache();
     
+    /**
+     * @brief Mark a document-space rectangle for recompositing
+     *
+     * markDirty() followed by notifyRegionChanged().
+     */
+    void invalidateRegion(const QRect& rect);
+    
+    /**
+     * @brief Add a rectangle to the cache's dirty region, without signals
+     */
+    void markDirty(const QRect& rect);
+    
+    /**
+     * @brief Emit regionChanged, or hold it back for the open transaction
+     */
+    void notifyRegionChanged(const QRect& rect);
+    
     /**
      * @brief Update modification date
      */
     void updateModifiedDate();
 
 private:
+    
     /**
-     * @brief Convert blend mode to QPainter composition mode
+     * @brief Have layers in the open transaction report their damage so far
+     *
+     * Call without m_cacheMutex held.
      */
-    QPainter::CompositionMode blendModeToQPainter(BlendMode mode) const;
+    void flushLayerDamage() const;
+    
+    /**
+     * @brief Bring the cached composite up to date inside an area
+     *
+     * Call with m_cacheMutex held.
+     */
+    void updateCache(const QRect& area) const;
+    
+    /**
+     * @brief Recomposite the damaged part of one cache tile
+     */
+    void compositeTile(const RenderSnapshot& snapshot, int tileX, int tileY, const QRegion& damage) const;
+    
+    /**
+     * @brief Connect a layer's damage notifications to the cache
+     */
+    void trackLayer(const LayerPtr& layer);
+    
+    /**
+     * @brief Disconnect a layer, flushing any damage it still holds back
+     */
+    void untrackLayer(const LayerPtr& layer);
+    
+    /**
+     * @brief Emit documentChanged, or hold it back for the open transaction
+     */
+    void notifyDocumentChanged();
 
 private:
     // Document properties
@@ -309,9 +417,32 @@ private:
     QDateTime m_createdDate;
     QDateTime m_modifiedDate;
     
-    // Cache (for performance)
-    mutable QImage m_cachedRender;
+    // Open transaction: notifications waiting for commitTransaction(). The
+    // damage is already part of the cache's dirty region.
+    int m_transactionDepth = 0;
+    QRect m_transactionDamage;
+    bool m_modifiedPending = false;
+    bool m_documentChangePending = false;
+    
+    // Cache (for performance). The composite is kept in tiles that are
+    // built on first use; afterwards only damaged regions are recomposited.
+    // m_cacheMutex guards every member below, for readers and writers
+    // alike; the tiles of one update are composited in parallel while it is
+    // held, each worker writing only its own tile.
+    mutable std::mutex m_cacheMutex;
+    mutable TileStorage m_cachedRender;
+    mutable std::vector<uint8_t> m_cachedTiles;
+    mutable QRegion m_dirtyRegion;
     mutable bool m_cacheValid = false;
+    
+    // Runs of adjustment layers fused by the last snapshot, by the pipelines
+    // they were made from. Layers rebuild their pipeline when a parameter
+    // changes, which retires the run. GUI thread only.
+    struct FusedAdjustment {
+        std::vector<std::shared_ptr<const AdjustmentPipeline>> parts;
+        std::shared_ptr<const AdjustmentPipeline> pipeline;
+    };
+    mutable std::vector<FusedAdjustment> m_fusedAdjustments;
 };
 
 } // namespace core
\ No newline at end of file
@@ -0,0 +1,593 @@
+#include "document_file.h"
+#include "document.h"
+#include "layer.h"
+#include "mip_pyramid.h"
+#include "thread_pool.h"
+#include <QDataStream>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <mutex>
+
+namespace core {
+
+namespace {
+
+constexpr char Magic[4] = { 'K', 'D', 'O', 'C' };
+constexpr int HeaderSize = 64;
+constexpr int TileBytes = TileStorage::TileSize * TileStorage::TileSize * static_cast<int>(sizeof(QRgb));
+
+// Header field offsets
+constexpr int VersionOffset = 4;
+constexpr int WidthOffset = 8;
+constexpr int HeightOffset = 12;
+constexpr int ColorModeOffset = 16;
+constexpr int LayerCountOffset = 20;
+constexpr int TileSizeOffset = 24;
+constexpr int TableOffsetOffset = 32;
+constexpr int TableSizeOffset = 40;
+constexpr int TableCrcOffset = 48;
+constexpr int OverviewLevelOffset = 52;
+
+enum TileKind : quint8 {
+    UniformTile = 0,
+    ChunkTile = 1
+};
+
+// Tiles per compression batch per thread; bounds the encoded data held
+// in memory before it is written out
+constexpr int BatchTilesPerThread = 8;
+
+std::array<quint32, 256> makeCrcTable()
+{
+    std::array<quint32, 256> table{};
+    for (quint32 i = 0; i < 256; ++i) {
+        quint32 crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+// CRC-32 (IEEE), as used by zlib and PNG
+quint32 crc32(const uchar* data, qint64 size)
+{
+    static const std::array<quint32, 256> table = makeCrcTable();
+    quint32 crc = 0xFFFFFFFFu;
+    for (qint64 i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+quint32 crc32(const QByteArray& data)
+{
+    return crc32(reinterpret_cast<const uchar*>(data.constData()), data.size());
+}
+
+class MappedTile;
+
+/**
+ * @brief Read-only mapping of a document file, shared by its lazy tiles
+ *
+ * Every open mapping is listed (mappings()) so that a save can release the
+ * one it is about to replace; see DocumentFile::write().
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const QString& filename) : m_file(filename) {}
+
+    ~MappedFile()
+    {
+        if (m_data) {
+            m_file.unmap(m_data);
+        }
+    }
+
+    bool open()
+    {
+        if (!m_file.open(QIODevice::ReadOnly)) return false;
+        m_size = m_file.size();
+        m_data = m_size > 0 ? m_file.map(0, m_size) : nullptr;
+        m_path = QFileInfo(m_file).canonicalFilePath();
+        return m_data != nullptr;
+    }
+
+    const uchar* data() const { return m_data; }
+    qint64 size() const { return m_size; }
+    QString fileName() const { return m_file.fileName(); }
+    QString canonicalPath() const { return m_path; }
+
+    /**
+     * @brief Note a tile reading from this file, for release()
+     */
+    void track(const std::shared_ptr<const MappedTile>& tile)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tiles.push_back(tile);
+    }
+
+    /**
+     * @brief Give every tile its own copy of its chunk, then unmap and close
+     */
+    void release();
+
+private:
+    QFile m_file;
+    uchar* m_data = nullptr;
+    qint64 m_size = 0;
+    QString m_path;
+    std::mutex m_mutex;
+    std::vector<std::weak_ptr<const MappedTile>> m_tiles;
+};
+
+std::mutex& mappingsMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+// Open mappings; guarded by mappingsMutex()
+std::vector<std::weak_ptr<MappedFile>>& mappings()
+{
+    static std::vector<std::weak_ptr<MappedFile>> list;
+    return list;
+}
+
+std::shared_ptr<MappedFile> openMapping(const QString& filename)
+{
+    auto mapped = std::make_shared<MappedFile>(filename);
+    if (!mapped->open()) return nullptr;
+
+    std::lock_guard<std::mutex> lock(mappingsMutex());
+    auto& list = mappings();
+    list.erase(std::remove_if(list.begin(), list.end(),
+        [](const std::weak_ptr<MappedFile>& entry) { return entry.expired(); }), list.end());
+    list.push_back(mapped);
+    return mapped;
+}
+
+/**
+ * @brief Tile chunk inside a mapped document file
+ *
+ * Moves between files when a save replaces the file it was read from:
+ * first to a private copy of its chunk (detach()), then to the same chunk
+ * in the file just written (relocate()).
+ */
+class MappedTile : public LazyTile, public std::enable_shared_from_this<MappedTile> {
+public:
+    MappedTile(std::shared_ptr<const MappedFile> file, qint64 offset, quint32 size, quint32 crc)
+        : LazyTile(true), m_file(std::move(file)), m_offset(offset), m_size(size), m_crc(crc) {}
+
+    /**
+     * @brief The compressed chunk; refers into the mapping while there is one
+     */
+    QByteArray chunk() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return chunkLocked();
+    }
+
+    quint32 size() const { return m_size; }
+    quint32 crc() const { return m_crc; }
+
+    void detach(const MappedFile* from) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_file.get() != from) return;
+        m_detached = QByteArray(reinterpret_cast<const char*>(m_file->data() + m_offset),
+                                static_cast<int>(m_size));
+        m_file.reset();
+    }
+
+    void relocate(std::shared_ptr<const MappedFile> file, qint64 offset) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_file = std::move(file);
+        m_offset = offset;
+        m_detached = QByteArray();
+    }
+
+protected:
+    QImage decode() const override
+    {
+        QImage image(TileStorage::TileSize, TileStorage::TileSize, QImage::Format_ARGB32_Premultiplied);
+
+        // Held while the chunk is read, so the mapping cannot go away
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const QByteArray chunk = chunkLocked();
+        QByteArray pixels;
+        if (crc32(chunk) == m_crc) {
+            pixels = qUncompress(chunk);
+        }
+        if (pixels.size() != TileBytes) {
+            qWarning() << "DocumentFile: Damaged tile at offset" << m_offset
+                       << "in" << (m_file ? m_file->fileName() : QString("a replaced file"));
+            image.fill(Qt::transparent);
+            return image;
+        }
+
+        std::memcpy(image.bits(), pixels.constData(), TileBytes);
+        return image;
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    mutable std::shared_ptr<const MappedFile> m_file;   // Null once detached
+    mutable qint64 m_offset;
+    mutable QByteArray m_detached;
+    quint32 m_size;
+    quint32 m_crc;
+
+    QByteArray chunkLocked() const
+    {
+        if (!m_file) return m_detached;
+        return QByteArray::fromRawData(reinterpret_cast<const char*>(m_file->data() + m_offset),
+                                       static_cast<int>(m_size));
+    }
+};
+
+void MappedFile::release()
+{
+    std::vector<std::weak_ptr<const MappedTile>> tiles;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        tiles.swap(m_tiles);
+    }
+    for (const auto& entry : tiles) {
+        if (auto tile = entry.lock()) {
+            tile->detach(this);
+        }
+    }
+
+    // No tile reads the mapping any more
+    if (m_data) {
+        m_file.unmap(m_data);
+        m_data = nullptr;
+    }
+    m_file.close();
+}
+
+/**
+ * @brief Release every mapping of a file about to be replaced
+ */
+void releaseMappings(const QString& filename)
+{
+    const QString path = QFileInfo(filename).canonicalFilePath();
+    if (path.isEmpty()) return;
+
+    std::vector<std::shared_ptr<MappedFile>> matching;
+    {
+        std::lock_guard<std::mutex> lock(mappingsMutex());
+        for (const auto& entry : mappings()) {
+            auto mapped = entry.lock();
+            if (mapped && mapped->canonicalPath() == path) {
+                matching.push_back(std::move(mapped));
+            }
+        }
+    }
+    for (const auto& mapped : matching) {
+        mapped->release();
+    }
+}
+
+struct EncodedTile {
+    QByteArray data;
+    quint32 crc = 0;
+};
+
+EncodedTile encodeTile(const TileStorage::Tile& tile)
+{
+    EncodedTile encoded;
+    if (auto mapped = dynamic_cast<const MappedTile*>(tile.lazy())) {
+        // Unmodified since it was loaded: reuse the chunk as it is
+        encoded.data = mapped->chunk();
+        encoded.crc = mapped->crc();
+        return encoded;
+    }
+
+    const QImage image = tile.image();
+    encoded.data = qCompress(image.constBits(), TileBytes, 1);
+    encoded.crc = crc32(encoded.data);
+    return encoded;
+}
+
+bool fail(QString* error, const QString& message)
+{
+    if (error) {
+        *error = message;
+    }
+    return false;
+}
+
+} // namespace
+
+bool DocumentFile::isDocumentFile(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    return file.read(sizeof(Magic)) == QByteArray(Magic, sizeof(Magic));
+}
+
+bool DocumentFile::write(const Document& document, const QString& filename, QString* error)
+{
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return fail(error, file.errorString());
+    }
+
+    // Placeholder, filled in once the table position is known
+    QByteArray header(HeaderSize, '\0');
+    if (file.write(header) != HeaderSize) {
+        return fail(error, file.errorString());
+    }
+    qint64 position = HeaderSize;
+
+    QByteArray table;
+    QDataStream stream(&table, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    const int batchSize = ThreadPool::global().concurrency() * BatchTilesPerThread;
+    const auto& layers = document.getLayers();
+    const int overviewLevel = MipPyramid::overviewLevel(document.size());
+
+    // Chunks copied from mapped files, and where they went in this one
+    std::vector<std::pair<const MappedTile*, qint64>> copied;
+
+    // Chunks are written as they are compressed, uniform tiles and chunk
+    // references go to the table
+    auto writeTiles = [&](const TileStorage& tiles) {
+        const int tileCount = tiles.tilesX() * tiles.tilesY();
+        std::vector<EncodedTile> batch;
+        for (int first = 0; first < tileCount; first += batchSize) {
+            const int count = std::min(batchSize, tileCount - first);
+            batch.assign(count, EncodedTile());
+
+            ThreadPool::global().parallelFor(0, count, [&](int i) {
+                const int index = first + i;
+                const auto& tile = tiles.tileAt(index % tiles.tilesX(), index / tiles.tilesX());
+                if (!tile.isUniform()) {
+                    batch[i] = encodeTile(tile);
+                }
+            });
+
+            for (int i = 0; i < count; ++i) {
+                const int index = first + i;
+                const auto& tile = tiles.tileAt(index % tiles.tilesX(), index / tiles.tilesX());
+                if (tile.isUniform()) {
+                    stream << static_cast<quint8>(UniformTile) << static_cast<quint32>(tile.uniformColor());
+                    continue;
+                }
+
+                const EncodedTile& encoded = batch[i];
+                if (file.write(encoded.data) != encoded.data.size()) {
+                    return false;
+                }
+                if (auto mapped = dynamic_cast<const MappedTile*>(tile.lazy())) {
+                    copied.emplace_back(mapped, position);
+                }
+                stream << static_cast<quint8>(ChunkTile)
+                       << static_cast<quint64>(position)
+                       << static_cast<quint32>(encoded.data.size())
+                       << encoded.crc;
+                position += encoded.data.size();
+            }
+        }
+        return true;
+    };
+
+    for (const auto& layer : layers) {
+        // Only raster pixels are stored; other layer types are flattened
+        TileStorage flattened;
+        auto rasterLayer = std::dynamic_pointer_cast<RasterLayer>(layer);
+        if (!rasterLayer) {
+            flattened = TileStorage(layer->render(layer->getSize()));
+        }
+        const TileStorage& tiles = rasterLayer ? rasterLayer->tiles() : flattened;
+
+        stream << layer->getName()
+               << layer->isVisible()
+               << layer->isLocked()
+               << layer->getOpacity()
+               << static_cast<quint32>(layer->getBlendMode())
+               << static_cast<quint32>(layer->getFlags())
+               << layer->getPosition()
+               << static_cast<qint32>(tiles.width())
+               << static_cast<qint32>(tiles.height());
+
+        if (!writeTiles(tiles)) {
+            return fail(error, file.errorString());
+        }
+
+        // A reduced copy for the overview, so opening the file can show the
+        // whole document without decoding every tile
+        if (overviewLevel > 0) {
+            const TileStorage overview = rasterLayer ? rasterLayer->mipLevel(overviewLevel)
+                                                     : MipPyramid().level(flattened, overviewLevel);
+            stream << static_cast<qint32>(overview.width()) << static_cast<qint32>(overview.height());
+            if (!writeTiles(overview)) {
+                return fail(error, file.errorString());
+            }
+        }
+    }
+
+    if (file.write(table) != table.size()) {
+        return fail(error, file.errorString());
+    }
+
+    std::memcpy(header.data(), Magic, sizeof(Magic));
+    uchar* fields = reinterpret_cast<uchar*>(header.data());
+    qToLittleEndian<quint32>(Version, fields + VersionOffset);
+    qToLittleEndian<quint32>(static_cast<quint32>(document.width()), fields + WidthOffset);
+    qToLittleEndian<quint32>(static_cast<quint32>(document.height()), fields + HeightOffset);
+    qToLittleEndian<quint32>(static_cast<quint32>(document.getColorMode()), fields + ColorModeOffset);
+    qToLittleEndian<quint32>(static_cast<quint32>(layers.size()), fields + LayerCountOffset);
+    qToLittleEndian<quint32>(TileStorage::TileSize, fields + TileSizeOffset);
+    qToLittleEndian<quint64>(static_cast<quint64>(position), fields + TableOffsetOffset);
+    qToLittleEndian<quint64>(static_cast<quint64>(table.size()), fields + TableSizeOffset);
+    qToLittleEndian<quint32>(crc32(table), fields + TableCrcOffset);
+    qToLittleEndian<quint32>(static_cast<quint32>(overviewLevel), fields + OverviewLevelOffset);
+
+    if (!file.seek(0) || file.write(header) != HeaderSize) {
+        return fail(error, file.errorString());
+    }
+
+    // Saving over the file the tiles were read from. Windows refuses to
+    // replace a file that is open or mapped, so the commit would fail;
+    // POSIX renames over it, but the old inode stays mapped, holding its
+    // disk space, until every tile is gone. Either way, tiles first take a
+    // copy of their compressed chunk and the mapping is closed.
+    releaseMappings(filename);
+    if (!file.commit()) {
+        return fail(error, file.errorString());
+    }
+
+    // Copied tiles read from the new file again, dropping their copies
+    if (!copied.empty()) {
+        if (auto mapped = openMapping(filename)) {
+            for (const auto& [tile, offset] : copied) {
+                tile->relocate(mapped, offset);
+                mapped->track(tile->shared_from_this());
+            }
+        }
+    }
+    return true;
+}
+
+bool DocumentFile::read(const QString& filename, Contents& contents, QString* error)
+{
+    auto mapped = openMapping(filename);
+    if (!mapped) {
+        return fail(error, QString("Cannot map %1").arg(filename));
+    }
+    if (mapped->size() < HeaderSize || std::memcmp(mapped->data(), Magic, sizeof(Magic)) != 0) {
+        return fail(error, "Not a document file");
+    }
+
+    const uchar* fields = mapped->data();
+    const quint32 version = qFromLittleEndian<quint32>(fields + VersionOffset);
+    if (version < 1 || version > Version) {
+        return fail(error, QString("Unsupported document version %1").arg(version));
+    }
+    if (qFromLittleEndian<quint32>(fields + TileSizeOffset) != static_cast<quint32>(TileStorage::TileSize)) {
+        return fail(error, "Unsupported tile size");
+    }
+
+    const quint64 tableOffset = qFromLittleEndian<quint64>(fields + TableOffsetOffset);
+    const quint64 tableSize = qFromLittleEndian<quint64>(fields + TableSizeOffset);
+    if (tableOffset < static_cast<quint64>(HeaderSize)
+        || tableOffset + tableSize > static_cast<quint64>(mapped->size())) {
+        return fail(error, "Truncated document file");
+    }
+    const uchar* tableData = mapped->data() + tableOffset;
+    if (crc32(tableData, static_cast<qint64>(tableSize)) != qFromLittleEndian<quint32>(fields + TableCrcOffset)) {
+        return fail(error, "Damaged layer table");
+    }
+
+    Contents result;
+    result.size = QSize(static_cast<int>(qFromLittleEndian<quint32>(fields + WidthOffset)),
+                        static_cast<int>(qFromLittleEndian<quint32>(fields + HeightOffset)));
+    result.colorMode = static_cast<ColorMode>(qFromLittleEndian<quint32>(fields + ColorModeOffset));
+    const quint32 layerCount = qFromLittleEndian<quint32>(fields + LayerCountOffset);
+    // Version 1 files have no overview
+    const int overviewLevel = version >= 2
+        ? static_cast<int>(qFromLittleEndian<quint32>(fields + OverviewLevelOffset)) : 0;
+
+    // The table is parsed straight out of the mapping
+    const QByteArray table = QByteArray::fromRawData(reinterpret_cast<const char*>(tableData),
+                                                     static_cast<int>(tableSize));
+    QDataStream stream(table);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    // Chunk tiles stay encoded in the mapping
+    auto readTiles = [&](TileStorage& tiles) {
+        for (int ty = 0; ty < tiles.tilesY(); ++ty) {
+            for (int tx = 0; tx < tiles.tilesX(); ++tx) {
+                quint8 kind = UniformTile;
+                stream >> kind;
+                if (kind == UniformTile) {
+                    quint32 color = 0;
+                    stream >> color;
+                    tiles.setUniformTile(tx, ty, color);
+                    continue;
+                }
+
+                quint64 offset = 0;
+                quint32 size = 0;
+                quint32 crc = 0;
+                stream >> offset >> size >> crc;
+                if (kind != ChunkTile || offset < static_cast<quint64>(HeaderSize)
+                    || offset + size > tableOffset) {
+                    return false;
+                }
+                auto tile = std::make_shared<MappedTile>(mapped, static_cast<qint64>(offset), size, crc);
+                mapped->track(tile);
+                tiles.setLazyTile(tx, ty, std::move(tile));
+            }
+        }
+        return stream.status() == QDataStream::Ok;
+    };
+
+    for (quint32 l = 0; l < layerCount; ++l) {
+        QString name;
+        bool visible = true;
+        bool locked = false;
+        float opacity = 1.0f;
+        quint32 blendMode = 0;
+        quint32 flags = 0;
+        QPointF position;
+        qint32 width = 0;
+        qint32 height = 0;
+        stream >> name >> visible >> locked >> opacity >> blendMode >> flags >> position >> width >> height;
+        if (stream.status() != QDataStream::Ok || width < 0 || height < 0
+            || blendMode >= static_cast<quint32>(BlendModeCount)) {
+            return fail(error, "Damaged layer table");
+        }
+
+        TileStorage tiles(width, height);
+        if (!readTiles(tiles)) {
+            return fail(error, "Damaged layer table");
+        }
+
+        TileStorage overview;
+        if (overviewLevel > 0) {
+            qint32 overviewWidth = 0;
+            qint32 overviewHeight = 0;
+            stream >> overviewWidth >> overviewHeight;
+            if (stream.status() != QDataStream::Ok || overviewWidth < 0 || overviewHeight < 0) {
+                return fail(error, "Damaged layer table");
+            }
+            overview = TileStorage(overviewWidth, overviewHeight);
+            if (!readTiles(overview)) {
+                return fail(error, "Damaged layer table");
+            }
+        }
+
+        auto layer = std::make_shared<RasterLayer>(std::move(tiles));
+        layer->setName(name);
+        layer->setVisible(visible);
+        layer->setLocked(locked);
+        layer->setOpacity(opacity);
+        layer->setBlendMode(static_cast<BlendMode>(blendMode));
+        layer->setFlags(static_cast<LayerFlags>(flags));
+        layer->setPosition(position);
+        if (overviewLevel > 0) {
+            layer->setMipLevel(overviewLevel, overview);
+        }
+        result.layers.push_back(layer);
+    }
+
+    contents = std::move(result);
+    return true;
+}
+
+} // namespace core
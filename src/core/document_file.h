@@ -0,0 +1,76 @@
+#pragma once
+
+#include <QString>
+#include <QSize>
+#include <memory>
+#include <vector>
+
+namespace core {
+
+class Document;
+class Layer;
+enum class ColorMode;
+
+/**
+ * @brief Native layered document format (.kdoc)
+ *
+ * Layout, all integers little-endian:
+ *
+ *   header       64 bytes: "KDOC", version, width, height, colour mode,
+ *                layer count, tile size, then the offset, size and CRC-32
+ *                of the layer table and the overview level
+ *   tile chunks  one per painted tile, each compressed on its own
+ *   layer table  per layer its properties and, for every tile, either a
+ *                uniform colour or the offset, size and CRC-32 of its chunk;
+ *                then, with an overview level above 0, the size and tiles of
+ *                the layer's mip level at that level, stored the same way
+ *
+ * The table is written last so chunks can be streamed out as they are
+ * compressed. Reading maps the file and only parses the table; tile chunks
+ * are checked and decompressed when something first reads the tile, so
+ * opening costs the same whatever the document size. The overview level
+ * (MipPyramid::overviewLevel()) is stored precomputed, so showing the whole
+ * document after opening does not decode every tile either. Decoded tiles
+ * may be dropped again under memory pressure (LazyTile::cacheLimit()).
+ * Saving copies chunks that were never modified straight from the source
+ * file.
+ *
+ * Version 1 files, without the overview, are still read.
+ */
+class DocumentFile {
+public:
+    static constexpr quint32 Version = 2;
+
+    /**
+     * @brief Document contents read from a file
+     */
+    struct Contents {
+        QSize size;
+        ColorMode colorMode;
+        std::vector<std::shared_ptr<Layer>> layers;
+    };
+
+    /**
+     * @brief Check whether a file starts with the native header
+     */
+    static bool isDocumentFile(const QString& filename);
+
+    /**
+     * @brief Write a document; the target is replaced only on success
+     *
+     * The target may be the file the document was read from. Its mapping
+     * is closed before the target is replaced (Windows cannot replace a
+     * mapped file), with tiles still referring to it first taking a copy of
+     * their compressed chunk; afterwards, tiles saved unmodified map the
+     * new file. If the save fails after that point, the copies remain in
+     * use and the document stays intact.
+     */
+    static bool write(const Document& document, const QString& filename, QString* error = nullptr);
+
+    /**
+     * @brief Open a document; tiles stay encoded in the mapped file until used
+     */
+    static bool read(const QString& filename, Contents& contents, QString* error = nullptr);
+};
+
+} // namespace core
@@ -0,0 +1,713 @@
+#include "effects_renderer.h"
+#include "layer.h"
+#include "morphology.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+namespace core {
+
+namespace {
+
+constexpr float kPi = 3.14159265f;
+constexpr int kTile = TileStorage::TileSize;
+
+// Mask tiles varying less than this are stored as a single value
+constexpr float kFlatTolerance = 1.0f / 1024.0f;
+
+using Mask = EffectsRenderer::Mask;
+
+// Pixels a mask grown by `distance` can change beyond it
+int growReach(float distance)
+{
+    return distance > 0.0f ? static_cast<int>(std::ceil(distance)) + 1 : 0;
+}
+
+// Sigma of the blur behind a shadow or glow of `size` pixels
+float blurSigma(float size, float amount)
+{
+    return std::max(0.0f, size * (1.0f - amount)) * 0.5f;
+}
+
+float clampAmount(float amount)
+{
+    return std::clamp(amount, 0.0f, 1.0f);
+}
+
+QPoint shadowOffset(float angle, float distance, float scale)
+{
+    const float radians = angle * kPi / 180.0f;
+    return QPoint(static_cast<int>(std::lround(-std::cos(radians) * distance * scale)),
+                  static_cast<int>(std::lround(std::sin(radians) * distance * scale)));
+}
+
+// Reach of a blurred mask, including what spread or choke grows first
+int blurReach(float size, float amount, float scale)
+{
+    amount = clampAmount(amount);
+    return blur::reach(blurSigma(size * scale, amount)) + growReach(size * scale * amount);
+}
+
+float strokeRadius(const LayerEffects::Stroke& stroke, float scale)
+{
+    const float size = std::max(0.0f, stroke.size) * scale;
+    return stroke.position == LayerEffects::Stroke::Center ? size * 0.5f : size;
+}
+
+// Colour with its alpha folded into `opacity`, premultiplied
+struct Paint {
+    float r = 0.0f, g = 0.0f, b = 0.0f, a = 0.0f;
+
+    Paint() = default;
+    Paint(const QColor& color, float opacity)
+    {
+        a = std::clamp(static_cast<float>(color.alphaF()) * opacity, 0.0f, 1.0f);
+        r = static_cast<float>(color.redF());
+        g = static_cast<float>(color.greenF());
+        b = static_cast<float>(color.blueF());
+    }
+};
+
+// Everything the composite depends on, to tell when it must be redone
+std::vector<float> signature(const LayerEffects& effects)
+{
+    std::vector<float> values;
+    auto color = [&values](const QColor& c) {
+        values.insert(values.end(), {static_cast<float>(c.redF()), static_cast<float>(c.greenF()),
+                                     static_cast<float>(c.blueF()), static_cast<float>(c.alphaF())});
+    };
+
+    const auto& drop = effects.dropShadow;
+    values.push_back(drop.enabled);
+    if (drop.enabled) {
+        color(drop.color);
+        values.insert(values.end(), {drop.opacity, drop.angle, drop.distance, drop.spread, drop.size});
+    }
+    const auto& inner = effects.innerShadow;
+    values.push_back(inner.enabled);
+    if (inner.enabled) {
+        color(inner.color);
+        values.insert(values.end(), {inner.opacity, inner.angle, inner.distance, inner.choke, inner.size});
+    }
+    const auto& outerGlow = effects.outerGlow;
+    values.push_back(outerGlow.enabled);
+    if (outerGlow.enabled) {
+        color(outerGlow.color);
+        values.insert(values.end(), {outerGlow.opacity, outerGlow.spread, outerGlow.size});
+    }
+    const auto& innerGlow = effects.innerGlow;
+    values.push_back(innerGlow.enabled);
+    if (innerGlow.enabled) {
+        color(innerGlow.color);
+        values.insert(values.end(), {innerGlow.opacity, innerGlow.choke, innerGlow.size});
+    }
+    const auto& stroke = effects.stroke;
+    values.push_back(stroke.enabled);
+    if (stroke.enabled) {
+        color(stroke.color);
+        values.insert(values.end(), {stroke.size, static_cast<float>(stroke.position)});
+    }
+    return values;
+}
+
+QRect maskTileRect(const Mask& mask, int tx, int ty)
+{
+    return QRect(mask.rect.left() + tx * kTile, mask.rect.top() + ty * kTile, kTile, kTile) & mask.rect;
+}
+
+// Mask tiles overlapping `area`, as a tile range
+QRect maskTileRange(const Mask& mask, const QRect& area)
+{
+    const QRect inside = area & mask.rect;
+    if (inside.isEmpty()) return QRect();
+    return QRect(QPoint((inside.left() - mask.rect.left()) / kTile, (inside.top() - mask.rect.top()) / kTile),
+                 QPoint((inside.right() - mask.rect.left()) / kTile, (inside.bottom() - mask.rect.top()) / kTile));
+}
+
+// Values along a row, `outside` beyond the mask
+void sampleRow(const Mask& mask, int x, int y, int count, float outside, float* out)
+{
+    const QRect& rect = mask.rect;
+    if (y < rect.top() || y > rect.bottom()) {
+        std::fill(out, out + count, outside);
+        return;
+    }
+
+    const int ty = (y - rect.top()) / kTile;
+    int i = 0;
+    while (i < count) {
+        const int px = x + i;
+        if (px < rect.left() || px > rect.right()) {
+            const int end = px < rect.left() ? std::min(count, rect.left() - x) : count;
+            std::fill(out + i, out + end, outside);
+            i = end;
+            continue;
+        }
+
+        const int tx = (px - rect.left()) / kTile;
+        const int tileRight = std::min(rect.left() + (tx + 1) * kTile - 1, rect.right());
+        const int end = std::min(count, tileRight - x + 1);
+        const size_t index = static_cast<size_t>(ty) * mask.columns + tx;
+        if (const QImage& plane = mask.planes[index]; !plane.isNull()) {
+            const int tileLeft = rect.left() + tx * kTile;
+            const uint8_t* row = plane.constScanLine(y - rect.top() - ty * kTile) + (x - tileLeft);
+            for (int j = i; j < end; ++j) {
+                out[j] = row[j] * (1.0f / 255.0f);
+            }
+        } else {
+            std::fill(out + i, out + end, mask.values[index]);
+        }
+        i = end;
+    }
+}
+
+// Whether the mask holds a single value over `area`, and which
+bool flatOver(const Mask& mask, const QRect& area, float outside, float& value)
+{
+    bool first = true;
+    auto agree = [&](float v) {
+        if (first) {
+            value = v;
+            first = false;
+        }
+        return v == value;
+    };
+
+    if (!mask.rect.contains(area) && !agree(outside)) return false;
+    const QRect range = maskTileRange(mask, area);
+    if (range.isNull()) return true;
+
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            const size_t index = static_cast<size_t>(ty) * mask.columns + tx;
+            if (!mask.planes[index].isNull() || !agree(mask.values[index])) return false;
+        }
+    }
+    return true;
+}
+
+// One effect's mask and how it is laid on the layer
+struct EffectPass {
+    std::shared_ptr<const EffectsRenderer::Mask> mask;
+    Paint paint;
+    QPoint offset;
+    float outside = 0.0f;   // Inner masks are 1 beyond the layer
+
+    bool active() const { return mask && paint.a > 0.0f; }
+
+    const float* sample(int x, int y, int count, float* row) const
+    {
+        if (!active()) return nullptr;
+        sampleRow(*mask, x - offset.x(), y - offset.y(), count, outside, row);
+        return row;
+    }
+
+    bool flat(const QRect& area, float& value) const
+    {
+        return flatOver(*mask, area.translated(-offset.x(), -offset.y()), outside, value);
+    }
+};
+
+// Everything needed to composite the result, shared by the lazy tiles of
+// one render so changing the effects later does not affect them
+struct Style {
+    TileStorage content;
+    EffectPass innerGlow;
+    EffectPass innerShadow;
+    EffectPass dropShadow;
+    EffectPass outerGlow;
+    EffectPass strokeGrow;      // Both carry the stroke colour
+    EffectPass strokeShrink;
+    LayerEffects::Stroke::Position strokePosition = LayerEffects::Stroke::Outside;
+
+    // Composite `count` pixels starting at (x, y) in layer coordinates
+    void composeRow(int x, int y, int count, const QRgb* src, QRgb* dst) const;
+};
+
+void Style::composeRow(int x, int y, int count, const QRgb* src, QRgb* dst) const
+{
+    float innerGlowRow[kTile], innerShadowRow[kTile], dropRow[kTile], outerGlowRow[kTile];
+    float growRow[kTile], shrinkRow[kTile];
+    const float* innerGlowMask = innerGlow.sample(x, y, count, innerGlowRow);
+    const float* innerShadowMask = innerShadow.sample(x, y, count, innerShadowRow);
+    const float* dropMask = dropShadow.sample(x, y, count, dropRow);
+    const float* outerGlowMask = outerGlow.sample(x, y, count, outerGlowRow);
+    const float* growMask = strokeGrow.sample(x, y, count, growRow);
+    const float* shrinkMask = strokeShrink.sample(x, y, count, shrinkRow);
+    const bool stroke = growMask || shrinkMask;
+    const Paint& strokePaint = growMask ? strokeGrow.paint : strokeShrink.paint;
+
+    for (int i = 0; i < count; ++i) {
+        const QRgb p = src[i];
+        const float coverage = qAlpha(p) * (1.0f / 255.0f);
+        float a = coverage;
+        float r = qRed(p) * (1.0f / 255.0f);
+        float g = qGreen(p) * (1.0f / 255.0f);
+        float b = qBlue(p) * (1.0f / 255.0f);
+
+        // Inner effects recolour the layer without changing its coverage
+        auto atop = [&](const Paint& paint, float mask) {
+            const float m = mask * paint.a;
+            r += (paint.r * a - r) * m;
+            g += (paint.g * a - g) * m;
+            b += (paint.b * a - b) * m;
+        };
+        if (a > 0.0f) {
+            if (innerGlowMask) atop(innerGlow.paint, innerGlowMask[i]);
+            if (innerShadowMask) atop(innerShadow.paint, innerShadowMask[i]);
+        }
+
+        // Shadow and glow go under the layer, glow over the shadow
+        auto over = [](float& cr, float& cg, float& cb, float& ca, const Paint& paint, float mask) {
+            const float m = mask * paint.a;
+            cr = paint.r * m + cr * (1.0f - m);
+            cg = paint.g * m + cg * (1.0f - m);
+            cb = paint.b * m + cb * (1.0f - m);
+            ca = m + ca * (1.0f - m);
+        };
+        if (a < 1.0f && (dropMask || outerGlowMask)) {
+            float ur = 0.0f, ug = 0.0f, ub = 0.0f, ua = 0.0f;
+            if (dropMask) over(ur, ug, ub, ua, dropShadow.paint, dropMask[i]);
+            if (outerGlowMask) over(ur, ug, ub, ua, outerGlow.paint, outerGlowMask[i]);
+            r += ur * (1.0f - a);
+            g += ug * (1.0f - a);
+            b += ub * (1.0f - a);
+            a += ua * (1.0f - a);
+        }
+
+        // The stroke sits on top, over the band between the masks
+        if (stroke) {
+            const float outside = growMask ? growMask[i] : coverage;
+            const float inside = shrinkMask ? shrinkMask[i] : coverage;
+            const float band = strokePosition == LayerEffects::Stroke::Outside ? outside * (1.0f - coverage)
+                             : strokePosition == LayerEffects::Stroke::Inside ? coverage * (1.0f - inside)
+                             : outside * (1.0f - inside);
+            over(r, g, b, a, strokePaint, band);
+        }
+
+        const float alpha = std::clamp(a, 0.0f, 1.0f);
+        auto channel = [alpha](float value) {
+            return static_cast<int>(std::clamp(value, 0.0f, alpha) * 255.0f + 0.5f);
+        };
+        dst[i] = qRgba(channel(r), channel(g), channel(b), static_cast<int>(alpha * 255.0f + 0.5f));
+    }
+}
+
+// A result tile composited when first read
+class EffectsTile : public LazyTile {
+public:
+    EffectsTile(std::shared_ptr<const Style> style, const QRect& area)
+        : m_style(std::move(style))
+        , m_area(area)
+    {
+    }
+
+protected:
+    QImage decode() const override
+    {
+        QImage image(kTile, kTile, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        const QImage source = m_style->content.copy(m_area);
+        for (int y = 0; y < m_area.height(); ++y) {
+            m_style->composeRow(m_area.left(), m_area.top() + y, m_area.width(),
+                                reinterpret_cast<const QRgb*>(source.constScanLine(y)),
+                                reinterpret_cast<QRgb*>(image.scanLine(y)));
+        }
+        // The style holds the masks of the whole layer; let them go
+        m_style.reset();
+        return image;
+    }
+
+private:
+    mutable std::shared_ptr<const Style> m_style;
+    QRect m_area;
+};
+
+} // namespace
+
+bool EffectsRenderer::isActive(const LayerEffects& effects)
+{
+    return (effects.dropShadow.enabled && effects.dropShadow.opacity > 0.0f)
+        || (effects.innerShadow.enabled && effects.innerShadow.opacity > 0.0f)
+        || (effects.outerGlow.enabled && effects.outerGlow.opacity > 0.0f)
+        || (effects.innerGlow.enabled && effects.innerGlow.opacity > 0.0f)
+        || (effects.stroke.enabled && effects.stroke.size > 0.0f);
+}
+
+int EffectsRenderer::reach(const LayerEffects& effects, int level)
+{
+    if (!isActive(effects)) return 0;
+
+    // Inner effects stay inside the layer, but their masks still need the
+    // halo so the blur sees the transparent surroundings
+    const float scale = 1.0f / (1 << std::max(0, level));
+    int margin = 0;
+    if (effects.dropShadow.enabled) {
+        const auto& drop = effects.dropShadow;
+        const QPoint offset = shadowOffset(drop.angle, drop.distance, scale);
+        margin = std::max(margin, blurReach(drop.size, drop.spread, scale)
+                                      + std::max(std::abs(offset.x()), std::abs(offset.y())));
+    }
+    if (effects.innerShadow.enabled) {
+        const auto& inner = effects.innerShadow;
+        const QPoint offset = shadowOffset(inner.angle, inner.distance, scale);
+        margin = std::max(margin, blurReach(inner.size, inner.choke, scale)
+                                      + std::max(std::abs(offset.x()), std::abs(offset.y())));
+    }
+    if (effects.outerGlow.enabled) {
+        margin = std::max(margin, blurReach(effects.outerGlow.size, effects.outerGlow.spread, scale));
+    }
+    if (effects.innerGlow.enabled) {
+        margin = std::max(margin, blurReach(effects.innerGlow.size, effects.innerGlow.choke, scale));
+    }
+    if (effects.stroke.enabled) {
+        margin = std::max(margin, growReach(strokeRadius(effects.stroke, scale)));
+    }
+    return margin + 1;
+}
+
+int EffectsRenderer::maskReach(const MaskKey& key)
+{
+    const float size = std::get<1>(key);
+    const float amount = std::get<2>(key);
+    switch (std::get<0>(key)) {
+        case MaskKind::Outer:
+        case MaskKind::Inner:
+            return blur::reach(blurSigma(size, amount)) + growReach(size * amount);
+        case MaskKind::Grow:
+        case MaskKind::Shrink:
+            break;
+    }
+    return growReach(size);
+}
+
+void EffectsRenderer::buildMask(const TileStorage& content, const MaskKey& key, Mask& mask, const QRect& region)
+{
+    const QRect range = maskTileRange(mask, region);
+    if (range.isNull()) return;
+
+    // A band of tile rows at a time, cut with a halo so each comes out as if
+    // the whole layer was done. Bands at least twice the halo tall keep the
+    // overlap below the work done.
+    const int halo = maskReach(key);
+    const int bandRows = std::max(1, (2 * halo + kTile - 1) / kTile);
+    const float size = std::get<1>(key);
+    const float amount = std::get<2>(key);
+
+    for (int top = range.top(); top <= range.bottom(); top += bandRows) {
+        const int bottom = std::min(range.bottom(), top + bandRows - 1);
+        const QRect band = maskTileRect(mask, range.left(), top) | maskTileRect(mask, range.right(), bottom);
+        AlphaPlane plane = AlphaPlane::fromTiles(content, band.adjusted(-halo, -halo, halo, halo));
+
+        switch (std::get<0>(key)) {
+            case MaskKind::Outer:
+            case MaskKind::Inner:
+                // Spread or choke is the hard-edged part of the size, the rest blurs
+                if (std::get<0>(key) == MaskKind::Inner) plane.invert();
+                morphology::grow(plane, size * amount);
+                blur::gaussian(plane, blurSigma(size, amount));
+                break;
+            case MaskKind::Grow:
+                morphology::grow(plane, size);
+                break;
+            case MaskKind::Shrink:
+                morphology::shrink(plane, size);
+                break;
+        }
+
+        const int columns = range.width();
+        ThreadPool::global().parallelFor(0, columns * (bottom - top + 1), [&](int index) {
+            const int tx = range.left() + index % columns;
+            const int ty = top + index / columns;
+            const QRect rect = maskTileRect(mask, tx, ty);
+
+            float low = 1.0f, high = 0.0f;
+            for (int y = rect.top(); y <= rect.bottom(); ++y) {
+                const float* row = plane.row(y);
+                for (int x = rect.left(); x <= rect.right(); ++x) {
+                    low = std::min(low, row[x]);
+                    high = std::max(high, row[x]);
+                }
+            }
+
+            const size_t tile = static_cast<size_t>(ty) * mask.columns + tx;
+            if (high - low < kFlatTolerance) {
+                // Snap so fully covered or empty tiles compare exactly
+                const float value = (low + high) * 0.5f;
+                mask.values[tile] = value < kFlatTolerance ? 0.0f : value > 1.0f - kFlatTolerance ? 1.0f : value;
+                mask.planes[tile] = QImage();
+                return;
+            }
+
+            QImage image(rect.size(), QImage::Format_Alpha8);
+            for (int y = rect.top(); y <= rect.bottom(); ++y) {
+                const float* row = plane.row(y) + rect.left();
+                uint8_t* out = image.scanLine(y - rect.top());
+                for (int x = 0; x < rect.width(); ++x) {
+                    out[x] = static_cast<uint8_t>(std::clamp(row[x], 0.0f, 1.0f) * 255.0f + 0.5f);
+                }
+            }
+            mask.planes[tile] = std::move(image);
+        });
+    }
+}
+
+void EffectsRenderer::reset(Level& cache, const TileStorage& content, int margin)
+{
+    cache = Level();
+    cache.contentSize = content.size();
+    cache.margin = margin;
+
+    cache.extent = content.rect().adjusted(-margin, -margin, margin, margin);
+    cache.result = TileStorage(cache.extent.width(), cache.extent.height());
+    cache.stale.assign(static_cast<size_t>(cache.result.tilesX()) * cache.result.tilesY(), 1);
+}
+
+void EffectsRenderer::update(Level& cache, const TileStorage& content)
+{
+    const QRect dirty = cache.dirty & content.rect();
+    cache.dirty = QRect();
+    if (dirty.isEmpty()) return;
+
+    // Each mask changes within its own reach of the edit; the new mask
+    // shares every other tile with the old one
+    for (auto& entry : cache.masks) {
+        const Mask& old = *entry.second;
+        const int halo = maskReach(entry.first);
+        const QRect range = maskTileRange(old, dirty.adjusted(-halo, -halo, halo, halo));
+        if (range.isNull()) continue;
+
+        auto updated = std::make_shared<Mask>(old);
+        buildMask(content, entry.first, *updated,
+                  maskTileRect(old, range.left(), range.top()) | maskTileRect(old, range.right(), range.bottom()));
+        entry.second = std::move(updated);
+    }
+
+    // The margin covers every mask's reach plus the shadow offsets
+    const int margin = cache.margin;
+    const QRect range = cache.result.tileRange(
+        dirty.adjusted(-margin, -margin, margin, margin).translated(margin, margin));
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            cache.stale[static_cast<size_t>(ty) * cache.result.tilesX() + tx] = 1;
+        }
+    }
+}
+
+std::shared_ptr<const EffectsRenderer::Mask> EffectsRenderer::mask(Level& cache, const TileStorage& content,
+                                                                   MaskKind kind, float size, float amount)
+{
+    const MaskKey key(kind, size, amount);
+    auto it = cache.masks.find(key);
+    if (it != cache.masks.end()) return it->second;
+
+    auto built = std::make_shared<Mask>();
+    built->rect = cache.extent;
+    built->columns = cache.result.tilesX();
+    const size_t count = static_cast<size_t>(built->columns) * cache.result.tilesY();
+    built->planes.resize(count);
+    built->values.resize(count);
+    buildMask(content, key, *built, built->rect);
+
+    cache.masks.emplace(key, built);
+    return built;
+}
+
+TileStorage EffectsRenderer::render(const TileStorage& content, const LayerEffects& effects, int level,
+                                    QPoint* offset)
+{
+    level = std::max(0, level);
+    const int needed = reach(effects, level);
+    if (needed == 0 || content.isNull()) {
+        m_levels.erase(level);
+        if (offset) *offset = QPoint();
+        return content;
+    }
+
+    // Whole tiles of margin, so result tiles line up with the layer's
+    const int margin = (needed + kTile - 1) / kTile * kTile;
+    if (offset) *offset = QPoint(margin, margin);
+
+    Level& cache = m_levels[level];
+    if (cache.contentSize != content.size() || cache.margin != margin) {
+        reset(cache, content, margin);
+    }
+
+    // Mask keys the effects need at this level's resolution
+    const float scale = 1.0f / (1 << level);
+    const auto& drop = effects.dropShadow;
+    const auto& innerShadow = effects.innerShadow;
+    const auto& outerGlow = effects.outerGlow;
+    const auto& innerGlow = effects.innerGlow;
+    const auto& stroke = effects.stroke;
+    const bool hasDrop = drop.enabled && drop.opacity > 0.0f;
+    const bool hasInnerShadow = innerShadow.enabled && innerShadow.opacity > 0.0f;
+    const bool hasOuterGlow = outerGlow.enabled && outerGlow.opacity > 0.0f;
+    const bool hasInnerGlow = innerGlow.enabled && innerGlow.opacity > 0.0f;
+    const bool hasStroke = stroke.enabled && stroke.size > 0.0f;
+    const float strokeSize = strokeRadius(stroke, scale);
+
+    std::set<MaskKey> used;
+    if (hasDrop) used.emplace(MaskKind::Outer, drop.size * scale, clampAmount(drop.spread));
+    if (hasInnerShadow) used.emplace(MaskKind::Inner, innerShadow.size * scale, clampAmount(innerShadow.choke));
+    if (hasOuterGlow) used.emplace(MaskKind::Outer, outerGlow.size * scale, clampAmount(outerGlow.spread));
+    if (hasInnerGlow) used.emplace(MaskKind::Inner, innerGlow.size * scale, clampAmount(innerGlow.choke));
+    if (hasStroke && stroke.position != LayerEffects::Stroke::Inside) used.emplace(MaskKind::Grow, strokeSize, 0.0f);
+    if (hasStroke && stroke.position != LayerEffects::Stroke::Outside) used.emplace(MaskKind::Shrink, strokeSize, 0.0f);
+
+    // Forget masks of changed geometry before bringing the rest up to date
+    for (auto it = cache.masks.begin(); it != cache.masks.end();) {
+        it = used.count(it->first) ? std::next(it) : cache.masks.erase(it);
+    }
+    update(cache, content);
+
+    std::vector<float> key = signature(effects);
+    if (key != cache.signature) {
+        std::fill(cache.stale.begin(), cache.stale.end(), 1);
+        cache.signature = std::move(key);
+    }
+    if (std::find(cache.stale.begin(), cache.stale.end(), 1) == cache.stale.end()) {
+        return cache.result;
+    }
+
+    auto style = std::make_shared<Style>();
+    style->content = content;
+    if (hasDrop) {
+        style->dropShadow.mask = mask(cache, content, MaskKind::Outer, drop.size * scale,
+                                      clampAmount(drop.spread));
+        style->dropShadow.paint = Paint(drop.color, drop.opacity);
+        style->dropShadow.offset = shadowOffset(drop.angle, drop.distance, scale);
+    }
+    if (hasInnerShadow) {
+        style->innerShadow.mask = mask(cache, content, MaskKind::Inner, innerShadow.size * scale,
+                                       clampAmount(innerShadow.choke));
+        style->innerShadow.paint = Paint(innerShadow.color, innerShadow.opacity);
+        style->innerShadow.offset = shadowOffset(innerShadow.angle, innerShadow.distance, scale);
+        style->innerShadow.outside = 1.0f;
+    }
+    if (hasOuterGlow) {
+        style->outerGlow.mask = mask(cache, content, MaskKind::Outer, outerGlow.size * scale,
+                                     clampAmount(outerGlow.spread));
+        style->outerGlow.paint = Paint(outerGlow.color, outerGlow.opacity);
+    }
+    if (hasInnerGlow) {
+        style->innerGlow.mask = mask(cache, content, MaskKind::Inner, innerGlow.size * scale,
+                                     clampAmount(innerGlow.choke));
+        style->innerGlow.paint = Paint(innerGlow.color, innerGlow.opacity);
+        style->innerGlow.outside = 1.0f;
+    }
+    if (hasStroke) {
+        style->strokePosition = stroke.position;
+        if (stroke.position != LayerEffects::Stroke::Inside) {
+            style->strokeGrow.mask = mask(cache, content, MaskKind::Grow, strokeSize, 0.0f);
+            style->strokeGrow.paint = Paint(stroke.color, 1.0f);
+        }
+        if (stroke.position != LayerEffects::Stroke::Outside) {
+            style->strokeShrink.mask = mask(cache, content, MaskKind::Shrink, strokeSize, 0.0f);
+            style->strokeShrink.paint = Paint(stroke.color, 1.0f);
+            style->strokeShrink.outside = 1.0f;
+        }
+    }
+
+    // Rebuild stale tiles. Only tiles whose pixels really mix the layer
+    // with an effect are composited, and only once something reads them.
+    const int shift = margin / kTile;
+    for (int ty = 0; ty < cache.result.tilesY(); ++ty) {
+        for (int tx = 0; tx < cache.result.tilesX(); ++tx) {
+            uint8_t& stale = cache.stale[static_cast<size_t>(ty) * cache.result.tilesX() + tx];
+            if (!stale) continue;
+            stale = 0;
+
+            const QRect area = cache.result.tileRect(tx, ty).translated(-margin, -margin);
+            const int cx = tx - shift;
+            const int cy = ty - shift;
+            const TileStorage::Tile* source = cx >= 0 && cy >= 0 && cx < content.tilesX() && cy < content.tilesY()
+                ? &content.tileAt(cx, cy) : nullptr;
+            const bool fullTile = source && content.tileRect(cx, cy).size() == area.size();
+
+            // Content flat over the whole result tile, including any part
+            // beyond the layer's edge
+            bool flatContent = !source;
+            QRgb flatColor = 0;
+            if (source && source->isUniform() && (fullTile || source->uniformColor() == 0)) {
+                flatContent = true;
+                flatColor = source->uniformColor();
+            }
+            const bool opaque = flatContent && qAlpha(flatColor) == 255;
+            const bool clear = flatContent && flatColor == 0;
+
+            // Whether every input is flat, and whether no effect shows
+            bool allFlat = flatContent;
+            bool inert = true;
+            auto check = [&](const EffectPass& pass, float inertValue, bool hidden) {
+                if (!pass.active()) return;
+                float value = 0.0f;
+                const bool flat = pass.flat(area, value);
+                allFlat = allFlat && flat;
+                inert = inert && (hidden || (flat && value == inertValue));
+            };
+            check(style->innerGlow, 0.0f, clear);
+            check(style->innerShadow, 0.0f, clear);
+            check(style->dropShadow, 0.0f, opaque);
+            check(style->outerGlow, 0.0f, opaque);
+            if (style->strokePosition == LayerEffects::Stroke::Center && style->strokeGrow.active()) {
+                float grown = 0.0f, shrunk = 0.0f;
+                const bool flatGrow = style->strokeGrow.flat(area, grown);
+                const bool flatShrink = style->strokeShrink.flat(area, shrunk);
+                allFlat = allFlat && flatGrow && flatShrink;
+                inert = inert && ((flatGrow && grown == 0.0f) || (flatShrink && shrunk == 1.0f));
+            } else {
+                check(style->strokeGrow, 0.0f, opaque);
+                check(style->strokeShrink, 1.0f, clear);
+            }
+
+            if (allFlat) {
+                QRgb color;
+                style->composeRow(area.left(), area.top(), 1, &flatColor, &color);
+                cache.result.setUniformTile(tx, ty, color);
+            } else if (inert && flatContent) {
+                cache.result.setUniformTile(tx, ty, flatColor);
+            } else if (inert && fullTile) {
+                cache.result.setTile(tx, ty, *source);
+            } else {
+                cache.result.setLazyTile(tx, ty, std::make_shared<EffectsTile>(style, area));
+            }
+        }
+    }
+
+    return cache.result;
+}
+
+void EffectsRenderer::invalidate(const QRect& rect)
+{
+    if (rect.isEmpty()) return;
+    for (auto& entry : m_levels) {
+        const int level = entry.first;
+        // A level pixel covers 2^level base pixels on each axis
+        entry.second.dirty |= QRect(QPoint(rect.left() >> level, rect.top() >> level),
+                                    QPoint(rect.right() >> level, rect.bottom() >> level));
+    }
+}
+
+void EffectsRenderer::clear()
+{
+    m_levels.clear();
+}
+
+size_t EffectsRenderer::memoryUsage() const
+{
+    size_t total = 0;
+    for (const auto& entry : m_levels) {
+        const Level& cache = entry.second;
+        total += cache.result.memoryUsage();
+        for (const auto& mask : cache.masks) {
+            for (const QImage& plane : mask.second->planes) {
+                total += static_cast<size_t>(plane.sizeInBytes());
+            }
+        }
+    }
+    return total;
+}
+
+} // namespace core
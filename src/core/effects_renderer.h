@@ -0,0 +1,125 @@
+#pragma once
+
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+#include <QSize>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+#include "blur.h"
+#include "tile_storage.h"
+
+namespace core {
+
+struct LayerEffects;
+
+/**
+ * @brief Renders a layer's effects around its pixels, caching the masks
+ *
+ * Every effect is a colour laid through a coverage mask derived from the
+ * layer's alpha: shadows and glows blur it with blur::gaussian, spread,
+ * choke and strokes grow or shrink it by exact distances with morphology.
+ *
+ * The work is split in two cached stages, each invalidated only by what it
+ * depends on:
+ * - Masks depend on the alpha and the effect's geometry (size, spread,
+ *   choke, stroke width and position) and are cached under exactly those
+ *   values, cut into the result's tiles as 8-bit coverage. Flat tiles keep
+ *   a single value. They are built a band of tile rows at a time, from a
+ *   float plane of the layer's alpha covering just the band and the
+ *   effect's reach, so no float copy of the whole layer is kept. Content
+ *   edits recompute only the mask tiles within reach of the edit.
+ * - The result is rebuilt tile by tile from the masks, the colours,
+ *   opacities and shadow offsets. Flat tiles become uniform, tiles no
+ *   effect touches share the layer's own tile and the rest are LazyTiles
+ *   that composite on first read, so a colour or opacity change costs a
+ *   pass over the tile grid and the pixels are produced by whoever reads
+ *   them.
+ *
+ * The margin around the layer is rounded up to whole tiles so result and
+ * layer tiles line up, and so small changes to an effect's size do not move
+ * the grid and drop the other masks. Everything is kept per mip level.
+ *
+ * Not thread-safe, like MipPyramid: calls must be serialised, as the raster
+ * layer's render cache does by keeping both under one mutex and rendering
+ * on the compositing threads. Results, including their lazy tiles, may be
+ * read anywhere.
+ */
+class EffectsRenderer {
+public:
+    /**
+     * @brief Whether any effect is enabled and can leave a mark
+     */
+    static bool isActive(const LayerEffects& effects);
+
+    /**
+     * @brief How far the effects reach outside the layer, in pixels at
+     * 1/2^level scale; 0 when none is active
+     */
+    static int reach(const LayerEffects& effects, int level = 0);
+
+    /**
+     * @brief The layer composited with its effects
+     *
+     * `content` is the layer at 1/2^level scale. The result is at least
+     * reach(effects, level) larger on every side; its top-left pixel sits at
+     * `-offset` relative to the content, and `offset` receives that margin.
+     */
+    TileStorage render(const TileStorage& content, const LayerEffects& effects, int level, QPoint* offset);
+
+    /**
+     * @brief Mark an area of the layer (level 0 coordinates) as changed
+     */
+    void invalidate(const QRect& rect);
+
+    /**
+     * @brief Drop every level
+     */
+    void clear();
+
+    size_t memoryUsage() const;
+
+    /**
+     * @brief Coverage cut into the result's tiles
+     *
+     * Tiles with a null plane hold a single value; the others are Alpha8
+     * images the size of the tile. Masks are never modified once built;
+     * updates make a new one sharing the unchanged tiles.
+     */
+    struct Mask {
+        QRect rect;     // Layer coordinates covered, the result's extent
+        int columns = 0;
+        std::vector<QImage> planes;
+        std::vector<float> values;
+    };
+
+private:
+    enum class MaskKind { Outer, Inner, Grow, Shrink };
+    // kind, size, amount, at the level's scale
+    using MaskKey = std::tuple<MaskKind, float, float>;
+
+    struct Level {
+        QSize contentSize;
+        int margin = 0;
+        QRect extent;       // Layer coordinates the result covers
+        std::map<MaskKey, std::shared_ptr<const Mask>> masks;
+        QRect dirty;        // Content changed since the last render
+        TileStorage result;
+        std::vector<float> signature;
+        std::vector<uint8_t> stale;
+    };
+
+    static int maskReach(const MaskKey& key);
+    static void buildMask(const TileStorage& content, const MaskKey& key, Mask& mask, const QRect& region);
+
+    void reset(Level& cache, const TileStorage& content, int margin);
+    void update(Level& cache, const TileStorage& content);
+    std::shared_ptr<const Mask> mask(Level& cache, const TileStorage& content, MaskKind kind, float size,
+                                     float amount);
+
+    std::map<int, Level> m_levels;
+};
+
+} // namespace core
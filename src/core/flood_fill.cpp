@@ -0,0 +1,297 @@
+#include "flood_fill.h"
+#include "selection_kernels.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace core {
+
+namespace {
+
+constexpr int TileSize = TileStorage::TileSize;
+
+// Progress of a contiguous fill in one tile
+struct FillTile {
+    QImage coverage;            // Alpha8, null until the fill reaches the tile
+    bool whole = false;         // Filled entirely with `value`
+    uint8_t value = 0;
+    bool queued = false;
+    std::vector<QPoint> seeds;  // Tile coordinates
+
+    uint8_t at(int x, int y) const
+    {
+        if (whole) return value;
+        return coverage.isNull() ? 0 : coverage.constScanLine(y)[x];
+    }
+};
+
+// The four edges of a tile, top, bottom, left and right, as they stood
+// before a round
+using Edges = std::array<std::array<uint8_t, TileSize>, 4>;
+
+void readEdges(const FillTile& tile, const QRect& valid, Edges& edges)
+{
+    for (int x = 0; x < valid.width(); ++x) {
+        edges[0][x] = tile.at(x, 0);
+        edges[1][x] = tile.at(x, valid.height() - 1);
+    }
+    for (int y = 0; y < valid.height(); ++y) {
+        edges[2][y] = tile.at(0, y);
+        edges[3][y] = tile.at(valid.width() - 1, y);
+    }
+}
+
+} // namespace
+
+FloodFill::FloodFill(const TileStorage& pixels, const QPoint& seed)
+    : m_pixels(pixels)
+    , m_seed(seed)
+    , m_distances(static_cast<size_t>(pixels.tilesX()) * pixels.tilesY())
+{
+    if (m_pixels.rect().contains(seed)) {
+        m_reference = m_pixels.pixel(seed.x(), seed.y());
+    }
+}
+
+Selection FloodFill::select(const Options& options)
+{
+    Selection result(m_pixels.size());
+    if (!m_pixels.rect().contains(m_seed)) return result;
+
+    const CoverageTable coverage = coverageTable(options);
+    if (options.contiguous) {
+        fillContiguous(coverage, result);
+    } else {
+        fillGlobal(coverage, result);
+    }
+    return result;
+}
+
+size_t FloodFill::memoryUsage() const
+{
+    size_t bytes = 0;
+    for (const Distances& tile : m_distances) {
+        bytes += tile.values.size();
+    }
+    return bytes;
+}
+
+FloodFill::CoverageTable FloodFill::coverageTable(const Options& options)
+{
+    const int tolerance = std::clamp(options.tolerance, 0, 255);
+    CoverageTable table;
+    for (int d = 0; d < 256; ++d) {
+        if (d <= tolerance) {
+            table[d] = 255;
+        } else if (options.antiAlias && tolerance > 0) {
+            // Full at the tolerance, none at 1.5 times it
+            const float ramp = 3.0f - 2.0f * d / tolerance;
+            table[d] = static_cast<uint8_t>(std::clamp(ramp, 0.0f, 1.0f) * 255.0f + 0.5f);
+        } else {
+            table[d] = 0;
+        }
+    }
+    return table;
+}
+
+const FloodFill::Distances& FloodFill::distances(int tx, int ty)
+{
+    Distances& tile = m_distances[ty * m_pixels.tilesX() + tx];
+    if (tile.ready) return tile;
+
+    const TileStorage::Tile& source = m_pixels.tileAt(tx, ty);
+    if (source.isUniform()) {
+        tile.low = tile.high = blend::colorDistance(source.uniformColor(), m_reference);
+    } else {
+        const blend::ColorDistanceFunc kernel = blend::colorDistanceFunction();
+        const QRect rect = m_pixels.tileRect(tx, ty);
+        const QImage& image = source.image();
+        tile.values.resize(static_cast<size_t>(TileSize) * TileSize);
+        uint8_t low = 255;
+        uint8_t high = 0;
+        for (int y = 0; y < rect.height(); ++y) {
+            uint8_t* row = tile.values.data() + static_cast<size_t>(y) * TileSize;
+            kernel(reinterpret_cast<const uint32_t*>(image.constScanLine(y)), rect.width(), m_reference, row);
+            for (int x = 0; x < rect.width(); ++x) {
+                low = std::min(low, row[x]);
+                high = std::max(high, row[x]);
+            }
+        }
+        tile.low = low;
+        tile.high = high;
+    }
+    tile.ready = true;
+    return tile;
+}
+
+QImage FloodFill::coverageImage(const Distances& distance, const CoverageTable& coverage, int tx, int ty) const
+{
+    const QRect rect = m_pixels.tileRect(tx, ty);
+    QImage image(TileSize, TileSize, QImage::Format_Alpha8);
+    for (int y = 0; y < rect.height(); ++y) {
+        const uint8_t* in = distance.values.data() + static_cast<size_t>(y) * TileSize;
+        uint8_t* out = image.scanLine(y);
+        for (int x = 0; x < rect.width(); ++x) {
+            out[x] = coverage[in[x]];
+        }
+    }
+    return image;
+}
+
+void FloodFill::fillContiguous(const CoverageTable& coverage, Selection& result)
+{
+    // Pixels join the region while their coverage is nonzero, which the
+    // table keeps true for every distance up to `limit`
+    int limit = -1;
+    while (limit < 255 && coverage[limit + 1] > 0) ++limit;
+    if (limit < 0) return;
+
+    const int tilesX = m_pixels.tilesX();
+    const int tilesY = m_pixels.tilesY();
+    std::vector<FillTile> tiles(static_cast<size_t>(tilesX) * tilesY);
+    auto validRect = [&](int index) {
+        const int tx = index % tilesX;
+        const int ty = index / tilesX;
+        return m_pixels.tileRect(tx, ty).translated(-tx * TileSize, -ty * TileSize);
+    };
+
+    // Span fill from the seeds of one tile, in tile coordinates
+    auto fillTile = [&](int index) {
+        FillTile& tile = tiles[index];
+        const int tx = index % tilesX;
+        const int ty = index / tilesX;
+        const Distances& distance = distances(tx, ty);
+        std::vector<QPoint> stack;
+        stack.swap(tile.seeds);
+        if (tile.whole || distance.low > limit) return;
+
+        if (distance.high <= limit) {
+            // Every pixel matches, so any seed reaches them all. Coverage
+            // only falls with distance, so a full one at `high` is full
+            // everywhere.
+            if (distance.values.empty() || coverage[distance.high] == 255) {
+                tile.whole = true;
+                tile.value = coverage[distance.high];
+            } else if (tile.coverage.isNull()) {
+                tile.coverage = coverageImage(distance, coverage, tx, ty);
+            }
+            return;
+        }
+
+        const QRect valid = validRect(index);
+        if (tile.coverage.isNull()) {
+            tile.coverage = QImage(TileSize, TileSize, QImage::Format_Alpha8);
+            std::memset(tile.coverage.bits(), 0, static_cast<size_t>(tile.coverage.sizeInBytes()));
+        }
+        uint8_t* filled = tile.coverage.bits();
+        const int stride = tile.coverage.bytesPerLine();
+        const uint8_t* values = distance.values.data();
+        auto matches = [&](int x, int y) {
+            return filled[y * stride + x] == 0 && values[y * TileSize + x] <= limit;
+        };
+
+        while (!stack.empty()) {
+            const QPoint point = stack.back();
+            stack.pop_back();
+            const int y = point.y();
+            if (!matches(point.x(), y)) continue;
+
+            int left = point.x();
+            int right = point.x();
+            while (left > 0 && matches(left - 1, y)) --left;
+            while (right < valid.width() - 1 && matches(right + 1, y)) ++right;
+            for (int x = left; x <= right; ++x) {
+                filled[y * stride + x] = coverage[values[y * TileSize + x]];
+            }
+
+            // One seed per run of matching pixels above and below the span
+            for (int ny = y - 1; ny <= y + 1; ny += 2) {
+                if (ny < 0 || ny >= valid.height()) continue;
+                bool inRun = false;
+                for (int x = left; x <= right; ++x) {
+                    const bool match = matches(x, ny);
+                    if (match && !inRun) stack.emplace_back(x, ny);
+                    inRun = match;
+                }
+            }
+        }
+    };
+
+    const int seedIndex = (m_seed.y() / TileSize) * tilesX + m_seed.x() / TileSize;
+    tiles[seedIndex].seeds.emplace_back(m_seed.x() % TileSize, m_seed.y() % TileSize);
+    std::vector<int> pending{seedIndex};
+    std::vector<Edges> edges;
+
+    while (!pending.empty()) {
+        edges.resize(pending.size());
+        ThreadPool::global().parallelFor(0, static_cast<int>(pending.size()), [&](int i) {
+            const int index = pending[i];
+            readEdges(tiles[index], validRect(index), edges[i]);
+            fillTile(index);
+        });
+
+        // Pixels newly filled along an edge seed the pixel across it
+        std::vector<int> next;
+        auto seed = [&](int tx, int ty, int x, int y) {
+            if (tx < 0 || ty < 0 || tx >= tilesX || ty >= tilesY) return;
+            const int index = ty * tilesX + tx;
+            FillTile& neighbour = tiles[index];
+            if (neighbour.at(x, y) != 0) return;
+            neighbour.seeds.emplace_back(x, y);
+            if (!neighbour.queued) {
+                neighbour.queued = true;
+                next.push_back(index);
+            }
+        };
+        for (size_t i = 0; i < pending.size(); ++i) {
+            const int index = pending[i];
+            const int tx = index % tilesX;
+            const int ty = index / tilesX;
+            const QRect valid = validRect(index);
+            Edges now;
+            readEdges(tiles[index], valid, now);
+            const Edges& before = edges[i];
+
+            for (int x = 0; x < valid.width(); ++x) {
+                if (now[0][x] && !before[0][x]) seed(tx, ty - 1, x, TileSize - 1);
+                if (now[1][x] && !before[1][x]) seed(tx, ty + 1, x, 0);
+            }
+            for (int y = 0; y < valid.height(); ++y) {
+                if (now[2][y] && !before[2][y]) seed(tx - 1, ty, TileSize - 1, y);
+                if (now[3][y] && !before[3][y]) seed(tx + 1, ty, 0, y);
+            }
+        }
+        for (int index : next) {
+            tiles[index].queued = false;
+        }
+        pending.swap(next);
+    }
+
+    result.replaceTiles([&](int tx, int ty, Selection::Tile& tile) {
+        const FillTile& fill = tiles[ty * tilesX + tx];
+        if (fill.whole) {
+            tile = Selection::Tile(fill.value);
+        } else if (!fill.coverage.isNull()) {
+            tile = Selection::Tile(fill.coverage);
+        } else {
+            return false;
+        }
+        return true;
+    });
+}
+
+void FloodFill::fillGlobal(const CoverageTable& coverage, Selection& result)
+{
+    result.replaceTiles([&](int tx, int ty, Selection::Tile& tile) {
+        const Distances& distance = distances(tx, ty);
+        if (coverage[distance.low] == coverage[distance.high]) {
+            tile = Selection::Tile(coverage[distance.low]);
+        } else {
+            tile = Selection::Tile(coverageImage(distance, coverage, tx, ty));
+        }
+        return true;
+    });
+}
+
+} // namespace core
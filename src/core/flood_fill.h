@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QImage>
+#include <QPoint>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "selection.h"
+#include "tile_storage.h"
+
+namespace core {
+
+/**
+ * @brief Regions of similar colour, for the magic wand and bucket fill
+ *
+ * Pixels are compared with the one under the seed by their largest
+ * premultiplied channel difference (blend::colorDistance), computed a row at
+ * a time by the SIMD kernels of selection_kernels.h. The distances depend
+ * only on the seed colour, so they are computed once per tile, when a fill
+ * first reaches the tile, and reused: calling select() again with another
+ * tolerance, as a live tolerance slider does, only redoes the fill.
+ *
+ * Contiguous fills run tile by tile in rounds. Every tile with pending
+ * seeds is span filled on the global ThreadPool, then the pixels each round
+ * filled along tile edges seed the neighbouring tiles, until no seeds are
+ * left. Tiles whose every pixel matches are filled whole without the span
+ * fill, and become a single value when their coverage is flat (a tile of
+ * one colour, or one wholly within the tolerance). Non-contiguous fills are
+ * a threshold pass over every tile in parallel, with the same shortcuts.
+ *
+ * With anti-aliasing, pixels up to 1.5 x tolerance away from the seed
+ * colour join the region with coverage falling linearly to 0 (as in GIMP);
+ * otherwise coverage is all or nothing.
+ *
+ * The pixels are a copy-on-write snapshot taken at construction. Not
+ * thread-safe: call select() from one thread at a time.
+ */
+class FloodFill {
+public:
+    struct Options {
+        int tolerance = 32;     // Largest channel difference, 0 to 255
+        bool contiguous = true; // Only pixels connected to the seed
+        bool antiAlias = true;
+    };
+
+    /**
+     * @brief Fill `pixels` starting from `seed`, whose colour is matched
+     */
+    FloodFill(const TileStorage& pixels, const QPoint& seed);
+
+    QPoint seed() const { return m_seed; }
+    QRgb reference() const { return m_reference; }
+
+    /**
+     * @brief The region as coverage over the whole image; empty when the
+     * seed lies outside it
+     */
+    Selection select(const Options& options);
+
+    size_t memoryUsage() const;
+
+private:
+    using CoverageTable = std::array<uint8_t, 256>;
+
+    // Distances of one tile to the reference, with their range; tiles of
+    // one colour keep only the range
+    struct Distances {
+        std::vector<uint8_t> values;    // TileSize rows of TileSize
+        uint8_t low = 0;
+        uint8_t high = 0;
+        bool ready = false;
+    };
+
+    TileStorage m_pixels;
+    QPoint m_seed;
+    QRgb m_reference = 0;
+    std::vector<Distances> m_distances;
+
+    static CoverageTable coverageTable(const Options& options);
+
+    const Distances& distances(int tx, int ty);
+    QImage coverageImage(const Distances& distance, const CoverageTable& coverage, int tx, int ty) const;
+    void fillContiguous(const CoverageTable& coverage, Selection& result);
+    void fillGlobal(const CoverageTable& coverage, Selection& result);
+};
+
+} // namespace core
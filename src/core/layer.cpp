@@ -1,7 +1,13 @@
 #include "layer.h"
+#include "dab_kernels.h"
+#include "thread_pool.h"
 #include <QDebug>
 #include <QPainter>
 #include <QDateTime>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
 
 namespace core {
 
@@ -91,6 +97,8 @@ void Layer::removeChild(std::shared_ptr<Layer> child)
 void Layer::setPosition(const QPointF& pos)
 {
     if (m_position != pos) {
+        // The area the layer is leaving needs recompositing too
+        emitDamage(getVisualBounds());
         m_position = pos;
         emit positionChanged(pos);
         onPropertyChanged();
@@ -100,6 +108,7 @@ void Layer::setPosition(const QPointF& pos)
 void Layer::setSize(const QSize& size)
 {
     if (m_size != size) {
+        emitDamage(getVisualBounds());
         m_size = size;
         emit sizeChanged(size);
         onPropertyChanged();
@@ -138,6 +147,8 @@ void Layer::linkMask(bool link)
 
 void Layer::setEffects(const LayerEffects& effects)
 {
+    // Effects that shrink leave damage outside the new bounds
+    emitDamage(getVisualBounds());
     m_effects = effects;
     emit effectsChanged();
     onPropertyChanged();
@@ -167,6 +178,18 @@ QRectF Layer::getBounds() const
     return QRectF(m_position, m_size);
 }
 
+QRect Layer::getVisualBounds() const
+{
+    const int reach = EffectsRenderer::reach(m_effects);
+    return getBounds().toAlignedRect().adjusted(-reach, -reach, reach, reach);
+}
+
+std::shared_ptr<const RenderSnapshot::Source> Layer::renderSource(int level) const
+{
+    Q_UNUSED(level)
+    return nullptr;
+}
+
 bool Layer::contains(const QPointF& point) const
 {
     return getBounds().contains(point);
@@ -182,12 +205,77 @@ void Layer::updateModifiedDate()
     m_modifiedDate = QDateTime::currentDateTime();
 }
 
+void Layer::beginUpdate()
+{
+    ++m_updateDepth;
+}
+
+void Layer::endUpdate()
+{
+    if (m_updateDepth == 0 || --m_updateDepth > 0) return;
+    flushDamage();
+    if (!m_changePending) return;
+    
+    m_changePending = false;
+    const QRect damage = m_pendingDamage;
+    m_pendingDamage = QRect();
+    sendChanged(damage);
+}
+
+void Layer::flushDamage()
+{
+    if (m_unflushedDamage.isEmpty()) return;
+    const QRect damage = m_unflushedDamage;
+    m_unflushedDamage = QRect();
+    emit regionDamaged(damage);
+}
+
 void Layer::onPropertyChanged()
+{
+    onChanged(getVisualBounds());
+}
+
+void Layer::onContentChanged(const QRect& rect)
+{
+    const int reach = EffectsRenderer::reach(m_effects);
+    onChanged(rect.translated(m_position.toPoint()).adjusted(-reach, -reach, reach, reach));
+}
+
+void Layer::onChanged(const QRect& damage)
+{
+    if (m_updateDepth > 0) {
+        m_pendingDamage |= damage;
+        m_unflushedDamage |= damage;
+        m_changePending = true;
+        return;
+    }
+    if (!damage.isEmpty()) {
+        emit regionDamaged(damage);
+    }
+    sendChanged(damage);
+}
+
+void Layer::sendChanged(const QRect& damage)
 {
     updateModifiedDate();
+    if (!damage.isEmpty()) {
+        emit contentChanged(damage);
+    }
     notifyParentOfChange();
 }
 
+void Layer::emitDamage(const QRect& rect)
+{
+    if (rect.isEmpty()) return;
+    if (m_updateDepth > 0) {
+        m_pendingDamage |= rect;
+        m_unflushedDamage |= rect;
+        return;
+    }
+    emit regionDamaged(rect);
+    emit contentChanged(rect);
+}
+
 void Layer::notifyParentOfChange()
 {
     if (m_parent) {
@@ -195,77 +283,452 @@ void Layer::notifyParentOfChange()
     }
 }
 
+// Mip levels of a raster layer and its effects, shared with the snapshots
+// that read them. Snapshots build their level on compositing threads, so
+// everything is under the mutex. Edits are queued with the content version
+// they lead to and applied only when a snapshot of that version or a later
+// one builds, so an older snapshot never marks tiles clean with pixels the
+// layer no longer has; older ones read what was built last instead.
+class RasterLayer::RenderCache {
+public:
+    void invalidate(uint64_t version, const QRect& rect)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.emplace_back(version, rect);
+        // Nothing may be reading for a while; don't let edits pile up
+        while (m_pending.size() > MaxPending) {
+            apply(m_pending.front().first);
+        }
+    }
+    
+    TileStorage level(const TileStorage& base, uint64_t version, int level)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return levelLocked(base, version, level);
+    }
+    
+    // The level with `effects` composited around it, from `offset` above
+    // and left of the layer
+    TileStorage withEffects(const TileStorage& base, uint64_t version, int level, const LayerEffects& effects,
+                            QPoint* offset)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!EffectsRenderer::isActive(effects)) {
+            m_effects.clear();
+            if (offset) *offset = QPoint();
+            return levelLocked(base, version, level);
+        }
+        if (version < m_applied) {
+            // Rare: a snapshot older than the cache, done without it
+            EffectsRenderer scratch;
+            return scratch.render(levelLocked(base, version, level), effects, level, offset);
+        }
+        return m_effects.render(levelLocked(base, version, level), effects, level, offset);
+    }
+    
+    size_t memoryUsage()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_mips.memoryUsage() + m_effects.memoryUsage();
+    }
+    
+    void preset(const TileStorage& base, int level, const TileStorage& tiles)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_mips.setLevel(base.size(), level, tiles);
+        m_built.clear();
+    }
+    
+private:
+    static constexpr size_t MaxPending = 256;
+    
+    std::mutex m_mutex;
+    MipPyramid m_mips;
+    EffectsRenderer m_effects;
+    uint64_t m_applied = 0;
+    std::deque<std::pair<uint64_t, QRect>> m_pending;
+    std::map<int, TileStorage> m_built;     // Last result per level
+    
+    TileStorage levelLocked(const TileStorage& base, uint64_t version, int level)
+    {
+        if (version < m_applied) {
+            auto it = m_built.find(level);
+            if (it != m_built.end()) return it->second;
+            MipPyramid scratch;
+            return scratch.level(base, level);
+        }
+        apply(version);
+        TileStorage result = m_mips.level(base, level);
+        m_built[level] = result;
+        return result;
+    }
+    
+    void apply(uint64_t version)
+    {
+        while (!m_pending.empty() && m_pending.front().first <= version) {
+            m_mips.invalidate(m_pending.front().second);
+            m_effects.invalidate(m_pending.front().second);
+            m_pending.pop_front();
+        }
+        m_applied = std::max(m_applied, version);
+    }
+};
+
 // RasterLayer implementation
 RasterLayer::RasterLayer(int width, int height, const QColor& fillColor, QObject* parent)
     : Layer("Raster Layer", parent)
+    , m_tiles(width, height, qPremultiply(fillColor.rgba()))
+    , m_renderCache(std::make_shared<RenderCache>())
+    , m_selection(m_tiles.size())
 {
     m_type = LayerType::Raster;
     m_size = QSize(width, height);
-    m_image = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
-    m_image.fill(fillColor);
-    m_originalImage = m_image;
 }
 
 RasterLayer::RasterLayer(const QImage& image, QObject* parent)
     : Layer("Raster Layer", parent)
+    , m_tiles(image)
+    , m_renderCache(std::make_shared<RenderCache>())
+    , m_selection(m_tiles.size())
 {
     m_type = LayerType::Raster;
-    m_image = image;
     m_size = image.size();
-    m_originalImage = image;
 }
 
+RasterLayer::RasterLayer(TileStorage tiles, QObject* parent)
+    : Layer("Raster Layer", parent)
+    , m_tiles(std::move(tiles))
+    , m_renderCache(std::make_shared<RenderCache>())
+    , m_selection(m_tiles.size())
+{
+    m_type = LayerType::Raster;
+    m_size = m_tiles.size();
+}
 
+QImage RasterLayer::getImage() const
+{
+    return m_tiles.toImage();
+}
 
 void RasterLayer::setImage(const QImage& image)
 {
-    m_image = image;
-    m_size = image.size();
+    QRect oldRect = m_tiles.rect();
+    m_tiles = TileStorage(image);
+    if (m_selection.size() != m_tiles.size()) {
+        m_selection = Selection(m_tiles.size());
+        ++m_selectionVersion;
+    }
     updateImageBounds();
-    onPropertyChanged();
+    onContentChanged(oldRect | m_tiles.rect());
+}
+
+void RasterLayer::onContentChanged(const QRect& rect)
+{
+    // The fill holds the old pixels and their distances; keeping it would
+    // also make every later edit copy the tiles it still shares
+    m_similar.fill.reset();
+    ++m_contentVersion;
+    if (isUpdating()) {
+        m_renderDamage |= rect;
+    } else {
+        m_renderCache->invalidate(m_contentVersion, rect);
+    }
+    Layer::onContentChanged(rect);
+}
+
+void RasterLayer::flushDamage()
+{
+    syncRenderCache();
+    Layer::flushDamage();
+}
+
+void RasterLayer::syncRenderCache() const
+{
+    // One entry at the current version covers every edit held back
+    if (m_renderDamage.isEmpty()) return;
+    m_renderCache->invalidate(m_contentVersion, m_renderDamage);
+    m_renderDamage = QRect();
+}
+
+size_t RasterLayer::cacheMemoryUsage() const
+{
+    size_t bytes = m_renderCache->memoryUsage();
+    if (m_similar.fill) {
+        bytes += m_similar.fill->memoryUsage();
+    }
+    return bytes;
+}
+
+TileStorage RasterLayer::mipLevel(int level) const
+{
+    syncRenderCache();
+    return m_renderCache->level(m_tiles, m_contentVersion, level);
+}
+
+void RasterLayer::setMipLevel(int level, const TileStorage& tiles)
+{
+    syncRenderCache();
+    m_renderCache->preset(m_tiles, level, tiles);
+}
+
+TileStorage RasterLayer::effectsLevel(int level, QPoint* offset) const
+{
+    syncRenderCache();
+    return m_renderCache->withEffects(m_tiles, m_contentVersion, level, m_effects, offset);
+}
+
+std::shared_ptr<const RenderSnapshot::Source> RasterLayer::renderSource(int level) const
+{
+    syncRenderCache();
+    return RenderSnapshot::makeSource(
+        [tiles = m_tiles, version = m_contentVersion, level, effects = m_effects,
+         cache = m_renderCache](QPoint* offset) {
+            return cache->withEffects(tiles, version, level, effects, offset);
+        });
+}
+
+void RasterLayer::writeRegion(const QImage& image, const QPoint& position)
+{
+    QRect rect = QRect(position, image.size()) & m_tiles.rect();
+    if (rect.isEmpty()) return;
+    
+    m_tiles.write(image, position);
+    onContentChanged(rect);
+}
+
+namespace {
+
+// dst += (src - dst) * coverage, on premultiplied pixels
+void mixByCoverage(QRgb* dst, const QRgb* src, const uint8_t* coverage, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        const int weight = coverage[i] + (coverage[i] >> 7);   // 0..256
+        const QRgb d = dst[i];
+        const QRgb s = src[i];
+        dst[i] = qRgba(qRed(d) + (((qRed(s) - qRed(d)) * weight) >> 8),
+                       qGreen(d) + (((qGreen(s) - qGreen(d)) * weight) >> 8),
+                       qBlue(d) + (((qBlue(s) - qBlue(d)) * weight) >> 8),
+                       qAlpha(d) + (((qAlpha(s) - qAlpha(d)) * weight) >> 8));
+    }
+}
+
+} // namespace
+
+RasterLayer::WriteAccess RasterLayer::beginWrite(const QRect& area, const Selection* clip)
+{
+    return WriteAccess(*this, area, clip);
+}
+
+RasterLayer::WriteAccess::WriteAccess(RasterLayer& layer, const QRect& area, const Selection* clip)
+    : m_layer(layer)
+    , m_area(area & layer.m_tiles.rect())
+    , m_clip(clip && !clip->isEmpty() && clip->size() == layer.m_tiles.size() ? clip : nullptr)
+{
+    if (m_clip) {
+        m_area &= m_clip->bounds();
+    }
+}
+
+RasterLayer::WriteAccess::~WriteAccess()
+{
+    if (m_damaged.isEmpty()) return;
+    
+    // Edits that leave a tile one colour give its memory back, as write() does
+    m_layer.m_tiles.optimize(m_damaged);
+    m_layer.onContentChanged(m_damaged);
+}
+
+bool RasterLayer::WriteAccess::paint(const std::function<void(QPainter&)>& paint)
+{
+    TileStorage& tiles = m_layer.m_tiles;
+    const QRect range = tiles.tileRange(m_area);
+    if (range.isNull()) return true;
+    
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            const QPoint tileOrigin(tx * TileStorage::TileSize, ty * TileStorage::TileSize);
+            const QRect part = tiles.tileRect(tx, ty) & m_area;
+            
+            QPainter painter(&tiles.detachTile(tx, ty));
+            if (!painter.isActive()) return false;
+            m_damaged |= part;
+            painter.translate(-tileOrigin);
+            painter.setClipRect(part);
+            paint(painter);
+        }
+    }
+    return true;
+}
+
+void RasterLayer::WriteAccess::mapPixels(const std::function<void(QRgb* pixels, int count)>& func)
+{
+    TileStorage& tiles = m_layer.m_tiles;
+    const QRect range = tiles.tileRange(m_area);
+    if (range.isNull()) return;
+    
+    // Tiles are disjoint, so workers detach and write them without locking
+    const int columns = range.width();
+    ThreadPool::global().parallelFor(0, columns * range.height(), [&](int index) {
+        const int tx = range.left() + index % columns;
+        const int ty = range.top() + index / columns;
+        const QRect tileRect = tiles.tileRect(tx, ty);
+        const QRect part = tileRect & m_area;
+        
+        const Selection::Coverage coverage = m_clip ? m_clip->coverage(part) : Selection::Coverage::Full;
+        if (coverage == Selection::Coverage::None) return;
+        
+        const TileStorage::Tile& tile = tiles.tileAt(tx, ty);
+        if (coverage == Selection::Coverage::Full && tile.isUniform() && part == tileRect) {
+            QRgb color = tile.uniformColor();
+            func(&color, 1);
+            tiles.setUniformTile(tx, ty, color);
+            return;
+        }
+        
+        QImage& image = tiles.detachTile(tx, ty);
+        if (coverage == Selection::Coverage::Full) {
+            for (int y = part.top(); y <= part.bottom(); ++y) {
+                QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y - tileRect.top()));
+                func(line + (part.left() - tileRect.left()), part.width());
+            }
+            return;
+        }
+        
+        // Map a copy of each span, then keep as much of it as is selected
+        m_clip->forEachSpan(part, [&](int x, int y, const uint8_t* values, int count) {
+            QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y - tileRect.top())) + (x - tileRect.left());
+            QRgb mapped[TileStorage::TileSize];
+            std::copy(line, line + count, mapped);
+            func(mapped, count);
+            mixByCoverage(line, mapped, values, count);
+        });
+    });
+    m_damaged |= m_area;
+}
+
+void RasterLayer::restoreSnapshot(const TileSnapshot& snapshot)
+{
+    QRect rect = snapshot.bounds() & m_tiles.rect();
+    if (rect.isEmpty()) return;
+    
+    snapshot.restore(m_tiles);
+    onContentChanged(rect);
+}
+
+void RasterLayer::adoptTiles(const TileStorage& source, const QRect& rect)
+{
+    QRect area = rect & m_tiles.rect();
+    if (area.isEmpty()) return;
+    
+    m_tiles.shareTiles(source, area);
+    onContentChanged(area);
 }
 
 QColor RasterLayer::getPixel(int x, int y) const
 {
-    if (m_image.valid(x, y)) {
-        return m_image.pixelColor(x, y);
+    if (m_tiles.rect().contains(x, y)) {
+        return QColor::fromRgba(qUnpremultiply(m_tiles.pixel(x, y)));
     }
     return QColor();
 }
 
 void RasterLayer::setPixel(int x, int y, const QColor& color)
 {
-    if (m_image.valid(x, y)) {
-        m_image.setPixelColor(x, y, color);
-        onPropertyChanged();
+    if (m_tiles.rect().contains(x, y)) {
+        m_tiles.setPixel(x, y, qPremultiply(color.rgba()));
+        onContentChanged(QRect(x, y, 1, 1));
     }
 }
 
 void RasterLayer::fill(const QColor& color)
 {
-    m_image.fill(color);
-    onPropertyChanged();
+    m_tiles.fill(qPremultiply(color.rgba()));
+    onContentChanged(m_tiles.rect());
+}
+
+void RasterLayer::fill(const Selection& coverage, const QColor& color)
+{
+    if (coverage.size() != m_tiles.size() || coverage.isEmpty()) return;
+    
+    blend::DabSource source;
+    source.r = color.redF();
+    source.g = color.greenF();
+    source.b = color.blueF();
+    source.a = color.alphaF();
+    const blend::DabRowFunc8 row = blend::dabKernel(blend::DabMode::Normal).row8;
+    
+    // Selection tiles line up with the layer's, so workers own one each
+    const QRect area = coverage.bounds();
+    const QRect range = m_tiles.tileRange(area);
+    const int columns = range.width();
+    ThreadPool::global().parallelFor(0, columns * range.height(), [&](int index) {
+        const int tx = range.left() + index % columns;
+        const int ty = range.top() + index / columns;
+        const Selection::Tile& mask = coverage.tileAt(tx, ty);
+        const QRect part = mask.bounds();
+        if (part.isEmpty()) return;
+        
+        const TileStorage::Tile& tile = m_tiles.tileAt(tx, ty);
+        if (mask.isUniform() && tile.isUniform()) {
+            QRgb pixel = tile.uniformColor();
+            const uint8_t value = mask.uniformValue();
+            row(&pixel, &value, 1, source);
+            m_tiles.setUniformTile(tx, ty, pixel);
+            return;
+        }
+        
+        uint8_t uniformRow[TileStorage::TileSize];
+        if (mask.isUniform()) {
+            std::fill(uniformRow, uniformRow + part.width(), mask.uniformValue());
+        }
+        QImage& image = m_tiles.detachTile(tx, ty);
+        for (int y = part.top(); y <= part.bottom(); ++y) {
+            const uint8_t* values = mask.isUniform() ? uniformRow : mask.image().constScanLine(y) + part.left();
+            row(reinterpret_cast<uint32_t*>(image.scanLine(y)) + part.left(), values, part.width(), source);
+        }
+    });
+    
+    m_tiles.optimize(area);
+    onContentChanged(area);
+}
+
+void RasterLayer::floodFill(const QPoint& seed, const QColor& color, const FloodFill::Options& options)
+{
+    Selection region = similarRegion(seed, options.contiguous).select(options);
+    if (!m_selection.isEmpty()) {
+        region.combine(m_selection, Selection::Operation::Intersect);
+    }
+    fill(region, color);
 }
 
 void RasterLayer::clear()
 {
-    m_image.fill(Qt::transparent);
-    onPropertyChanged();
+    m_tiles.fill(0);
+    onContentChanged(m_tiles.rect());
 }
 
 QImage RasterLayer::render(const QSize& size)
 {
     Q_UNUSED(size)
-    return m_image;
+    return m_tiles.toImage();
 }
 
 void RasterLayer::render(QPainter* painter, const QRect& bounds)
 {
-    if (painter) {
-        painter->drawImage(bounds, m_image);
+    if (!painter) return;
+    
+    if (bounds.size() == m_tiles.size()) {
+        drawRegion(painter, bounds.topLeft(), m_tiles.rect());
+    } else {
+        painter->drawImage(bounds, m_tiles.toImage());
     }
 }
 
+void RasterLayer::drawRegion(QPainter* painter, const QPoint& target, const QRect& source) const
+{
+    m_tiles.draw(painter, target, source);
+}
+
 void RasterLayer::duplicate()
 {
     // TODO: Implement raster layer duplication
@@ -292,68 +755,134 @@ void RasterLayer::applyFilter(Filter* filter)
     qDebug() << "Filter application not yet implemented";
 }
 
+void RasterLayer::adjust(const PointOperation& operation)
+{
+    if (operation.isIdentity()) return;
+    
+    WriteAccess access = beginWrite(m_tiles.rect(), &m_selection);
+    access.mapPixels([&operation](QRgb* pixels, int count) {
+        operation.applyRow(pixels, count);
+    });
+}
+
 void RasterLayer::adjustBrightnessContrast(float brightness, float contrast)
 {
-    Q_UNUSED(brightness)
-    Q_UNUSED(contrast)
-    // TODO: Implement brightness/contrast adjustment
-    qDebug() << "Brightness/contrast adjustment not yet implemented";
+    adjust(PointOperation::brightnessContrast(brightness, contrast));
 }
 
 void RasterLayer::adjustHueSaturation(float hue, float saturation, float lightness)
 {
-    Q_UNUSED(hue)
-    Q_UNUSED(saturation)
-    Q_UNUSED(lightness)
-    // TODO: Implement hue/saturation adjustment
-    qDebug() << "Hue/saturation adjustment not yet implemented";
+    adjust(PointOperation::hueSaturation(hue, saturation, lightness));
 }
 
 void RasterLayer::adjustLevels(float blackPoint, float whitePoint, float gamma)
 {
-    Q_UNUSED(blackPoint)
-    Q_UNUSED(whitePoint)
-    Q_UNUSED(gamma)
-    // TODO: Implement levels adjustment
-    qDebug() << "Levels adjustment not yet implemented";
+    adjust(PointOperation::levels(blackPoint, whitePoint, gamma));
+}
+
+void RasterLayer::select(const QRect& rect, Selection::Operation op)
+{
+    m_selection.combine(rect, op);
+    onSelectionChanged();
+}
+
+void RasterLayer::select(const Selection& selection, Selection::Operation op)
+{
+    m_selection.combine(selection, op);
+    onSelectionChanged();
+}
+
+void RasterLayer::selectSimilar(const QPoint& seed, const FloodFill::Options& options, Selection::Operation op)
+{
+    m_similar.base = m_selection;
+    m_similar.seed = seed;
+    m_similar.op = op;
+    m_selection.combine(similarRegion(seed, options.contiguous).select(options), op);
+    onSelectionChanged();
+    m_similar.selectionVersion = m_selectionVersion;
+}
+
+bool RasterLayer::reselectSimilar(const FloodFill::Options& options)
+{
+    if (m_similar.selectionVersion == 0 || m_similar.selectionVersion != m_selectionVersion) {
+        return false;
+    }
+    
+    m_selection = m_similar.base;
+    m_selection.combine(similarRegion(m_similar.seed, options.contiguous).select(options), m_similar.op);
+    onSelectionChanged();
+    m_similar.selectionVersion = m_selectionVersion;
+    return true;
 }
 
 void RasterLayer::selectAll()
 {
-    m_selection = m_image.rect();
-    onPropertyChanged();
+    m_selection.selectAll();
+    onSelectionChanged();
 }
 
 void RasterLayer::clearSelection()
 {
-    m_selection = QRect();
-    onPropertyChanged();
+    m_selection.clear();
+    onSelectionChanged();
 }
 
 void RasterLayer::invertSelection()
 {
-    // TODO: Implement selection inversion
-    qDebug() << "Selection inversion not yet implemented";
+    m_selection.invert();
+    onSelectionChanged();
 }
 
 void RasterLayer::expandSelection(int pixels)
 {
-    Q_UNUSED(pixels)
-    // TODO: Implement selection expansion
-    qDebug() << "Selection expansion not yet implemented";
+    if (m_selection.isEmpty() || pixels <= 0) return;
+    
+    m_selection.grow(static_cast<float>(pixels));
+    onSelectionChanged();
 }
 
 void RasterLayer::contractSelection(int pixels)
 {
-    Q_UNUSED(pixels)
-    // TODO: Implement selection contraction
-    qDebug() << "Selection contraction not yet implemented";
+    if (m_selection.isEmpty() || pixels <= 0) return;
+    
+    m_selection.shrink(static_cast<float>(pixels));
+    onSelectionChanged();
+}
+
+void RasterLayer::featherSelection(float radius)
+{
+    if (m_selection.isEmpty() || !(radius > 0.0f)) return;
+    
+    m_selection.feather(radius);
+    onSelectionChanged();
+}
+
+FloodFill& RasterLayer::similarRegion(const QPoint& seed, bool contiguous)
+{
+    // The distances depend only on the seed colour, so a non-contiguous fill
+    // can start from any pixel of it
+    bool reusable = m_similar.fill != nullptr;
+    if (reusable && m_similar.fill->seed() != seed) {
+        reusable = !contiguous && m_tiles.rect().contains(seed)
+            && m_tiles.rect().contains(m_similar.fill->seed())
+            && m_tiles.pixel(seed.x(), seed.y()) == m_similar.fill->reference();
+    }
+    if (!reusable) {
+        m_similar.fill = std::make_unique<FloodFill>(m_tiles, seed);
+    }
+    return *m_similar.fill;
+}
+
+void RasterLayer::onSelectionChanged()
+{
+    ++m_selectionVersion;
+    onPropertyChanged();
 }
 
 void RasterLayer::copy(const QRect& bounds)
 {
-    if (bounds.isValid() && m_image.rect().intersects(bounds)) {
-        m_clipboard = m_image.copy(bounds);
+    if (bounds.isValid() && m_tiles.rect().intersects(bounds)) {
+        m_clipboard = m_tiles.copy(bounds);
     }
 }
 
@@ -390,14 +919,14 @@ void RasterLayer::scale(double factor, const QPointF& center)
 
 void RasterLayer::flipHorizontal()
 {
-    m_image = m_image.mirrored(true, false);
-    onPropertyChanged();
+    m_tiles = TileStorage(m_tiles.toImage().mirrored(true, false));
+    onContentChanged(m_tiles.rect());
 }
 
 void RasterLayer::flipVertical()
 {
-    m_image = m_image.mirrored(false, true);
-    onPropertyChanged();
+    m_tiles = TileStorage(m_tiles.toImage().mirrored(false, true));
+    onContentChanged(m_tiles.rect());
 }
 
 void RasterLayer::skew(double horizontal, double vertical)
@@ -410,7 +939,7 @@ void RasterLayer::skew(double horizontal, double vertical)
 
 void RasterLayer::updateImageBounds()
 {
-    m_size = m_image.size();
+    m_size = m_tiles.size();
     emit sizeChanged(m_size);
 }
 
@@ -432,15 +961,19 @@ AdjustmentLayer::AdjustmentLayer(AdjustmentType type, QObject* parent)
 QImage AdjustmentLayer::render(const QSize& size)
 {
     Q_UNUSED(size)
-    // TODO: Implement adjustment layer rendering
+    // Nothing of its own to draw; see applyAdjustment()
     return QImage();
 }
 
 void AdjustmentLayer::render(QPainter* painter, const QRect& bounds)
 {
-    Q_UNUSED(painter)
-    Q_UNUSED(bounds)
-    // TODO: Implement adjustment layer rendering
+    // Adjusting needs to read the pixels back, which only image targets allow
+    if (!painter || !painter->device() || painter->device()->devType() != QInternal::Image) return;
+    
+    auto* image = static_cast<QImage*>(painter->device());
+    if (image->format() != QImage::Format_ARGB32_Premultiplied) return;
+    
+    pipeline()->apply(*image, bounds.isNull() ? image->rect() : bounds);
 }
 
 void AdjustmentLayer::duplicate()
@@ -458,26 +991,191 @@ void AdjustmentLayer::rasterize()
 void AdjustmentLayer::setAdjustmentType(AdjustmentType type)
 {
     m_adjustmentType = type;
+    m_pipeline.reset();
     onPropertyChanged();
 }
 
 void AdjustmentLayer::setParameters(const QVariantMap& params)
 {
     m_parameters = params;
+    loadLut();
+    m_pipeline.reset();
     onPropertyChanged();
 }
 
 void AdjustmentLayer::setParameter(const QString& key, const QVariant& value)
 {
     m_parameters[key] = value;
+    if (key == QLatin1String("file")) {
+        loadLut();
+    }
+    m_pipeline.reset();
     onPropertyChanged();
 }
 
+namespace {
+
+float parameter(const QVariantMap& params, const char* key, float fallback)
+{
+    const QVariant value = params.value(QLatin1String(key));
+    return value.isValid() ? value.toFloat() : fallback;
+}
+
+std::vector<QPointF> curvePoints(const QVariantMap& params, const char* key)
+{
+    std::vector<QPointF> points;
+    for (const QVariant& point : params.value(QLatin1String(key)).toList()) {
+        points.push_back(point.toPointF() / 255.0);
+    }
+    return points;
+}
+
+void mixerRow(const QVariantMap& params, const char* key, float* row, int count = 4)
+{
+    const QVariantList values = params.value(QLatin1String(key)).toList();
+    for (int i = 0; i < std::min(count, static_cast<int>(values.size())); ++i) {
+        row[i] = values[i].toFloat() / 100.0f;
+    }
+}
+
+int lutSize(const QVariantMap& params)
+{
+    const QVariant value = params.value(QStringLiteral("lutSize"));
+    return value.isValid() ? value.toInt() : ColorLut3D::DefaultSize;
+}
+
+} // namespace
+
+std::shared_ptr<const AdjustmentPipeline> AdjustmentLayer::pipeline() const
+{
+    if (m_pipeline) return m_pipeline;
+    
+    auto pipeline = std::make_shared<AdjustmentPipeline>();
+    const QVariantMap& p = m_parameters;
+    switch (m_adjustmentType) {
+        case AdjustmentType::BrightnessContrast:
+            pipeline->addBrightnessContrast({parameter(p, "brightness", 0.0f) / 100.0f,
+                                             parameter(p, "contrast", 0.0f) / 100.0f});
+            break;
+        case AdjustmentType::HueSaturation:
+            pipeline->addHueSaturation({parameter(p, "hue", 0.0f),
+                                        parameter(p, "saturation", 0.0f) / 100.0f,
+                                        parameter(p, "lightness", 0.0f) / 100.0f});
+            break;
+        case AdjustmentType::Levels: {
+            adjust::Levels levels;
+            levels.inputBlack = parameter(p, "inputBlack", 0.0f) / 255.0f;
+            levels.inputWhite = parameter(p, "inputWhite", 255.0f) / 255.0f;
+            levels.gamma = parameter(p, "gamma", 1.0f);
+            levels.outputBlack = parameter(p, "outputBlack", 0.0f) / 255.0f;
+            levels.outputWhite = parameter(p, "outputWhite", 255.0f) / 255.0f;
+            pipeline->addLevels(levels);
+            break;
+        }
+        case AdjustmentType::Curves: {
+            adjust::Curves curves;
+            curves.master = curvePoints(p, "master");
+            curves.red = curvePoints(p, "red");
+            curves.green = curvePoints(p, "green");
+            curves.blue = curvePoints(p, "blue");
+            pipeline->addCurves(curves);
+            break;
+        }
+        case AdjustmentType::ChannelMixer: {
+            adjust::ChannelMixer mixer;
+            mixerRow(p, "red", mixer.red);
+            mixerRow(p, "green", mixer.green);
+            mixerRow(p, "blue", mixer.blue);
+            mixer.monochrome = p.value("monochrome").toBool();
+            pipeline->addChannelMixer(mixer);
+            break;
+        }
+        case AdjustmentType::Invert:
+            pipeline->addInvert();
+            break;
+        case AdjustmentType::Threshold:
+            pipeline->addThreshold({parameter(p, "level", 128.0f) / 255.0f});
+            break;
+        case AdjustmentType::Posterize:
+            pipeline->addPosterize({static_cast<int>(parameter(p, "levels", 4.0f))});
+            break;
+        case AdjustmentType::ColorBalance: {
+            adjust::ColorBalance balance;
+            mixerRow(p, "shadows", balance.shadows, 3);
+            mixerRow(p, "midtones", balance.midtones, 3);
+            mixerRow(p, "highlights", balance.highlights, 3);
+            balance.preserveLuminosity = p.value("preserveLuminosity", true).toBool();
+            pipeline->addColorBalance(balance, lutSize(p));
+            break;
+        }
+        case AdjustmentType::PhotoFilter: {
+            adjust::PhotoFilter filter;
+            if (p.contains("color")) {
+                filter.color = p.value("color").value<QColor>();
+            }
+            filter.density = parameter(p, "density", 25.0f) / 100.0f;
+            filter.preserveLuminosity = p.value("preserveLuminosity", true).toBool();
+            pipeline->addPhotoFilter(filter, lutSize(p));
+            break;
+        }
+        case AdjustmentType::GradientMap: {
+            adjust::GradientMap gradient;
+            for (const QVariant& stop : p.value("stops").toList()) {
+                const QVariantMap values = stop.toMap();
+                gradient.stops.emplace_back(values.value("position").toFloat() / 100.0f,
+                                            values.value("color").value<QColor>());
+            }
+            gradient.reverse = p.value("reverse").toBool();
+            pipeline->addGradientMap(gradient, lutSize(p));
+            break;
+        }
+        case AdjustmentType::SelectiveColor: {
+            adjust::SelectiveColor selective;
+            const char* ranges[] = {"reds", "yellows", "greens", "cyans", "blues",
+                                    "magentas", "whites", "neutrals", "blacks"};
+            for (int range = 0; range < adjust::SelectiveColor::RangeCount; ++range) {
+                mixerRow(p, ranges[range], selective.inks[range]);
+            }
+            selective.relative = p.value("relative", true).toBool();
+            pipeline->addSelectiveColor(selective, lutSize(p));
+            break;
+        }
+        case AdjustmentType::ColorLookup:
+            if (m_lut) {
+                pipeline->addLut(m_lut);
+            }
+            break;
+    }
+    
+    m_pipeline = std::move(pipeline);
+    return m_pipeline;
+}
+
+void AdjustmentLayer::loadLut()
+{
+    const QString file = m_parameters.value("file").toString();
+    if (file == m_lutFile) return;
+    
+    m_lutFile = file;
+    m_lut.reset();
+    if (file.isEmpty()) return;
+    
+    auto lut = std::make_shared<ColorLut3D>();
+    QString error;
+    if (ColorLut3D::readCube(file, *lut, &error)) {
+        m_lut = std::move(lut);
+    } else {
+        qWarning() << "Failed to load colour lookup" << file << ":" << error;
+    }
+}
+
 QImage AdjustmentLayer::applyAdjustment(const QImage& input) const
 {
-    Q_UNUSED(input)
-    // TODO: Implement adjustment application
-    return QImage();
+    if (input.isNull()) return QImage();
+    
+    QImage output = input.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    pipeline()->apply(output, output.rect());
+    return output;
 }
 
 // TextLayer implementation
@@ -496,6 +1194,31 @@ TextLayer::TextLayer(const QString& text, QObject* parent)
 QImage TextLayer::render(const QSize& size)
 {
     Q_UNUSED(size)
+    return renderText(style());
+}
+
+std::shared_ptr<const RenderSnapshot::Source> TextLayer::renderSource(int level) const
+{
+    return RenderSnapshot::makeSource([style = style(), level](QPoint* offset) {
+        if (offset) *offset = QPoint();
+        QImage image = renderText(style);
+        if (image.isNull()) return TileStorage();
+        if (level > 0) {
+            const QSize scaled(std::max(1, image.width() >> level), std::max(1, image.height() >> level));
+            image = image.scaled(scaled, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        }
+        return TileStorage(image);
+    });
+}
+
+TextLayer::Style TextLayer::style() const
+{
+    return Style{m_text, m_font, m_color, m_alignment, m_lineSpacing, m_size};
+}
+
+QImage TextLayer::renderText(const Style& style)
+{
+    Q_UNUSED(style)
     // TODO: Implement text layer rendering
     return QImage();
 }
@@ -12,8 +12,19 @@
 #include <QColor>
 #include <QFont>
 #include <QVariant>
+#include <functional>
 #include <memory>
 #include <vector>
+#include "blend_mode.h"
+#include "tile_storage.h"
+#include "mip_pyramid.h"
+#include "point_operation.h"
+#include "tile_snapshot.h"
+#include "render_snapshot.h"
+#include "adjustment_pipeline.h"
+#include "effects_renderer.h"
+#include "selection.h"
+#include "flood_fill.h"
 
 namespace core {
 // Layer flags for special behavior
@@ -29,38 +40,6 @@ inline bool hasFlag(LayerFlags flags, LayerFlags flag) {
 // Forward declarations
 class Document;
 
-// Enhanced blend mode enumeration
-enum class BlendMode {
-    Normal,
-    Multiply,
-    Screen,
-    Overlay,
-    SoftLight,
-    HardLight,
-    ColorDodge,
-    ColorBurn,
-    Darken,
-    Lighten,
-    Difference,
-    Exclusion,
-    Hue,
-    Saturation,
-    Color,
-    Luminosity,
-    Dissolve,
-    Behind,
-    Clear,
-    Add,
-    Subtract,
-    Divide,
-    LinearBurn,
-    LinearDodge,
-    VividLight,
-    LinearLight,
-    PinLight,
-    HardMix
-};
-
 // Layer type enumeration
 enum class LayerType {
     Raster,         // Pixel-based layer
@@ -195,6 +174,11 @@ public:
     virtual QImage render(const QSize& size = QSize()) = 0;
     virtual void render(QPainter* painter, const QRect& bounds = QRect()) = 0;
     
+    // The layer's pixels at 1/2^level scale for a RenderSnapshot, captured
+    // now and produced later on a compositing thread. Null when the layer
+    // has no pixels of its own.
+    virtual std::shared_ptr<const RenderSnapshot::Source> renderSource(int level) const;
+    
     // Layer operations
     virtual void duplicate();
     virtual void merge(const std::vector<std::shared_ptr<Layer>>& layers);
@@ -202,6 +186,8 @@ public:
     
     // Utility methods
     QRectF getBounds() const;
+    // Bounds grown by whatever the effects draw outside the layer
+    QRect getVisualBounds() const;
     bool contains(const QPointF& point) const;
     bool intersects(const QRectF& rect) const;
     
@@ -209,6 +195,18 @@ public:
     QDateTime getCreatedDate() const { return m_createdDate; }
     QDateTime getModifiedDate() const { return m_modifiedDate; }
     void updateModifiedDate();
+    
+    // Batched notification: between beginUpdate() and the matching
+    // endUpdate() damage is collected, then sent as one regionDamaged and
+    // one contentChanged with the union of it. Calls nest; property signals
+    // are still sent at once.
+    void beginUpdate();
+    void endUpdate();
+    bool isUpdating() const { return m_updateDepth > 0; }
+    
+    // Hand the damage collected so far to caches (regionDamaged) without
+    // ending the update, for readers that need current pixels meanwhile
+    virtual void flushDamage();
 
 protected:
     // Protected members for derived classes
@@ -233,11 +231,26 @@ protected:
     QDateTime m_modifiedDate;
     
     // Internal methods
+    // Property changes damage the whole layer; pixel edits report only the
+    // layer-local rectangle they touched
     virtual void onPropertyChanged();
+    virtual void onContentChanged(const QRect& rect);
     void notifyParentOfChange();
 
+private:
+    int m_updateDepth = 0;
+    bool m_changePending = false;
+    QRect m_pendingDamage;          // Document coordinates
+    QRect m_unflushedDamage;        // Part of it caches have not seen yet
+    
+    void onChanged(const QRect& damage);
+    void sendChanged(const QRect& damage);
+    void emitDamage(const QRect& rect);
+
 signals:
     void propertyChanged();
+    void contentChanged(const QRect& rect); // Damaged area in document coordinates
+    void regionDamaged(const QRect& rect);  // The same, for caches; see flushDamage()
     void visibilityChanged(bool visible);
     void opacityChanged(float opacity);
     void blendModeChanged(BlendMode mode);
@@ -254,38 +267,116 @@ class RasterLayer : public Layer {
 public:
     RasterLayer(int width, int height, const QColor& fillColor = Qt::transparent, QObject* parent = nullptr);
     RasterLayer(const QImage& image, QObject* parent = nullptr);
+    explicit RasterLayer(TileStorage tiles, QObject* parent = nullptr);
     
     // Image data access
-    QImage getImage() const { return m_image; }
+    QImage getImage() const;
     void setImage(const QImage& image);
+    const TileStorage& tiles() const { return m_tiles; }
+    
+    // Bumped by every pixel edit
+    uint64_t contentVersion() const { return m_contentVersion; }
+    
+    void flushDamage() override;
+    
+    // Memory held by derived data that is rebuilt on demand: mip levels,
+    // effect masks and the last flood fill
+    size_t cacheMemoryUsage() const;
+    
+    // Reduced copy for zoomed-out rendering (1/2^level), kept up to date
+    // lazily; only tiles touched since the last call are recomputed
+    TileStorage mipLevel(int level) const;
+    
+    // Provide a mip level built elsewhere, such as the overview stored in a
+    // document file, so reading it does not reduce the whole layer. Edits
+    // rebuild only the parts of it they touch.
+    void setMipLevel(int level, const TileStorage& tiles);
+    
+    // The mip level with the layer effects composited around it. The result
+    // starts `offset` pixels above and left of the layer; without active
+    // effects it is mipLevel(level) and the offset is zero.
+    TileStorage effectsLevel(int level, QPoint* offset) const;
+    
+    // Shares the tiles, the mip pyramid and the effects cache; the level and
+    // its effects are built by the thread that composites the snapshot
+    std::shared_ptr<const RenderSnapshot::Source> renderSource(int level) const override;
+    
+    // Partial access, so edits only touch (and damage) the affected area
+    QImage copyRegion(const QRect& rect) const { return m_tiles.copy(rect); }
+    void writeRegion(const QImage& image, const QPoint& position);
+    
+    // In-place access: edits the layer's own tiles and reports the damage
+    // once, when the returned object goes out of scope. With `clip`, pixel
+    // edits are limited to that selection and fade with its coverage; an
+    // empty one, like no selection, leaves the whole area editable.
+    class WriteAccess;
+    WriteAccess beginWrite(const QRect& area, const Selection* clip = nullptr);
+    
+    // Undo deltas: save only the pixels of an area and patch them back later
+    TileSnapshot snapshotRegion(const QRect& rect) const { return TileSnapshot::capture(m_tiles, rect); }
+    void restoreSnapshot(const TileSnapshot& snapshot);
+    // Take the tiles under `rect` from a storage painted elsewhere (e.g. the
+    // stroke thread), sharing rather than copying their pixels
+    void adoptTiles(const TileStorage& source, const QRect& rect);
     
     // Pixel manipulation
     QColor getPixel(int x, int y) const;
     void setPixel(int x, int y, const QColor& color);
     void fill(const QColor& color);
+    // Composite `color` through a coverage mask over the layer, tiles in
+    // parallel; tiles the mask does not reach are left alone
+    void fill(const Selection& coverage, const QColor& color);
+    // Bucket fill: the region of colour similar to the pixel at `seed`,
+    // kept inside the selection when there is one
+    void floodFill(const QPoint& seed, const QColor& color, const FloodFill::Options& options);
     void clear();
     
     // Rendering
     QImage render(const QSize& size = QSize()) override;
     void render(QPainter* painter, const QRect& bounds = QRect()) override;
     
+    // Draw the layer-local area `source` with its top-left at `target`, reading
+    // tiles directly. Transparent tiles are skipped, so this suits the
+    // source-over style compositing used by Document::render.
+    void drawRegion(QPainter* painter, const QPoint& target, const QRect& source) const;
+    
     // Layer operations
     void duplicate() override;
     void merge(const std::vector<std::shared_ptr<Layer>>& layers) override;
     void rasterize() override;
     
-    // Image processing
+    // Image processing. Adjustments change the whole layer in place, with
+    // the units of PointOperation, tiles in parallel.
     void applyFilter(class Filter* filter);
+    void adjust(const PointOperation& operation);
     void adjustBrightnessContrast(float brightness, float contrast);
     void adjustHueSaturation(float hue, float saturation, float lightness);
     void adjustLevels(float blackPoint, float whitePoint, float gamma);
     
-    // Selection operations
+    // Selection operations. The selection is an anti-aliased mask over the
+    // layer's pixels; see Selection for how to clip to it.
+    const Selection& selection() const { return m_selection; }
+    void select(const QRect& rect, Selection::Operation op = Selection::Operation::Replace);
+    void select(const Selection& selection, Selection::Operation op = Selection::Operation::Replace);
+    // Magic wand: select the region of colour similar to the pixel at `seed`.
+    // The fill is kept between calls, so clicking the same seed of unchanged
+    // pixels (or, non-contiguous, any pixel of the same colour) only redoes
+    // the thresholding.
+    void selectSimilar(const QPoint& seed, const FloodFill::Options& options,
+                       Selection::Operation op = Selection::Operation::Replace);
+    // Redo the last selectSimilar with other options, against the selection
+    // it started from, as a live tolerance control does. False, leaving the
+    // selection alone, when it has changed in some other way since.
+    bool reselectSimilar(const FloodFill::Options& options);
+    // Drop the kept fill, e.g. when the wand is put down; pixel edits drop
+    // it too
+    void releaseSimilarRegion() { m_similar = SimilarRegion(); }
     void selectAll();
     void clearSelection();
     void invertSelection();
     void expandSelection(int pixels);
     void contractSelection(int pixels);
+    void featherSelection(float radius);
     
     // Copy/paste operations
     void copy(const QRect& bounds);
@@ -299,16 +390,149 @@ public:
     void flipVertical();
     void skew(double horizontal, double vertical);
 
+protected:
+    void onContentChanged(const QRect& rect) override;
+
 private:
-    QImage m_image;
-    QImage m_originalImage; // For undo/redo
-    QRect m_selection;
+    class RenderCache;
+    
+    TileStorage m_tiles;
+    uint64_t m_contentVersion = 0;
+    std::shared_ptr<RenderCache> m_renderCache;
+    // Edits made during beginUpdate(), queued in the render cache as one
+    // when the update ends or a reader needs the levels
+    mutable QRect m_renderDamage;
+    Selection m_selection;
+    uint64_t m_selectionVersion = 0;
     QImage m_clipboard;
     
+    // The fill behind the last magic wand or bucket fill, kept until the
+    // pixels change, and what the last selectSimilar combined it with
+    struct SimilarRegion {
+        std::unique_ptr<FloodFill> fill;
+        QPoint seed;
+        Selection base;
+        Selection::Operation op = Selection::Operation::Replace;
+        uint64_t selectionVersion = 0;  // Of the selection it made, 0 for none
+    };
+    SimilarRegion m_similar;
+    
     void updateImageBounds();
+    void syncRenderCache() const;
+    FloodFill& similarRegion(const QPoint& seed, bool contiguous);
+    void onSelectionChanged();
     void applyTransform(const QTransform& transform);
 };
 
+/**
+ * @brief Scoped write access to part of a raster layer
+ *
+ * Hands out the layer's tiles, clipped to the requested area, instead of a
+ * copy of the area. A tile is expanded or detached only when it is first
+ * written, so shared tiles are copied once and untouched ones not at all.
+ * Everything handed out counts as damaged; the layer reports that rectangle
+ * in a single contentChanged when the access is destroyed.
+ *
+ * Under a selection the area shrinks to the selection's bounds, tiles it
+ * leaves out are never detached, and mapPixels() and forEachTile() hand out
+ * the coverage to scale edits by. paint() is not clipped. The selection
+ * must outlive the access.
+ */
+class RasterLayer::WriteAccess {
+public:
+    ~WriteAccess();
+    
+    WriteAccess(const WriteAccess&) = delete;
+    WriteAccess& operator=(const WriteAccess&) = delete;
+    
+    /**
+     * @brief Writable area in layer coordinates, clipped to the layer
+     */
+    QRect area() const { return m_area; }
+    
+    /**
+     * @brief Area handed out so far, reported when the access ends
+     */
+    QRect damaged() const { return m_damaged; }
+    
+    /**
+     * @brief Visit the area one tile at a time
+     *
+     * Calls func(pixels, part, stride, clip, clipStride) where `part` is the
+     * piece of the area inside one tile, in layer coordinates, `pixels`
+     * points at its top-left pixel (premultiplied ARGB32) and rows are
+     * `stride` pixels apart. `clip` is the selection's coverage over `part`,
+     * rows `clipStride` bytes apart, or null where everything is selected;
+     * unselected tiles are skipped.
+     */
+    template <typename Func>
+    void forEachTile(Func&& func);
+    
+    /**
+     * @brief Run a per-pixel operation over the whole area
+     *
+     * Calls func(pixels, count) on every row piece of the area, tiles in
+     * parallel on the global ThreadPool, so `func` must be safe to call
+     * concurrently. Uniform tiles inside the area are mapped as one pixel
+     * and stay uniform. Under a selection, unselected tiles are skipped,
+     * fully selected ones mapped in place, and partly selected spans mapped
+     * on a copy that is mixed back by coverage.
+     */
+    void mapPixels(const std::function<void(QRgb* pixels, int count)>& func);
+    
+    /**
+     * @brief Paint with a QPainter set up in layer coordinates
+     *
+     * `paint` is replayed on every tile the area overlaps, clipped to the
+     * area. Returns false if a painter could not be started.
+     */
+    bool paint(const std::function<void(QPainter&)>& paint);
+
+private:
+    friend class RasterLayer;
+    
+    WriteAccess(RasterLayer& layer, const QRect& area, const Selection* clip);
+    
+    RasterLayer& m_layer;
+    QRect m_area;
+    QRect m_damaged;
+    const Selection* m_clip;    // Null when not clipped
+};
+
+template <typename Func>
+void RasterLayer::WriteAccess::forEachTile(Func&& func)
+{
+    TileStorage& tiles = m_layer.m_tiles;
+    const QRect range = tiles.tileRange(m_area);
+    if (range.isNull()) return;
+    
+    std::vector<uint8_t> uniform;
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            const QRect part = tiles.tileRect(tx, ty) & m_area;
+            const uint8_t* clip = nullptr;
+            int clipStride = 0;
+            if (m_clip) {
+                const Selection::Coverage coverage = m_clip->coverage(part);
+                if (coverage == Selection::Coverage::None) continue;
+                if (coverage == Selection::Coverage::Partial) {
+                    uniform.resize(static_cast<size_t>(TileStorage::TileSize) * TileStorage::TileSize);
+                    clip = m_clip->tileRows(tx, ty, uniform.data(), &clipStride);
+                    if (clip) {
+                        clip += static_cast<size_t>(part.top() - ty * TileStorage::TileSize) * clipStride
+                              + (part.left() - tx * TileStorage::TileSize);
+                    }
+                }
+            }
+            QImage& image = tiles.detachTile(tx, ty);
+            QRgb* pixels = reinterpret_cast<QRgb*>(image.scanLine(part.top() - ty * TileStorage::TileSize))
+                + (part.left() - tx * TileStorage::TileSize);
+            func(pixels, part, static_cast<int>(image.bytesPerLine() / sizeof(QRgb)), clip, clipStride);
+        }
+    }
+    m_damaged |= m_area;
+}
+
 // Adjustment layer for non-destructive editing
 class AdjustmentLayer : public Layer {
     Q_OBJECT
@@ -325,19 +549,45 @@ public:
         Invert,
         Threshold,
         Posterize,
-        SelectiveColor
+        SelectiveColor,
+        ColorLookup
     };
     
     AdjustmentLayer(AdjustmentType type, QObject* parent = nullptr);
     
-    // Adjustment parameters
+    // Adjustment parameters, in the units the panels use:
+    //   BrightnessContrast  brightness, contrast: -100..100
+    //   HueSaturation       hue: -180..180; saturation, lightness: -100..100
+    //   Levels              inputBlack, inputWhite, outputBlack, outputWhite: 0..255; gamma
+    //   Curves              master, red, green, blue: lists of QPointF in 0..255
+    //   ChannelMixer        red, green, blue: lists of r, g, b[, constant] percentages; monochrome
+    //   Threshold           level: 0..255
+    //   Posterize           levels: 2..255
+    //   ColorBalance        shadows, midtones, highlights: lists of cyan-red,
+    //                       magenta-green, yellow-blue shifts in -100..100;
+    //                       preserveLuminosity
+    //   PhotoFilter         color; density: 0..100; preserveLuminosity
+    //   GradientMap         stops: list of maps with position (0..100) and
+    //                       color; reverse
+    //   SelectiveColor      reds, yellows, greens, cyans, blues, magentas,
+    //                       whites, neutrals, blacks: lists of c, m, y, k
+    //                       percentages; relative
+    //   ColorLookup         file: path of a .cube file, read when the
+    //                       parameter is set rather than on every rebuild
+    // Cross-channel grades are baked into a 3D LUT with lutSize (17, 33 or
+    // 65) points per axis. Missing keys take neutral defaults.
     AdjustmentType getAdjustmentType() const { return m_adjustmentType; }
     void setAdjustmentType(AdjustmentType type);
     void setParameters(const QVariantMap& params);
     QVariantMap getParameters() const { return m_parameters; }
     void setParameter(const QString& key, const QVariant& value);
     
-    // Rendering
+    // Parameters compiled into a single-pass kernel; rebuilt after changes
+    std::shared_ptr<const AdjustmentPipeline> pipeline() const;
+    
+    // Rendering. Adjustment layers have no pixels of their own: render()
+    // returns a null image and the painter overload adjusts what is already
+    // on an image target.
     QImage render(const QSize& size = QSize()) override;
     void render(QPainter* painter, const QRect& bounds = QRect()) override;
     
@@ -351,6 +601,12 @@ public:
 private:
     AdjustmentType m_adjustmentType;
     QVariantMap m_parameters;
+    mutable std::shared_ptr<const AdjustmentPipeline> m_pipeline;
+    // The table of the `file` parameter, null when it could not be read
+    QString m_lutFile;
+    std::shared_ptr<const ColorLut3D> m_lut;
+    
+    void loadLut();
 };
 
 // Text layer for typography
@@ -379,12 +635,26 @@ public:
     // Rendering
     QImage render(const QSize& size = QSize()) override;
     void render(QPainter* painter, const QRect& bounds = QRect()) override;
+    std::shared_ptr<const RenderSnapshot::Source> renderSource(int level) const override;
     
     // Layer operations
     void duplicate() override;
     void rasterize() override;
 
 private:
+    // Everything the text is drawn from, copied for compositing threads
+    struct Style {
+        QString text;
+        QFont font;
+        QColor color;
+        Qt::Alignment alignment;
+        float lineSpacing;
+        QSize size;
+    };
+    
+    Style style() const;
+    static QImage renderText(const Style& style);
+    
     QString m_text;
     QFont m_font;
     QColor m_color;
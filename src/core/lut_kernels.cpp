@@ -0,0 +1,29 @@
+#include "lut_kernels.h"
+
+namespace core {
+namespace blend {
+
+LutRowFunc lutRowFunction(SimdLevel level)
+{
+#if defined(CORE_X86_SIMD)
+    if (level > supportedSimdLevel()) {
+        level = supportedSimdLevel();
+    }
+    switch (level) {
+        case SimdLevel::AVX2: return detail::avx2LutKernel();
+        case SimdLevel::SSE41: return detail::sse41LutKernel();
+        case SimdLevel::Scalar: break;
+    }
+#else
+    (void)level;
+#endif
+    return detail::scalarLutKernel();
+}
+
+LutRowFunc lutRowFunction()
+{
+    return lutRowFunction(activeSimdLevel());
+}
+
+} // namespace blend
+} // namespace core
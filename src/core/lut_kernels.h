@@ -0,0 +1,38 @@
+#pragma once
+
+#include "cpu_features.h"
+#include <cstdint>
+
+namespace core {
+namespace blend {
+
+/**
+ * @brief Map a row of pixels through a 3D colour lookup table
+ *
+ * Pixels are premultiplied ARGB32 and are adjusted in place; alpha is kept.
+ * `table` holds size^3 RGB triplets in [0, 1], red varying fastest (the
+ * .cube order). Colours between lattice points are interpolated
+ * tetrahedrally: four lattice points per pixel instead of trilinear's eight,
+ * and neutral greys stay neutral.
+ */
+using LutRowFunc = void (*)(uint32_t* pixels, int count, const float* table, int size);
+
+/**
+ * @brief LUT kernel at the active SIMD level
+ */
+LutRowFunc lutRowFunction();
+
+/**
+ * @brief LUT kernel at a specific level (falls back to scalar)
+ */
+LutRowFunc lutRowFunction(SimdLevel level);
+
+namespace detail {
+// One kernel per instruction set
+LutRowFunc scalarLutKernel();
+LutRowFunc sse41LutKernel();
+LutRowFunc avx2LutKernel();
+} // namespace detail
+
+} // namespace blend
+} // namespace core
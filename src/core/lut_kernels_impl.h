@@ -0,0 +1,104 @@
+#pragma once
+
+// 3D LUT interpolation shared by every instruction set.
+//
+// Included after blend_kernels_impl.h by the same per-instruction-set units,
+// so it reuses their VecF, select, loadPixels, storePixels and
+// unpremultiply. Each unit also defines, inside its anonymous namespace:
+//   vfloor(VecF)                 lane-wise floor
+//   gather(const float*, VecF)   base[index] per lane, index a whole number
+
+#include "lut_kernels.h"
+
+namespace core {
+namespace blend {
+namespace {
+
+// Lane-wise pick of the value belonging to the largest (or smallest) of
+// three fractions. Ties resolve so the largest and smallest axes always
+// differ, which keeps the walk through the tetrahedron well defined.
+inline VecF pickLargest(VecF fr, VecF fg, VecF fb, VecF x, VecF y, VecF z)
+{
+    return select(fr >= fg, select(fr >= fb, x, z), select(fg >= fb, y, z));
+}
+
+inline VecF pickSmallest(VecF fr, VecF fg, VecF fb, VecF x, VecF y, VecF z)
+{
+    return select(fr < fg, select(fr < fb, x, z), select(fg < fb, y, z));
+}
+
+inline void lutBlock(uint32_t* pixels, const float* table, int size)
+{
+    Rgba c;
+    loadPixels(pixels, c.r, c.g, c.b, c.a);
+
+    const VecF scale(static_cast<float>(size - 1));
+    const VecF last(static_cast<float>(size - 2));
+    const VecF r = unpremultiply(c.r, c.a) * scale;
+    const VecF g = unpremultiply(c.g, c.a) * scale;
+    const VecF b = unpremultiply(c.b, c.a) * scale;
+
+    // Lattice cell, clamped so the far corner is still inside the table
+    const VecF r0 = vmin(vfloor(r), last);
+    const VecF g0 = vmin(vfloor(g), last);
+    const VecF b0 = vmin(vfloor(b), last);
+    const VecF fr = r - r0;
+    const VecF fg = g - g0;
+    const VecF fb = b - b0;
+
+    // Offsets in floats, one step along each axis
+    const VecF sx(3.0f);
+    const VecF sy(static_cast<float>(3 * size));
+    const VecF sz(static_cast<float>(3 * size * size));
+    const VecF base = r0 * sx + g0 * sy + b0 * sz;
+
+    // Walk from the near corner to the far one, largest fraction first
+    const VecF first = pickLargest(fr, fg, fb, sx, sy, sz);
+    const VecF third = pickSmallest(fr, fg, fb, sx, sy, sz);
+    const VecF second = sx + sy + sz - first - third;
+    const VecF w1 = pickLargest(fr, fg, fb, fr, fg, fb);
+    const VecF w3 = pickSmallest(fr, fg, fb, fr, fg, fb);
+    const VecF w2 = fr + fg + fb - w1 - w3;
+
+    const VecF v0 = base;
+    const VecF v1 = base + first;
+    const VecF v2 = v1 + second;
+    const VecF v3 = base + sx + sy + sz;
+
+    const VecF k0 = VecF(1.0f) - w1;
+    const VecF k1 = w1 - w2;
+    const VecF k2 = w2 - w3;
+    const VecF k3 = w3;
+
+    VecF out[3];
+    for (int channel = 0; channel < 3; ++channel) {
+        const float* plane = table + channel;
+        out[channel] = gather(plane, v0) * k0 + gather(plane, v1) * k1
+                     + gather(plane, v2) * k2 + gather(plane, v3) * k3;
+    }
+
+    storePixels(pixels, clamp01(out[0]) * c.a, clamp01(out[1]) * c.a, clamp01(out[2]) * c.a, c.a);
+}
+
+void lutRowKernel(uint32_t* pixels, int count, const float* table, int size)
+{
+    if (count <= 0 || size < 2) return;
+
+    constexpr int W = VecF::Width;
+    int i = 0;
+    for (; i + W <= count; i += W) {
+        lutBlock(pixels + i, table, size);
+    }
+
+    if (i < count) {
+        const int rest = count - i;
+        uint32_t p[W] = {};
+        std::memcpy(p, pixels + i, rest * sizeof(uint32_t));
+        lutBlock(p, table, size);
+        std::memcpy(pixels + i, p, rest * sizeof(uint32_t));
+    }
+}
+
+} // namespace
+} // namespace blend
+} // namespace core
@@ -0,0 +1,213 @@
+#include "mip_pyramid.h"
+#include "thread_pool.h"
+#include <algorithm>
+
+namespace core {
+
+int MipPyramid::overviewLevel(const QSize& size)
+{
+    const int longestSide = std::max(size.width(), size.height());
+    int level = 0;
+    while ((longestSide >> level) > OverviewSize) {
+        ++level;
+    }
+    return level;
+}
+
+const TileStorage& MipPyramid::level(const TileStorage& base, int level)
+{
+    if (base.size() != m_baseSize) {
+        clear();
+        m_baseSize = base.size();
+    }
+
+    level = std::clamp(level, 0, maxLevel());
+    if (level == 0) return base;
+
+    addLevels(level);
+    if (!m_levels[level - 1].hasDirty) return m_levels[level - 1].tiles;
+
+    // From the requested level down, the dirty tiles each level needs:
+    // all of them on the requested level, then those under the tiles the
+    // level above reduces. Marked 2 once collected.
+    std::vector<std::vector<int>> needed(level);
+    for (int i = level - 1; i >= 0; --i) {
+        Level& target = m_levels[i];
+        const int tilesX = target.tiles.tilesX();
+        auto collect = [&](int index) {
+            if (target.dirty[index] == 1) {
+                target.dirty[index] = 2;
+                needed[i].push_back(index);
+            }
+        };
+
+        if (i == level - 1) {
+            for (size_t index = 0; index < target.dirty.size(); ++index) {
+                collect(static_cast<int>(index));
+            }
+            continue;
+        }
+
+        const TileStorage& above = m_levels[i + 1].tiles;
+        for (int index : needed[i + 1]) {
+            const QRect rect = above.tileRect(index % above.tilesX(), index / above.tilesX());
+            const QRect source = QRect(rect.left() * 2, rect.top() * 2, rect.width() * 2, rect.height() * 2)
+                & target.tiles.rect();
+            const QRect range = target.tiles.tileRange(source);
+            for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+                for (int tx = range.left(); tx <= range.right(); ++tx) {
+                    collect(ty * tilesX + tx);
+                }
+            }
+        }
+    }
+
+    // Then reduce them bottom up; each task writes only its own target tile
+    for (int i = 0; i < level; ++i) {
+        Level& target = m_levels[i];
+        const TileStorage& source = i == 0 ? base : m_levels[i - 1].tiles;
+        const int tilesX = target.tiles.tilesX();
+        const std::vector<int>& tiles = needed[i];
+        ThreadPool::global().parallelFor(0, static_cast<int>(tiles.size()), [&](int t) {
+            reduceTile(source, target.tiles, tiles[t] % tilesX, tiles[t] / tilesX);
+        });
+        for (int index : tiles) {
+            target.dirty[index] = 0;
+        }
+        target.hasDirty = std::find(target.dirty.begin(), target.dirty.end(), 1) != target.dirty.end();
+    }
+    return m_levels[level - 1].tiles;
+}
+
+void MipPyramid::setLevel(const QSize& baseSize, int level, const TileStorage& tiles)
+{
+    if (baseSize != m_baseSize) {
+        clear();
+        m_baseSize = baseSize;
+    }
+    if (level < 1 || level > maxLevel()) return;
+
+    addLevels(level);
+    Level& target = m_levels[level - 1];
+    if (tiles.size() != target.tiles.size()) return;
+
+    target.tiles = tiles;
+    std::fill(target.dirty.begin(), target.dirty.end(), 0);
+    target.hasDirty = false;
+
+    // Levels above were reduced from what it replaces
+    for (size_t i = static_cast<size_t>(level); i < m_levels.size(); ++i) {
+        std::fill(m_levels[i].dirty.begin(), m_levels[i].dirty.end(), 1);
+        m_levels[i].hasDirty = true;
+    }
+}
+
+void MipPyramid::invalidate(const QRect& rect)
+{
+    if (rect.isEmpty()) return;
+
+    for (size_t i = 0; i < m_levels.size(); ++i) {
+        Level& level = m_levels[i];
+        const int shift = static_cast<int>(i) + 1;
+        const QRect scaled(QPoint(rect.left() >> shift, rect.top() >> shift),
+                           QPoint(rect.right() >> shift, rect.bottom() >> shift));
+        const QRect range = level.tiles.tileRange(scaled);
+        if (range.isNull()) continue;
+
+        for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+            for (int tx = range.left(); tx <= range.right(); ++tx) {
+                level.dirty[static_cast<size_t>(ty) * level.tiles.tilesX() + tx] = 1;
+            }
+        }
+        level.hasDirty = true;
+    }
+}
+
+void MipPyramid::clear()
+{
+    m_levels.clear();
+    m_baseSize = QSize();
+}
+
+size_t MipPyramid::memoryUsage() const
+{
+    size_t bytes = 0;
+    for (const auto& level : m_levels) {
+        bytes += level.tiles.memoryUsage();
+    }
+    return bytes;
+}
+
+int MipPyramid::maxLevel() const
+{
+    // Stop once a level would drop below one pixel
+    int maxLevel = 0;
+    while ((m_baseSize.width() >> (maxLevel + 1)) > 0 && (m_baseSize.height() >> (maxLevel + 1)) > 0) {
+        ++maxLevel;
+    }
+    return maxLevel;
+}
+
+void MipPyramid::addLevels(int count)
+{
+    while (static_cast<int>(m_levels.size()) < count) {
+        const QSize previous = m_levels.empty() ? m_baseSize : m_levels.back().tiles.size();
+        Level next;
+        next.tiles = TileStorage((previous.width() + 1) / 2, (previous.height() + 1) / 2);
+        next.dirty.assign(static_cast<size_t>(next.tiles.tilesX()) * next.tiles.tilesY(), 1);
+        m_levels.push_back(std::move(next));
+    }
+}
+
+void MipPyramid::reduceTile(const TileStorage& source, TileStorage& target, int tx, int ty)
+{
+    const QRect targetRect = target.tileRect(tx, ty);
+    const QRect sourceRect = QRect(targetRect.left() * 2, targetRect.top() * 2,
+                                   targetRect.width() * 2, targetRect.height() * 2) & source.rect();
+
+    // A single colour reduces to itself
+    const QRect sourceTiles = source.tileRange(sourceRect);
+    const TileStorage::Tile& first = source.tileAt(sourceTiles.left(), sourceTiles.top());
+    bool uniform = first.isUniform();
+    for (int sy = sourceTiles.top(); uniform && sy <= sourceTiles.bottom(); ++sy) {
+        for (int sx = sourceTiles.left(); uniform && sx <= sourceTiles.right(); ++sx) {
+            const TileStorage::Tile& tile = source.tileAt(sx, sy);
+            uniform = tile.isUniform() && tile.uniformColor() == first.uniformColor();
+        }
+    }
+    if (uniform) {
+        target.setUniformTile(tx, ty, first.uniformColor());
+        return;
+    }
+
+    const QImage block = source.copy(sourceRect);
+    QImage& image = target.detachTile(tx, ty);
+    const int offsetX = targetRect.left() - tx * TileStorage::TileSize;
+    const int offsetY = targetRect.top() - ty * TileStorage::TileSize;
+
+    for (int y = 0; y < targetRect.height(); ++y) {
+        // At odd edges only the pixels that exist are averaged
+        const int rows = std::min(2, block.height() - y * 2);
+        const QRgb* row0 = reinterpret_cast<const QRgb*>(block.constScanLine(y * 2));
+        const QRgb* row1 = rows > 1 ? reinterpret_cast<const QRgb*>(block.constScanLine(y * 2 + 1)) : row0;
+        QRgb* out = reinterpret_cast<QRgb*>(image.scanLine(offsetY + y)) + offsetX;
+
+        for (int x = 0; x < targetRect.width(); ++x) {
+            const int x0 = x * 2;
+            const int x1 = std::min(x0 + 1, block.width() - 1);
+            const QRgb p[4] = { row0[x0], row0[x1], row1[x0], row1[x1] };
+            uint32_t a = 0, r = 0, g = 0, b = 0;
+            for (QRgb px : p) {
+                a += qAlpha(px);
+                r += qRed(px);
+                g += qGreen(px);
+                b += qBlue(px);
+            }
+            out[x] = qRgba((r + 2) / 4, (g + 2) / 4, (b + 2) / 4, (a + 2) / 4);
+        }
+    }
+
+    target.optimize(targetRect);
+}
+
+} // namespace core
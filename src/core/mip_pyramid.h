@@ -0,0 +1,85 @@
+#pragma once
+
+#include <QRect>
+#include <QSize>
+#include <cstdint>
+#include <vector>
+#include "tile_storage.h"
+
+namespace core {
+
+/**
+ * @brief Lazily built mip levels of a tiled image
+ *
+ * Level n is the base image reduced by 2^n with a 2x2 box filter on
+ * premultiplied pixels. Levels are only built when first requested, and an
+ * edit only marks the tiles it touches on each level, so the next request
+ * recomputes just those tiles, along with the tiles of lower levels they are
+ * reduced from. Uniform 2x2 tile blocks reduce to a uniform tile without
+ * touching pixels.
+ *
+ * A level can also be provided ready-made (setLevel()), as document files
+ * do with their overview; reading it then never touches the base, and an
+ * edit only rebuilds the part of it that changed.
+ *
+ * Not thread-safe: level() mutates the pyramid and is meant to be called
+ * from the thread that owns the layer. The returned storage can be copied
+ * into a snapshot and read elsewhere.
+ */
+class MipPyramid {
+public:
+    /**
+     * @brief Longest side of the overview level
+     */
+    static constexpr int OverviewSize = 1024;
+
+    /**
+     * @brief First level whose longest side is at most OverviewSize, for
+     * an image of the given size
+     */
+    static int overviewLevel(const QSize& size);
+
+    /**
+     * @brief Get a level of the pyramid, bringing it up to date first
+     *
+     * Level 0 is the base itself. Levels are clamped so the result is at
+     * least one pixel wide and high.
+     */
+    const TileStorage& level(const TileStorage& base, int level);
+
+    /**
+     * @brief Provide a level built elsewhere for a base of the given size
+     *
+     * Ignored unless `tiles` has the size that level would have. Levels
+     * below it are left unbuilt until a request needs them.
+     */
+    void setLevel(const QSize& baseSize, int level, const TileStorage& tiles);
+
+    /**
+     * @brief Mark an area of the base (level 0 coordinates) as changed
+     */
+    void invalidate(const QRect& rect);
+
+    /**
+     * @brief Drop all levels
+     */
+    void clear();
+
+    size_t memoryUsage() const;
+
+private:
+    struct Level {
+        TileStorage tiles;
+        std::vector<uint8_t> dirty;
+        bool hasDirty = true;
+    };
+
+    int maxLevel() const;
+    void addLevels(int count);
+    void reduceTile(const TileStorage& source, TileStorage& target, int tx, int ty);
+
+    QSize m_baseSize;
+    std::vector<Level> m_levels;  // m_levels[i] holds level i + 1
+};
+
+} // namespace core
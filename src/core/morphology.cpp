@@ -0,0 +1,190 @@
+#include "morphology.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace core {
+namespace morphology {
+
+namespace {
+
+constexpr int ColumnBlock = 64;     // Columns per task in the column sweep
+constexpr int RowBlock = 16;        // Rows per task in the envelope pass
+
+// Stands for "no pixel" while squared distances are summed; large enough
+// never to win, small enough to keep the envelope arithmetic finite
+constexpr float kFar = 1e20f;
+
+// Squared distance from every pixel to the nearest selected one, where
+// `selected(value)` picks the pixels distances are measured to
+template <typename Select>
+std::vector<float> squaredDistance(const AlphaPlane& plane, Select selected)
+{
+    const int width = plane.rect().width();
+    const int height = plane.rect().height();
+    std::vector<float> result(static_cast<size_t>(width) * height);
+    const float* values = plane.data();
+
+    // Down the columns: nearest selected pixel in the same column, found
+    // with one sweep each way. Blocks of columns keep the reads in cache.
+    const int columnBlocks = (width + ColumnBlock - 1) / ColumnBlock;
+    ThreadPool::global().parallelFor(0, columnBlocks, [&](int block) {
+        const int x0 = block * ColumnBlock;
+        const int x1 = std::min(x0 + ColumnBlock, width);
+        float last[ColumnBlock];
+        std::fill(last, last + ColumnBlock, -1.0f);
+
+        for (int y = 0; y < height; ++y) {
+            const float* in = values + static_cast<size_t>(y) * width;
+            float* out = result.data() + static_cast<size_t>(y) * width;
+            for (int x = x0; x < x1; ++x) {
+                float& seen = last[x - x0];
+                if (selected(in[x])) seen = static_cast<float>(y);
+                out[x] = seen < 0.0f ? kFar : y - seen;
+            }
+        }
+
+        std::fill(last, last + ColumnBlock, -1.0f);
+        for (int y = height - 1; y >= 0; --y) {
+            float* out = result.data() + static_cast<size_t>(y) * width;
+            for (int x = x0; x < x1; ++x) {
+                float& seen = last[x - x0];
+                if (out[x] == 0.0f) seen = static_cast<float>(y);
+                const float below = seen < 0.0f ? kFar : seen - y;
+                const float nearest = std::min(out[x], below);
+                out[x] = nearest >= kFar ? kFar : nearest * nearest;
+            }
+        }
+    });
+
+    // Along the rows: the lower envelope of the parabolas rooted at each
+    // column's result gives the exact two-dimensional distance
+    const int rowBlocks = (height + RowBlock - 1) / RowBlock;
+    ThreadPool::global().parallelFor(0, rowBlocks, [&](int block) {
+        std::vector<float> line(width);
+        std::vector<int> roots(width);
+        std::vector<double> bounds(width + 1);
+        constexpr double infinity = std::numeric_limits<double>::infinity();
+
+        const int y1 = std::min((block + 1) * RowBlock, height);
+        for (int y = block * RowBlock; y < y1; ++y) {
+            float* row = result.data() + static_cast<size_t>(y) * width;
+            if (std::all_of(row, row + width, [](float v) { return v >= kFar; })) continue;
+            std::copy(row, row + width, line.begin());
+
+            // Intersections in double: q * q is no longer exact in float
+            // past a few thousand pixels
+            int k = 0;
+            roots[0] = 0;
+            bounds[0] = -infinity;
+            bounds[1] = infinity;
+            for (int q = 1; q < width; ++q) {
+                const double fq = line[q] + static_cast<double>(q) * q;
+                double s;
+                for (;;) {
+                    const int r = roots[k];
+                    s = (fq - (line[r] + static_cast<double>(r) * r)) / (2.0 * (q - r));
+                    if (s > bounds[k]) break;
+                    --k;
+                }
+                ++k;
+                roots[k] = q;
+                bounds[k] = s;
+                bounds[k + 1] = infinity;
+            }
+
+            k = 0;
+            for (int q = 0; q < width; ++q) {
+                while (bounds[k + 1] < q) ++k;
+                const float dx = static_cast<float>(q - roots[k]);
+                row[q] = std::min(kFar, dx * dx + line[roots[k]]);
+            }
+        }
+    });
+
+    return result;
+}
+
+bool covered(float value) { return value >= 0.5f; }
+bool uncovered(float value) { return value < 0.5f; }
+
+// Replace the plane with f(distance to covered, distance to uncovered),
+// computing only the transforms `f` needs
+template <typename Map>
+void mapDistances(AlphaPlane& plane, bool outside, bool inside, Map map)
+{
+    if (plane.isNull()) return;
+    std::vector<float> toCovered, toUncovered;
+    if (outside) toCovered = squaredDistance(plane, covered);
+    if (inside) toUncovered = squaredDistance(plane, uncovered);
+
+    const int width = plane.rect().width();
+    const int height = plane.rect().height();
+    float* values = plane.data();
+    ThreadPool::global().parallelFor(0, height, [&](int y) {
+        const size_t begin = static_cast<size_t>(y) * width;
+        for (size_t i = begin; i < begin + width; ++i) {
+            const float out = outside ? std::sqrt(toCovered[i]) : 0.0f;
+            const float in = inside ? std::sqrt(toUncovered[i]) : 0.0f;
+            values[i] = map(values[i], out, in);
+        }
+    });
+}
+
+float clamp01(float value)
+{
+    return std::clamp(value, 0.0f, 1.0f);
+}
+
+} // namespace
+
+AlphaPlane distance(const AlphaPlane& coverage, bool inverse)
+{
+    AlphaPlane result(coverage.rect());
+    if (coverage.isNull()) return result;
+
+    const std::vector<float> squared = inverse ? squaredDistance(coverage, uncovered)
+                                               : squaredDistance(coverage, covered);
+    std::transform(squared.begin(), squared.end(), result.data(), [](float v) {
+        return v >= kFar ? std::numeric_limits<float>::infinity() : std::sqrt(v);
+    });
+    return result;
+}
+
+// Covered pixels are 0 from the covered set and their edge lies half a
+// pixel out, so a pixel `d` away is covered by an edge moved out to
+// radius + 0.5 by about radius + 1 - d.
+void grow(AlphaPlane& plane, float radius)
+{
+    if (!(radius > 0.0f)) return;
+    mapDistances(plane, true, false, [radius](float value, float out, float) {
+        return std::max(value, clamp01(radius + 1.0f - out));
+    });
+}
+
+void shrink(AlphaPlane& plane, float radius)
+{
+    if (!(radius > 0.0f)) return;
+    mapDistances(plane, false, true, [radius](float value, float, float in) {
+        return std::min(value, clamp01(in - radius));
+    });
+}
+
+void border(AlphaPlane& plane, float width)
+{
+    if (!(width > 0.0f)) {
+        plane = AlphaPlane(plane.rect());
+        return;
+    }
+    const float half = width * 0.5f;
+    mapDistances(plane, true, true, [half](float value, float out, float in) {
+        const float outer = covered(value) ? 1.0f : clamp01(half + 1.0f - out);
+        const float inner = covered(value) ? clamp01(in - half) : 0.0f;
+        return outer - inner;
+    });
+}
+
+} // namespace morphology
+} // namespace core
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "blur.h"
+
+namespace core {
+
+/**
+ * @brief Grow, shrink and outline coverage by exact Euclidean distances
+ *
+ * Built on a two-pass distance transform (Felzenszwalb and Huttenlocher's
+ * lower envelope of parabolas): a sweep down the columns, then the
+ * envelope along the rows. Both passes are linear in the number of pixels
+ * whatever the distances involved, so growing by 2 or by 500 pixels costs
+ * the same. Column blocks and rows are spread over the global ThreadPool.
+ *
+ * A pixel counts as covered when its value is at least 0.5; results are
+ * anti-aliased over about one pixel. Values beyond the plane count as
+ * uncovered and are never used as the nearest pixel, so to work on part of
+ * a larger image cut the plane with a halo of ceil(distance) + 1 pixels.
+ */
+namespace morphology {
+
+/**
+ * @brief Distance from every pixel centre to the nearest covered pixel
+ * centre, or to the nearest uncovered one with `inverse`
+ *
+ * Pixels with no such pixel in the plane get infinity.
+ */
+AlphaPlane distance(const AlphaPlane& coverage, bool inverse = false);
+
+/**
+ * @brief Cover everything within `radius` of the covered pixels
+ */
+void grow(AlphaPlane& plane, float radius);
+
+/**
+ * @brief Keep only what lies deeper than `radius` inside the covered pixels
+ */
+void shrink(AlphaPlane& plane, float radius);
+
+/**
+ * @brief Replace the coverage with a band `width` wide centred on its edge
+ */
+void border(AlphaPlane& plane, float width);
+
+} // namespace morphology
+
+} // namespace core
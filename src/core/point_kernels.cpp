@@ -0,0 +1,121 @@
+#include "point_kernels.h"
+#include <algorithm>
+#include <cmath>
+
+namespace core {
+namespace blend {
+
+ToneParams ToneParams::levels(float inputBlack, float inputWhite, float gamma,
+                              float outputBlack, float outputWhite)
+{
+    ToneParams params;
+    params.black = inputBlack;
+    params.scale = 1.0f / std::max(inputWhite - inputBlack, 1.0f / 255.0f);
+    params.invGamma = 1.0f / std::max(gamma, 0.01f);
+    params.gain = outputWhite - outputBlack;
+    params.offset = outputBlack;
+    return params;
+}
+
+ToneParams ToneParams::brightnessContrast(float brightness, float contrast)
+{
+    // +1 contrast approaches a hard threshold
+    contrast = std::clamp(contrast, -1.0f, 1.0f);
+    const float factor = contrast >= 0.0f ? 1.0f / std::max(1.0f - contrast, 0.01f) : 1.0f + contrast;
+
+    ToneParams params;
+    params.gain = factor;
+    params.offset = (brightness - 0.5f) * factor + 0.5f;
+    return params;
+}
+
+bool ToneParams::isIdentity() const
+{
+    return black == 0.0f && scale == 1.0f && invGamma == 1.0f && gain == 1.0f && offset == 0.0f;
+}
+
+float ToneParams::map(float x) const
+{
+    float t = std::clamp((x - black) * scale, 0.0f, 1.0f);
+    if (invGamma != 1.0f) {
+        t = std::pow(t, invGamma);
+    }
+    return std::clamp(t * gain + offset, 0.0f, 1.0f);
+}
+
+ToneRowFunc toneRowFunction(SimdLevel level)
+{
+#if defined(CORE_X86_SIMD)
+    if (level > supportedSimdLevel()) {
+        level = supportedSimdLevel();
+    }
+    switch (level) {
+        case SimdLevel::AVX2: return detail::avx2ToneKernel();
+        case SimdLevel::SSE41: return detail::sse41ToneKernel();
+        case SimdLevel::Scalar: break;
+    }
+#else
+    (void)level;
+#endif
+    return detail::scalarToneKernel();
+}
+
+HslRowFunc hslRowFunction(SimdLevel level)
+{
+#if defined(CORE_X86_SIMD)
+    if (level > supportedSimdLevel()) {
+        level = supportedSimdLevel();
+    }
+    switch (level) {
+        case SimdLevel::AVX2: return detail::avx2HslKernel();
+        case SimdLevel::SSE41: return detail::sse41HslKernel();
+        case SimdLevel::Scalar: break;
+    }
+#else
+    (void)level;
+#endif
+    return detail::scalarHslKernel();
+}
+
+ToneRowFunc toneRowFunction()
+{
+    return toneRowFunction(activeSimdLevel());
+}
+
+HslRowFunc hslRowFunction()
+{
+    return hslRowFunction(activeSimdLevel());
+}
+
+ToneTable toneTable(const ToneParams& params)
+{
+    ToneTable table;
+    for (int i = 0; i < 256; ++i) {
+        table[i] = static_cast<uint8_t>(params.map(i / 255.0f) * 255.0f + 0.5f);
+    }
+    return table;
+}
+
+void toneRow(uint32_t* pixels, int count, const ToneParams& params, const ToneTable& table,
+             ToneRowFunc kernel)
+{
+    int i = 0;
+    while (i < count) {
+        for (; i < count && (pixels[i] >> 24) == 0xff; ++i) {
+            const uint32_t p = pixels[i];
+            pixels[i] = 0xff000000u
+                | (static_cast<uint32_t>(table[(p >> 16) & 0xff]) << 16)
+                | (static_cast<uint32_t>(table[(p >> 8) & 0xff]) << 8)
+                | table[p & 0xff];
+        }
+
+        const int start = i;
+        while (i < count && (pixels[i] >> 24) != 0xff) ++i;
+        if (i > start) {
+            kernel(pixels + start, i - start, params);
+        }
+    }
+}
+
+} // namespace blend
+} // namespace core
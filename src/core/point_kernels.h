@@ -0,0 +1,102 @@
+#pragma once
+
+#include "cpu_features.h"
+#include <array>
+#include <cstdint>
+
+namespace core {
+namespace blend {
+
+/**
+ * @brief Per-channel tone curve shared by levels and brightness/contrast
+ *
+ * Maps a straight channel value x in [0, 1] to
+ *   clamp(pow(clamp((x - black) * scale), invGamma) * gain + offset)
+ */
+struct ToneParams {
+    float black = 0.0f;
+    float scale = 1.0f;
+    float invGamma = 1.0f;
+    float gain = 1.0f;
+    float offset = 0.0f;
+
+    /**
+     * @brief Input range, midtone gamma and output range, all in [0, 1]
+     */
+    static ToneParams levels(float inputBlack, float inputWhite, float gamma,
+                             float outputBlack = 0.0f, float outputWhite = 1.0f);
+
+    /**
+     * @brief Brightness and contrast in [-1, 1]; contrast pivots on mid grey
+     */
+    static ToneParams brightnessContrast(float brightness, float contrast);
+
+    bool isIdentity() const;
+
+    /**
+     * @brief Scalar reference of the curve
+     */
+    float map(float x) const;
+};
+
+/**
+ * @brief Hue rotation in degrees, saturation and lightness in [-1, 1]
+ */
+struct HslParams {
+    float hue = 0.0f;
+    float saturation = 0.0f;
+    float lightness = 0.0f;
+
+    bool isIdentity() const { return hue == 0.0f && saturation == 0.0f && lightness == 0.0f; }
+};
+
+/**
+ * @brief Point operations on a row of premultiplied ARGB32 pixels, in place
+ *
+ * The float kernels unpremultiply, evaluate in float and premultiply again
+ * without rounding in between, so translucent pixels keep all the
+ * precision their alpha allows. Alpha is kept.
+ */
+using ToneRowFunc = void (*)(uint32_t* pixels, int count, const ToneParams& params);
+using HslRowFunc = void (*)(uint32_t* pixels, int count, const HslParams& params);
+
+/**
+ * @brief Kernels at the active SIMD level
+ */
+ToneRowFunc toneRowFunction();
+HslRowFunc hslRowFunction();
+
+/**
+ * @brief Kernels at a specific level (falls back to scalar)
+ */
+ToneRowFunc toneRowFunction(SimdLevel level);
+HslRowFunc hslRowFunction(SimdLevel level);
+
+using ToneTable = std::array<uint8_t, 256>;
+
+/**
+ * @brief The tone curve sampled at every 8-bit value
+ */
+ToneTable toneTable(const ToneParams& params);
+
+/**
+ * @brief Tone-map a row, picking the path per run of pixels
+ *
+ * Opaque runs go through `table`, which is exact for 8-bit input; runs of
+ * translucent pixels go through `kernel`.
+ */
+void toneRow(uint32_t* pixels, int count, const ToneParams& params, const ToneTable& table,
+             ToneRowFunc kernel);
+
+namespace detail {
+// One kernel per instruction set
+ToneRowFunc scalarToneKernel();
+ToneRowFunc sse41ToneKernel();
+ToneRowFunc avx2ToneKernel();
+HslRowFunc scalarHslKernel();
+HslRowFunc sse41HslKernel();
+HslRowFunc avx2HslKernel();
+} // namespace detail
+
+} // namespace blend
+} // namespace core
@@ -0,0 +1,174 @@
+#pragma once
+
+// Point-operation kernels shared by every instruction set.
+//
+// Included after blend_kernels_impl.h and lut_kernels_impl.h by the same
+// per-instruction-set units, so it reuses their VecF, select, vfloor,
+// loadPixels, storePixels and unpremultiply. Each unit also defines, inside
+// its anonymous namespace:
+//   mantissa(VecF x, VecF& exponent)   x = m * 2^exponent, m in [1, 2), x > 0
+//   pow2i(VecF n)                      2^n for whole n in [-126, 127]
+
+#include "point_kernels.h"
+
+namespace core {
+namespace blend {
+namespace {
+
+inline VecF vlog2(VecF x)
+{
+    VecF exponent;
+    VecF m = mantissa(x, exponent);
+
+    // Centre the mantissa on 1 so the series below converges quickly
+    const MaskF high = m > VecF(1.41421356f);
+    m = select(high, m * VecF(0.5f), m);
+    exponent = select(high, exponent + VecF(1.0f), exponent);
+
+    // log2(m) = 2/ln2 * atanh(t), t = (m - 1) / (m + 1), |t| < 0.172
+    const VecF t = (m - VecF(1.0f)) / (m + VecF(1.0f));
+    const VecF t2 = t * t;
+    VecF series = VecF(0.32059890f);
+    series = series * t2 + VecF(0.41219858f);
+    series = series * t2 + VecF(0.57707802f);
+    series = series * t2 + VecF(0.96179669f);
+    series = series * t2 + VecF(2.88539008f);
+    return exponent + series * t;
+}
+
+inline VecF vexp2(VecF x)
+{
+    x = vmin(vmax(x, VecF(-126.0f)), VecF(126.0f));
+    const VecF whole = vfloor(x);
+    const VecF f = (x - whole) * VecF(0.69314718f);
+
+    // e^f for f in [0, ln2), Taylor to the ninth power
+    VecF p = VecF(1.0f / 362880.0f);
+    p = p * f + VecF(1.0f / 40320.0f);
+    p = p * f + VecF(1.0f / 5040.0f);
+    p = p * f + VecF(1.0f / 720.0f);
+    p = p * f + VecF(1.0f / 120.0f);
+    p = p * f + VecF(1.0f / 24.0f);
+    p = p * f + VecF(1.0f / 6.0f);
+    p = p * f + VecF(0.5f);
+    p = p * f + VecF(1.0f);
+    p = p * f + VecF(1.0f);
+    return p * pow2i(whole);
+}
+
+// x^y for x in [0, 1], y > 0
+inline VecF vpow01(VecF x, VecF y)
+{
+    const VecF result = vexp2(y * vlog2(vmax(x, VecF(1e-30f))));
+    return select(x <= VecF(0.0f), VecF(0.0f), result);
+}
+
+template <bool Gamma>
+inline void toneBlock(uint32_t* pixels, const ToneParams& params)
+{
+    Rgba c;
+    loadPixels(pixels, c.r, c.g, c.b, c.a);
+
+    const VecF black(params.black);
+    const VecF scale(params.scale);
+    const VecF invGamma(params.invGamma);
+    const VecF gain(params.gain);
+    const VecF offset(params.offset);
+    auto curve = [&](VecF x) {
+        VecF t = clamp01((x - black) * scale);
+        if constexpr (Gamma) {
+            t = vpow01(t, invGamma);
+        }
+        return clamp01(t * gain + offset) * c.a;
+    };
+
+    storePixels(pixels, curve(unpremultiply(c.r, c.a)), curve(unpremultiply(c.g, c.a)),
+                curve(unpremultiply(c.b, c.a)), c.a);
+}
+
+inline VecF hueChannel(VecF p, VecF q, VecF t)
+{
+    t = t - vfloor(t);
+    const VecF rising = p + (q - p) * VecF(6.0f) * t;
+    const VecF falling = p + (q - p) * (VecF(2.0f / 3.0f) - t) * VecF(6.0f);
+    return select(t < VecF(1.0f / 6.0f), rising,
+                  select(t < VecF(0.5f), q,
+                         select(t < VecF(2.0f / 3.0f), falling, p)));
+}
+
+inline void hslBlock(uint32_t* pixels, const HslParams& params)
+{
+    Rgba c;
+    loadPixels(pixels, c.r, c.g, c.b, c.a);
+    const VecF r = unpremultiply(c.r, c.a);
+    const VecF g = unpremultiply(c.g, c.a);
+    const VecF b = unpremultiply(c.b, c.a);
+
+    const VecF one(1.0f);
+    const VecF maxC = vmax(r, vmax(g, b));
+    const VecF minC = vmin(r, vmin(g, b));
+    const VecF sum = maxC + minC;
+    const VecF d = maxC - minC;
+    const VecF safeD = vmax(d, VecF(kEpsilon));
+    const MaskF grey = d <= VecF(0.0f);
+    VecF l = sum * VecF(0.5f);
+
+    VecF s = select(l > VecF(0.5f), d / vmax(VecF(2.0f) - sum, VecF(kEpsilon)), d / vmax(sum, VecF(kEpsilon)));
+    s = select(grey, VecF(0.0f), s);
+
+    const VecF hr = (g - b) / safeD + select(g < b, VecF(6.0f), VecF(0.0f));
+    const VecF hg = (b - r) / safeD + VecF(2.0f);
+    const VecF hb = (r - g) / safeD + VecF(4.0f);
+    VecF h = select(r >= maxC, hr, select(g >= maxC, hg, hb)) * VecF(1.0f / 6.0f);
+    h = select(grey, VecF(0.0f), h) + VecF(params.hue / 360.0f);
+
+    s = clamp01(s * VecF(1.0f + params.saturation));
+    l = params.lightness >= 0.0f ? l + (one - l) * VecF(params.lightness)
+                                 : l * VecF(1.0f + params.lightness);
+
+    const VecF q = select(l < VecF(0.5f), l * (one + s), l + s - l * s);
+    const VecF p = l + l - q;
+    storePixels(pixels,
+                clamp01(hueChannel(p, q, h + VecF(1.0f / 3.0f))) * c.a,
+                clamp01(hueChannel(p, q, h)) * c.a,
+                clamp01(hueChannel(p, q, h - VecF(1.0f / 3.0f))) * c.a,
+                c.a);
+}
+
+template <typename Params, typename Block>
+inline void pointRow(uint32_t* pixels, int count, const Params& params, Block block)
+{
+    constexpr int W = VecF::Width;
+    int i = 0;
+    for (; i + W <= count; i += W) {
+        block(pixels + i, params);
+    }
+
+    if (i < count) {
+        const int rest = count - i;
+        uint32_t p[W] = {};
+        std::memcpy(p, pixels + i, rest * sizeof(uint32_t));
+        block(p, params);
+        std::memcpy(pixels + i, p, rest * sizeof(uint32_t));
+    }
+}
+
+void toneRowKernel(uint32_t* pixels, int count, const ToneParams& params)
+{
+    if (count <= 0) return;
+    if (params.invGamma == 1.0f) {
+        pointRow(pixels, count, params, &toneBlock<false>);
+    } else {
+        pointRow(pixels, count, params, &toneBlock<true>);
+    }
+}
+
+void hslRowKernel(uint32_t* pixels, int count, const HslParams& params)
+{
+    if (count <= 0) return;
+    pointRow(pixels, count, params, &hslBlock);
+}
+
+} // namespace
+} // namespace blend
+} // namespace core
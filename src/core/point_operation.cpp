@@ -0,0 +1,49 @@
+#include "point_operation.h"
+
+namespace core {
+
+PointOperation::PointOperation(Kind kind)
+    : m_kind(kind)
+    , m_toneKernel(blend::toneRowFunction())
+    , m_hslKernel(blend::hslRowFunction())
+{
+}
+
+PointOperation PointOperation::brightnessContrast(float brightness, float contrast)
+{
+    PointOperation operation(Kind::BrightnessContrast);
+    operation.m_tone = blend::ToneParams::brightnessContrast(brightness / 100.0f, contrast / 100.0f);
+    operation.m_table = blend::toneTable(operation.m_tone);
+    return operation;
+}
+
+PointOperation PointOperation::hueSaturation(float hue, float saturation, float lightness)
+{
+    PointOperation operation(Kind::HueSaturation);
+    operation.m_hsl = {hue, saturation / 100.0f, lightness / 100.0f};
+    return operation;
+}
+
+PointOperation PointOperation::levels(float blackPoint, float whitePoint, float gamma)
+{
+    PointOperation operation(Kind::Levels);
+    operation.m_tone = blend::ToneParams::levels(blackPoint / 255.0f, whitePoint / 255.0f, gamma);
+    operation.m_table = blend::toneTable(operation.m_tone);
+    return operation;
+}
+
+bool PointOperation::isIdentity() const
+{
+    return m_kind == Kind::HueSaturation ? m_hsl.isIdentity() : m_tone.isIdentity();
+}
+
+void PointOperation::applyRow(uint32_t* pixels, int count) const
+{
+    if (m_kind == Kind::HueSaturation) {
+        m_hslKernel(pixels, count, m_hsl);
+    } else {
+        blend::toneRow(pixels, count, m_tone, m_table, m_toneKernel);
+    }
+}
+
+} // namespace core
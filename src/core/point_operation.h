@@ -0,0 +1,59 @@
+#pragma once
+
+#include "point_kernels.h"
+#include <cstdint>
+
+namespace core {
+
+/**
+ * @brief A destructive per-pixel colour adjustment
+ *
+ * Takes its parameters in the units the adjustment panels use and runs the
+ * point kernels from point_kernels.h. Per-channel curves (levels,
+ * brightness/contrast) send opaque pixels through an 8-bit table and
+ * translucent ones through the float kernel; hue/saturation always runs
+ * in float. Immutable once built, so rows can be adjusted from any thread.
+ */
+class PointOperation {
+public:
+    enum class Kind {
+        BrightnessContrast,
+        HueSaturation,
+        Levels
+    };
+
+    /**
+     * @brief Brightness and contrast in -100..100
+     */
+    static PointOperation brightnessContrast(float brightness, float contrast);
+
+    /**
+     * @brief Hue in -180..180 degrees, saturation and lightness in -100..100
+     */
+    static PointOperation hueSaturation(float hue, float saturation, float lightness);
+
+    /**
+     * @brief Input black and white points in 0..255 and midtone gamma
+     */
+    static PointOperation levels(float blackPoint, float whitePoint, float gamma);
+
+    Kind kind() const { return m_kind; }
+    bool isIdentity() const;
+
+    /**
+     * @brief Adjust premultiplied ARGB32 pixels in place
+     */
+    void applyRow(uint32_t* pixels, int count) const;
+
+private:
+    explicit PointOperation(Kind kind);
+
+    Kind m_kind;
+    blend::ToneParams m_tone;
+    blend::ToneTable m_table{};
+    blend::HslParams m_hsl;
+    blend::ToneRowFunc m_toneKernel = nullptr;
+    blend::HslRowFunc m_hslKernel = nullptr;
+};
+
+} // namespace core
@@ -0,0 +1,133 @@
+#include "render_snapshot.h"
+#include "blend_kernels.h"
+#include <algorithm>
+
+namespace core {
+
+namespace {
+
+// dst + (src - dst) * weight / 256 per channel. Adjusted pixels keep their
+// alpha, so mixing is the right way to apply an adjustment at part strength
+// (source-over would darken semi-transparent areas).
+void mixRow(QRgb* dst, const QRgb* src, int count, int weight)
+{
+    for (int i = 0; i < count; ++i) {
+        const QRgb d = dst[i];
+        const QRgb s = src[i];
+        dst[i] = qRgba(qRed(d) + (((qRed(s) - qRed(d)) * weight) >> 8),
+                       qGreen(d) + (((qGreen(s) - qGreen(d)) * weight) >> 8),
+                       qBlue(d) + (((qBlue(s) - qBlue(d)) * weight) >> 8),
+                       qAlpha(d));
+    }
+}
+
+class FunctionSource : public RenderSnapshot::Source {
+public:
+    explicit FunctionSource(std::function<TileStorage(QPoint*)> produce)
+        : m_produce(std::move(produce))
+    {
+    }
+
+    TileStorage produce(QPoint* offset) const override { return m_produce(offset); }
+
+private:
+    std::function<TileStorage(QPoint*)> m_produce;
+};
+
+} // namespace
+
+std::shared_ptr<const RenderSnapshot::Source> RenderSnapshot::makeSource(std::function<TileStorage(QPoint*)> produce)
+{
+    return std::make_shared<FunctionSource>(std::move(produce));
+}
+
+RenderSnapshot::RenderSnapshot(const QSize& size, int level, std::vector<LayerState> layers)
+    : m_size(size)
+    , m_level(level)
+    , m_layers(std::move(layers))
+    , m_prepared(new std::once_flag[m_layers.size()])
+{
+}
+
+const RenderSnapshot::LayerState& RenderSnapshot::prepared(size_t index) const
+{
+    LayerState& layer = m_layers[index];
+    std::call_once(m_prepared[index], [&layer]() {
+        if (layer.adjustment && layer.lutSize > 0) {
+            layer.adjustment = layer.adjustment->baked(layer.lutSize);
+        }
+        if (!layer.source) return;
+        QPoint offset;
+        layer.tiles = layer.source->produce(&offset);
+        layer.position -= offset;
+        layer.source.reset();
+    });
+    return layer;
+}
+
+void RenderSnapshot::composite(QImage& target, const QPoint& origin, const QRect& area) const
+{
+    // Render layers from bottom to top
+    for (size_t i = 0; i < m_layers.size(); ++i) {
+        const LayerState& layer = prepared(i);
+        if (layer.adjustment) {
+            applyAdjustment(layer, target, origin, area);
+            continue;
+        }
+        
+        QRect layerBounds(layer.position, layer.tiles.size());
+        QRect visible = area & layerBounds;
+        if (visible.isEmpty()) continue;
+
+        // Blend mode and opacity are applied by the kernel, one row span at a time
+        const blend::RowFunc blendRow = blend::rowFunction(layer.blendMode);
+        const float opacity = layer.opacity;
+        const QPoint layerPos = layer.position;
+        layer.tiles.forEachSpan(visible.translated(-layerPos),
+            [&](int x, int y, const QRgb* pixels, int count) {
+                const int docX = x + layerPos.x();
+                const int docY = y + layerPos.y();
+                QRgb* line = reinterpret_cast<QRgb*>(target.scanLine(docY - origin.y())) + (docX - origin.x());
+                blendRow(line, pixels, count, opacity, docX, docY);
+            });
+    }
+}
+
+void RenderSnapshot::applyAdjustment(const LayerState& layer, QImage& target, const QPoint& origin,
+                                     const QRect& area) const
+{
+    const QRect targetArea = area.translated(-origin);
+    if (layer.blendMode == BlendMode::Normal && layer.opacity >= 1.0f) {
+        layer.adjustment->apply(target, targetArea);
+        return;
+    }
+    
+    // Partial strength or another mode: adjust a copy of each row, then
+    // combine it with the original
+    const bool mix = layer.blendMode == BlendMode::Normal;
+    const int weight = static_cast<int>(std::clamp(layer.opacity, 0.0f, 1.0f) * 256.0f + 0.5f);
+    const blend::RowFunc blendRow = blend::rowFunction(layer.blendMode);
+    std::vector<QRgb> row(static_cast<size_t>(area.width()));
+    for (int y = area.top(); y <= area.bottom(); ++y) {
+        QRgb* line = reinterpret_cast<QRgb*>(target.scanLine(y - origin.y())) + (area.left() - origin.x());
+        std::copy(line, line + area.width(), row.begin());
+        layer.adjustment->applyRow(row.data(), area.width());
+        if (mix) {
+            mixRow(line, row.data(), area.width(), weight);
+        } else {
+            blendRow(line, row.data(), area.width(), layer.opacity, area.left(), y);
+        }
+    }
+}
+
+QImage RenderSnapshot::render(const QRect& area) const
+{
+    if (area.isEmpty()) return QImage();
+
+    QImage image(area.size(), QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    composite(image, area.topLeft(), area);
+    return image;
+}
+
+} // namespace core
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+#include <QSize>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "adjustment_pipeline.h"
+#include "blend_mode.h"
+#include "tile_storage.h"
+
+namespace core {
+
+/**
+ * @brief Immutable view of a document's visible layers for compositing
+ *
+ * Taking a snapshot copies each layer's tile table, not its pixels: tiles
+ * are implicitly shared, so later edits detach their own copies and leave
+ * the snapshot untouched. A snapshot can therefore be composited on worker
+ * threads while the document keeps changing on the GUI thread.
+ *
+ * Snapshots taken at a mip level hold each raster layer's reduced tiles, so
+ * all coordinates (size, positions, areas) are at that level's scale.
+ *
+ * An entry with an adjustment pipeline instead of tiles recolours everything
+ * composited below it, over the whole canvas.
+ *
+ * Layers whose pixels take work to produce (mip levels, rasterized text)
+ * carry a Source instead of tiles. Taking the snapshot then costs no pixel
+ * work at all: the first thread to composite the snapshot produces each
+ * source once, and every other compositing thread waits for and shares
+ * that result. Adjustments to be previewed through a 3D LUT are baked the
+ * same way, unless their pipeline already holds the table.
+ */
+class RenderSnapshot {
+public:
+    /**
+     * @brief A layer's pixels, produced on first use
+     */
+    class Source {
+    public:
+        virtual ~Source() = default;
+
+        /**
+         * @brief The pixels at the snapshot's scale
+         *
+         * Called at most once per snapshot, on whichever thread composites
+         * first, so it must only read state captured at construction.
+         * `offset` receives how far above and left of the layer's position
+         * the result starts.
+         */
+        virtual TileStorage produce(QPoint* offset) const = 0;
+    };
+
+    /**
+     * @brief Source calling `produce`, which must only use what it captured
+     */
+    static std::shared_ptr<const Source> makeSource(std::function<TileStorage(QPoint* offset)> produce);
+
+    struct LayerState {
+        TileStorage tiles;
+        std::shared_ptr<const Source> source;   // Produces `tiles` when set
+        QPoint position;
+        BlendMode blendMode;
+        float opacity = 1.0f;
+        std::shared_ptr<const AdjustmentPipeline> adjustment;  // Set for adjustment layers
+        int lutSize = 0;    // When set, `adjustment` is baked into a 3D LUT of this size first
+    };
+
+    /**
+     * @param size Size at the snapshot's resolution
+     * @param level Mip level the layers were captured at (scale 1/2^level)
+     */
+    RenderSnapshot(const QSize& size, int level, std::vector<LayerState> layers);
+
+    QSize size() const { return m_size; }
+    QRect rect() const { return QRect(QPoint(0, 0), m_size); }
+    int level() const { return m_level; }
+
+    /**
+     * @brief Blend all layers over an area of a target image
+     *
+     * @param target Premultiplied ARGB32 image whose top-left is at origin
+     * @param area Area in snapshot coordinates, which must lie inside the target
+     */
+    void composite(QImage& target, const QPoint& origin, const QRect& area) const;
+
+    /**
+     * @brief Composite an area onto a transparent image
+     */
+    QImage render(const QRect& area) const;
+
+private:
+    // The layer with its source produced
+    const LayerState& prepared(size_t index) const;
+    void applyAdjustment(const LayerState& layer, QImage& target, const QPoint& origin, const QRect& area) const;
+
+    QSize m_size;
+    int m_level = 0;
+    mutable std::vector<LayerState> m_layers;   // Sources are replaced by their tiles
+    std::unique_ptr<std::once_flag[]> m_prepared;
+};
+
+} // namespace core
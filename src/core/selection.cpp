@@ -0,0 +1,457 @@
+#include "selection.h"
+#include "morphology.h"
+#include "selection_kernels.h"
+#include "thread_pool.h"
+#include <QDebug>
+#include <cmath>
+#include <cstring>
+
+namespace core {
+
+namespace {
+
+using blend::MaskOp;
+using blend::MaskRange;
+
+constexpr int TileSize = Selection::TileSize;
+
+QImage blankTile(uint8_t value)
+{
+    QImage image(TileSize, TileSize, QImage::Format_Alpha8);
+    for (int y = 0; y < TileSize; ++y) {
+        std::memset(image.scanLine(y), value, TileSize);
+    }
+    return image;
+}
+
+// Nonzero pixels of the `valid` part of a tile image
+QRect nonzeroBounds(const QImage& image, const QRect& valid)
+{
+    const int width = valid.width();
+    int left = width, right = -1, top = -1, bottom = -1;
+    for (int y = 0; y < valid.height(); ++y) {
+        const uint8_t* line = image.constScanLine(y);
+        uint8_t any = 0;
+        for (int x = 0; x < width; ++x) {
+            any |= line[x];
+        }
+        if (!any) continue;
+
+        // Only look for pixels beyond the bounds found so far
+        int x0 = 0;
+        while (x0 < left && line[x0] == 0) ++x0;
+        int x1 = width - 1;
+        while (x1 > right && line[x1] == 0) --x1;
+        left = std::min(left, x0);
+        right = std::max(right, x1);
+        if (top < 0) top = y;
+        bottom = y;
+    }
+    return top < 0 ? QRect() : QRect(left, top, right - left + 1, bottom - top + 1);
+}
+
+MaskRange valueRange(const QImage& image, const QRect& valid)
+{
+    MaskRange range;
+    for (int y = 0; y < valid.height(); ++y) {
+        const uint8_t* line = image.constScanLine(y);
+        for (int x = 0; x < valid.width(); ++x) {
+            range.low = std::min(range.low, line[x]);
+            range.high = std::max(range.high, line[x]);
+        }
+    }
+    return range;
+}
+
+uint8_t toCoverage(float value)
+{
+    return static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+MaskOp maskOp(Selection::Operation op)
+{
+    switch (op) {
+        case Selection::Operation::Subtract: return MaskOp::Subtract;
+        case Selection::Operation::Intersect: return MaskOp::Intersect;
+        default: return MaskOp::Add;
+    }
+}
+
+// Values s for which op(x, s) == x whatever x
+bool keepsTarget(MaskOp op, uint8_t s)
+{
+    return op == MaskOp::Intersect ? s == 255 : s == 0;
+}
+
+// Values s for which op(x, s) is the same whatever x
+bool decidesResult(MaskOp op, uint8_t s)
+{
+    return op == MaskOp::Intersect ? s == 0 : s == 255;
+}
+
+// Values t for which op(t, x) == x whatever x
+bool takesSource(MaskOp op, uint8_t t)
+{
+    return (op == MaskOp::Add && t == 0) || (op == MaskOp::Intersect && t == 255);
+}
+
+// Values t for which op(t, x) == t whatever x
+bool ignoresSource(MaskOp op, uint8_t t)
+{
+    return (op == MaskOp::Add && t == 255) || (op != MaskOp::Add && t == 0);
+}
+
+} // namespace
+
+Selection::Selection(const QSize& size)
+    : m_size(size.isValid() ? size : QSize())
+    , m_tilesX((m_size.width() + TileSize - 1) / TileSize)
+    , m_tilesY((m_size.height() + TileSize - 1) / TileSize)
+    , m_tiles(static_cast<size_t>(m_tilesX) * m_tilesY)
+{
+}
+
+QRect Selection::tileRect(int tx, int ty) const
+{
+    return QRect(tx * TileSize, ty * TileSize, TileSize, TileSize) & rect();
+}
+
+uint8_t Selection::value(int x, int y) const
+{
+    if (!m_bounds.contains(x, y)) return 0;
+    const Tile& tile = tileAt(x / TileSize, y / TileSize);
+    return tile.isUniform() ? tile.uniformValue()
+                            : tile.image().constScanLine(y % TileSize)[x % TileSize];
+}
+
+const uint8_t* Selection::tileRows(int tx, int ty, uint8_t* buffer, int* stride) const
+{
+    const Tile& tile = tileAt(tx, ty);
+    if (!tile.isUniform()) {
+        *stride = static_cast<int>(tile.image().bytesPerLine());
+        return tile.image().constBits();
+    }
+    if (tile.uniformValue() == 255) return nullptr;
+    std::fill(buffer, buffer + TileSize * TileSize, tile.uniformValue());
+    *stride = TileSize;
+    return buffer;
+}
+
+Selection::Coverage Selection::coverage(const QRect& area) const
+{
+    const QRect clipped = area & rect();
+    if (!clipped.intersects(m_bounds)) return Coverage::None;
+    if (clipped != area) return Coverage::Partial;
+
+    bool full = true;
+    const int tx1 = clipped.right() / TileSize;
+    const int ty1 = clipped.bottom() / TileSize;
+    for (int ty = clipped.top() / TileSize; ty <= ty1; ++ty) {
+        for (int tx = clipped.left() / TileSize; tx <= tx1; ++tx) {
+            const Tile& tile = tileAt(tx, ty);
+            if (tile.isUniform() && tile.uniformValue() == 255) continue;
+
+            // Something here is not selected: the area is partial as soon as
+            // anything is
+            full = false;
+            if (!tile.isUniform() || tile.uniformValue() != 0) {
+                const QRect part = (tileRect(tx, ty) & clipped).translated(-tx * TileSize, -ty * TileSize);
+                if (part.intersects(tile.bounds())) return Coverage::Partial;
+            }
+        }
+    }
+    // Some tile was full, or the area would have missed m_bounds
+    return full ? Coverage::Full : Coverage::Partial;
+}
+
+QImage Selection::copy(const QRect& area) const
+{
+    QImage image(area.size(), QImage::Format_Alpha8);
+    if (image.isNull()) return image;
+    image.fill(0);
+    forEachSpan(area & m_bounds, [&](int x, int y, const uint8_t* values, int count) {
+        std::memcpy(image.scanLine(y - area.top()) + (x - area.left()), values, count);
+    });
+    return image;
+}
+
+AlphaPlane Selection::toPlane(const QRect& area) const
+{
+    AlphaPlane plane(area);
+    forEachSpan(area & m_bounds, [&](int x, int y, const uint8_t* values, int count) {
+        float* out = plane.row(y) + x;
+        for (int i = 0; i < count; ++i) {
+            out[i] = values[i] * (1.0f / 255.0f);
+        }
+    });
+    return plane;
+}
+
+void Selection::clear()
+{
+    std::fill(m_tiles.begin(), m_tiles.end(), Tile());
+    m_bounds = QRect();
+}
+
+void Selection::selectAll()
+{
+    for (int ty = 0; ty < m_tilesY; ++ty) {
+        for (int tx = 0; tx < m_tilesX; ++tx) {
+            tileRef(tx, ty) = uniformTile(255, validRect(tx, ty));
+        }
+    }
+    m_bounds = rect();
+}
+
+void Selection::invert()
+{
+    const blend::MaskRowFunc subtract = blend::maskRowFunctions()[static_cast<int>(MaskOp::Subtract)];
+    ThreadPool::global().parallelFor(0, static_cast<int>(m_tiles.size()), [&](int index) {
+        const int tx = index % m_tilesX;
+        const int ty = index / m_tilesX;
+        const QRect valid = validRect(tx, ty);
+        Tile& tile = tileRef(tx, ty);
+        if (tile.isUniform()) {
+            tile = uniformTile(255 - tile.m_value, valid);
+            return;
+        }
+
+        // 255 - x, through the same kernels as everything else
+        QImage image = tile.m_image;
+        tile.m_image = QImage();    // Let the image detach only if shared elsewhere
+        MaskRange range;
+        uint8_t line[TileSize];
+        for (int y = 0; y < valid.height(); ++y) {
+            uint8_t* values = image.scanLine(y);
+            std::fill(line, line + valid.width(), 255);
+            subtract(line, values, valid.width(), range);
+            std::memcpy(values, line, valid.width());
+        }
+        setPixels(tile, image, valid, range);
+    });
+    updateBounds();
+}
+
+void Selection::combine(const QRect& area, Operation op)
+{
+    apply(op, [&](int tx, int ty, Tile& tile) {
+        const QRect valid = validRect(tx, ty);
+        const QRect part = (area & tileRect(tx, ty)).translated(-tx * TileSize, -ty * TileSize);
+        if (part.isEmpty()) {
+            // Nothing to add or subtract here
+            return op == Operation::Replace || op == Operation::Intersect;
+        }
+        if (part == valid) {
+            tile = uniformTile(255, valid);
+            return true;
+        }
+        tile.m_image = blankTile(0);
+        for (int y = part.top(); y <= part.bottom(); ++y) {
+            std::memset(tile.m_image.scanLine(y) + part.left(), 255, part.width());
+        }
+        tile.m_bounds = part;
+        return true;
+    });
+}
+
+void Selection::combine(const AlphaPlane& plane, Operation op)
+{
+    apply(op, [&](int tx, int ty, Tile& tile) {
+        if (!plane.rect().intersects(tileRect(tx, ty))) {
+            return op == Operation::Replace || op == Operation::Intersect;
+        }
+        tile = planeTile(plane, tx, ty, blankTile(0));
+        return true;
+    });
+}
+
+void Selection::combine(const Selection& other, Operation op)
+{
+    if (other.size() != m_size) {
+        qWarning() << "Selection::combine: sizes differ" << other.size() << m_size;
+        return;
+    }
+    apply(op, [&](int tx, int ty, Tile& tile) {
+        tile = other.tileAt(tx, ty);
+        return true;
+    });
+}
+
+void Selection::replaceTiles(const TileSource& source)
+{
+    apply(Operation::Replace, [&](int tx, int ty, Tile& tile) {
+        if (!source(tx, ty, tile)) return false;
+        const QRect valid = validRect(tx, ty);
+        if (tile.isUniform()) {
+            tile = uniformTile(tile.m_value, valid);
+        } else {
+            const QImage image = tile.m_image;
+            setPixels(tile, image, valid, valueRange(image, valid));
+        }
+        return true;
+    });
+}
+
+void Selection::feather(float radius)
+{
+    const float sigma = radius * 0.5f;
+    const int reach = blur::reach(sigma);
+    if (isEmpty() || reach <= 0) return;
+
+    // The plane reaches past the canvas, where it is 0, so the edge fades
+    AlphaPlane plane = toPlane(m_bounds.adjusted(-reach, -reach, reach, reach));
+    blur::gaussian(plane, sigma);
+    write(plane);
+}
+
+void Selection::grow(float radius)
+{
+    if (isEmpty() || !(radius > 0.0f)) return;
+    const int halo = static_cast<int>(std::ceil(radius)) + 1;
+    AlphaPlane plane = toPlane(m_bounds.adjusted(-halo, -halo, halo, halo) & rect());
+    morphology::grow(plane, radius);
+    write(plane);
+}
+
+void Selection::shrink(float radius)
+{
+    if (isEmpty() || !(radius > 0.0f)) return;
+    // One unselected pixel all round, past the canvas edge if need be, gives
+    // the distances something to be measured from
+    AlphaPlane plane = toPlane(m_bounds.adjusted(-1, -1, 1, 1));
+    morphology::shrink(plane, radius);
+    write(plane);
+}
+
+size_t Selection::memoryUsage() const
+{
+    size_t bytes = 0;
+    for (const Tile& tile : m_tiles) {
+        if (!tile.isUniform()) bytes += tile.m_image.sizeInBytes();
+    }
+    return bytes;
+}
+
+int Selection::allocatedTileCount() const
+{
+    return static_cast<int>(std::count_if(m_tiles.begin(), m_tiles.end(),
+                                          [](const Tile& tile) { return !tile.isUniform(); }));
+}
+
+QRect Selection::validRect(int tx, int ty) const
+{
+    return tileRect(tx, ty).translated(-tx * TileSize, -ty * TileSize);
+}
+
+Selection::Tile Selection::uniformTile(uint8_t value, const QRect& valid)
+{
+    Tile tile;
+    tile.m_value = value;
+    tile.m_bounds = value ? valid : QRect();
+    return tile;
+}
+
+void Selection::setPixels(Tile& tile, const QImage& image, const QRect& valid, const MaskRange& range)
+{
+    if (range.isFlat()) {
+        tile = uniformTile(range.low, valid);
+        return;
+    }
+    tile.m_image = image;
+    tile.m_bounds = range.low ? valid : nonzeroBounds(image, valid);
+}
+
+Selection::Tile Selection::planeTile(const AlphaPlane& plane, int tx, int ty, QImage image) const
+{
+    const QRect part = plane.rect() & tileRect(tx, ty);
+    for (int y = part.top(); y <= part.bottom(); ++y) {
+        const float* in = plane.row(y);
+        uint8_t* out = image.scanLine(y - ty * TileSize) - tx * TileSize;
+        for (int x = part.left(); x <= part.right(); ++x) {
+            out[x] = toCoverage(in[x]);
+        }
+    }
+
+    Tile tile;
+    const QRect valid = validRect(tx, ty);
+    setPixels(tile, image, valid, valueRange(image, valid));
+    return tile;
+}
+
+void Selection::apply(Operation op, const TileSource& source)
+{
+    const MaskOp maskOperation = maskOp(op);
+    const blend::MaskRowFunc kernel = blend::maskRowFunctions()[static_cast<int>(maskOperation)];
+
+    ThreadPool::global().parallelFor(0, static_cast<int>(m_tiles.size()), [&](int index) {
+        const int tx = index % m_tilesX;
+        const int ty = index / m_tilesX;
+        Tile incoming;
+        if (!source(tx, ty, incoming)) return;
+
+        Tile& tile = tileRef(tx, ty);
+        if (op == Operation::Replace) {
+            tile = incoming;
+            return;
+        }
+
+        // Resolve single values without touching pixels
+        const QRect valid = validRect(tx, ty);
+        if (incoming.isUniform()) {
+            const uint8_t s = incoming.m_value;
+            if (keepsTarget(maskOperation, s)) return;
+            if (tile.isUniform() || decidesResult(maskOperation, s)) {
+                tile = uniformTile(blend::applyMaskOp(maskOperation, tile.m_value, s), valid);
+                return;
+            }
+        } else if (tile.isUniform()) {
+            if (takesSource(maskOperation, tile.m_value)) {
+                tile = incoming;
+                return;
+            }
+            if (ignoresSource(maskOperation, tile.m_value)) return;
+        }
+
+        QImage image = tile.isUniform() ? blankTile(tile.m_value) : tile.m_image;
+        tile.m_image = QImage();    // Let the image detach only if shared elsewhere
+        uint8_t uniformRow[TileSize];
+        if (incoming.isUniform()) {
+            std::fill(uniformRow, uniformRow + TileSize, incoming.m_value);
+        }
+
+        MaskRange range;
+        for (int y = 0; y < valid.height(); ++y) {
+            const uint8_t* values = incoming.isUniform() ? uniformRow : incoming.m_image.constScanLine(y);
+            kernel(image.scanLine(y), values, valid.width(), range);
+        }
+        setPixels(tile, image, valid, range);
+    });
+    updateBounds();
+}
+
+void Selection::write(const AlphaPlane& plane)
+{
+    apply(Operation::Replace, [&](int tx, int ty, Tile& tile) {
+        if (!plane.rect().intersects(tileRect(tx, ty))) return false;
+
+        // Start from the tile as it is, so pixels outside the plane stay
+        const Tile& current = tileAt(tx, ty);
+        tile = planeTile(plane, tx, ty, current.isUniform() ? blankTile(current.m_value) : current.m_image);
+        return true;
+    });
+}
+
+void Selection::updateBounds()
+{
+    m_bounds = QRect();
+    for (int ty = 0; ty < m_tilesY; ++ty) {
+        for (int tx = 0; tx < m_tilesX; ++tx) {
+            const QRect bounds = tileAt(tx, ty).m_bounds;
+            if (!bounds.isEmpty()) {
+                m_bounds |= bounds.translated(tx * TileSize, ty * TileSize);
+            }
+        }
+    }
+}
+
+} // namespace core
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "blur.h"
+#include "selection_kernels.h"
+#include "tile_storage.h"
+
+namespace core {
+
+/**
+ * @brief Anti-aliased selection mask over a canvas, stored as sparse tiles
+ *
+ * Coverage is 8 bits per pixel, 0 unselected to 255 fully selected, cut
+ * into tiles of TileStorage::TileSize. A tile holding a single value, which
+ * is how wholly selected and unselected areas are kept, stores only that
+ * value; the others own an Alpha8 QImage whose implicit sharing makes copies
+ * of a selection copy-on-write per tile, as with TileStorage.
+ *
+ * Every tile also keeps the bounds of its nonzero pixels, so bounds() is
+ * tight and costs a pass over the tile grid to maintain. Filters and brushes
+ * clip with coverage(): an area it reports as None or Full needs no
+ * per-pixel work, and forEachSpan() hands out rows without copying.
+ *
+ * Combining works tile by tile over the global ThreadPool. Single-valued
+ * operands are resolved without touching pixels (adding to an empty tile
+ * shares the other's pixels, intersecting with a full one keeps them...);
+ * the rest go through the SIMD kernels of selection_kernels.h and collapse
+ * back to a single value when the result comes out flat.
+ *
+ * Beyond the canvas counts as unselected: feathering and shrinking a
+ * selection that touches the edge pull it away from the edge.
+ */
+class Selection {
+public:
+    static constexpr int TileSize = TileStorage::TileSize;
+
+    enum class Operation {
+        Replace,
+        Add,
+        Subtract,
+        Intersect
+    };
+
+    /**
+     * @brief How much of an area is selected
+     */
+    enum class Coverage {
+        None,
+        Partial,
+        Full
+    };
+
+    /**
+     * @brief A single tile, either uniform or backed by an Alpha8 image
+     */
+    class Tile {
+    public:
+        Tile() = default;
+        explicit Tile(uint8_t value) : m_value(value) {}
+        explicit Tile(const QImage& image) : m_image(image) {}
+
+        bool isUniform() const { return m_image.isNull(); }
+        uint8_t uniformValue() const { return m_value; }
+        const QImage& image() const { return m_image; }
+
+        /**
+         * @brief Nonzero pixels, in tile coordinates
+         */
+        QRect bounds() const { return m_bounds; }
+
+    private:
+        friend class Selection;
+
+        QImage m_image;  // Null while the tile is uniform
+        uint8_t m_value = 0;
+        QRect m_bounds;
+    };
+
+    Selection() = default;
+
+    /**
+     * @brief Empty selection over a canvas of `size`
+     */
+    explicit Selection(const QSize& size);
+
+    // === Geometry ===
+
+    QSize size() const { return m_size; }
+    QRect rect() const { return QRect(QPoint(0, 0), m_size); }
+    bool isNull() const { return m_tiles.empty(); }
+
+    int tilesX() const { return m_tilesX; }
+    int tilesY() const { return m_tilesY; }
+    QRect tileRect(int tx, int ty) const;
+    const Tile& tileAt(int tx, int ty) const { return m_tiles[ty * m_tilesX + tx]; }
+
+    /**
+     * @brief Smallest rectangle holding every selected pixel, null when empty
+     */
+    QRect bounds() const { return m_bounds; }
+    bool isEmpty() const { return m_bounds.isEmpty(); }
+
+    // === Queries ===
+
+    uint8_t value(int x, int y) const;
+
+    /**
+     * @brief Whether an area is unselected, wholly selected or in between
+     *
+     * Decided from the tiles alone: areas under partially selected tiles
+     * report Partial unless they miss the tiles' nonzero bounds.
+     */
+    Coverage coverage(const QRect& area) const;
+
+    /**
+     * @brief Visit an area one row span at a time
+     *
+     * Calls func(x, y, coverage, count) for each row of each tile
+     * overlapping the area, without copying. Uniform tiles are expanded into
+     * a small row buffer.
+     */
+    template <typename Func>
+    void forEachSpan(const QRect& area, Func&& func) const;
+
+    /**
+     * @brief One tile's coverage as rows of bytes, to clip pixel work with
+     *
+     * Null when the tile is wholly selected and needs no clipping. Tiles
+     * holding another single value are expanded into `buffer`, which takes
+     * TileSize * TileSize bytes. `stride` receives the distance between rows.
+     */
+    const uint8_t* tileRows(int tx, int ty, uint8_t* buffer, int* stride) const;
+
+    /**
+     * @brief Copy an area into an Alpha8 image (pixels outside are 0)
+     */
+    QImage copy(const QRect& area) const;
+
+    /**
+     * @brief Coverage of an area as floats in [0, 1]
+     */
+    AlphaPlane toPlane(const QRect& area) const;
+
+    // === Editing ===
+
+    void clear();
+    void selectAll();
+    void invert();
+
+    void combine(const QRect& rect, Operation op = Operation::Replace);
+
+    /**
+     * @brief Combine with coverage in [0, 1]; beyond the plane counts as 0
+     */
+    void combine(const AlphaPlane& plane, Operation op = Operation::Replace);
+
+    /**
+     * @brief Combine with a selection over a canvas of the same size
+     */
+    void combine(const Selection& other, Operation op = Operation::Replace);
+
+    /**
+     * @brief Replace tiles with coverage computed elsewhere, tiles in parallel
+     *
+     * source(tx, ty, tile) sets `tile` to a value or to an Alpha8 image
+     * TileSize square and returns true, or returns false to keep the tile.
+     * It is called concurrently for different tiles. Flat images are stored
+     * as a single value.
+     */
+    using TileSource = std::function<bool(int tx, int ty, Tile& tile)>;
+    void replaceTiles(const TileSource& source);
+
+    /**
+     * @brief Soften the edge with a Gaussian of standard deviation radius / 2
+     */
+    void feather(float radius);
+
+    /**
+     * @brief Grow or shrink by exact distances (see morphology)
+     */
+    void grow(float radius);
+    void shrink(float radius);
+
+    // === Statistics ===
+
+    size_t memoryUsage() const;
+    int allocatedTileCount() const;
+
+private:
+    QSize m_size;
+    int m_tilesX = 0;
+    int m_tilesY = 0;
+    std::vector<Tile> m_tiles;
+    QRect m_bounds;
+
+    Tile& tileRef(int tx, int ty) { return m_tiles[ty * m_tilesX + tx]; }
+    QRect validRect(int tx, int ty) const;  // tileRect() in tile coordinates
+
+    static Tile uniformTile(uint8_t value, const QRect& valid);
+    // Keep `image` as the tile's pixels, or only its value if `range` is flat
+    static void setPixels(Tile& tile, const QImage& image, const QRect& valid, const blend::MaskRange& range);
+    Tile planeTile(const AlphaPlane& plane, int tx, int ty, QImage image) const;
+
+    // Like replaceTiles(), combining with `op`; sources set the bounds
+    void apply(Operation op, const TileSource& source);
+    void write(const AlphaPlane& plane);
+    void updateBounds();
+};
+
+template <typename Func>
+void Selection::forEachSpan(const QRect& area, Func&& func) const
+{
+    const QRect clipped = area & rect();
+    if (clipped.isEmpty()) return;
+
+    uint8_t uniformRow[TileSize];
+    const int tx0 = clipped.left() / TileSize;
+    const int ty0 = clipped.top() / TileSize;
+    const int tx1 = clipped.right() / TileSize;
+    const int ty1 = clipped.bottom() / TileSize;
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            const Tile& tile = tileAt(tx, ty);
+            const QRect part = tileRect(tx, ty) & clipped;
+            const int srcX = part.left() - tx * TileSize;
+
+            if (tile.isUniform()) {
+                std::fill(uniformRow, uniformRow + part.width(), tile.uniformValue());
+            }
+            for (int y = part.top(); y <= part.bottom(); ++y) {
+                const uint8_t* values = tile.isUniform()
+                    ? uniformRow
+                    : tile.image().constScanLine(y - ty * TileSize) + srcX;
+                func(part.left(), y, values, part.width());
+            }
+        }
+    }
+}
+
+} // namespace core
@@ -0,0 +1,51 @@
+#include "selection_kernels.h"
+
+namespace core {
+namespace blend {
+
+const MaskRowFunc* maskRowFunctions(SimdLevel level)
+{
+#if defined(CORE_X86_SIMD)
+    if (level > supportedSimdLevel()) {
+        level = supportedSimdLevel();
+    }
+    switch (level) {
+        case SimdLevel::AVX2: return detail::avx2MaskKernels();
+        case SimdLevel::SSE41: return detail::sse41MaskKernels();
+        case SimdLevel::Scalar: break;
+    }
+#else
+    (void)level;
+#endif
+    return detail::scalarMaskKernels();
+}
+
+const MaskRowFunc* maskRowFunctions()
+{
+    return maskRowFunctions(activeSimdLevel());
+}
+
+ColorDistanceFunc colorDistanceFunction(SimdLevel level)
+{
+#if defined(CORE_X86_SIMD)
+    if (level > supportedSimdLevel()) {
+        level = supportedSimdLevel();
+    }
+    switch (level) {
+        case SimdLevel::AVX2: return detail::avx2DistanceKernel();
+        case SimdLevel::SSE41: return detail::sse41DistanceKernel();
+        case SimdLevel::Scalar: break;
+    }
+#else
+    (void)level;
+#endif
+    return detail::scalarDistanceKernel();
+}
+
+ColorDistanceFunc colorDistanceFunction()
+{
+    return colorDistanceFunction(activeSimdLevel());
+}
+
+} // namespace blend
+} // namespace core
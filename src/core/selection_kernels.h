@@ -0,0 +1,106 @@
+#pragma once
+
+#include "cpu_features.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace core {
+namespace blend {
+
+/**
+ * @brief Ways of combining two 8-bit coverage masks, dst = op(dst, src)
+ *
+ * Add keeps the larger value, Intersect the smaller, Subtract takes src
+ * away from dst, saturating at 0.
+ */
+enum class MaskOp {
+    Add,
+    Intersect,
+    Subtract
+};
+
+constexpr int MaskOpCount = 3;
+
+/**
+ * @brief Smallest and largest value written, so callers can spot flat tiles
+ */
+struct MaskRange {
+    uint8_t low = 255;
+    uint8_t high = 0;
+
+    bool isFlat() const { return low == high; }
+};
+
+/**
+ * @brief Combine a row of coverage into `dst` in place
+ *
+ * `range` is widened to include every value written.
+ */
+using MaskRowFunc = void (*)(uint8_t* dst, const uint8_t* src, int count, MaskRange& range);
+
+/**
+ * @brief Kernels at the active SIMD level, indexed by MaskOp
+ */
+const MaskRowFunc* maskRowFunctions();
+
+/**
+ * @brief Kernels at a specific level (falls back to scalar)
+ */
+const MaskRowFunc* maskRowFunctions(SimdLevel level);
+
+/**
+ * @brief Scalar reference of an operation on a single value
+ */
+inline uint8_t applyMaskOp(MaskOp op, uint8_t dst, uint8_t src)
+{
+    switch (op) {
+        case MaskOp::Add: return dst > src ? dst : src;
+        case MaskOp::Intersect: return dst < src ? dst : src;
+        case MaskOp::Subtract: return dst > src ? static_cast<uint8_t>(dst - src) : 0;
+    }
+    return dst;
+}
+
+/**
+ * @brief Largest difference between the channels of two premultiplied
+ * ARGB32 pixels, 0 to 255
+ */
+inline uint8_t colorDistance(uint32_t a, uint32_t b)
+{
+    uint32_t distance = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        const int ca = (a >> shift) & 0xff;
+        const int cb = (b >> shift) & 0xff;
+        distance = std::max<uint32_t>(distance, ca > cb ? ca - cb : cb - ca);
+    }
+    return static_cast<uint8_t>(distance);
+}
+
+/**
+ * @brief colorDistance() from every pixel of a row to `reference`
+ */
+using ColorDistanceFunc = void (*)(const uint32_t* pixels, int count, uint32_t reference,
+                                   uint8_t* distance);
+
+/**
+ * @brief Distance kernel at the active SIMD level
+ */
+ColorDistanceFunc colorDistanceFunction();
+
+/**
+ * @brief Distance kernel at a specific level (falls back to scalar)
+ */
+ColorDistanceFunc colorDistanceFunction(SimdLevel level);
+
+namespace detail {
+// One kernel table per instruction set
+const MaskRowFunc* scalarMaskKernels();
+const MaskRowFunc* sse41MaskKernels();
+const MaskRowFunc* avx2MaskKernels();
+ColorDistanceFunc scalarDistanceKernel();
+ColorDistanceFunc sse41DistanceKernel();
+ColorDistanceFunc avx2DistanceKernel();
+} // namespace detail
+
+} // namespace blend
+} // namespace core
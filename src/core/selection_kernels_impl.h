@@ -0,0 +1,91 @@
+#pragma once
+
+// Selection mask kernels shared by every instruction set.
+//
+// Included after blend_kernels_impl.h by the same per-instruction-set
+// units. Besides VecF, each unit defines VecB, Width bytes per step, with
+// minBytes, maxBytes and subBytes (saturating). Units whose VecB holds
+// whole pixels also define storeChannelMax, which writes the largest byte
+// of each 32-bit lane.
+
+#include "selection_kernels.h"
+#include <algorithm>
+
+namespace core {
+namespace blend {
+namespace {
+
+template <MaskOp Op>
+inline VecB maskOp(VecB dst, VecB src)
+{
+    switch (Op) {
+        case MaskOp::Add: return maxBytes(dst, src);
+        case MaskOp::Intersect: return minBytes(dst, src);
+        case MaskOp::Subtract: return subBytes(dst, src);
+    }
+    return dst;
+}
+
+template <MaskOp Op>
+void maskRowKernel(uint8_t* dst, const uint8_t* src, int count, MaskRange& range)
+{
+    constexpr int W = VecB::Width;
+    VecB low(range.low);
+    VecB high(range.high);
+
+    int i = 0;
+    for (; i + W <= count; i += W) {
+        const VecB value = maskOp<Op>(VecB::load(dst + i), VecB::load(src + i));
+        value.store(dst + i);
+        low = minBytes(low, value);
+        high = maxBytes(high, value);
+    }
+
+    uint8_t lanes[W];
+    low.store(lanes);
+    range.low = *std::min_element(lanes, lanes + W);
+    high.store(lanes);
+    range.high = *std::max_element(lanes, lanes + W);
+
+    for (; i < count; ++i) {
+        dst[i] = applyMaskOp(Op, dst[i], src[i]);
+        range.low = std::min(range.low, dst[i]);
+        range.high = std::max(range.high, dst[i]);
+    }
+}
+
+const MaskRowFunc* maskKernelTable()
+{
+    static const MaskRowFunc table[MaskOpCount] = {
+        &maskRowKernel<MaskOp::Add>,
+        &maskRowKernel<MaskOp::Intersect>,
+        &maskRowKernel<MaskOp::Subtract>,
+    };
+    return table;
+}
+
+// Templated on the vector so the pixel loop is only instantiated by units
+// whose VecB holds whole pixels
+template <typename V>
+void colorDistanceKernel(const uint32_t* pixels, int count, uint32_t reference, uint8_t* distance)
+{
+    int i = 0;
+    if constexpr (V::Width >= 4) {
+        constexpr int P = V::Width / 4;
+        uint32_t repeated[P];
+        std::fill(repeated, repeated + P, reference);
+        const V ref = V::load(reinterpret_cast<const uint8_t*>(repeated));
+
+        for (; i + P <= count; i += P) {
+            const V px = V::load(reinterpret_cast<const uint8_t*>(pixels + i));
+            storeChannelMax(maxBytes(subBytes(px, ref), subBytes(ref, px)), distance + i);
+        }
+    }
+    for (; i < count; ++i) {
+        distance[i] = colorDistance(pixels[i], reference);
+    }
+}
+
+} // namespace
+} // namespace blend
+} // namespace core
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace core {
+
+/**
+ * @brief Bounded lock-free queue for one producer thread and one consumer
+ *
+ * The producer only writes m_tail and the consumer only writes m_head, each
+ * on its own cache line, so neither side ever waits on the other. Each side
+ * also keeps a cached copy of the other's index and only reloads it when the
+ * queue looks full (or empty), which keeps cross-core traffic to roughly
+ * one cache line transfer per batch rather than per item.
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "SpscQueue capacity must be a power of two");
+
+public:
+    SpscQueue() = default;
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /**
+     * @brief Append an item (producer thread only); false if the queue is full
+     */
+    bool push(const T& value)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cachedHead == Capacity) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail - m_cachedHead == Capacity) return false;
+        }
+        m_slots[tail & (Capacity - 1)] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Take the oldest item (consumer thread only); false if empty
+     */
+    bool pop(T& value)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cachedTail) {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cachedTail) return false;
+        }
+        value = m_slots[head & (Capacity - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Whether the queue held no items at the time of the call
+     */
+    bool empty() const
+    {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(64) std::atomic<size_t> m_head{0};  // Next slot to read
+    size_t m_cachedTail = 0;                    // Consumer's view of m_tail
+    alignas(64) std::atomic<size_t> m_tail{0};  // Next slot to write
+    size_t m_cachedHead = 0;                    // Producer's view of m_head
+    alignas(64) T m_slots[Capacity];
+};
+
+} // namespace core
@@ -0,0 +1,286 @@
+#include "stroke_recording.h"
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace core {
+
+namespace {
+
+constexpr char Magic[4] = {'K', 'S', 'T', 'R'};
+
+// Upper bounds that no real recording reaches; guard allocations on load
+constexpr quint32 MaxStrokes = 1u << 24;
+constexpr quint32 MaxSamples = 1u << 26;
+
+bool fail(QString* error, const QString& message)
+{
+    if (error) {
+        *error = message;
+    }
+    return false;
+}
+
+void writeVarint(QDataStream& stream, uint64_t value)
+{
+    while (value >= 0x80) {
+        stream << static_cast<quint8>(value | 0x80);
+        value >>= 7;
+    }
+    stream << static_cast<quint8>(value);
+}
+
+uint64_t readVarint(QDataStream& stream)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        quint8 byte = 0;
+        stream >> byte;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80) || stream.status() != QDataStream::Ok) break;
+    }
+    return value;
+}
+
+quint16 packPressure(float pressure)
+{
+    return static_cast<quint16>(std::lround(std::clamp(pressure, 0.0f, 1.0f) * 65535.0f));
+}
+
+qint16 packTilt(float tilt)
+{
+    return static_cast<qint16>(std::lround(std::clamp(tilt, -327.0f, 327.0f) * 100.0f));
+}
+
+void setupStream(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+}
+
+void writeHeader(QDataStream& stream, const QSize& canvasSize, quint32 strokeCount)
+{
+    stream.writeRawData(Magic, sizeof(Magic));
+    stream << StrokeRecording::Version << static_cast<qint32>(canvasSize.width())
+           << static_cast<qint32>(canvasSize.height()) << strokeCount;
+}
+
+// Times are deltas, so they stay one or two bytes however long the session
+void writeStroke(QDataStream& stream, const StrokeRecording::Stroke& stroke, int64_t& previous)
+{
+    const BrushSettings& s = stroke.settings;
+    const quint8 flags = (s.pressureSensitive ? 1 : 0) | (s.tiltSensitive ? 2 : 0);
+    stream << s.size << s.hardness << s.opacity << s.flow << s.spacing
+           << flags << static_cast<quint8>(s.mode) << static_cast<quint32>(stroke.color)
+           << static_cast<quint32>(stroke.samples.size());
+
+    for (const StrokeRecording::Sample& sample : stroke.samples) {
+        writeVarint(stream, static_cast<uint64_t>(std::max<int64_t>(0, sample.time - previous)));
+        previous = std::max(previous, sample.time);
+        stream << sample.x << sample.y << packPressure(sample.pressure) << packTilt(sample.tilt);
+    }
+    writeVarint(stream, static_cast<uint64_t>(std::max<int64_t>(0, stroke.endTime - previous)));
+    previous = std::max(previous, stroke.endTime);
+}
+
+} // namespace
+
+StrokeRecording::StrokeRecording(const QSize& canvasSize)
+    : m_canvasSize(canvasSize)
+{
+}
+
+size_t StrokeRecording::sampleCount() const
+{
+    size_t count = 0;
+    for (const Stroke& stroke : m_strokes) {
+        count += stroke.samples.size();
+    }
+    return count;
+}
+
+int64_t StrokeRecording::elapsed()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (!m_clockStarted) {
+        m_start = now;
+        m_clockStarted = true;
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(now - m_start).count();
+}
+
+void StrokeRecording::beginStroke(const BrushSettings& settings, QRgb color,
+                                  float x, float y, float pressure, float tilt)
+{
+    if (m_recording) endStroke();
+
+    Stroke stroke;
+    stroke.settings = settings;
+    stroke.color = color;
+    stroke.samples.push_back({elapsed(), x, y, pressure, tilt});
+    m_strokes.push_back(std::move(stroke));
+    m_recording = true;
+}
+
+void StrokeRecording::addSample(float x, float y, float pressure, float tilt)
+{
+    if (!m_recording) return;
+    m_strokes.back().samples.push_back({elapsed(), x, y, pressure, tilt});
+}
+
+void StrokeRecording::endStroke()
+{
+    if (!m_recording) return;
+    m_strokes.back().endTime = elapsed();
+    m_recording = false;
+}
+
+bool StrokeRecording::save(const QString& filename, QString* error) const
+{
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return fail(error, file.errorString());
+    }
+
+    QDataStream stream(&file);
+    setupStream(stream);
+    writeHeader(stream, m_canvasSize, static_cast<quint32>(m_strokes.size()));
+
+    int64_t previous = 0;
+    for (const Stroke& stroke : m_strokes) {
+        writeStroke(stream, stroke, previous);
+    }
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        return fail(error, file.errorString());
+    }
+    return true;
+}
+
+bool StrokeRecording::load(const QString& filename, StrokeRecording& recording, QString* error)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return fail(error, file.errorString());
+    }
+
+    QDataStream stream(&file);
+    setupStream(stream);
+
+    char magic[sizeof(Magic)] = {};
+    if (stream.readRawData(magic, sizeof(magic)) != sizeof(magic) || std::memcmp(magic, Magic, sizeof(Magic)) != 0) {
+        return fail(error, "Not a stroke recording");
+    }
+
+    quint32 version = 0;
+    qint32 width = 0;
+    qint32 height = 0;
+    quint32 strokeCount = 0;
+    stream >> version >> width >> height >> strokeCount;
+    if (version < 1 || version > Version) {
+        return fail(error, QString("Unsupported stroke recording version %1").arg(version));
+    }
+    // Logs are appended to, so they run to the end of the file
+    const bool toEnd = version >= 2 && strokeCount == UnknownCount;
+    if (stream.status() != QDataStream::Ok || width < 0 || height < 0
+        || (strokeCount > MaxStrokes && !toEnd)) {
+        return fail(error, "Damaged stroke recording");
+    }
+
+    StrokeRecording result(QSize(width, height));
+    result.m_strokes.reserve(toEnd ? 0 : std::min<quint32>(strokeCount, 1024));
+
+    int64_t time = 0;
+    for (quint32 i = 0; toEnd ? !stream.atEnd() : i < strokeCount; ++i) {
+        Stroke stroke;
+        BrushSettings& s = stroke.settings;
+        quint8 flags = 0;
+        quint8 mode = 0;
+        quint32 color = 0;
+        quint32 sampleCount = 0;
+        stream >> s.size >> s.hardness >> s.opacity >> s.flow >> s.spacing
+               >> flags >> mode >> color >> sampleCount;
+        if (toEnd && stream.status() == QDataStream::ReadPastEnd) break;
+        if (stream.status() != QDataStream::Ok || sampleCount == 0 || sampleCount > MaxSamples
+            || mode >= blend::DabModeCount) {
+            return fail(error, "Damaged stroke recording");
+        }
+        s.pressureSensitive = flags & 1;
+        s.tiltSensitive = flags & 2;
+        s.mode = static_cast<blend::DabMode>(mode);
+        stroke.color = color;
+
+        // Grow as samples arrive, so a damaged count fails at end of file
+        // instead of allocating up front
+        stroke.samples.reserve(std::min<quint32>(sampleCount, 4096));
+        for (quint32 j = 0; j < sampleCount && stream.status() == QDataStream::Ok; ++j) {
+            Sample sample;
+            quint16 pressure = 0;
+            qint16 tilt = 0;
+            time += static_cast<int64_t>(readVarint(stream));
+            stream >> sample.x >> sample.y >> pressure >> tilt;
+            sample.time = time;
+            sample.pressure = pressure / 65535.0f;
+            sample.tilt = tilt / 100.0f;
+            stroke.samples.push_back(sample);
+        }
+        time += static_cast<int64_t>(readVarint(stream));
+        stroke.endTime = time;
+
+        if (toEnd && stream.status() == QDataStream::ReadPastEnd) break;
+        if (stream.status() != QDataStream::Ok) {
+            return fail(error, "Truncated stroke recording");
+        }
+        result.m_strokes.push_back(std::move(stroke));
+    }
+
+    recording = std::move(result);
+    return true;
+}
+
+StrokeLog::StrokeLog(const QString& filename, const QSize& canvasSize)
+    : m_file(filename)
+    , m_recording(canvasSize)
+{
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return;
+
+    QDataStream stream(&m_file);
+    setupStream(stream);
+    writeHeader(stream, canvasSize, StrokeRecording::UnknownCount);
+    if (stream.status() != QDataStream::Ok || !m_file.flush()) {
+        m_file.close();
+    }
+}
+
+void StrokeLog::beginStroke(const BrushSettings& settings, QRgb color,
+                            float x, float y, float pressure, float tilt)
+{
+    m_recording.beginStroke(settings, color, x, y, pressure, tilt);
+}
+
+void StrokeLog::addSample(float x, float y, float pressure, float tilt)
+{
+    m_recording.addSample(x, y, pressure, tilt);
+}
+
+bool StrokeLog::endStroke()
+{
+    if (!m_recording.m_recording) return true;
+    m_recording.endStroke();
+
+    // The clock keeps running across strokes; only the finished one is kept
+    const StrokeRecording::Stroke stroke = std::move(m_recording.m_strokes.back());
+    m_recording.m_strokes.clear();
+    if (!m_file.isOpen()) return false;
+
+    QDataStream stream(&m_file);
+    setupStream(stream);
+    writeStroke(stream, stroke, m_previous);
+    return stream.status() == QDataStream::Ok && m_file.flush();
+}
+
+} // namespace core
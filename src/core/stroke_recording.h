@@ -0,0 +1,115 @@
+#pragma once
+
+#include <QString>
+#include <QSize>
+#include <QColor>
+#include <QFile>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "brush_engine.h"
+
+namespace core {
+
+/**
+ * @brief Brush input captured with its timing, for replaying as a benchmark
+ *
+ * File layout, all integers little-endian:
+ *
+ *   header   "KSTR", version, canvas width and height, stroke count
+ *   strokes  brush settings, straight ARGB colour, sample count, then per
+ *            sample the time since the previous one (microseconds, LEB128
+ *            varint), x and y as floats, pressure as a 16-bit fraction and
+ *            tilt in hundredths of a degree; last, the time to the release
+ *
+ * A sample takes 13 to 16 bytes, so an hour of 200 Hz tablet input fits in
+ * about 10 MiB. Files written by StrokeLog, which appends strokes as they
+ * end, store UnknownCount as the stroke count; their strokes run to the end
+ * of the file, and a stroke cut short there (the editor quit mid-write) is
+ * dropped. Version 1 files, which always have a count, are still read.
+ */
+class StrokeRecording {
+public:
+    static constexpr quint32 Version = 2;
+    static constexpr quint32 UnknownCount = 0xffffffffu;
+
+    struct Sample {
+        int64_t time = 0;       // Microseconds since the recording started
+        float x = 0.0f;         // Layer coordinates
+        float y = 0.0f;
+        float pressure = 1.0f;
+        float tilt = 0.0f;      // Degrees from vertical
+    };
+
+    struct Stroke {
+        BrushSettings settings;
+        QRgb color = 0xff000000;
+        std::vector<Sample> samples;    // The first is the press
+        int64_t endTime = 0;            // Release
+    };
+
+    StrokeRecording() = default;
+    explicit StrokeRecording(const QSize& canvasSize);
+
+    QSize canvasSize() const { return m_canvasSize; }
+    const std::vector<Stroke>& strokes() const { return m_strokes; }
+    size_t sampleCount() const;
+
+    // === Capture, timed from the first call ===
+
+    void beginStroke(const BrushSettings& settings, QRgb color,
+                     float x, float y, float pressure = 1.0f, float tilt = 0.0f);
+    void addSample(float x, float y, float pressure = 1.0f, float tilt = 0.0f);
+    void endStroke();
+
+    // === Files ===
+
+    bool save(const QString& filename, QString* error = nullptr) const;
+    static bool load(const QString& filename, StrokeRecording& recording, QString* error = nullptr);
+
+private:
+    friend class StrokeLog;
+
+    int64_t elapsed();
+
+    QSize m_canvasSize;
+    std::vector<Stroke> m_strokes;
+    bool m_recording = false;
+    bool m_clockStarted = false;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+/**
+ * @brief Stroke recording written to a file as it is captured
+ *
+ * The file stays open and each stroke is appended when it ends, a few
+ * kilobytes at most, instead of the whole session being rewritten. Only the
+ * stroke in progress is kept in memory. Read the file back with
+ * StrokeRecording::load().
+ */
+class StrokeLog {
+public:
+    /**
+     * @brief Create or truncate the file and write its header
+     */
+    StrokeLog(const QString& filename, const QSize& canvasSize);
+
+    bool isOpen() const { return m_file.isOpen(); }
+    QString errorString() const { return m_file.errorString(); }
+
+    void beginStroke(const BrushSettings& settings, QRgb color,
+                     float x, float y, float pressure = 1.0f, float tilt = 0.0f);
+    void addSample(float x, float y, float pressure = 1.0f, float tilt = 0.0f);
+
+    /**
+     * @brief Finish the stroke and append it; false if the write failed
+     */
+    bool endStroke();
+
+private:
+    QFile m_file;
+    StrokeRecording m_recording;    // The stroke in progress
+    int64_t m_previous = 0;         // Time of the last sample written
+};
+
+} // namespace core
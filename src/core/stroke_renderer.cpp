@@ -0,0 +1,352 @@
+#include "stroke_renderer.h"
+#include "layer.h"
+#include <QDebug>
+#include <algorithm>
+#include <chrono>
+
+namespace core {
+
+namespace {
+
+int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+QRect toRect(const DamageRect& damage)
+{
+    return damage.isEmpty() ? QRect() : QRect(damage.x, damage.y, damage.width, damage.height);
+}
+
+// Inputs painted per batch: enough to amortise the tile lock, few enough
+// that the first dabs of a burst reach the screen without waiting for the rest
+constexpr int MaxBatch = 32;
+
+} // namespace
+
+StrokeRenderer::StrokeRenderer(QObject* parent)
+    : QObject(parent)
+{
+    m_latencies.reserve(LatencyWindow);
+
+    // Emitted from the stroke thread, so this is a queued connection
+    connect(this, &StrokeRenderer::updatesAvailable, this, &StrokeRenderer::applyUpdates,
+            Qt::QueuedConnection);
+
+    m_thread = std::thread([this]() { run(); });
+}
+
+StrokeRenderer::~StrokeRenderer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void StrokeRenderer::beginStroke(RasterLayer* layer, const BrushSettings& settings, const QColor& color,
+                                 const QPointF& position, float pressure, float tilt)
+{
+    // The stroke thread must be idle before its engine and tiles change hands
+    flush();
+    if (!layer) return;
+
+    m_layer = layer;
+    m_engine.setSettings(settings);
+    m_color[0] = static_cast<unsigned char>(color.red());
+    m_color[1] = static_cast<unsigned char>(color.green());
+    m_color[2] = static_cast<unsigned char>(color.blue());
+    m_color[3] = static_cast<unsigned char>(color.alpha());
+    m_selection = layer->selection();
+    {
+        std::lock_guard<std::mutex> lock(m_tilesMutex);
+        m_tiles = layer->tiles();
+        m_damage = QRect();
+        m_oldestInput = 0;
+        m_strokeEnded = false;
+        m_paintedInputs = 0;
+    }
+    m_adoptedVersion = layer->contentVersion();
+    m_adoptedInputs = 0;
+
+    m_strokeActive = true;
+    push({ Input::Begin, static_cast<float>(position.x()), static_cast<float>(position.y()),
+           pressure, tilt, now() });
+}
+
+void StrokeRenderer::addPoint(const QPointF& position, float pressure, float tilt)
+{
+    if (!m_strokeActive) return;
+    push({ Input::Point, static_cast<float>(position.x()), static_cast<float>(position.y()),
+           pressure, tilt, now() });
+}
+
+void StrokeRenderer::endStroke()
+{
+    if (!m_strokeActive) return;
+    m_strokeActive = false;
+    push({ Input::End, 0.0f, 0.0f, 0.0f, 0.0f, now() });
+}
+
+void StrokeRenderer::push(const Input& input)
+{
+    while (!m_queue.push(input)) {
+        // Only when the stroke thread is thousands of events behind
+        std::this_thread::yield();
+    }
+
+    // Pairs with the fence in run(): either the stroke thread sees the item
+    // before sleeping or we see it asleep and wake it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed)) {
+        { std::lock_guard<std::mutex> lock(m_wakeMutex); }
+        m_wake.notify_one();
+    }
+}
+
+void StrokeRenderer::flush()
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_idle.wait(lock, [this]() {
+                return m_sleeping.load(std::memory_order_relaxed) && m_queue.empty();
+            });
+        }
+        applyUpdates();
+
+        // Adopting may have found an edit and queued a re-run instead
+        std::lock_guard<std::mutex> lock(m_tilesMutex);
+        if (m_rebasesPending == 0) return;
+    }
+}
+
+void StrokeRenderer::run()
+{
+    Input input;
+    for (;;) {
+        DamageRect damage;
+        int64_t oldest = 0;
+        bool ended = false;
+        int rebases = 0;
+        int count = 0;
+
+        while (count < MaxBatch && m_queue.pop(input)) {
+            if (count++ == 0) oldest = input.queuedAt;
+            if (input.type == Input::Rebase) {
+                damage.unite(rebase());
+                ++rebases;
+                continue;
+            }
+
+            if (input.type == Input::Begin) {
+                m_history.clear();
+            }
+            m_history.push_back(input);
+            switch (input.type) {
+                case Input::Begin:
+                    damage.unite(m_engine.beginStroke(input.x, input.y, input.pressure, input.tilt));
+                    break;
+                case Input::Point:
+                    damage.unite(m_engine.addPoint(input.x, input.y, input.pressure, input.tilt));
+                    break;
+                case Input::End:
+                    m_engine.endStroke();
+                    ended = true;
+                    break;
+                case Input::Rebase:
+                    break;
+            }
+        }
+
+        if (count > 0) {
+            paint(damage, oldest, ended, rebases);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_wakeMutex);
+        m_sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_idle.notify_all();
+        m_wake.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+        m_sleeping.store(false, std::memory_order_relaxed);
+        if (m_stopping) return;
+    }
+}
+
+DamageRect StrokeRenderer::rebase()
+{
+    size_t from = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_tilesMutex);
+        // A later re-run already took the newest tiles
+        if (m_rebaseTiles.isNull()) return DamageRect();
+        m_tiles = std::move(m_rebaseTiles);
+        m_rebaseTiles = TileStorage();
+        from = m_rebaseFrom;
+    }
+
+    // Run the whole stroke again so the engine's spacing carries over, and
+    // keep only the dabs the edited tiles do not have; they, and the dabs
+    // still pending from this batch, are stamped by paint()
+    DamageRect damage;
+    for (size_t i = 0; i < m_history.size(); ++i) {
+        const Input& input = m_history[i];
+        DamageRect dabs;
+        switch (input.type) {
+            case Input::Begin:
+                dabs = m_engine.beginStroke(input.x, input.y, input.pressure, input.tilt);
+                break;
+            case Input::Point:
+                dabs = m_engine.addPoint(input.x, input.y, input.pressure, input.tilt);
+                break;
+            case Input::End:
+                m_engine.endStroke();
+                break;
+            case Input::Rebase:
+                break;
+        }
+        if (i < from) {
+            m_engine.clearPendingDabs();
+        } else {
+            damage.unite(dabs);
+        }
+    }
+    return damage;
+}
+
+void StrokeRenderer::paint(const DamageRect& damage, int64_t oldestInput, bool strokeEnded, int rebases)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_tilesMutex);
+
+        const bool clipped = !m_selection.isEmpty() && m_selection.size() == m_tiles.size();
+        QRect area = toRect(damage) & m_tiles.rect();
+        if (clipped) {
+            area &= m_selection.bounds();
+        }
+        const QRect range = m_tiles.tileRange(area);
+        if (!range.isNull()) {
+            uint8_t uniform[TileStorage::TileSize * TileStorage::TileSize];
+            for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+                for (int tx = range.left(); tx <= range.right(); ++tx) {
+                    const QRect tileRect = m_tiles.tileRect(tx, ty);
+                    DabClip clip;
+                    if (clipped) {
+                        if (m_selection.coverage(tileRect) == Selection::Coverage::None) continue;
+                        clip.coverage = m_selection.tileRows(tx, ty, uniform, &clip.stride);
+                    }
+                    // Detaches only if the layer adopted this tile since our last write
+                    QImage& image = m_tiles.detachTile(tx, ty);
+                    m_engine.paintOnTile(reinterpret_cast<uint32_t*>(image.bits()),
+                                         tileRect.width(), tileRect.height(),
+                                         static_cast<int>(image.bytesPerLine() / sizeof(uint32_t)),
+                                         tileRect.left(), tileRect.top(),
+                                         m_color[0], m_color[1], m_color[2], m_color[3], clip);
+                }
+            }
+            m_damage |= area;
+            if (m_oldestInput == 0) m_oldestInput = oldestInput;
+        }
+        m_engine.clearPendingDabs();
+        m_strokeEnded = m_strokeEnded || strokeEnded;
+        m_paintedInputs = m_history.size();
+        m_rebasesPending -= rebases;
+    }
+
+    // One notification until the GUI thread catches up, however many batches
+    if (!m_updatePending.exchange(true, std::memory_order_acq_rel)) {
+        emit updatesAvailable();
+    }
+}
+
+void StrokeRenderer::applyUpdates()
+{
+    m_updatePending.store(false, std::memory_order_release);
+
+    // Take references under the lock, publish to the layer outside it so
+    // repaints triggered by the layer never hold up the stroke thread
+    TileStorage staged;
+    QRect damage;
+    int64_t oldest = 0;
+    bool rerun = false;
+    {
+        std::lock_guard<std::mutex> lock(m_tilesMutex);
+        // A re-run is on its way and brings its own update
+        if (m_rebasesPending > 0) return;
+
+        if (m_layer && !m_damage.isEmpty() && m_layer->contentVersion() != m_adoptedVersion) {
+            // Edited since the last adopt: re-run the stroke on the edit
+            m_rebaseTiles = m_layer->tiles();
+            m_rebaseFrom = m_adoptedInputs;
+            ++m_rebasesPending;
+            rerun = true;
+        } else {
+            damage = m_damage;
+            oldest = m_oldestInput;
+            if (!damage.isEmpty()) {
+                staged = m_tiles;
+            }
+            m_damage = QRect();
+            m_oldestInput = 0;
+            m_adoptedInputs = m_paintedInputs;
+
+            // Once adopted, holding on to the tiles would only force copies
+            // when the layer is next edited
+            if (m_strokeEnded) {
+                m_tiles = TileStorage();
+                m_strokeEnded = false;
+            }
+        }
+    }
+
+    if (rerun) {
+        push({ Input::Rebase, 0.0f, 0.0f, 0.0f, 0.0f, now() });
+        return;
+    }
+    if (damage.isEmpty()) return;
+    if (m_layer) {
+        m_layer->adoptTiles(staged, damage);
+        m_adoptedVersion = m_layer->contentVersion();
+    }
+
+    const double latency = (now() - oldest) / 1e6;
+    if (m_latencies.size() < LatencyWindow) {
+        m_latencies.push_back(latency);
+    } else {
+        m_latencies[m_latencyNext] = latency;
+        m_latencyNext = (m_latencyNext + 1) % LatencyWindow;
+    }
+}
+
+StrokeRenderer::LatencyStats StrokeRenderer::latency() const
+{
+    LatencyStats stats;
+    if (m_latencies.empty()) return stats;
+
+    std::vector<double> sorted = m_latencies;
+    std::sort(sorted.begin(), sorted.end());
+
+    double total = 0.0;
+    for (double value : sorted) {
+        total += value;
+    }
+    stats.samples = static_cast<int>(sorted.size());
+    stats.average = total / sorted.size();
+    stats.p95 = sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)];
+    stats.max = sorted.back();
+    return stats;
+}
+
+void StrokeRenderer::resetLatency()
+{
+    m_latencies.clear();
+    m_latencyNext = 0;
+}
+
+} // namespace core
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <QObject>
+#include <QColor>
+#include <QPointF>
+#include <QPointer>
+#include <QRect>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "brush_engine.h"
+#include "selection.h"
+#include "spsc_queue.h"
+#include "tile_storage.h"
+
+namespace core {
+
+class RasterLayer;
+
+/**
+ * @brief Rasterizes brush strokes on a dedicated thread
+ *
+ * The GUI thread timestamps input and pushes it into a lock-free queue; it
+ * never paints. The stroke thread feeds the queue through its BrushEngine
+ * and stamps the dabs straight into a private copy of the layer's tiles
+ * (implicitly shared, so only touched tiles are ever copied). When a batch
+ * is done it signals updatesAvailable() once; the GUI thread then adopts
+ * the damaged tiles by reference, which costs a few pointer copies however
+ * large the brush, and the layer reports the damaged rectangle as usual.
+ *
+ * While the GUI thread is busy the stroke thread keeps painting and the
+ * damage accumulates, so a slow frame delays the picture but never the
+ * rasterization, and catching up takes one adopt.
+ *
+ * The layer may be edited by other means while a stroke is running (an
+ * undo, a fill). Adopting would then overwrite the edit with tiles copied
+ * before it, so the layer's content version is checked first. On a
+ * mismatch nothing is adopted; instead the stroke thread takes the edited
+ * tiles and re-runs the stroke, stamping the dabs not adopted yet on top.
+ * The engine is deterministic, so the dabs come out as before.
+ *
+ * Dabs are clipped to the layer's selection as it was when the stroke
+ * began: tiles outside it are never touched and partly selected pixels take
+ * the dabs scaled by their coverage.
+ */
+class StrokeRenderer : public QObject {
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Input-to-pixel latency over recent updates, in milliseconds
+     *
+     * Measured from the time an input event was queued to the time its
+     * dabs were handed to the layer.
+     */
+    struct LatencyStats {
+        int samples = 0;
+        double average = 0.0;
+        double p95 = 0.0;
+        double max = 0.0;
+    };
+
+    explicit StrokeRenderer(QObject* parent = nullptr);
+    ~StrokeRenderer() override;
+
+    /**
+     * @brief Start a stroke on a layer (GUI thread)
+     *
+     * Finishes the previous stroke first. Positions are layer-local.
+     * The colour is straight; the dab mode comes from the settings.
+     */
+    void beginStroke(RasterLayer* layer, const BrushSettings& settings, const QColor& color,
+                     const QPointF& position, float pressure = 1.0f, float tilt = 0.0f);
+    void addPoint(const QPointF& position, float pressure = 1.0f, float tilt = 0.0f);
+    void endStroke();
+
+    bool isStrokeActive() const { return m_strokeActive; }
+
+    /**
+     * @brief Block until every queued input is painted and adopted
+     */
+    void flush();
+
+    LatencyStats latency() const;
+    void resetLatency();
+
+signals:
+    /**
+     * @brief Painted tiles are waiting to be adopted (emitted from the stroke thread)
+     */
+    void updatesAvailable();
+
+private slots:
+    void applyUpdates();
+
+private:
+    struct Input {
+        enum Type : uint8_t { Begin, Point, End, Rebase };
+        Type type;
+        float x, y;
+        float pressure;
+        float tilt;
+        int64_t queuedAt;       // steady_clock nanoseconds
+    };
+
+    static constexpr size_t QueueCapacity = 4096;
+    static constexpr size_t LatencyWindow = 512;
+
+    void push(const Input& input);
+    void run();
+    void paint(const DamageRect& damage, int64_t oldestInput, bool strokeEnded, int rebases);
+    DamageRect rebase();
+
+    // Written by the GUI thread only while the stroke thread is idle
+    BrushEngine m_engine;
+    unsigned char m_color[4] = {0, 0, 0, 255};
+    Selection m_selection;          // Empty when nothing is selected
+
+    // Stroke thread state: the inputs of the current stroke, to re-run it
+    std::vector<Input> m_history;
+
+    SpscQueue<Input, QueueCapacity> m_queue;
+    std::thread m_thread;
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    std::atomic<bool> m_sleeping{false};
+    bool m_stopping = false;
+
+    // Guards the painted tiles and the damage not yet adopted
+    std::mutex m_tilesMutex;
+    TileStorage m_tiles;
+    QRect m_damage;
+    int64_t m_oldestInput = 0;      // Queue time of the oldest unadopted input
+    bool m_strokeEnded = false;     // Tiles can be released once adopted
+    size_t m_paintedInputs = 0;     // Inputs of the stroke painted into m_tiles
+    TileStorage m_rebaseTiles;      // Edited layer tiles to re-run the stroke on
+    size_t m_rebaseFrom = 0;        // First input whose dabs are not on them
+    int m_rebasesPending = 0;       // Queued and not painted yet
+    std::atomic<bool> m_updatePending{false};
+
+    // GUI thread state
+    QPointer<RasterLayer> m_layer;
+    bool m_strokeActive = false;
+    uint64_t m_adoptedVersion = 0;  // Layer content version after the last adopt
+    size_t m_adoptedInputs = 0;
+    std::vector<double> m_latencies;
+    size_t m_latencyNext = 0;
+};
+
+} // namespace core
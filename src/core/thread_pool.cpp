@@ -0,0 +1,224 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+namespace core {
+
+namespace {
+
+uint64_t packRange(uint32_t begin, uint32_t end)
+{
+    return (static_cast<uint64_t>(begin) << 32) | end;
+}
+
+uint32_t rangeBegin(uint64_t range) { return static_cast<uint32_t>(range >> 32); }
+uint32_t rangeEnd(uint64_t range) { return static_cast<uint32_t>(range); }
+
+} // namespace
+
+// Shared state of one parallelFor call. Helpers hold it by shared_ptr, so a
+// helper that is dequeued after the call has returned finds no work and exits.
+struct ThreadPool::ForJob {
+    struct alignas(64) Slice {
+        std::atomic<uint64_t> range{0};
+    };
+
+    const std::function<void(int)>* body = nullptr;
+    int offset = 0;
+    std::vector<Slice> slices;
+    std::atomic<int> pending{0};
+    std::mutex doneMutex;
+    std::condition_variable done;
+
+    explicit ForJob(int participants) : slices(participants) {}
+
+    // Owner side: take one item from the front of our slice
+    bool takeOwn(int slot, uint32_t& item)
+    {
+        auto& range = slices[slot].range;
+        uint64_t current = range.load(std::memory_order_acquire);
+        while (rangeBegin(current) < rangeEnd(current)) {
+            const uint64_t next = packRange(rangeBegin(current) + 1, rangeEnd(current));
+            if (range.compare_exchange_weak(current, next, std::memory_order_acq_rel)) {
+                item = rangeBegin(current);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Thief side: move the back half of another slice into ours
+    bool steal(int slot)
+    {
+        const int count = static_cast<int>(slices.size());
+        for (int i = 1; i < count; ++i) {
+            auto& victim = slices[(slot + i) % count].range;
+            uint64_t current = victim.load(std::memory_order_acquire);
+            while (rangeBegin(current) < rangeEnd(current)) {
+                const uint32_t begin = rangeBegin(current);
+                const uint32_t end = rangeEnd(current);
+                const uint32_t split = end - (end - begin + 1) / 2;
+                if (victim.compare_exchange_weak(current, packRange(begin, split),
+                                                 std::memory_order_acq_rel)) {
+                    slices[slot].range.store(packRange(split, end), std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void participate(int slot)
+    {
+        uint32_t item = 0;
+        for (;;) {
+            while (takeOwn(slot, item)) {
+                (*body)(offset + static_cast<int>(item));
+                if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    done.notify_all();
+                }
+            }
+            if (!steal(slot)) return;
+        }
+    }
+};
+
+ThreadPool::ThreadPool(int workerCount)
+{
+    if (workerCount <= 0) {
+        const unsigned hardware = std::thread::hardware_concurrency();
+        workerCount = hardware > 1 ? static_cast<int>(hardware) - 1 : 0;
+    }
+
+    m_workers.reserve(workerCount);
+    for (int i = 0; i < workerCount; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    for (int i = 0; i < workerCount; ++i) {
+        m_workers[i]->thread = std::thread([this, i]() { workerLoop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (auto& worker : m_workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+ThreadPool& ThreadPool::global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int)>& body)
+{
+    const int count = end - begin;
+    if (count <= 0) return;
+
+    const int participants = std::min(concurrency(), count);
+    if (participants == 1) {
+        for (int i = begin; i < end; ++i) {
+            body(i);
+        }
+        return;
+    }
+
+    auto job = std::make_shared<ForJob>(participants);
+    job->body = &body;
+    job->offset = begin;
+    job->pending.store(count, std::memory_order_relaxed);
+
+    // Even initial split; stealing evens out tiles that cost more than others
+    for (int slot = 0; slot < participants; ++slot) {
+        const uint32_t sliceBegin = static_cast<uint32_t>(static_cast<int64_t>(count) * slot / participants);
+        const uint32_t sliceEnd = static_cast<uint32_t>(static_cast<int64_t>(count) * (slot + 1) / participants);
+        job->slices[slot].range.store(packRange(sliceBegin, sliceEnd), std::memory_order_relaxed);
+    }
+
+    const unsigned first = m_nextWorker.fetch_add(participants - 1, std::memory_order_relaxed);
+    for (int slot = 1; slot < participants; ++slot) {
+        push(static_cast<int>((first + slot - 1) % m_workers.size()), [job, slot]() {
+            job->participate(slot);
+        });
+    }
+
+    job->participate(0);
+
+    std::unique_lock<std::mutex> lock(job->doneMutex);
+    job->done.wait(lock, [&job]() { return job->pending.load(std::memory_order_acquire) == 0; });
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    if (m_workers.empty()) {
+        task();
+        return;
+    }
+    const unsigned index = m_nextWorker.fetch_add(1, std::memory_order_relaxed);
+    push(static_cast<int>(index % m_workers.size()), std::move(task));
+}
+
+void ThreadPool::push(int index, std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_workers[index]->mutex);
+        m_workers[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_queued.fetch_add(1, std::memory_order_release);
+    }
+    m_wake.notify_all();
+}
+
+bool ThreadPool::popTask(int index, std::function<void()>& task)
+{
+    // Own queue first (FIFO), then steal from the back of the others
+    const int count = static_cast<int>(m_workers.size());
+    for (int i = 0; i < count; ++i) {
+        Worker& worker = *m_workers[(index + i) % count];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty()) continue;
+
+        if (i == 0) {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        } else {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        }
+        m_queued.fetch_sub(1, std::memory_order_acq_rel);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(int index)
+{
+    std::function<void()> task;
+    for (;;) {
+        if (popTask(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [this]() {
+            return m_stopping || m_queued.load(std::memory_order_acquire) > 0;
+        });
+        if (m_stopping && m_queued.load(std::memory_order_acquire) == 0) return;
+    }
+}
+
+} // namespace core
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace core {
+
+/**
+ * @brief Work-stealing thread pool for tile-parallel pixel work
+ *
+ * parallelFor() splits an index range into one contiguous slice per
+ * participant. Each slice is a packed (begin, end) pair in a single atomic
+ * word: the owner takes items from the front and idle participants steal
+ * half of what is left from the back, all with compare-and-swap, so the
+ * hot path never takes a lock. The calling thread always participates, which
+ * keeps nested calls from deadlocking.
+ *
+ * submit() queues fire-and-forget tasks; workers drain their own queue first
+ * and steal from the others when it runs dry.
+ */
+class ThreadPool {
+public:
+    /**
+     * @brief Create a pool with the given number of worker threads
+     *
+     * @param workerCount Workers besides the caller; 0 picks one less than
+     *                    the hardware concurrency
+     */
+    explicit ThreadPool(int workerCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Shared pool used by the compositor and the canvas
+     */
+    static ThreadPool& global();
+
+    /**
+     * @brief Number of threads that work on a parallelFor (workers + caller)
+     */
+    int concurrency() const { return static_cast<int>(m_workers.size()) + 1; }
+
+    /**
+     * @brief Run body(i) for every i in [begin, end) and wait for completion
+     */
+    void parallelFor(int begin, int end, const std::function<void(int)>& body);
+
+    /**
+     * @brief Queue a task to run on a worker thread
+     */
+    void submit(std::function<void()> task);
+
+private:
+    struct ForJob;
+
+    struct Worker {
+        std::thread thread;
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void workerLoop(int index);
+    bool popTask(int index, std::function<void()>& task);
+    void push(int index, std::function<void()> task);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<unsigned> m_nextWorker{0};
+    std::atomic<int> m_queued{0};
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+};
+
+} // namespace core
@@ -0,0 +1,209 @@
+#include "tile_snapshot.h"
+#include "thread_pool.h"
+#include <QDataStream>
+#include <algorithm>
+#include <cstring>
+
+namespace core {
+
+TileSnapshot TileSnapshot::capture(const TileStorage& tiles, const QRect& area)
+{
+    TileSnapshot snapshot;
+    const QRect clipped = area & tiles.rect();
+    const QRect range = tiles.tileRange(clipped);
+    if (range.isNull()) return snapshot;
+
+    snapshot.m_bounds = clipped;
+    snapshot.m_region = clipped;
+    snapshot.m_parts.reserve(static_cast<size_t>(range.width()) * range.height());
+
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            const TileStorage::Tile& tile = tiles.tileAt(tx, ty);
+            const QRect tileRect = tiles.tileRect(tx, ty);
+
+            Part part;
+            part.rect = tileRect & clipped;
+            if (tile.isUniform()) {
+                part.color = tile.uniformColor();
+            } else if (part.rect == tileRect && tile.image().size() == tileRect.size()) {
+                // Whole tile: share it, the layer detaches when it paints
+                part.pixels = tile.image();
+            } else {
+                const QPoint origin(tx * TileStorage::TileSize, ty * TileStorage::TileSize);
+                part.pixels = tile.image().copy(part.rect.translated(-origin));
+            }
+            snapshot.m_parts.push_back(std::move(part));
+        }
+    }
+
+    return snapshot;
+}
+
+void TileSnapshot::restore(TileStorage& tiles) const
+{
+    for (const Part& part : m_parts) {
+        const int tx = part.rect.left() / TileStorage::TileSize;
+        const int ty = part.rect.top() / TileStorage::TileSize;
+        if (tx >= tiles.tilesX() || ty >= tiles.tilesY()) continue;
+
+        const QRect target = part.rect & tiles.tileRect(tx, ty);
+        if (target.isEmpty()) continue;
+
+        if (part.isUniform() && target == tiles.tileRect(tx, ty)) {
+            tiles.setUniformTile(tx, ty, part.color);
+            continue;
+        }
+
+        const QByteArray unpacked = part.packed.isEmpty() ? QByteArray() : qUncompress(part.packed);
+        const int stride = part.rect.width() * static_cast<int>(sizeof(QRgb));
+        if (!part.packed.isEmpty() && unpacked.size() < stride * part.rect.height()) continue;
+
+        QImage& image = tiles.detachTile(tx, ty);
+        const int dstX = target.left() - tx * TileStorage::TileSize;
+        const int dstY = target.top() - ty * TileStorage::TileSize;
+        for (int row = 0; row < target.height(); ++row) {
+            QRgb* dst = reinterpret_cast<QRgb*>(image.scanLine(dstY + row)) + dstX;
+            if (part.isUniform()) {
+                std::fill(dst, dst + target.width(), part.color);
+            } else if (!part.packed.isEmpty()) {
+                std::memcpy(dst, unpacked.constData() + row * stride, target.width() * sizeof(QRgb));
+            } else {
+                std::memcpy(dst, part.pixels.constScanLine(row), target.width() * sizeof(QRgb));
+            }
+        }
+    }
+
+    tiles.optimize(m_bounds);
+}
+
+namespace {
+
+QByteArray packRows(const QImage& pixels, const QRect& rect)
+{
+    const int stride = rect.width() * static_cast<int>(sizeof(QRgb));
+    QByteArray rows(stride * rect.height(), Qt::Uninitialized);
+    for (int row = 0; row < rect.height(); ++row) {
+        std::memcpy(rows.data() + row * stride, pixels.constScanLine(row), stride);
+    }
+    // Fast level: history is written far more often than it is read
+    return qCompress(rows, 1);
+}
+
+} // namespace
+
+TileSnapshot::Part TileSnapshot::Part::cropped(const QRect& area) const
+{
+    if (area == rect || isUniform()) {
+        Part part = *this;
+        part.rect = area;
+        return part;
+    }
+
+    QImage source = pixels;
+    if (!packed.isEmpty()) {
+        const QByteArray rows = qUncompress(packed);
+        const int stride = rect.width() * static_cast<int>(sizeof(QRgb));
+        if (rows.size() < stride * rect.height()) return Part{area};
+        source = QImage(rect.size(), QImage::Format_ARGB32_Premultiplied);
+        for (int row = 0; row < rect.height(); ++row) {
+            std::memcpy(source.scanLine(row), rows.constData() + row * stride, stride);
+        }
+    }
+
+    Part part;
+    part.rect = area;
+    part.pixels = source.copy(area.translated(-rect.topLeft()));
+    return part;
+}
+
+void TileSnapshot::merge(const TileSnapshot& later)
+{
+    if (later.isNull()) return;
+    if (isNull()) {
+        *this = later;
+        return;
+    }
+
+    for (const Part& part : later.m_parts) {
+        const QRegion fresh = QRegion(part.rect).subtracted(m_region);
+        for (const QRect& rect : fresh) {
+            m_parts.push_back(part.cropped(rect));
+        }
+    }
+    m_region += later.m_region;
+    m_bounds |= later.m_bounds;
+}
+
+void TileSnapshot::compress()
+{
+    size_t pending = 0;
+    for (const Part& part : m_parts) {
+        if (part.packed.isEmpty()) {
+            pending += static_cast<size_t>(part.pixels.sizeInBytes());
+        }
+    }
+    if (pending <= CompressThreshold) return;
+
+    ThreadPool::global().parallelFor(0, static_cast<int>(m_parts.size()), [this](int i) {
+        Part& part = m_parts[i];
+        if (part.pixels.isNull()) return;
+        part.packed = packRows(part.pixels, part.rect);
+        part.pixels = QImage();
+    });
+}
+
+size_t TileSnapshot::memoryUsage() const
+{
+    size_t bytes = 0;
+    for (const Part& part : m_parts) {
+        bytes += part.packed.isEmpty()
+            ? static_cast<size_t>(part.pixels.sizeInBytes())
+            : static_cast<size_t>(part.packed.size());
+    }
+    return bytes;
+}
+
+QByteArray TileSnapshot::toByteArray() const
+{
+    std::vector<QByteArray> packed(m_parts.size());
+    ThreadPool::global().parallelFor(0, static_cast<int>(m_parts.size()), [this, &packed](int i) {
+        const Part& part = m_parts[i];
+        if (!part.packed.isEmpty()) {
+            packed[i] = part.packed;
+        } else if (!part.pixels.isNull()) {
+            packed[i] = packRows(part.pixels, part.rect);
+        }
+    });
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << m_bounds << static_cast<quint32>(m_parts.size());
+    for (size_t i = 0; i < m_parts.size(); ++i) {
+        stream << m_parts[i].rect << static_cast<quint32>(m_parts[i].color) << packed[i];
+    }
+    return data;
+}
+
+TileSnapshot TileSnapshot::fromByteArray(const QByteArray& data)
+{
+    TileSnapshot snapshot;
+    QDataStream stream(data);
+
+    quint32 count = 0;
+    stream >> snapshot.m_bounds >> count;
+    snapshot.m_parts.resize(count);
+    for (Part& part : snapshot.m_parts) {
+        quint32 color = 0;
+        stream >> part.rect >> color >> part.packed;
+        part.color = color;
+        snapshot.m_region += part.rect;
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        return TileSnapshot();
+    }
+    return snapshot;
+}
+
+} // namespace core
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <QByteArray>
+#include <QImage>
+#include <QRect>
+#include <QRegion>
+#include <vector>
+#include <cstddef>
+#include "tile_storage.h"
+
+namespace core {
+
+/**
+ * @brief Saved copy of part of a TileStorage, used as an undo delta
+ *
+ * Only the pixels inside the captured area are kept, as parts that each lie
+ * within one tile. Parts that fall on a uniform tile store just the colour.
+ * Once a snapshot holds more than CompressThreshold bytes of uncompressed
+ * pixels, compress() packs them with zlib; restoring unpacks one at a time.
+ */
+class TileSnapshot {
+public:
+    static constexpr size_t CompressThreshold = 64 * 1024;
+
+    TileSnapshot() = default;
+
+    /**
+     * @brief Capture the pixels of `area` (clipped to the storage bounds)
+     */
+    static TileSnapshot capture(const TileStorage& tiles, const QRect& area);
+
+    bool isNull() const { return m_parts.empty(); }
+    QRect bounds() const { return m_bounds; }
+    const QRegion& region() const { return m_region; }
+
+    /**
+     * @brief Write the saved pixels back, touching only the captured area
+     */
+    void restore(TileStorage& tiles) const;
+
+    /**
+     * @brief Add a snapshot taken after this one
+     *
+     * Pixels this snapshot already holds are older and win; only the part
+     * of `later` outside region() is added, so restoring the result gives
+     * the state from before both.
+     */
+    void merge(const TileSnapshot& later);
+
+    /**
+     * @brief Compress uncompressed parts if they add up to CompressThreshold
+     */
+    void compress();
+
+    /**
+     * @brief Bytes held by the saved pixel data
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * @brief Serialise with every part compressed, for spilling to disk
+     */
+    QByteArray toByteArray() const;
+
+    /**
+     * @brief Rebuild a snapshot written by toByteArray()
+     *
+     * The parts stay compressed until restore().
+     */
+    static TileSnapshot fromByteArray(const QByteArray& data);
+
+private:
+    struct Part {
+        QRect rect;             // Storage coordinates, inside one tile
+        QRgb color = 0;         // Used while pixels and packed are empty
+        QImage pixels;
+        QByteArray packed;      // zlib-compressed rows of `pixels`
+
+        bool isUniform() const { return pixels.isNull() && packed.isEmpty(); }
+        Part cropped(const QRect& area) const;
+    };
+
+    QRect m_bounds;
+    QRegion m_region;
+    std::vector<Part> m_parts;
+};
+
+} // namespace core
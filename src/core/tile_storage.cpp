@@ -0,0 +1,396 @@
+#include "tile_storage.h"
+#include <QPainter>
+#include <algorithm>
+#include <cstring>
+
+namespace core {
+
+/**
+ * @brief Decoded pixels of evictable lazy tiles, most recently read first
+ *
+ * Lock order is the cache, then a tile; a tile's own lock is never held
+ * while taking the cache's.
+ */
+class DecodedTileCache {
+public:
+    static DecodedTileCache& instance()
+    {
+        // Never destroyed: tiles may outlive static destruction
+        static DecodedTileCache* cache = new DecodedTileCache;
+        return *cache;
+    }
+
+    void touch(const LazyTile* tile)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        {
+            std::lock_guard<std::mutex> tileLock(tile->m_mutex);
+            if (tile->m_image.isNull()) return;     // Evicted since it was read
+        }
+        if (tile->m_cached) {
+            m_tiles.splice(m_tiles.begin(), m_tiles, tile->m_cacheEntry);
+            return;
+        }
+        m_tiles.push_front(tile);
+        tile->m_cacheEntry = m_tiles.begin();
+        tile->m_cached = true;
+        m_bytes += TileBytes;
+        trim();
+    }
+
+    void remove(const LazyTile* tile)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (tile->m_cached) {
+            m_tiles.erase(tile->m_cacheEntry);
+            tile->m_cached = false;
+            m_bytes -= TileBytes;
+        }
+    }
+
+    size_t limit()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_limit;
+    }
+
+    void setLimit(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_limit = bytes;
+        trim();
+    }
+
+private:
+    static constexpr size_t TileBytes = size_t(TileStorage::TileSize) * TileStorage::TileSize * sizeof(QRgb);
+
+    std::mutex m_mutex;
+    std::list<const LazyTile*> m_tiles;
+    size_t m_bytes = 0;
+    size_t m_limit = LazyTile::DefaultCacheLimit;
+
+    void trim()
+    {
+        while (m_bytes > m_limit && !m_tiles.empty()) {
+            const LazyTile* tile = m_tiles.back();
+            m_tiles.pop_back();
+            tile->m_cached = false;
+            m_bytes -= TileBytes;
+
+            std::lock_guard<std::mutex> tileLock(tile->m_mutex);
+            tile->m_image = QImage();
+            tile->m_decoded.store(false, std::memory_order_release);
+        }
+    }
+};
+
+LazyTile::~LazyTile()
+{
+    if (m_evictable) {
+        DecodedTileCache::instance().remove(this);
+    }
+}
+
+QImage LazyTile::image() const
+{
+    QImage image;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_image.isNull()) {
+            m_image = decode();
+            m_decoded.store(true, std::memory_order_release);
+        }
+        image = m_image;
+    }
+    if (m_evictable) {
+        DecodedTileCache::instance().touch(this);
+    }
+    return image;
+}
+
+size_t LazyTile::cacheLimit()
+{
+    return DecodedTileCache::instance().limit();
+}
+
+void LazyTile::setCacheLimit(size_t bytes)
+{
+    DecodedTileCache::instance().setLimit(bytes);
+}
+
+QRgb TileStorage::Tile::pixel(int x, int y) const
+{
+    if (isUniform()) {
+        return m_color;
+    }
+    return reinterpret_cast<const QRgb*>(image().constScanLine(y))[x];
+}
+
+TileStorage::TileStorage(int width, int height, QRgb fill)
+    : m_width(std::max(0, width))
+    , m_height(std::max(0, height))
+    , m_tilesX((m_width + TileSize - 1) / TileSize)
+    , m_tilesY((m_height + TileSize - 1) / TileSize)
+    , m_tiles(static_cast<size_t>(m_tilesX) * m_tilesY)
+{
+    for (auto& tile : m_tiles) {
+        tile.m_color = fill;
+    }
+}
+
+TileStorage::TileStorage(const QImage& image)
+    : TileStorage(image.width(), image.height(), 0)
+{
+    write(image);
+}
+
+QRect TileStorage::tileRect(int tx, int ty) const
+{
+    return QRect(tx * TileSize, ty * TileSize, TileSize, TileSize) & rect();
+}
+
+QRect TileStorage::tileRange(const QRect& area) const
+{
+    QRect clipped = area & rect();
+    if (clipped.isEmpty()) {
+        return QRect();
+    }
+    return QRect(QPoint(clipped.left() / TileSize, clipped.top() / TileSize),
+                 QPoint(clipped.right() / TileSize, clipped.bottom() / TileSize));
+}
+
+QImage& TileStorage::detachTile(int tx, int ty)
+{
+    Tile& tile = tileRef(tx, ty);
+    if (tile.m_lazy) {
+        tile.m_image = tile.m_lazy->image();
+        tile.m_lazy.reset();
+    } else if (tile.isUniform()) {
+        tile.m_image = QImage(TileSize, TileSize, QImage::Format_ARGB32_Premultiplied);
+        tile.m_image.fill(tile.m_color);
+    }
+    // Non-const bits() detaches the image if it is shared with another storage
+    tile.m_image.bits();
+    return tile.m_image;
+}
+
+void TileStorage::setUniformTile(int tx, int ty, QRgb value)
+{
+    Tile& tile = tileRef(tx, ty);
+    tile.m_image = QImage();
+    tile.m_lazy.reset();
+    tile.m_color = value;
+}
+
+void TileStorage::setLazyTile(int tx, int ty, std::shared_ptr<const LazyTile> lazy)
+{
+    Tile& tile = tileRef(tx, ty);
+    tile.m_image = QImage();
+    tile.m_lazy = std::move(lazy);
+}
+
+void TileStorage::setTile(int tx, int ty, const Tile& tile)
+{
+    tileRef(tx, ty) = tile;
+}
+
+void TileStorage::shareTiles(const TileStorage& source, const QRect& area)
+{
+    if (source.m_width != m_width || source.m_height != m_height) return;
+
+    const QRect range = tileRange(area);
+    if (range.isNull()) return;
+
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            tileRef(tx, ty) = source.tileAt(tx, ty);
+        }
+    }
+}
+
+void TileStorage::collapseIfUniform(Tile& tile, const QRect& valid)
+{
+    // Lazy tiles were stored because they are not uniform
+    if (tile.isUniform() || tile.m_lazy || valid.isEmpty()) return;
+
+    const QRgb first = reinterpret_cast<const QRgb*>(tile.m_image.constScanLine(valid.top()))[valid.left()];
+    for (int y = valid.top(); y <= valid.bottom(); ++y) {
+        const QRgb* line = reinterpret_cast<const QRgb*>(tile.m_image.constScanLine(y));
+        for (int x = valid.left(); x <= valid.right(); ++x) {
+            if (line[x] != first) return;
+        }
+    }
+
+    tile.m_image = QImage();
+    tile.m_color = first;
+}
+
+void TileStorage::optimize(const QRect& area)
+{
+    QRect range = tileRange(area.isNull() ? rect() : area);
+    if (range.isNull()) return;
+
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            QRect valid = tileRect(tx, ty).translated(-tx * TileSize, -ty * TileSize);
+            collapseIfUniform(tileRef(tx, ty), valid);
+        }
+    }
+}
+
+QRgb TileStorage::pixel(int x, int y) const
+{
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height) {
+        return 0;
+    }
+    return tileAt(x / TileSize, y / TileSize).pixel(x % TileSize, y % TileSize);
+}
+
+void TileStorage::setPixel(int x, int y, QRgb value)
+{
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height) return;
+
+    const int tx = x / TileSize;
+    const int ty = y / TileSize;
+    const Tile& tile = tileAt(tx, ty);
+    if (tile.isUniform() && tile.uniformColor() == value) return;
+
+    QImage& image = detachTile(tx, ty);
+    reinterpret_cast<QRgb*>(image.scanLine(y % TileSize))[x % TileSize] = value;
+}
+
+void TileStorage::fill(QRgb value)
+{
+    for (auto& tile : m_tiles) {
+        tile.m_image = QImage();
+        tile.m_lazy.reset();
+        tile.m_color = value;
+    }
+}
+
+QImage TileStorage::copy(const QRect& area) const
+{
+    if (area.isEmpty()) return QImage();
+
+    QImage result(area.size(), QImage::Format_ARGB32_Premultiplied);
+    QRect clipped = area & rect();
+    if (clipped != area) {
+        result.fill(Qt::transparent);
+    }
+
+    QRect range = tileRange(clipped);
+    if (range.isNull()) return result;
+
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            const Tile& tile = tileAt(tx, ty);
+            QRect part = tileRect(tx, ty) & clipped;
+            const int srcX = part.left() - tx * TileSize;
+            const int srcY = part.top() - ty * TileSize;
+            const int dstX = part.left() - area.left();
+            const int dstY = part.top() - area.top();
+            const QImage image = tile.image();
+
+            for (int row = 0; row < part.height(); ++row) {
+                QRgb* dst = reinterpret_cast<QRgb*>(result.scanLine(dstY + row)) + dstX;
+                if (tile.isUniform()) {
+                    std::fill(dst, dst + part.width(), tile.uniformColor());
+                } else {
+                    const QRgb* src = reinterpret_cast<const QRgb*>(image.constScanLine(srcY + row)) + srcX;
+                    std::memcpy(dst, src, part.width() * sizeof(QRgb));
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+void TileStorage::write(const QImage& image, const QPoint& pos)
+{
+    if (image.isNull()) return;
+
+    const QImage source = image.format() == QImage::Format_ARGB32_Premultiplied
+        ? image
+        : image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    QRect target = QRect(pos, source.size()) & rect();
+    QRect range = tileRange(target);
+    if (range.isNull()) return;
+
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            QRect part = tileRect(tx, ty) & target;
+            const int dstX = part.left() - tx * TileSize;
+            const int dstY = part.top() - ty * TileSize;
+            const int srcX = part.left() - pos.x();
+            const int srcY = part.top() - pos.y();
+
+            // Writing a whole tile from scratch doesn't need the old contents
+            Tile& tile = tileRef(tx, ty);
+            if (part.size() == QSize(TileSize, TileSize) && (tile.isUniform() || tile.m_lazy)) {
+                tile.m_image = QImage(TileSize, TileSize, QImage::Format_ARGB32_Premultiplied);
+                tile.m_lazy.reset();
+            }
+
+            QImage& dstImage = detachTile(tx, ty);
+            for (int row = 0; row < part.height(); ++row) {
+                const QRgb* src = reinterpret_cast<const QRgb*>(source.constScanLine(srcY + row)) + srcX;
+                QRgb* dst = reinterpret_cast<QRgb*>(dstImage.scanLine(dstY + row)) + dstX;
+                std::memcpy(dst, src, part.width() * sizeof(QRgb));
+            }
+
+            QRect valid = tileRect(tx, ty).translated(-tx * TileSize, -ty * TileSize);
+            collapseIfUniform(tile, valid);
+        }
+    }
+}
+
+void TileStorage::draw(QPainter* painter, const QPoint& target, const QRect& source) const
+{
+    if (!painter) return;
+
+    QRect range = tileRange(source);
+    if (range.isNull()) return;
+
+    const QPoint offset = target - source.topLeft();
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            const Tile& tile = tileAt(tx, ty);
+            QRect part = tileRect(tx, ty) & source;
+
+            if (tile.isUniform()) {
+                if (qAlpha(tile.uniformColor()) == 0) continue;
+                painter->fillRect(part.translated(offset),
+                                  QColor::fromRgba(qUnpremultiply(tile.uniformColor())));
+            } else {
+                QPoint tileOrigin(tx * TileSize, ty * TileSize);
+                painter->drawImage(part.topLeft() + offset, tile.image(),
+                                   part.translated(-tileOrigin));
+            }
+        }
+    }
+}
+
+size_t TileStorage::memoryUsage() const
+{
+    size_t bytes = 0;
+    for (const auto& tile : m_tiles) {
+        if (tile.m_lazy) {
+            if (tile.m_lazy->isDecoded()) {
+                bytes += static_cast<size_t>(TileSize) * TileSize * sizeof(QRgb);
+            }
+        } else if (!tile.isUniform()) {
+            bytes += static_cast<size_t>(tile.m_image.sizeInBytes());
+        }
+    }
+    return bytes;
+}
+
+int TileStorage::allocatedTileCount() const
+{
+    return static_cast<int>(std::count_if(m_tiles.begin(), m_tiles.end(),
+        [](const Tile& tile) { return !tile.isUniform(); }));
+}
+
+} // namespace core
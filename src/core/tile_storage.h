@@ -0,0 +1,265 @@
+#pragma once
+
+#include <QImage>
+#include <QRect>
+#include <QPoint>
+#include <QSize>
+#include <QColor>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+
+class QPainter;
+
+namespace core {
+
+/**
+ * @brief Tile pixels kept in encoded form until first read
+ *
+ * Used for tiles of documents opened from disk and for tiles computed on
+ * demand, such as layer effects. Decoding happens on whichever thread
+ * reads the tile first; the result is then shared by every storage that
+ * refers to the tile. Writing to such a tile detaches it from
+ * the encoded source like any other shared tile.
+ *
+ * Evictable tiles share a budget for their decoded pixels (cacheLimit()).
+ * Past it, the least recently read ones drop their pixels and decode again
+ * when next read, so browsing a large file does not end up holding all of
+ * it decoded. Readers keep what they got: image() returns an implicitly
+ * shared copy that outlives an eviction.
+ */
+class LazyTile {
+public:
+    static constexpr size_t DefaultCacheLimit = size_t(256) << 20;
+
+    virtual ~LazyTile();
+
+    /**
+     * @brief Decoded pixels, a TileSize square premultiplied ARGB32 image
+     */
+    QImage image() const;
+
+    bool isDecoded() const { return m_decoded.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Bytes of decoded pixels kept by all evictable tiles together
+     */
+    static size_t cacheLimit();
+    static void setCacheLimit(size_t bytes);
+
+protected:
+    /**
+     * @param evictable Whether the decoded pixels may be dropped; only for
+     * sources decode() can read again, such as a mapped file
+     */
+    explicit LazyTile(bool evictable = false) : m_evictable(evictable) {}
+
+    virtual QImage decode() const = 0;
+
+private:
+    friend class DecodedTileCache;
+
+    const bool m_evictable;
+    mutable std::mutex m_mutex;
+    mutable QImage m_image;
+    mutable std::atomic<bool> m_decoded{false};
+
+    // Position in the eviction order, guarded by the cache
+    mutable bool m_cached = false;
+    mutable std::list<const LazyTile*>::iterator m_cacheEntry;
+};
+
+/**
+ * @brief Sparse tiled pixel storage used by raster layers
+ *
+ * Pixels are stored as premultiplied ARGB32 in fixed-size square tiles.
+ * A tile that holds a single colour (the common case for empty areas) keeps
+ * only that value; painted tiles own a QImage whose implicit sharing makes
+ * copies of the storage copy-on-write at tile granularity. Tiles loaded from
+ * a file may instead refer to a LazyTile that decodes on first access.
+ */
+class TileStorage {
+public:
+    static constexpr int TileSize = 256;
+
+    /**
+     * @brief A single tile, either uniform or backed by pixel data
+     */
+    class Tile {
+    public:
+        bool isUniform() const { return m_image.isNull() && !m_lazy; }
+        QRgb uniformColor() const { return m_color; }
+        QImage image() const { return m_lazy ? m_lazy->image() : m_image; }
+
+        /**
+         * @brief Encoded source of the tile, or null once it owns its pixels
+         */
+        const LazyTile* lazy() const { return m_lazy.get(); }
+
+        QRgb pixel(int x, int y) const;
+
+    private:
+        friend class TileStorage;
+
+        QImage m_image;  // Null while the tile is uniform or lazy
+        QRgb m_color = 0;
+        std::shared_ptr<const LazyTile> m_lazy;
+    };
+
+    TileStorage() = default;
+    TileStorage(int width, int height, QRgb fill = 0);
+    explicit TileStorage(const QImage& image);
+
+    // === Geometry ===
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    QSize size() const { return QSize(m_width, m_height); }
+    QRect rect() const { return QRect(0, 0, m_width, m_height); }
+    bool isNull() const { return m_tiles.empty(); }
+
+    int tilesX() const { return m_tilesX; }
+    int tilesY() const { return m_tilesY; }
+
+    /**
+     * @brief Pixel rectangle covered by a tile, clipped to the storage bounds
+     */
+    QRect tileRect(int tx, int ty) const;
+
+    /**
+     * @brief Range of tile indices (inclusive) overlapping a pixel rectangle
+     */
+    QRect tileRange(const QRect& area) const;
+
+    // === Tile access ===
+
+    const Tile& tileAt(int tx, int ty) const { return m_tiles[ty * m_tilesX + tx]; }
+
+    /**
+     * @brief Get writable pixel data for a tile
+     *
+     * Uniform tiles are expanded and shared tiles are detached, so the
+     * returned image may be modified in place.
+     */
+    QImage& detachTile(int tx, int ty);
+
+    /**
+     * @brief Replace a tile with a single colour, releasing its pixels
+     */
+    void setUniformTile(int tx, int ty, QRgb value);
+
+    /**
+     * @brief Replace a tile with one that is decoded on first access
+     */
+    void setLazyTile(int tx, int ty, std::shared_ptr<const LazyTile> tile);
+
+    /**
+     * @brief Share a tile of another storage, e.g. one at a different offset
+     */
+    void setTile(int tx, int ty, const Tile& tile);
+
+    /**
+     * @brief Take the tiles overlapping an area from a storage of the same size
+     *
+     * Tiles are shared, not copied: whichever storage writes first detaches.
+     */
+    void shareTiles(const TileStorage& source, const QRect& area);
+
+    /**
+     * @brief Collapse tiles inside the given area that hold a single colour
+     */
+    void optimize(const QRect& area = QRect());
+
+    // === Pixel access ===
+
+    QRgb pixel(int x, int y) const;
+    void setPixel(int x, int y, QRgb value);
+    void fill(QRgb value);
+
+    /**
+     * @brief Copy an area into a new image (pixels outside are transparent)
+     */
+    QImage copy(const QRect& area) const;
+
+    /**
+     * @brief Materialise the whole storage as one image
+     */
+    QImage toImage() const { return copy(rect()); }
+
+    /**
+     * @brief Write an image into the storage with its top-left at pos
+     */
+    void write(const QImage& image, const QPoint& pos = QPoint(0, 0));
+
+    /**
+     * @brief Draw the area `source` with its top-left at `target`
+     *
+     * Fully transparent tiles are skipped, which matches drawing them only
+     * under source-over style composition.
+     */
+    void draw(QPainter* painter, const QPoint& target, const QRect& source) const;
+
+    /**
+     * @brief Visit an area one row span at a time
+     *
+     * Calls func(x, y, pixels, count) for each row of each tile overlapping
+     * the area, without copying painted tiles. Uniform tiles are expanded
+     * into a small row buffer.
+     */
+    template <typename Func>
+    void forEachSpan(const QRect& area, Func&& func) const;
+
+    // === Statistics ===
+
+    /**
+     * @brief Bytes held by tiles with pixel data (lazy tiles once decoded)
+     */
+    size_t memoryUsage() const;
+
+    int allocatedTileCount() const;
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    int m_tilesX = 0;
+    int m_tilesY = 0;
+    std::vector<Tile> m_tiles;
+
+    Tile& tileRef(int tx, int ty) { return m_tiles[ty * m_tilesX + tx]; }
+    void collapseIfUniform(Tile& tile, const QRect& valid);
+};
+
+template <typename Func>
+void TileStorage::forEachSpan(const QRect& area, Func&& func) const
+{
+    const QRect clipped = area & rect();
+    const QRect range = tileRange(clipped);
+    if (range.isNull()) return;
+
+    QRgb uniformRow[TileSize];
+    for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+        for (int tx = range.left(); tx <= range.right(); ++tx) {
+            const Tile& tile = tileAt(tx, ty);
+            const QRect part = tileRect(tx, ty) & clipped;
+            const int srcX = part.left() - tx * TileSize;
+
+            // Held for the whole tile: a lazy tile may drop its pixels
+            const QImage image = tile.image();
+            if (tile.isUniform()) {
+                std::fill(uniformRow, uniformRow + part.width(), tile.uniformColor());
+            }
+            for (int y = part.top(); y <= part.bottom(); ++y) {
+                const QRgb* pixels = tile.isUniform()
+                    ? uniformRow
+                    : reinterpret_cast<const QRgb*>(image.constScanLine(y - ty * TileSize)) + srcX;
+                func(part.left(), y, pixels, part.width());
+            }
+        }
+    }
+}
+
+} // namespace core
@@ -0,0 +1,162 @@
+#include "undo_journal.h"
+#include <QDir>
+#include <QDebug>
+#include <iterator>
+
+namespace core {
+
+UndoJournal::UndoJournal(const QString& directory)
+    : m_directory(directory)
+{
+}
+
+UndoJournal::~UndoJournal()
+{
+    unmap();
+}
+
+bool UndoJournal::open()
+{
+    if (m_file.isOpen()) return true;
+
+    QDir dir(m_directory);
+    if (!dir.mkpath(".")) {
+        qDebug() << "UndoJournal: Cannot create cache directory" << m_directory;
+        return false;
+    }
+
+    m_file.setFileTemplate(dir.filePath("undo-XXXXXX.journal"));
+    if (!m_file.open()) {
+        qDebug() << "UndoJournal: Cannot create journal in" << m_directory;
+        return false;
+    }
+    return true;
+}
+
+UndoJournal::Record UndoJournal::append(const QByteArray& data)
+{
+    Record record;
+    if (data.isEmpty() || !open()) return record;
+
+    const qint64 size = data.size();
+    qint64 offset = takeHole(size);
+    const bool atEnd = offset < 0;
+    if (atEnd) offset = m_fileSize;
+
+    // Flushed so the mapping, which may already cover a hole, sees the data
+    if (!m_file.seek(offset) || m_file.write(data) != size || !m_file.flush()) {
+        // Disk full or similar: leave the range for the next record to overwrite
+        if (!atEnd) addHole(offset, size);
+        return record;
+    }
+
+    record.offset = offset;
+    record.size = size;
+    if (atEnd) m_fileSize += size;
+    m_liveBytes += size;
+    return record;
+}
+
+QByteArray UndoJournal::read(const Record& record)
+{
+    if (!record.isValid() || record.offset + record.size > m_fileSize) return QByteArray();
+
+    if (mapUpTo(record.offset + record.size)) {
+        return QByteArray(reinterpret_cast<const char*>(m_mapping + record.offset),
+                          static_cast<int>(record.size));
+    }
+
+    // Mapping can fail for huge files on 32-bit builds; fall back to a read
+    if (!m_file.seek(record.offset)) return QByteArray();
+    return m_file.read(record.size);
+}
+
+void UndoJournal::release(const Record& record)
+{
+    if (!record.isValid()) return;
+
+    m_liveBytes -= record.size;
+    if (m_liveBytes <= 0) {
+        clear();
+        return;
+    }
+    addHole(record.offset, record.size);
+
+    // A hole at the end is just a shorter file
+    auto last = m_holes.empty() ? m_holes.end() : std::prev(m_holes.end());
+    if (last != m_holes.end() && last->first + last->second == m_fileSize) {
+        m_fileSize = last->first;
+        m_holes.erase(last);
+        unmap();
+        m_file.resize(m_fileSize);
+    }
+}
+
+void UndoJournal::clear()
+{
+    unmap();
+    if (m_file.isOpen()) {
+        m_file.resize(0);
+    }
+    m_fileSize = 0;
+    m_liveBytes = 0;
+    m_holes.clear();
+}
+
+qint64 UndoJournal::takeHole(qint64 size)
+{
+    for (auto it = m_holes.begin(); it != m_holes.end(); ++it) {
+        if (it->second < size) continue;
+
+        const qint64 offset = it->first;
+        const qint64 left = it->second - size;
+        m_holes.erase(it);
+        if (left > 0) {
+            m_holes.emplace(offset + size, left);
+        }
+        return offset;
+    }
+    return -1;
+}
+
+void UndoJournal::addHole(qint64 offset, qint64 size)
+{
+    // Merge with the holes on either side
+    auto next = m_holes.lower_bound(offset);
+    if (next != m_holes.end() && offset + size == next->first) {
+        size += next->second;
+        next = m_holes.erase(next);
+    }
+    if (next != m_holes.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            previous->second += size;
+            return;
+        }
+    }
+    m_holes.emplace(offset, size);
+}
+
+bool UndoJournal::mapUpTo(qint64 end)
+{
+    if (m_mapping && end <= m_mappedSize) return true;
+
+    // Appends have grown the file past the current view; map all of it
+    unmap();
+    m_file.flush();
+    m_mapping = m_file.map(0, m_fileSize);
+    if (!m_mapping) return false;
+    m_mappedSize = m_fileSize;
+    return true;
+}
+
+void UndoJournal::unmap()
+{
+    if (m_mapping) {
+        m_file.unmap(m_mapping);
+        m_mapping = nullptr;
+        m_mappedSize = 0;
+    }
+}
+
+} // namespace core
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QByteArray>
+#include <QTemporaryFile>
+#include <QString>
+#include <QtGlobal>
+#include <map>
+
+namespace core {
+
+/**
+ * @brief Append-only spill file for undo history payloads
+ *
+ * Records are written with ordinary writes and read back through a memory
+ * mapping of the file, so paging a record in costs one copy out of the page
+ * cache. Released records leave holes that later records fill, first fit;
+ * holes at the end of the file are cut off, and the file is truncated once
+ * no live record remains, so its size follows the live records rather than
+ * everything ever written. The file is temporary and removed with the
+ * journal.
+ */
+class UndoJournal {
+public:
+    /**
+     * @brief Location of one record in the journal
+     */
+    struct Record {
+        qint64 offset = -1;
+        qint64 size = 0;
+
+        bool isValid() const { return offset >= 0; }
+    };
+
+    /**
+     * @brief Create a journal in `directory`; the file is created lazily
+     */
+    explicit UndoJournal(const QString& directory);
+    ~UndoJournal();
+
+    UndoJournal(const UndoJournal&) = delete;
+    UndoJournal& operator=(const UndoJournal&) = delete;
+
+    /**
+     * @brief Store a payload, in a hole left by released records if one fits
+     * @return The record, or an invalid one if the file could not be written
+     */
+    Record append(const QByteArray& data);
+
+    /**
+     * @brief Read a payload back
+     */
+    QByteArray read(const Record& record);
+
+    /**
+     * @brief Mark a record as no longer needed
+     */
+    void release(const Record& record);
+
+    /**
+     * @brief Drop every record and truncate the file
+     */
+    void clear();
+
+    qint64 fileSize() const { return m_fileSize; }
+    qint64 liveBytes() const { return m_liveBytes; }
+
+private:
+    bool open();
+    bool mapUpTo(qint64 end);
+    void unmap();
+    qint64 takeHole(qint64 size);
+    void addHole(qint64 offset, qint64 size);
+
+    QString m_directory;
+    QTemporaryFile m_file;
+    uchar* m_mapping = nullptr;
+    qint64 m_mappedSize = 0;
+    qint64 m_fileSize = 0;
+    qint64 m_liveBytes = 0;
+    std::map<qint64, qint64> m_holes;   // Free ranges by offset, never adjacent
+};
+
+} // namespace core
@@ -0,0 +1,92 @@
+// Blend kernel throughput benchmark.
+//
+// Usage: blend-benchmark [width] [height] [iterations]
+// Composites a random premultiplied layer over a random backdrop with every
+// blend mode at every supported SIMD level and reports megapixels per second.
+
+#include "blend_kernels.h"
+#include "cpu_features.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+
+uint32_t randomPremultiplied(std::mt19937& rng)
+{
+    const uint32_t value = rng();
+    const uint32_t alpha = value >> 24;
+    auto channel = [alpha](uint32_t c) { return (c * alpha + 127) / 255; };
+    return (alpha << 24)
+        | (channel((value >> 16) & 0xff) << 16)
+        | (channel((value >> 8) & 0xff) << 8)
+        | channel(value & 0xff);
+}
+
+double measure(core::blend::RowFunc func, const std::vector<uint32_t>& backdrop,
+               const std::vector<uint32_t>& layer, int width, int height, int iterations)
+{
+    std::vector<uint32_t> target(backdrop.size());
+
+    double best = 0.0;
+    for (int i = 0; i < iterations; ++i) {
+        target = backdrop;
+        const auto start = std::chrono::steady_clock::now();
+        for (int y = 0; y < height; ++y) {
+            const size_t offset = static_cast<size_t>(y) * width;
+            func(target.data() + offset, layer.data() + offset, width, 0.8f, 0, y);
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const double mps = static_cast<double>(width) * height / elapsed.count() / 1e6;
+        if (mps > best) best = mps;
+    }
+    return best;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const int width = argc > 1 ? std::atoi(argv[1]) : 2048;
+    const int height = argc > 2 ? std::atoi(argv[2]) : 2048;
+    const int iterations = argc > 3 ? std::atoi(argv[3]) : 5;
+    if (width <= 0 || height <= 0 || iterations <= 0) {
+        std::fprintf(stderr, "usage: %s [width] [height] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 rng(42);
+    const size_t count = static_cast<size_t>(width) * height;
+    std::vector<uint32_t> backdrop(count);
+    std::vector<uint32_t> layer(count);
+    for (size_t i = 0; i < count; ++i) {
+        backdrop[i] = randomPremultiplied(rng);
+        layer[i] = randomPremultiplied(rng);
+    }
+
+    const core::SimdLevel supported = core::supportedSimdLevel();
+    std::printf("%dx%d, best of %d, supported: %s\n\n", width, height, iterations,
+                core::simdLevelName(supported));
+
+    std::printf("%-14s", "mode (MP/s)");
+    for (int level = 0; level <= static_cast<int>(supported); ++level) {
+        std::printf("%12s", core::simdLevelName(static_cast<core::SimdLevel>(level)));
+    }
+    std::printf("\n");
+
+    for (int mode = 0; mode < core::BlendModeCount; ++mode) {
+        const auto blendMode = static_cast<core::BlendMode>(mode);
+        std::printf("%-14s", core::blendModeName(blendMode));
+        for (int level = 0; level <= static_cast<int>(supported); ++level) {
+            auto func = core::blend::rowFunction(blendMode, static_cast<core::SimdLevel>(level));
+            std::printf("%12.1f", measure(func, backdrop, layer, width, height, iterations));
+        }
+        std::printf("\n");
+    }
+
+    return 0;
+}
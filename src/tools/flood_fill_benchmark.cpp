@@ -0,0 +1,105 @@
+// Magic wand and bucket fill benchmark.
+//
+// Usage: flood-fill-benchmark [width] [height] [iterations]
+// Fills a 100 MP image by default: one of a single colour, where whole
+// tiles are taken without touching pixels, and a painted one of noisy
+// cells walled off from each other except for small gaps, so a contiguous
+// fill winds through every cell and crosses tile edges many times.
+// For each it times the first contiguous fill (which computes the distances
+// of every tile it reaches), a second one at another tolerance (which
+// reuses them, as the tolerance slider does) and the non-contiguous
+// threshold pass, in milliseconds, best of `iterations` for the reused ones.
+
+#include "flood_fill.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double millisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Noisy light cells between dark walls with gaps, built a tile at a time
+core::TileStorage paintedImage(int width, int height)
+{
+    core::TileStorage tiles(width, height);
+    for (int ty = 0; ty < tiles.tilesY(); ++ty) {
+        for (int tx = 0; tx < tiles.tilesX(); ++tx) {
+            QImage& tile = tiles.detachTile(tx, ty);
+            const QRect rect = tiles.tileRect(tx, ty);
+            for (int y = 0; y < rect.height(); ++y) {
+                auto* line = reinterpret_cast<uint32_t*>(tile.scanLine(y));
+                const int gy = rect.top() + y;
+                for (int x = 0; x < rect.width(); ++x) {
+                    const int gx = rect.left() + x;
+                    const bool wall = (gx % 333 < 3 && gy % 1000 >= 40) || (gy % 277 < 3 && gx % 900 >= 40);
+                    const int value = wall ? 30 : 180 + ((gx * 7 + gy * 13) & 15);
+                    line[x] = 0xff000000u | (value << 16) | (value << 8) | value;
+                }
+            }
+        }
+    }
+    return tiles;
+}
+
+void run(const char* name, const core::TileStorage& tiles, int iterations)
+{
+    core::FloodFill::Options options;
+    options.tolerance = 20;
+
+    auto start = Clock::now();
+    core::FloodFill fill(tiles, QPoint(10, 10));
+    const core::Selection first = fill.select(options);
+    const double firstTime = millisecondsSince(start);
+
+    double again = 1e30;
+    double global = 1e30;
+    for (int i = 0; i < iterations; ++i) {
+        options.tolerance = 30 + i % 2;
+        options.contiguous = true;
+        start = Clock::now();
+        fill.select(options);
+        again = std::min(again, millisecondsSince(start));
+
+        options.contiguous = false;
+        start = Clock::now();
+        fill.select(options);
+        global = std::min(global, millisecondsSince(start));
+    }
+
+    const QRect bounds = first.bounds();
+    std::printf("%-10s%12.1f%12.1f%14.1f%10dx%-6d%10.1f\n", name, firstTime, again, global,
+                bounds.width(), bounds.height(), fill.memoryUsage() / (1024.0 * 1024.0));
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const int width = argc > 1 ? std::atoi(argv[1]) : 10000;
+    const int height = argc > 2 ? std::atoi(argv[2]) : 10000;
+    const int iterations = argc > 3 ? std::atoi(argv[3]) : 5;
+    if (width <= 0 || height <= 0 || iterations <= 0) {
+        std::fprintf(stderr, "usage: %s [width] [height] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    std::printf("%dx%d (%.1f MP), best of %d, %d threads\n\n", width, height,
+                static_cast<double>(width) * height / 1e6, iterations,
+                core::ThreadPool::global().concurrency());
+    std::printf("%-10s%12s%12s%14s%16s%10s\n", "(ms)", "first", "reused", "global", "region", "MiB");
+
+    run("flat", core::TileStorage(width, height, 0xffffffffu), iterations);
+    run("painted", paintedImage(width, height), iterations);
+
+    return 0;
+}
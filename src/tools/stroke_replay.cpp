@@ -0,0 +1,187 @@
+// Stroke replay benchmark.
+//
+// Usage: stroke-replay <recording.kstr> [--fast]
+// Feeds a recorded stroke file (see core::StrokeRecording; CanvasView writes
+// one per document when IMAGEEDITOR_STROKE_LOG is set) through BrushEngine
+// and CommandManager on a fresh document, exactly as an interactive stroke
+// would be painted and recorded for undo. By default events are replayed at their
+// recorded times; --fast feeds them back to back. Reports dabs per second,
+// per-event latency percentiles and memory growth.
+
+#include "brush_engine.h"
+#include "command.h"
+#include "document.h"
+#include "layer.h"
+#include "stroke_recording.h"
+
+#include <QCoreApplication>
+#include <QColor>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+size_t residentBytes()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.WorkingSetSize;
+    }
+#elif defined(__linux__)
+    if (FILE* statm = std::fopen("/proc/self/statm", "r")) {
+        unsigned long total = 0;
+        unsigned long resident = 0;
+        const int read = std::fscanf(statm, "%lu %lu", &total, &resident);
+        std::fclose(statm);
+        if (read == 2) {
+            return static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        }
+    }
+#endif
+    return 0;
+}
+
+double percentile(const std::vector<double>& sorted, double fraction)
+{
+    if (sorted.empty()) return 0.0;
+    const size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+double mib(size_t bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    const char* path = nullptr;
+    bool fast = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--fast") == 0) {
+            fast = true;
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (!path) {
+        std::fprintf(stderr, "usage: %s <recording.kstr> [--fast]\n", argv[0]);
+        return 1;
+    }
+
+    core::StrokeRecording recording;
+    QString error;
+    if (!core::StrokeRecording::load(QString::fromLocal8Bit(path), recording, &error)) {
+        std::fprintf(stderr, "%s: %s\n", path, qPrintable(error));
+        return 1;
+    }
+    if (recording.canvasSize().isEmpty() || recording.strokes().empty()) {
+        std::fprintf(stderr, "%s: nothing to replay\n", path);
+        return 1;
+    }
+
+    const QSize size = recording.canvasSize();
+    const int64_t duration = recording.strokes().back().endTime;
+    std::printf("recording: %zu strokes, %zu samples, %dx%d, %.1f s\n",
+                recording.strokes().size(), recording.sampleCount(),
+                size.width(), size.height(), duration / 1e6);
+    std::printf("mode: %s\n", fast ? "as fast as possible" : "recorded speed");
+
+    const size_t residentBefore = residentBytes();
+
+    // Paint on a layer of its own above the background, as a user would
+    core::Document document(size.width(), size.height());
+    auto layer = std::make_shared<core::RasterLayer>(size.width(), size.height());
+    layer->setName("Replay");
+    document.addLayer(layer);
+    const int layerIndex = document.getLayerCount() - 1;
+
+    core::CommandManager history;
+    auto engine = std::make_shared<core::BrushEngine>();
+
+    std::vector<double> latencies;
+    latencies.reserve(recording.sampleCount());
+    size_t dabCount = 0;
+
+    const Clock::time_point start = Clock::now();
+    auto due = [&](int64_t time) { return start + std::chrono::microseconds(time); };
+
+    for (const core::StrokeRecording::Stroke& stroke : recording.strokes()) {
+        engine->setSettings(stroke.settings);
+        const QColor color = QColor::fromRgba(stroke.color);
+        history.beginStroke();
+
+        for (size_t i = 0; i < stroke.samples.size(); ++i) {
+            const core::StrokeRecording::Sample& sample = stroke.samples[i];
+
+            // Latency counts from when the event was due, so falling behind
+            // the recording shows up as queueing delay on later events
+            Clock::time_point arrival = Clock::now();
+            if (!fast) {
+                arrival = due(sample.time);
+                std::this_thread::sleep_until(arrival);
+            }
+
+            if (i == 0) {
+                engine->beginStroke(sample.x, sample.y, sample.pressure, sample.tilt);
+            } else {
+                engine->addPoint(sample.x, sample.y, sample.pressure, sample.tilt);
+            }
+
+            if (!engine->pendingDabs().empty()) {
+                dabCount += engine->pendingDabs().size();
+                history.executeCommand(std::make_unique<core::DabStrokeCommand>(
+                    engine, engine->pendingDabs(), color, layerIndex), &document);
+                engine->clearPendingDabs();
+            }
+
+            const std::chrono::duration<double, std::milli> latency = Clock::now() - arrival;
+            latencies.push_back(latency.count());
+        }
+
+        if (!fast) {
+            std::this_thread::sleep_until(due(stroke.endTime));
+        }
+        engine->endStroke();
+        history.endStroke();
+    }
+
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    const size_t residentAfter = residentBytes();
+
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("dabs: %zu in %.2f s (%.0f dabs/s)\n", dabCount, elapsed.count(), dabCount / elapsed.count());
+    std::printf("event latency (ms): p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+                percentile(latencies, 0.50), percentile(latencies, 0.90),
+                percentile(latencies, 0.99), latencies.empty() ? 0.0 : latencies.back());
+    std::printf("memory: %+.1f MiB resident, history %.1f MiB, layer %.1f MiB, layer caches %.1f MiB\n",
+                mib(residentAfter) - mib(residentBefore),
+                mib(static_cast<size_t>(history.memoryUsage())), mib(layer->tiles().memoryUsage()),
+                mib(layer->cacheMemoryUsage()));
+
+    return 0;
+}
@@ -9,9 +9,13 @@
 #include <QDropEvent>
 #include <QMimeData>
 #include <QUrl>
+#include <QDir>
 #include <QFileInfo>
 #include <QImageReader>
+#include <QtMath>
 #include <QFile>
+#include <QTabletEvent>
+#include <cmath>
 #include "../core/layer.h"
 
 namespace ui {
@@ -27,6 +31,8 @@ CanvasView::CanvasView(QWidget* parent)
     , m_updateTimer(new QTimer(this))
     , m_brushColor(Qt::black)
     , m_brushSize(10)
+    , m_strokeRenderer(new core::StrokeRenderer(this))
+    , m_strokeLogPath(qEnvironmentVariable("IMAGEEDITOR_STROKE_LOG"))
 {
     setScene(m_scene);
     setRenderHint(QPainter::Antialiasing);
@@ -57,6 +63,11 @@ CanvasView::~CanvasView()
 
 void CanvasView::setDocument(core::Document* document)
 {
+    // Land any stroke in flight on the document it was drawn on
+    endLayerStroke();
+    m_strokeRenderer->flush();
+    m_strokeLog.reset();
+    
     // Disconnect from old document if any
     if (m_document) {
         disconnect(m_document, nullptr, this, nullptr);
@@ -71,6 +82,7 @@ void CanvasView::setDocument(core::Document* document)
         connect(m_document, &core::Document::activeLayerChanged,this, [this](int){ updateFromDocument(); });
         connect(m_document, &core::Document::documentChanged,   this, [this](){ updateFromDocument(); });
         connect(m_document, &core::Document::sizeChanged,       this, [this](const QSize&){ updateFromDocument(); });
+        connect(m_document, &core::Document::regionChanged,     this, [this](const QRect& rect){ updateCanvasRegion(rect); });
 
         // Update scene rect
         const QSize docSize = m_document->getSize();
@@ -118,6 +130,25 @@ void CanvasView::updateCanvasPixmap()
     m_scene->setSceneRect(m_canvasImage.rect());
 }
 
+void CanvasView::updateCanvasRegion(const QRect& rect)
+{
+    if (!m_document) return;
+    
+    QRect area = rect & m_canvasImage.rect();
+    if (area.isEmpty() || m_canvasImage.size() != m_document->getSize()) {
+        updateFromDocument();
+        return;
+    }
+    
+    // Patch just the damaged area from the document's composite cache
+    QPainter painter(&m_canvasImage);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(area.topLeft(), m_document->render(area));
+    painter.end();
+    
+    updateCanvasPixmap();
+}
+
 void CanvasView::updateFromDocument()
 {
     if (!m_document) return;
@@ -138,14 +169,16 @@ core::RasterLayer* CanvasView::activeRasterLayer()
 
 void CanvasView::drawBrushStroke(const QPointF& from, const QPointF& to)
 {
-    QPainter painter(&m_canvasImage);
-    painter.setRenderHint(QPainter::Antialiasing, true);
-    
     // Set up brush
     QPen pen(m_brushColor);
     pen.setWidth(m_brushSize);
     pen.setCapStyle(Qt::RoundCap);
     pen.setJoinStyle(Qt::RoundJoin);
+    
+    // Raster layers are painted by the stroke renderer; this only covers
+    // the bare canvas image shown when no document is open
+    QPainter painter(&m_canvasImage);
+    painter.setRenderHint(QPainter::Antialiasing, true);
     painter.setPen(pen);
     
     // Draw line
@@ -156,42 +189,21 @@ void CanvasView::drawBrushStroke(const QPointF& from, const QPointF& to)
         // Line stroke
         painter.drawLine(from, to);
     }
-    
-    // Persist stroke into active raster layer if available (layer position aware)
-    if (auto* layer = activeRasterLayer()) {
-        QImage layerImg = layer->getImage();
-        QPainter lp(&layerImg);
-        lp.setRenderHint(QPainter::Antialiasing, true);
-        QPen pen(m_brushColor);
-        pen.setWidth(m_brushSize);
-        pen.setCapStyle(Qt::RoundCap);
-        pen.setJoinStyle(Qt::RoundJoin);
-        lp.setPen(pen);
-        // Map scene coords to layer-local by subtracting layer position
-        QPointF lfrom = from - layer->getPosition();
-        QPointF lto   = to   - layer->getPosition();
-        if (lfrom == lto) {
-            lp.drawPoint(lfrom);
-        } else {
-            lp.drawLine(lfrom, lto);
-        }
-        lp.end();
-        layer->setImage(layerImg);
-    }
+    painter.end();
     updateCanvasPixmap();
 }
 
 void CanvasView::drawEraserStroke(const QPointF& from, const QPointF& to)
 {
-    QPainter painter(&m_canvasImage);
-    painter.setRenderHint(QPainter::Antialiasing, true);
-    painter.setCompositionMode(QPainter::CompositionMode_Clear);
-    
     // Set up eraser brush
     QPen pen(Qt::transparent);
     pen.setWidth(m_brushSize);
     pen.setCapStyle(Qt::RoundCap);
     pen.setJoinStyle(Qt::RoundJoin);
+    
+    QPainter painter(&m_canvasImage);
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    painter.setCompositionMode(QPainter::CompositionMode_Clear);
     painter.setPen(pen);
     
     // Draw eraser stroke
@@ -202,29 +214,71 @@ void CanvasView::drawEraserStroke(const QPointF& from, const QPointF& to)
         // Line stroke
         painter.drawLine(from, to);
     }
+    painter.end();
+    updateCanvasPixmap();
+}
+
+bool CanvasView::beginLayerStroke(const QPointF& scenePos, core::blend::DabMode mode)
+{
+    auto* layer = activeRasterLayer();
+    if (!layer) return false;
     
-    // Persist erase into active raster layer if available (layer position aware)
-    if (auto* layer = activeRasterLayer()) {
-        QImage layerImg = layer->getImage();
-        QPainter lp(&layerImg);
-        lp.setRenderHint(QPainter::Antialiasing, true);
-        lp.setCompositionMode(QPainter::CompositionMode_Clear);
-        QPen pen(Qt::transparent);
-        pen.setWidth(m_brushSize);
-        pen.setCapStyle(Qt::RoundCap);
-        pen.setJoinStyle(Qt::RoundJoin);
-        lp.setPen(pen);
-        QPointF lfrom = from - layer->getPosition();
-        QPointF lto   = to   - layer->getPosition();
-        if (lfrom == lto) {
-            lp.drawEllipse(lfrom, m_brushSize/2.0, m_brushSize/2.0);
-        } else {
-            lp.drawLine(lfrom, lto);
+    core::BrushSettings settings;
+    settings.size = m_brushSize / 2.0f;
+    settings.mode = mode;
+    
+    // Positions are layer-local; the layer is not moved mid-stroke
+    m_strokeOrigin = layer->getPosition();
+    // Erasing ignores the colour but takes its strength from the alpha
+    const QColor color = mode == core::blend::DabMode::Erase ? QColor(Qt::black) : m_brushColor;
+    m_strokeRenderer->beginStroke(layer, settings, color, scenePos - m_strokeOrigin,
+                                  m_penPressure, m_penTilt);
+    
+    if (!m_strokeLogPath.isEmpty()) {
+        // One log per document, appended to as strokes end. The first takes
+        // the name as given and later ones a numbered name beside it, so
+        // opening another document does not truncate the last recording.
+        if (!m_strokeLog) {
+            QString path = m_strokeLogPath;
+            if (m_strokeLogCount > 0) {
+                const QFileInfo info(m_strokeLogPath);
+                const QString suffix = info.suffix().isEmpty() ? QString() : "." + info.suffix();
+                path = info.dir().filePath(QString("%1-%2%3").arg(info.completeBaseName())
+                                               .arg(m_strokeLogCount + 1).arg(suffix));
+            }
+            ++m_strokeLogCount;
+            m_strokeLog = std::make_unique<core::StrokeLog>(path, m_document->getSize());
+            if (!m_strokeLog->isOpen()) {
+                qDebug() << "Failed to open stroke log" << path << ":" << m_strokeLog->errorString();
+            }
         }
-        lp.end();
-        layer->setImage(layerImg);
+        const QPointF position = scenePos - m_strokeOrigin;
+        m_strokeLog->beginStroke(settings, color.rgba(), position.x(), position.y(), m_penPressure, m_penTilt);
     }
-    updateCanvasPixmap();
+    return true;
+}
+
+void CanvasView::addLayerStrokePoint(const QPointF& scenePos)
+{
+    const QPointF position = scenePos - m_strokeOrigin;
+    m_strokeRenderer->addPoint(position, m_penPressure, m_penTilt);
+    if (m_strokeLog) {
+        m_strokeLog->addSample(position.x(), position.y(), m_penPressure, m_penTilt);
+    }
+}
+
+void CanvasView::endLayerStroke()
+{
+    if (!m_strokeRenderer->isStrokeActive()) return;
+    m_strokeRenderer->endStroke();
+    
+    if (m_strokeLog && m_strokeLog->isOpen() && !m_strokeLog->endStroke()) {
+        qDebug() << "Failed to write stroke log:" << m_strokeLog->errorString();
+    }
+    
+    const auto stats = m_strokeRenderer->latency();
+    qDebug() << "Stroke latency (ms): avg" << stats.average << "p95" << stats.p95
+             << "max" << stats.max << "over" << stats.samples << "updates";
 }
 
 void CanvasView::updateCursor()
@@ -328,12 +382,35 @@ void CanvasView::mousePressEvent(QMouseEvent* event)
 
 void CanvasView::mouseReleaseEvent(QMouseEvent* event)
 {
+    endLayerStroke();
     m_isDrawing = false;
     m_isSelecting = false;
     
     QGraphicsView::mouseReleaseEvent(event);
 }
 
+bool CanvasView::viewportEvent(QEvent* event)
+{
+    switch (event->type()) {
+        case QEvent::TabletPress:
+        case QEvent::TabletMove: {
+            // Left unaccepted, so Qt follows up with a mouse event that
+            // drives the tools as usual and picks these values up
+            const auto* tablet = static_cast<QTabletEvent*>(event);
+            m_penPressure = static_cast<float>(tablet->pressure());
+            m_penTilt = static_cast<float>(std::min(90.0, std::hypot(tablet->xTilt(), tablet->yTilt())));
+            break;
+        }
+        case QEvent::TabletRelease:
+            m_penPressure = 1.0f;
+            m_penTilt = 0.0f;
+            break;
+        default:
+            break;
+    }
+    return QGraphicsView::viewportEvent(event);
+}
+
 void CanvasView::wheelEvent(QWheelEvent* event)
 {
     if (event->modifiers() & Qt::ControlModifier) {
@@ -502,21 +579,28 @@ void CanvasView::handleBrushTool(QMouseEvent* event)
         m_currentStroke.moveTo(scenePos);
         
         // Draw initial brush mark
-        drawBrushStroke(scenePos, scenePos);
+        if (!beginLayerStroke(scenePos, core::blend::DabMode::Normal)) {
+            drawBrushStroke(scenePos, scenePos);
+        }
     }
     else if (m_isDrawing && event->buttons() & Qt::LeftButton) {
-        // Continue the stroke with smooth interpolation
-        QPointF lastScenePos = mapToScene(m_lastMousePos);
-        
-        // Calculate distance and interpolate points for smooth lines
-        qreal distance = QLineF(lastScenePos, scenePos).length();
-        int steps = qMax(1, int(distance / (m_brushSize / 4.0))); // Smooth interpolation
-        
-        for (int i = 1; i <= steps; ++i) {
-            qreal t = qreal(i) / qreal(steps);
-            QPointF interpolatedPos = lastScenePos + t * (scenePos - lastScenePos);
-            drawBrushStroke(lastScenePos, interpolatedPos);
-            lastScenePos = interpolatedPos;
+        if (m_strokeRenderer->isStrokeActive()) {
+            // Queued for the stroke thread, which spaces the dabs itself
+            addLayerStrokePoint(scenePos);
+        } else {
+            // Continue the stroke with smooth interpolation
+            QPointF lastScenePos = mapToScene(m_lastMousePos);
+            
+            // Calculate distance and interpolate points for smooth lines
+            qreal distance = QLineF(lastScenePos, scenePos).length();
+            int steps = qMax(1, int(distance / (m_brushSize / 4.0))); // Smooth interpolation
+            
+            for (int i = 1; i <= steps; ++i) {
+                qreal t = qreal(i) / qreal(steps);
+                QPointF interpolatedPos = lastScenePos + t * (scenePos - lastScenePos);
+                drawBrushStroke(lastScenePos, interpolatedPos);
+                lastScenePos = interpolatedPos;
+            }
         }
         
         m_currentStroke.lineTo(scenePos);
@@ -533,12 +617,18 @@ void CanvasView::handleEraserTool(QMouseEvent* event)
         m_lastMousePos = event->pos();
         
         // Draw with transparent color (erase)
-        drawEraserStroke(scenePos, scenePos);
+        if (!beginLayerStroke(scenePos, core::blend::DabMode::Erase)) {
+            drawEraserStroke(scenePos, scenePos);
+        }
     }
     else if (m_isDrawing && event->buttons() & Qt::LeftButton) {
         // Continue erasing
-        QPointF lastScenePos = mapToScene(m_lastMousePos);
-        drawEraserStroke(lastScenePos, scenePos);
+        if (m_strokeRenderer->isStrokeActive()) {
+            addLayerStrokePoint(scenePos);
+        } else {
+            QPointF lastScenePos = mapToScene(m_lastMousePos);
+            drawEraserStroke(lastScenePos, scenePos);
+        }
         m_lastMousePos = event->pos();
     }
 }
@@ -642,10 +732,49 @@ void CanvasView::handleHealingBrushTool(QMouseEvent* event)
 
 void CanvasView::handleMagicWandTool(QMouseEvent* event)
 {
-    if (event->button() == Qt::LeftButton) {
-        QPointF scenePos = mapToScene(event->pos());
-        qDebug() << "Magic wand tool activated at" << scenePos;
-        // TODO: Implement magic wand selection
+    if (event->button() != Qt::LeftButton) return;
+    
+    auto* layer = activeRasterLayer();
+    if (!layer) return;
+    
+    const QPointF position = mapToScene(event->pos()) - layer->getPosition();
+    const QPoint seed(qFloor(position.x()), qFloor(position.y()));
+    
+    // Shift adds to the selection, Alt subtracts from it, both intersect
+    const bool add = event->modifiers() & Qt::ShiftModifier;
+    const bool subtract = event->modifiers() & Qt::AltModifier;
+    core::Selection::Operation op = core::Selection::Operation::Replace;
+    if (add && subtract) {
+        op = core::Selection::Operation::Intersect;
+    } else if (add) {
+        op = core::Selection::Operation::Add;
+    } else if (subtract) {
+        op = core::Selection::Operation::Subtract;
+    }
+    layer->selectSimilar(seed, m_wandOptions, op);
+    viewport()->update();
+}
+
+void CanvasView::setCurrentTool(Tool tool)
+{
+    // Putting the wand down frees the fill it kept for live tolerance changes
+    if (m_currentTool == Tool::MagicWand && tool != Tool::MagicWand) {
+        if (auto* layer = activeRasterLayer()) {
+            layer->releaseSimilarRegion();
+        }
+    }
+    m_currentTool = tool;
+    updateCursor();
+}
+
+void CanvasView::setWandOptions(const core::FloodFill::Options& options)
+{
+    m_wandOptions = options;
+    if (m_currentTool != Tool::MagicWand) return;
+    
+    auto* layer = activeRasterLayer();
+    if (layer && layer->reselectSimilar(m_wandOptions)) {
+        viewport()->update();
     }
 }
 
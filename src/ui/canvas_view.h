@@ -19,6 +19,10 @@
 #include <QPainterPath>
 
 #include "../core/document.h"
+#include "../core/flood_fill.h"
+#include "../core/stroke_renderer.h"
+#include "../core/stroke_recording.h"
+#include <memory>
 namespace core { class RasterLayer; }
 
 namespace ui {
@@ -55,7 +59,7 @@ public:
     void setDocument(core::Document* document);
     core::Document* getDocument() const { return m_document; }
 
-    void setCurrentTool(Tool tool) { m_currentTool = tool; updateCursor(); }
+    void setCurrentTool(Tool tool);
     Tool getCurrentTool() const { return m_currentTool; }
     
     void setBrushColor(const QColor& color) { m_brushColor = color; }
@@ -64,6 +68,14 @@ public:
     void setBrushSize(int size) { m_brushSize = size; }
     int getBrushSize() const { return m_brushSize; }
     
+    // Magic wand tolerance and modes. With the wand active, the selection
+    // of its last click is redone with them at once.
+    void setWandOptions(const core::FloodFill::Options& options);
+    core::FloodFill::Options getWandOptions() const { return m_wandOptions; }
+    
+    // Input-to-pixel latency of recent brush and eraser strokes
+    core::StrokeRenderer::LatencyStats strokeLatency() const { return m_strokeRenderer->latency(); }
+    
     void setCanvasImage(const QImage& image);
     void loadImageFile(const QString& filePath);
 
@@ -79,6 +91,7 @@ protected:
     void mousePressEvent(QMouseEvent* event) override;
     void mouseMoveEvent(QMouseEvent* event) override;
     void mouseReleaseEvent(QMouseEvent* event) override;
+    bool viewportEvent(QEvent* event) override;
     void wheelEvent(QWheelEvent* event) override;
     void keyPressEvent(QKeyEvent* event) override;
     void dragEnterEvent(QDragEnterEvent* event) override;
@@ -89,10 +102,14 @@ protected:
 private:
     void updateCursor();
     void updateCanvasPixmap();
+    void updateCanvasRegion(const QRect& rect);
     void updateFromDocument();
     core::RasterLayer* activeRasterLayer();
     void drawBrushStroke(const QPointF& from, const QPointF& to);
     void drawEraserStroke(const QPointF& from, const QPointF& to);
+    bool beginLayerStroke(const QPointF& scenePos, core::blend::DabMode mode);
+    void addLayerStrokePoint(const QPointF& scenePos);
+    void endLayerStroke();
     void drawGrid(QPainter* painter, const QRectF& rect);
     void drawRulers(QPainter* painter);
     void drawSelection(QPainter* painter);
@@ -134,6 +151,23 @@ private:
     QColor m_brushColor;
     int m_brushSize;
     QPainterPath m_currentStroke;
+    
+    core::FloodFill::Options m_wandOptions;
+    
+    // Brush and eraser strokes on raster layers are painted off the GUI thread
+    core::StrokeRenderer* m_strokeRenderer;
+    QPointF m_strokeOrigin;     // Layer position when the stroke started
+
+    // Pen state from the last tablet event, applied to the mouse event Qt
+    // synthesizes from it; mouse input keeps the defaults
+    float m_penPressure = 1.0f;
+    float m_penTilt = 0.0f;     // Degrees from vertical
+
+    // Input is also appended to this file when IMAGEEDITOR_STROKE_LOG names
+    // one; documents after the first get files numbered from 2 beside it
+    QString m_strokeLogPath;
+    std::unique_ptr<core::StrokeLog> m_strokeLog;
+    int m_strokeLogCount = 0;   // Logs opened so far
 };
 
 } // namespace ui
@@ -1,12 +1,16 @@
 #include "canvas_widget.h"
 #include "../core/document.h"
 #include "../core/tool.h"
+#include "../core/thread_pool.h"
+#include "../core/render_snapshot.h"
+#include "../core/mip_pyramid.h"
 #include <QPainter>
 #include <QWheelEvent>
 #include <QtMath>
 #include <QTimer>
 #include <algorithm>
 #include <execution>
+#include <map>
 
 namespace ui {
 
@@ -27,14 +31,50 @@ public:
     // Tile cache for large documents
     struct Tile {
         QRect bounds;
-        QImage image;
+        QImage image;             // May be stale while a newer render is pending
         bool dirty = true;
+        uint64_t version = 0;     // Reassigned on every invalidation
+        uint64_t queuedVersion = 0; // Version of the render in flight, 0 if none
         std::chrono::steady_clock::time_point lastAccess;
     };
     
     static constexpr int TILE_SIZE = 256;
     mutable std::unordered_map<uint64_t, Tile> tileCache;
     mutable std::mutex tileCacheMutex;
+    uint64_t nextVersion = 0;
+    
+    // Background tile rendering. The queue is shared with in-flight jobs,
+    // which may outlive the widget: `widget` is cleared under the mutex on
+    // destruction, and jobs only post repaints while holding it.
+    static constexpr uint64_t OVERVIEW_KEY = ~uint64_t(0);
+    struct TileRequest {
+        uint64_t key;
+        int tileX;
+        int tileY;
+        uint64_t version;
+        std::shared_ptr<const core::RenderSnapshot> snapshot;
+    };
+    struct TileResult {
+        uint64_t key;
+        uint64_t version;
+        QImage image;
+    };
+    struct RenderQueue {
+        std::mutex mutex;
+        CanvasWidget* widget = nullptr;
+        std::vector<TileRequest> requests;  // Most urgent last
+        std::vector<TileResult> results;
+        int runners = 0;
+        bool updatePosted = false;
+    };
+    std::shared_ptr<RenderQueue> renderQueue = std::make_shared<RenderQueue>();
+    
+    // Document snapshots per mip level, dropped whenever the document changes
+    std::map<int, std::shared_ptr<const core::RenderSnapshot>> snapshots;
+    
+    // Whole document at reduced resolution, drawn for tiles never rendered
+    Tile overview;
+    int overviewLevel = 0;
     
     // Performance monitoring
     std::chrono::steady_clock::time_point lastFrameTime;
@@ -59,47 +99,183 @@ public:
     RenderQuality quality = Normal;
     bool useGPU = true;
     
-    uint64_t getTileKey(int x, int y) const {
-        return (static_cast<uint64_t>(x) << 32) | static_cast<uint64_t>(y);
+    // Tiles are TILE_SIZE pixels at their mip level, so a level n tile
+    // covers TILE_SIZE << n document pixels
+    uint64_t getTileKey(int x, int y, int level = 0) const {
+        return (static_cast<uint64_t>(level) << 58)
+            | (static_cast<uint64_t>(static_cast<uint32_t>(x) & 0x1fffffff) << 29)
+            | static_cast<uint64_t>(static_cast<uint32_t>(y) & 0x1fffffff);
+    }
+    
+    QRect getTileBounds(int tileX, int tileY, int level = 0) const {
+        const int size = TILE_SIZE << level;
+        return QRect(tileX * size, tileY * size, size, size);
+    }
+    
+    // Mip level whose resolution is the closest at or above the zoom level
+    int mipLevelForZoom() const {
+        int level = 0;
+        while (level < 8 && zoomLevel * (2 << level) <= 1.0) {
+            ++level;
+        }
+        return level;
     }
     
-    QRect getTileBounds(int tileX, int tileY) const {
-        return QRect(tileX * TILE_SIZE, tileY * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+    std::shared_ptr<const core::RenderSnapshot> snapshotFor(int level) {
+        auto& snapshot = snapshots[level];
+        if (!snapshot) {
+            snapshot = document->snapshot(level, true);
+        }
+        return snapshot;
     }
     
     void invalidateTiles(const QRect& rect) {
         std::lock_guard<std::mutex> lock(tileCacheMutex);
         
-        int startX = rect.left() / TILE_SIZE;
-        int endX = (rect.right() + TILE_SIZE - 1) / TILE_SIZE;
-        int startY = rect.top() / TILE_SIZE;
-        int endY = (rect.bottom() + TILE_SIZE - 1) / TILE_SIZE;
+        if (rect.isEmpty()) return;
         
-        for (int y = startY; y < endY; ++y) {
-            for (int x = startX; x < endX; ++x) {
-                uint64_t key = getTileKey(x, y);
-                if (auto it = tileCache.find(key); it != tileCache.end()) {
-                    it->second.dirty = true;
-                }
+        // Tiles of every mip level overlapping the damage go stale
+        for (auto& [key, tile] : tileCache) {
+            if (tile.bounds.intersects(rect)) {
+                tile.dirty = true;
+                tile.version = ++nextVersion;
             }
         }
+        
+        overview.dirty = true;
+        overview.version = ++nextVersion;
+        snapshots.clear();
     }
     
-    QImage renderTile(int tileX, int tileY) const {
-        if (!document) return QImage();
+    void resetTiles() {
+        std::lock_guard<std::mutex> lock(tileCacheMutex);
+        tileCache.clear();
+        overview = Tile();
+        overview.version = ++nextVersion;
+        snapshots.clear();
         
-        QRect tileBounds = getTileBounds(tileX, tileY);
+        std::lock_guard<std::mutex> queueLock(renderQueue->mutex);
+        renderQueue->requests.clear();
+    }
+    
+    static QImage renderTile(const core::RenderSnapshot& snapshot, int tileX, int tileY) {
+        QRect tileBounds(tileX * TILE_SIZE, tileY * TILE_SIZE, TILE_SIZE, TILE_SIZE);
         QImage tile(TILE_SIZE, TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
         tile.fill(Qt::transparent);
         
-        QPainter painter(&tile);
-        painter.setRenderHint(QPainter::Antialiasing, quality != Draft);
-        painter.translate(-tileBounds.topLeft());
+        // Composite document layers into this tile
+        snapshot.composite(tile, tileBounds.topLeft(), tileBounds & snapshot.rect());
+        return tile;
+    }
+    
+    // Runs on pool threads: render queued tiles, most urgent first, until
+    // the queue is empty, posting one repaint per batch of results
+    static void runRenderQueue(const std::shared_ptr<RenderQueue>& queue) {
+        for (;;) {
+            TileRequest request;
+            {
+                std::lock_guard<std::mutex> lock(queue->mutex);
+                if (queue->requests.empty()) {
+                    --queue->runners;
+                    return;
+                }
+                request = std::move(queue->requests.back());
+                queue->requests.pop_back();
+            }
+            
+            const core::RenderSnapshot& snapshot = *request.snapshot;
+            QImage image = request.key == OVERVIEW_KEY
+                ? snapshot.render(snapshot.rect())
+                : renderTile(snapshot, request.tileX, request.tileY);
+            
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->results.push_back({request.key, request.version, std::move(image)});
+            if (queue->widget && !queue->updatePosted) {
+                queue->updatePosted = true;
+                CanvasWidget* widget = queue->widget;
+                QMetaObject::invokeMethod(widget, [widget]() { widget->update(); }, Qt::QueuedConnection);
+            }
+        }
+    }
+    
+    // Move finished renders into the tile cache (GUI thread)
+    void collectRenderResults() {
+        std::vector<TileResult> results;
+        {
+            std::lock_guard<std::mutex> lock(renderQueue->mutex);
+            results.swap(renderQueue->results);
+            renderQueue->updatePosted = false;
+        }
         
-        // Render document layers to this tile
-        document->render(&painter, tileBounds);
+        std::lock_guard<std::mutex> lock(tileCacheMutex);
+        for (auto& result : results) {
+            Tile* tile = &overview;
+            if (result.key != OVERVIEW_KEY) {
+                auto it = tileCache.find(result.key);
+                if (it == tileCache.end()) continue;
+                tile = &it->second;
+            }
+            
+            // Outdated results still beat an empty tile as a placeholder
+            tile->image = std::move(result.image);
+            if (tile->version == result.version) {
+                tile->dirty = false;
+            }
+            if (tile->queuedVersion == result.version) {
+                tile->queuedVersion = 0;
+            }
+        }
+    }
+    
+    // Withdraw requests that have not started, so each frame can queue
+    // exactly the tiles it still needs in its own priority order (GUI thread)
+    void cancelPendingTiles() {
+        std::vector<TileRequest> dropped;
+        {
+            std::lock_guard<std::mutex> lock(renderQueue->mutex);
+            dropped.swap(renderQueue->requests);
+        }
         
-        return tile;
+        std::lock_guard<std::mutex> lock(tileCacheMutex);
+        for (const auto& request : dropped) {
+            Tile* tile = &overview;
+            if (request.key != OVERVIEW_KEY) {
+                auto it = tileCache.find(request.key);
+                if (it == tileCache.end()) continue;
+                tile = &it->second;
+            }
+            if (tile->queuedVersion == request.version) {
+                tile->queuedVersion = 0;
+            }
+        }
+    }
+    
+    // Queue a prioritized list of tiles and wake enough runners (GUI thread)
+    void scheduleTiles(std::vector<TileRequest> requests) {
+        if (requests.empty()) return;
+        
+        {
+            std::lock_guard<std::mutex> lock(tileCacheMutex);
+            for (const auto& request : requests) {
+                Tile& tile = request.key == OVERVIEW_KEY ? overview : tileCache[request.key];
+                tile.queuedVersion = request.version;
+            }
+        }
+        
+        // Keep a core free for the GUI thread
+        auto& pool = core::ThreadPool::global();
+        const int maxRunners = std::max(1, pool.concurrency() - 1);
+        int newRunners = 0;
+        {
+            std::lock_guard<std::mutex> lock(renderQueue->mutex);
+            renderQueue->requests = std::move(requests);
+            const int wanted = std::min(maxRunners, static_cast<int>(renderQueue->requests.size()));
+            newRunners = std::max(0, wanted - renderQueue->runners);
+            renderQueue->runners += newRunners;
+        }
+        for (int i = 0; i < newRunners; ++i) {
+            pool.submit([queue = renderQueue]() { runRenderQueue(queue); });
+        }
     }
 };
 
@@ -123,15 +299,26 @@ CanvasWidget::CanvasWidget(QWidget* parent)
         }
     });
     updateTimer->start();
+    
+    d->renderQueue->widget = this;
 }
 
-CanvasWidget::~CanvasWidget() = default;
+CanvasWidget::~CanvasWidget() {
+    // Background jobs keep the queue alive; stop them posting to us
+    std::lock_guard<std::mutex> lock(d->renderQueue->mutex);
+    d->renderQueue->widget = nullptr;
+    d->renderQueue->requests.clear();
+}
 
 void CanvasWidget::setDocument(core::Document* doc) {
     if (d->document == doc) return;
     
+    if (d->document) {
+        disconnect(d->document, nullptr, this, nullptr);
+    }
+    
     d->document = doc;
-    d->tileCache.clear();
+    d->resetTiles();
     
     if (doc) {
         // Connect to document signals
@@ -140,8 +327,19 @@ void CanvasWidget::setDocument(core::Document* doc) {
             update();
         });
         
+        // Only tiles overlapping composite damage need to be re-rendered
+        connect(doc, &core::Document::regionChanged, this, [this](const QRect& rect) {
+            d->invalidateTiles(rect);
+            update();
+        });
+        
         connect(doc, &core::Document::documentSizeChanged, this, [this](const QSize& newSize) {
-            d->tileCache.clear();
+            d->resetTiles();
+            update();
+        });
+        
+        connect(doc, &core::Document::sizeChanged, this, [this](const QSize&) {
+            d->resetTiles();
             update();
         });
     }
@@ -270,32 +468,107 @@ void CanvasWidget::paintEvent(QPaintEvent* event) {
     // Apply view transform
     painter.setTransform(d->viewTransform);
     
-    // Calculate visible tiles
+    // Calculate visible tiles at the mip level matching the zoom, so
+    // zoomed-out frames composite far fewer pixels
+    const int level = d->mipLevelForZoom();
+    const double levelTileSize = Impl::TILE_SIZE << level;
     QRectF visibleRect = d->viewTransform.inverted().mapRect(rect());
-    int startX = std::floor(visibleRect.left() / Impl::TILE_SIZE);
-    int endX = std::ceil(visibleRect.right() / Impl::TILE_SIZE);
-    int startY = std::floor(visibleRect.top() / Impl::TILE_SIZE);
-    int endY = std::ceil(visibleRect.bottom() / Impl::TILE_SIZE);
-    
-    // Render visible tiles
-    for (int y = startY; y < endY; ++y) {
-        for (int x = startX; x < endX; ++x) {
-            uint64_t key = d->getTileKey(x, y);
-            
-            // Get or render tile
-            auto& tile = d->tileCache[key];
-            if (tile.dirty || tile.image.isNull()) {
-                tile.bounds = d->getTileBounds(x, y);
-                tile.image = d->renderTile(x, y);
-                tile.dirty = false;
+    int startX = std::floor(visibleRect.left() / levelTileSize);
+    int endX = std::ceil(visibleRect.right() / levelTileSize);
+    int startY = std::floor(visibleRect.top() / levelTileSize);
+    int endY = std::ceil(visibleRect.bottom() / levelTileSize);
+    
+    // Pick up tiles finished in the background since the last frame and
+    // withdraw the requests that are still waiting; they are re-queued below
+    d->collectRenderResults();
+    d->cancelPendingTiles();
+    
+    const QRect documentRect(QPoint(0, 0), d->document->getSize());
+    const QPointF viewCenter = visibleRect.center();
+    
+    // Overview resolution: the level document files store precomputed
+    const int overviewLevel = core::MipPyramid::overviewLevel(documentRect.size());
+    if (overviewLevel != d->overviewLevel) {
+        d->overviewLevel = overviewLevel;
+        d->overview.dirty = true;
+        d->overview.version = ++d->nextVersion;
+    }
+    
+    // Draw ready tiles; never render on this thread. Stale tiles keep their
+    // previous image and missing ones fall back to the overview.
+    std::vector<std::pair<double, Impl::TileRequest>> pending;
+    std::shared_ptr<const core::RenderSnapshot> levelSnapshot;
+    {
+        std::lock_guard<std::mutex> lock(d->tileCacheMutex);
+        const auto now = std::chrono::steady_clock::now();
+        const QImage& overviewImage = d->overview.image;
+        const double overviewScale = overviewImage.isNull() || documentRect.isEmpty()
+            ? 0.0 : static_cast<double>(overviewImage.width()) / documentRect.width();
+        
+        for (int y = startY; y < endY; ++y) {
+            for (int x = startX; x < endX; ++x) {
+                QRect bounds = d->getTileBounds(x, y, level);
+                if (!bounds.intersects(documentRect)) continue;
+                
+                const uint64_t key = d->getTileKey(x, y, level);
+                auto& tile = d->tileCache[key];
+                if (tile.version == 0) {
+                    tile.bounds = bounds;
+                    tile.version = ++d->nextVersion;
+                }
+                tile.lastAccess = now;
+                
+                if (!tile.image.isNull()) {
+                    painter.drawImage(tile.bounds, tile.image);
+                } else if (overviewScale > 0.0) {
+                    QRect visiblePart = bounds & documentRect;
+                    QRectF source(visiblePart.x() * overviewScale, visiblePart.y() * overviewScale,
+                                  visiblePart.width() * overviewScale, visiblePart.height() * overviewScale);
+                    painter.drawImage(QRectF(visiblePart), overviewImage, source);
+                }
+                
+                if ((tile.dirty || tile.image.isNull()) && tile.queuedVersion != tile.version) {
+                    // Center of the view first
+                    const QPointF delta = QRectF(bounds).center() - viewCenter;
+                    const double distance = delta.x() * delta.x() + delta.y() * delta.y();
+                    if (!levelSnapshot) {
+                        levelSnapshot = d->snapshotFor(level);
+                    }
+                    pending.push_back({distance, {key, x, y, tile.version, levelSnapshot}});
+                }
             }
-            tile.lastAccess = std::chrono::steady_clock::now();
-            
-            // Draw tile
-            painter.drawImage(tile.bounds, tile.image);
         }
     }
     
+    // Queue what is missing; tiles already in flight keep rendering
+    const bool overviewNeeded = d->overview.dirty && d->overview.queuedVersion != d->overview.version;
+    if (!pending.empty() || overviewNeeded) {
+        std::sort(pending.begin(), pending.end(), [](const auto& a, const auto& b) {
+            return a.first > b.first;
+        });
+        
+        std::vector<Impl::TileRequest> requests;
+        requests.reserve(pending.size() + 1);
+        
+        // The overview is rendered from a small mip level, so it comes
+        // first while there is none; refreshes wait for the visible tiles
+        const bool overviewUrgent = d->overview.image.isNull();
+        Impl::TileRequest overviewRequest;
+        if (overviewNeeded) {
+            overviewRequest = {Impl::OVERVIEW_KEY, 0, 0, d->overview.version, d->snapshotFor(d->overviewLevel)};
+        }
+        if (overviewNeeded && !overviewUrgent) {
+            requests.push_back(overviewRequest);
+        }
+        for (auto& entry : pending) {
+            requests.push_back(std::move(entry.second));
+        }
+        if (overviewNeeded && overviewUrgent) {
+            requests.push_back(overviewRequest);
+        }
+        d->scheduleTiles(std::move(requests));
+    }
+    
     // Draw grid overlay
     if (d->showGrid && d->zoomLevel > 0.25) {
         drawGrid(painter);
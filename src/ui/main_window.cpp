@@ -282,6 +282,7 @@ void MainWindow::setupConnections()
         connect(m_toolPanel, &ToolPanel::toolChanged, this, [this](int toolId) {
             m_canvasView->setCurrentTool(static_cast<ui::Tool>(toolId));
         });
+        connect(m_toolPanel, &ToolPanel::fillOptionsChanged, m_canvasView, &CanvasView::setWandOptions);
     }
     
     // Connect layer panel to canvas view
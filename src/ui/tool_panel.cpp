@@ -124,6 +124,36 @@ void ToolPanel::setupUI()
     
     mainLayout->addWidget(advancedToolsGroup);
     
+    // Magic wand and bucket fill options
+    const core::FloodFill::Options fillDefaults;
+    auto fillOptionsGroup = new QGroupBox("Fill Options", this);
+    auto fillOptionsLayout = new QVBoxLayout(fillOptionsGroup);
+    auto toleranceLayout = new QHBoxLayout();
+    
+    toleranceLayout->addWidget(new QLabel("Tolerance:", this));
+    
+    m_toleranceSlider = new QSlider(Qt::Horizontal, this);
+    m_toleranceSlider->setRange(0, 255);
+    m_toleranceSlider->setValue(fillDefaults.tolerance);
+    toleranceLayout->addWidget(m_toleranceSlider);
+    
+    m_toleranceSpinBox = new QSpinBox(this);
+    m_toleranceSpinBox->setRange(0, 255);
+    m_toleranceSpinBox->setValue(fillDefaults.tolerance);
+    toleranceLayout->addWidget(m_toleranceSpinBox);
+    
+    fillOptionsLayout->addLayout(toleranceLayout);
+    
+    m_contiguousCheck = new QCheckBox("Contiguous", this);
+    m_contiguousCheck->setChecked(fillDefaults.contiguous);
+    fillOptionsLayout->addWidget(m_contiguousCheck);
+    
+    m_antiAliasCheck = new QCheckBox("Anti-alias", this);
+    m_antiAliasCheck->setChecked(fillDefaults.antiAlias);
+    fillOptionsLayout->addWidget(m_antiAliasCheck);
+    
+    mainLayout->addWidget(fillOptionsGroup);
+    
     // Effects Tools Group
     auto effectsToolsGroup = new QGroupBox("Effects Tools", this);
     auto effectsToolsLayout = new QVBoxLayout(effectsToolsGroup);
@@ -166,6 +196,14 @@ void ToolPanel::setupUI()
 void ToolPanel::setupConnections()
 {
     connect(m_toolGroup, &QButtonGroup::buttonClicked, this, &ToolPanel::onToolSelected);
+    
+    connect(m_toleranceSlider, &QSlider::valueChanged, m_toleranceSpinBox, &QSpinBox::setValue);
+    connect(m_toleranceSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), m_toleranceSlider, &QSlider::setValue);
+    
+    // The slider and spin box echo each other, so follow only one of them
+    connect(m_toleranceSlider, &QSlider::valueChanged, this, &ToolPanel::onFillOptionsChanged);
+    connect(m_contiguousCheck, &QCheckBox::toggled, this, &ToolPanel::onFillOptionsChanged);
+    connect(m_antiAliasCheck, &QCheckBox::toggled, this, &ToolPanel::onFillOptionsChanged);
 }
 
 void ToolPanel::onToolSelected(QAbstractButton* button)
@@ -176,4 +214,13 @@ void ToolPanel::onToolSelected(QAbstractButton* button)
     }
 }
 
+void ToolPanel::onFillOptionsChanged()
+{
+    core::FloodFill::Options options;
+    options.tolerance = m_toleranceSlider->value();
+    options.contiguous = m_contiguousCheck->isChecked();
+    options.antiAlias = m_antiAliasCheck->isChecked();
+    emit fillOptionsChanged(options);
+}
+
 } // namespace ui
@@ -5,6 +5,10 @@
 #include <QButtonGroup>
 #include <QVBoxLayout>
 #include <QGroupBox>
+#include <QSlider>
+#include <QSpinBox>
+#include <QCheckBox>
+#include "../core/flood_fill.h"
 
 namespace ui {
 
@@ -16,9 +20,12 @@ public:
 
 signals:
     void toolChanged(int toolId);
+    // Tolerance and modes of the magic wand and bucket fill
+    void fillOptionsChanged(const core::FloodFill::Options& options);
 
 private slots:
     void onToolSelected(QAbstractButton* button);
+    void onFillOptionsChanged();
 
 private:
     void setupUI();
@@ -43,6 +50,11 @@ private:
     QToolButton* m_dodgeTool;
     QToolButton* m_burnTool;
     QToolButton* m_spongeTool;
+    
+    QSlider* m_toleranceSlider;
+    QSpinBox* m_toleranceSpinBox;
+    QCheckBox* m_contiguousCheck;
+    QCheckBox* m_antiAliasCheck;
 };
 
 } // namespace ui
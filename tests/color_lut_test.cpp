@@ -0,0 +1,347 @@
+// 3D LUTs and compiled adjustment chains: .cube text and files survive a
+// write and a read, malformed files are refused, a chain baked into a
+// table stays close to the chain itself, and a pipeline whose stages were
+// fused gives what running each stage on its own gives.
+
+#include "adjustment_pipeline.h"
+#include "color_lut.h"
+#include "test_support.h"
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+
+using namespace core;
+
+namespace {
+
+using Stage = std::function<void(AdjustmentPipeline&)>;
+
+ColorLut3D randomLut(int size, std::mt19937& random)
+{
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    ColorLut3D lut(size);
+    float* values = lut.data();
+    for (int i = 0; i < size * size * size * 3; ++i) {
+        values[i] = unit(random);
+    }
+    return lut;
+}
+
+bool sameTable(const ColorLut3D& a, const ColorLut3D& b, float tolerance)
+{
+    if (a.size() != b.size()) return false;
+    const int count = a.size() * a.size() * a.size() * 3;
+    for (int i = 0; i < count; ++i) {
+        if (std::fabs(a.data()[i] - b.data()[i]) > tolerance) return false;
+    }
+    return true;
+}
+
+// Every opaque grey and primary ramp, then random colours, some translucent
+std::vector<QRgb> testPixels(std::mt19937& random, bool opaque)
+{
+    std::vector<QRgb> pixels;
+    for (int v = 0; v < 256; ++v) {
+        pixels.push_back(qRgb(v, v, v));
+        pixels.push_back(qRgb(v, 0, 0));
+        pixels.push_back(qRgb(0, v, 255 - v));
+    }
+    for (int i = 0; i < 20000; ++i) {
+        const int a = opaque ? 255 : static_cast<int>(random() % 256);
+        pixels.push_back(qRgba(static_cast<int>(random() % (a + 1)), static_cast<int>(random() % (a + 1)),
+                               static_cast<int>(random() % (a + 1)), a));
+    }
+    return pixels;
+}
+
+// Largest channel difference, and the mean of each pixel's largest
+std::pair<int, double> difference(const std::vector<QRgb>& a, const std::vector<QRgb>& b)
+{
+    int worst = 0;
+    double sum = 0.0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        const int d = std::max({std::abs(qRed(a[i]) - qRed(b[i])), std::abs(qGreen(a[i]) - qGreen(b[i])),
+                                std::abs(qBlue(a[i]) - qBlue(b[i])), std::abs(qAlpha(a[i]) - qAlpha(b[i]))});
+        worst = std::max(worst, d);
+        sum += d;
+    }
+    return {worst, a.empty() ? 0.0 : sum / a.size()};
+}
+
+void testCube(const QTemporaryDir& dir, std::mt19937& random)
+{
+    for (int size : {ColorLut3D::MinSize, 5, ColorLut3D::PreviewSize}) {
+        ColorLut3D lut = randomLut(size, random);
+        lut.setTitle("Warm \"film\"\nlook");
+
+        // Six decimals are written
+        ColorLut3D parsed;
+        QString error;
+        CHECK(ColorLut3D::parseCube(lut.toCube(), parsed, &error));
+        CHECK(sameTable(parsed, lut, 1e-6f));
+        CHECK(parsed.title() == "Warm film look");
+
+        const QString filename = dir.filePath(QString("lut-%1.cube").arg(size));
+        CHECK(lut.writeCube(filename, &error));
+        ColorLut3D read;
+        CHECK(ColorLut3D::readCube(filename, read, &error));
+        CHECK(sameTable(read, lut, 1e-6f));
+    }
+
+    // Comments, blank lines, CRLF line ends and unknown keywords are skipped
+    {
+        const QByteArray text = "# comment\r\nTITLE \"Identity\"\r\nLUT_3D_SIZE 2\r\nLUT_3D_INPUT_RANGE 0 1\r\n"
+                                "VENDOR_THING 1\r\n\r\n0 0 0\r\n1 0 0\r\n0 1 0\r\n1 1 0\r\n"
+                                "0 0 1\r\n1 0 1\r\n0 1 1\r\n1 1 1\r\n";
+        ColorLut3D parsed;
+        CHECK(ColorLut3D::parseCube(text, parsed));
+        CHECK(sameTable(parsed, ColorLut3D(2), 0.0f));
+        CHECK(parsed.title() == "Identity");
+    }
+
+    // A domain other than [0, 1] is resampled onto it, so the identity over
+    // [0, 2] is the identity here too
+    {
+        ColorLut3D identity(3);
+        QByteArray text = "LUT_3D_SIZE 3\nDOMAIN_MIN 0 0 0\nDOMAIN_MAX 2 2 2\n";
+        for (int i = 0; i < 27; ++i) {
+            const float* p = identity.data() + i * 3;
+            text += QByteArray::number(p[0] * 2.0f) + ' ' + QByteArray::number(p[1] * 2.0f) + ' '
+                  + QByteArray::number(p[2] * 2.0f) + '\n';
+        }
+        ColorLut3D parsed;
+        CHECK(ColorLut3D::parseCube(text, parsed));
+        float r = 0.25f, g = 0.5f, b = 1.0f;
+        parsed.sample(r, g, b);
+        CHECK(std::fabs(r - 0.25f) < 1e-5f && std::fabs(g - 0.5f) < 1e-5f && std::fabs(b - 1.0f) < 1e-5f);
+    }
+
+    // Malformed files
+    const QByteArray bad[] = {
+        "LUT_1D_SIZE 4\n0 0 0\n",                       // 1D tables are not supported
+        "0 0 0\n1 1 1\n",                               // No size
+        "LUT_3D_SIZE 1\n0 0 0\n",                       // Too small
+        "LUT_3D_SIZE 2\n0 0 0\n1 1 1\n",                // Too few entries
+        "LUT_3D_SIZE 2\n0 0 x\n",                       // Not a number
+        "LUT_3D_SIZE 2\nDOMAIN_MIN 1 1 1\nDOMAIN_MAX 0 0 0\n0 0 0\n1 0 0\n0 1 0\n1 1 0\n"
+        "0 0 1\n1 0 1\n0 1 1\n1 1 1\n",                 // Empty domain
+    };
+    for (const QByteArray& text : bad) {
+        ColorLut3D parsed;
+        QString error;
+        CHECK(!ColorLut3D::parseCube(text, parsed, &error));
+        CHECK(!error.isEmpty());
+    }
+    ColorLut3D missing;
+    CHECK(!ColorLut3D::readCube(dir.filePath("missing.cube"), missing));
+    CHECK(!ColorLut3D().writeCube(dir.filePath("empty.cube")));
+}
+
+// Smooth grades, as an adjustment stack of them would be
+AdjustmentPipeline smoothChain()
+{
+    AdjustmentPipeline pipeline;
+    pipeline.addLevels({0.05f, 0.9f, 1.2f, 0.0f, 1.0f});
+    adjust::Curves curves;
+    curves.master = {QPointF(0, 0), QPointF(0.5, 0.6), QPointF(1, 1)};
+    pipeline.addCurves(curves);
+    pipeline.addHueSaturation({25.0f, 0.3f, -0.05f});
+    adjust::ChannelMixer mixer;
+    mixer.red[1] = 0.2f;
+    mixer.red[0] = 0.8f;
+    pipeline.addChannelMixer(mixer);
+    adjust::ColorBalance balance;
+    balance.midtones[0] = 0.3f;
+    balance.shadows[2] = -0.2f;
+    pipeline.addColorBalance(balance);
+    pipeline.addBrightnessContrast({0.05f, 0.1f});
+    return pipeline;
+}
+
+void testBake(std::mt19937& random)
+{
+    const AdjustmentPipeline chain = smoothChain();
+    CHECK(chain.prefersLut());
+    const std::vector<QRgb> pixels = testPixels(random, true);
+    std::vector<QRgb> expected = pixels;
+    chain.applyRow(expected.data(), static_cast<int>(expected.size()));
+
+    // Finer tables follow the chain more closely. The kinks of levels and
+    // clipping fall between lattice points, hence the larger worst cases.
+    struct Bound {
+        int size;
+        int worst;
+        double mean;
+    };
+    const Bound bounds[] = {{ColorLut3D::PreviewSize, 20, 3.0}, {ColorLut3D::DefaultSize, 14, 2.0},
+                            {ColorLut3D::HighQualitySize, 8, 1.25}};
+    for (const Bound& bound : bounds) {
+        const int size = bound.size;
+        const auto baked = chain.baked(size);
+        CHECK(baked->operationCount() == 1);
+        CHECK(chain.baked(size) == baked);   // Kept per size
+        std::vector<QRgb> actual = pixels;
+        baked->applyRow(actual.data(), static_cast<int>(actual.size()));
+        const auto [worst, mean] = difference(actual, expected);
+        if (!CHECK(worst <= bound.worst && mean <= bound.mean)) {
+            std::fprintf(stderr, "  baked at %d: off by %d, %.2f on average\n", size, worst, mean);
+        }
+
+        // The table is the chain at the lattice points
+        const ColorLut3D lut = chain.bake(size);
+        const ColorLut3D identity(size);
+        for (int i = 0; i < size * size * size; i += 7) {
+            const float* point = identity.data() + i * 3;
+            QRgb pixel = qRgb(qRound(point[0] * 255.0f), qRound(point[1] * 255.0f), qRound(point[2] * 255.0f));
+            chain.applyRow(&pixel, 1);
+            const float* value = lut.data() + i * 3;
+            CHECK(qRound(value[0] * 255.0f) == qRed(pixel) && qRound(value[1] * 255.0f) == qGreen(pixel)
+                  && qRound(value[2] * 255.0f) == qBlue(pixel));
+        }
+    }
+
+    // A lone table applies as it is, to straight colours
+    const ColorLut3D lut = randomLut(9, random);
+    AdjustmentPipeline single;
+    single.addLut(std::make_shared<const ColorLut3D>(lut));
+    std::vector<QRgb> actual = pixels;
+    single.applyRow(actual.data(), static_cast<int>(actual.size()));
+    std::vector<QRgb> reference = pixels;
+    lut.applyRow(reference.data(), static_cast<int>(reference.size()));
+    CHECK(actual == reference);
+}
+
+// Runs each stage as a pipeline of its own, so nothing is fused
+std::vector<QRgb> unfused(const std::vector<Stage>& stages, std::vector<QRgb> pixels)
+{
+    for (const Stage& stage : stages) {
+        AdjustmentPipeline pipeline;
+        stage(pipeline);
+        pipeline.applyRow(pixels.data(), static_cast<int>(pixels.size()));
+    }
+    return pixels;
+}
+
+void testFusion(std::mt19937& random)
+{
+    adjust::Curves curves;
+    curves.red = {QPointF(0, 0.1), QPointF(0.4, 0.3), QPointF(1, 0.95)};
+    curves.master = {QPointF(0, 0), QPointF(0.7, 0.8), QPointF(1, 1)};
+    adjust::ChannelMixer warm;
+    warm.red[0] = 1.1f;
+    warm.blue[0] = 0.1f;
+    warm.blue[2] = 0.8f;
+    adjust::ChannelMixer mono;
+    mono.red[0] = 0.3f;
+    mono.red[1] = 0.6f;
+    mono.red[2] = 0.1f;
+    mono.monochrome = true;
+
+    // Per-channel stages compose into one table exactly
+    const std::vector<Stage> curveStages = {
+        [](AdjustmentPipeline& p) { p.addLevels({0.1f, 0.85f, 0.8f, 0.05f, 1.0f}); },
+        [&](AdjustmentPipeline& p) { p.addCurves(curves); },
+        [](AdjustmentPipeline& p) { p.addBrightnessContrast({-0.1f, 0.3f}); },
+        [](AdjustmentPipeline& p) { p.addInvert(); },
+        [](AdjustmentPipeline& p) { p.addPosterize({6}); },
+        [](AdjustmentPipeline& p) { p.addThreshold({0.4f}); },
+    };
+    // Channel mixes that stay in range compose into one matrix; each
+    // unfused stage rounds to 8 bits, so allow a step. One that
+    // leaves the range is clamped before the next, so it is not fused.
+    adjust::ChannelMixer soft;
+    soft.red[0] = 0.7f;
+    soft.red[2] = 0.2f;
+    soft.green[1] = 0.9f;
+    soft.green[3] = 0.05f;
+    const std::vector<Stage> matrixStages = {
+        [&](AdjustmentPipeline& p) { p.addChannelMixer(soft); },
+        [&](AdjustmentPipeline& p) { p.addChannelMixer(mono); },
+    };
+    const std::vector<Stage> clippedStages = {
+        [&](AdjustmentPipeline& p) { p.addChannelMixer(warm); },
+        [&](AdjustmentPipeline& p) { p.addChannelMixer(mono); },
+    };
+    // Hue/saturation and tables sit between fused runs
+    const ColorLut3D lut = randomLut(5, random);
+    const std::vector<Stage> mixed = {
+        curveStages[0], curveStages[1], clippedStages[0],
+        [](AdjustmentPipeline& p) { p.addHueSaturation({-40.0f, 0.2f, 0.0f}); },
+        [&](AdjustmentPipeline& p) { p.addLut(std::make_shared<const ColorLut3D>(lut)); },
+        curveStages[2], curveStages[3],
+    };
+
+    const std::vector<QRgb> opaque = testPixels(random, true);
+    const std::vector<QRgb> translucent = testPixels(random, false);
+    struct Case {
+        const char* name;
+        const std::vector<Stage>* stages;
+        int operations;     // Left after fusion
+        int tolerance;      // On opaque pixels
+    };
+    const Case cases[] = {
+        {"curves", &curveStages, 3, 0},      // Threshold mixes luminance in between
+        {"matrices", &matrixStages, 1, 1},
+        {"clipped matrices", &clippedStages, 2, 0},
+        {"mixed", &mixed, 5, 0},
+    };
+    for (const Case& c : cases) {
+        AdjustmentPipeline fused;
+        for (const Stage& stage : *c.stages) {
+            stage(fused);
+        }
+        CHECK(fused.operationCount() == c.operations);
+
+        std::vector<QRgb> actual = opaque;
+        fused.applyRow(actual.data(), static_cast<int>(actual.size()));
+        const int worst = difference(actual, unfused(*c.stages, opaque)).first;
+        if (!CHECK(worst <= c.tolerance)) {
+            std::fprintf(stderr, "  %s: fused differs by %d\n", c.name, worst);
+        }
+
+        // Appending pipelines fuses where they meet, like adding the stages
+        AdjustmentPipeline appended;
+        for (const Stage& stage : *c.stages) {
+            AdjustmentPipeline next;
+            stage(next);
+            appended.append(next);
+        }
+        CHECK(appended.operationCount() == c.operations);
+        std::vector<QRgb> viaAppend = opaque;
+        appended.applyRow(viaAppend.data(), static_cast<int>(viaAppend.size()));
+        CHECK(viaAppend == actual);
+
+        // Translucent pixels keep their alpha and stay premultiplied
+        actual = translucent;
+        fused.applyRow(actual.data(), static_cast<int>(actual.size()));
+        bool valid = true;
+        for (size_t i = 0; i < actual.size(); ++i) {
+            const int a = qAlpha(actual[i]);
+            valid = valid && a == qAlpha(translucent[i]) && qRed(actual[i]) <= a && qGreen(actual[i]) <= a
+                    && qBlue(actual[i]) <= a;
+        }
+        CHECK(valid);
+    }
+
+    // Stages that cancel out leave nothing to do
+    AdjustmentPipeline cancelled;
+    cancelled.addInvert();
+    cancelled.addInvert();
+    CHECK(cancelled.isIdentity());
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 random(19);
+    QTemporaryDir dir;
+    CHECK(dir.isValid());
+
+    testCube(dir, random);
+    testBake(random);
+    testFusion(random);
+    return test::finish("color_lut_test");
+}
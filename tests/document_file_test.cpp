@@ -0,0 +1,223 @@
+// .kdoc files: a document written and read back has the same layers and
+// pixels; damaged tile chunks decode as transparent without taking the
+// rest of the document with them; a damaged or truncated layer table is
+// refused; and a document saved over the file it was opened from (whose
+// tiles still map that file) keeps its pixels, as does the file.
+
+#include "document.h"
+#include "document_file.h"
+#include "layer.h"
+#include "mip_pyramid.h"
+#include "test_support.h"
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtEndian>
+#include <algorithm>
+#include <random>
+
+using namespace core;
+
+namespace {
+
+constexpr int TileSize = TileStorage::TileSize;
+constexpr int HeaderSize = 64;
+constexpr int TableOffsetOffset = 32;
+
+std::shared_ptr<RasterLayer> rasterAt(const std::vector<std::shared_ptr<Layer>>& layers, size_t index)
+{
+    return index < layers.size() ? std::dynamic_pointer_cast<RasterLayer>(layers[index]) : nullptr;
+}
+
+// A uniform background and a layer with noisy tiles, one of them partial,
+// over a canvas large enough to be stored with an overview
+std::unique_ptr<Document> makeDocument()
+{
+    auto document = std::make_unique<Document>(3 * TileSize + 70, 2 * TileSize + 30);
+    auto paint = std::make_shared<RasterLayer>(document->width(), document->height());
+    paint->fill(QColor(20, 40, 200));
+    std::mt19937 random(10);
+    const QPoint painted[] = {QPoint(0, 0), QPoint(2, 1), QPoint(3, 2)};
+    for (const QPoint& t : painted) {
+        const QRect rect(t * TileSize, QSize(TileSize, TileSize));
+        for (int y = rect.top(); y <= std::min(rect.bottom(), document->height() - 1); ++y) {
+            for (int x = rect.left(); x <= std::min(rect.right(), document->width() - 1); ++x) {
+                paint->setPixel(x, y, QColor(static_cast<int>(random() % 256), static_cast<int>(random() % 256),
+                                             static_cast<int>(random() % 256), 64 + static_cast<int>(random() % 192)));
+            }
+        }
+    }
+    paint->setName("Paint");
+    paint->setOpacity(0.75f);
+    paint->setBlendMode(BlendMode::Multiply);
+    paint->setVisible(false);
+    paint->setPosition(QPointF(12, -7));
+    document->addLayer(paint);
+    return document;
+}
+
+bool samePixels(const TileStorage& a, const TileStorage& b)
+{
+    return a.size() == b.size() && a.toImage() == b.toImage();
+}
+
+void checkContents(const char* what, const Document& document, const std::vector<std::shared_ptr<Layer>>& layers)
+{
+    const auto& expected = document.getLayers();
+    if (!CHECK(layers.size() == expected.size())) return;
+    for (size_t i = 0; i < layers.size(); ++i) {
+        const auto actual = rasterAt(layers, i);
+        const auto original = rasterAt(expected, i);
+        if (!CHECK(actual && original)) return;
+        CHECK(actual->getName() == original->getName());
+        CHECK(actual->getOpacity() == original->getOpacity());
+        CHECK(actual->getBlendMode() == original->getBlendMode());
+        CHECK(actual->isVisible() == original->isVisible());
+        CHECK(actual->getPosition() == original->getPosition());
+        CHECK(actual->getFlags() == original->getFlags());
+        if (!CHECK(samePixels(actual->tiles(), original->tiles()))) {
+            std::fprintf(stderr, "  %s: pixels of layer %zu differ\n", what, i);
+        }
+    }
+}
+
+QByteArray readAll(const QString& filename)
+{
+    QFile file(filename);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+bool writeAll(const QString& filename, const QByteArray& data)
+{
+    QFile file(filename);
+    return file.open(QIODevice::WriteOnly | QIODevice::Truncate) && file.write(data) == data.size();
+}
+
+void testRoundTrip(const QTemporaryDir& dir)
+{
+    const auto document = makeDocument();
+    const QString filename = dir.filePath("round-trip.kdoc");
+    QString error;
+    CHECK(DocumentFile::write(*document, filename, &error));
+    CHECK(DocumentFile::isDocumentFile(filename));
+
+    DocumentFile::Contents contents;
+    if (!CHECK(DocumentFile::read(filename, contents, &error))) {
+        std::fprintf(stderr, "  %s\n", qPrintable(error));
+        return;
+    }
+    CHECK(contents.size == document->size());
+    CHECK(contents.colorMode == document->getColorMode());
+    checkContents("round trip", *document, contents.layers);
+
+    // Painted tiles stay encoded until read; uniform ones are stored as such
+    const auto paint = rasterAt(contents.layers, 1);
+    CHECK(paint && paint->tiles().tileAt(0, 0).lazy() != nullptr);
+    CHECK(paint && paint->tiles().tileAt(1, 0).isUniform());
+
+    // The stored overview matches one made from the pixels
+    const int level = MipPyramid::overviewLevel(document->size());
+    CHECK(level > 0);
+    const auto original = rasterAt(document->getLayers(), 1);
+    CHECK(paint && samePixels(paint->mipLevel(level), original->mipLevel(level)));
+
+    // A file that is not a document
+    const QString other = dir.filePath("other.kdoc");
+    writeAll(other, QByteArray(200, 'x'));
+    CHECK(!DocumentFile::isDocumentFile(other));
+    CHECK(!DocumentFile::read(other, contents));
+}
+
+void testDamage(const QTemporaryDir& dir)
+{
+    const auto document = makeDocument();
+    const QString filename = dir.filePath("damaged.kdoc");
+    CHECK(DocumentFile::write(*document, filename));
+    const QByteArray intact = readAll(filename);
+    const quint64 tableOffset = qFromLittleEndian<quint64>(intact.constData() + TableOffsetOffset);
+
+    // A flipped byte in the first chunk, tile (0, 0) of the painted layer:
+    // the file opens, that tile reads as transparent and the others are intact
+    {
+        QByteArray data = intact;
+        data[HeaderSize + 20] = static_cast<char>(data[HeaderSize + 20] ^ 0x5a);
+        writeAll(filename, data);
+        DocumentFile::Contents contents;
+        CHECK(DocumentFile::read(filename, contents));
+        const auto paint = rasterAt(contents.layers, 1);
+        const auto original = rasterAt(document->getLayers(), 1);
+        if (CHECK(paint && original)) {
+            CHECK(paint->tiles().pixel(5, 5) == 0);
+            CHECK(paint->tiles().pixel(TileSize - 1, TileSize - 1) == 0);
+            const QRect intactTile(2 * TileSize, TileSize, TileSize, TileSize);
+            CHECK(paint->tiles().copy(intactTile) == original->tiles().copy(intactTile));
+        }
+    }
+
+    // A flipped byte in the layer table
+    {
+        QByteArray data = intact;
+        data[static_cast<int>(tableOffset) + 3] = static_cast<char>(data[static_cast<int>(tableOffset) + 3] ^ 0x01);
+        writeAll(filename, data);
+        DocumentFile::Contents contents;
+        QString error;
+        CHECK(!DocumentFile::read(filename, contents, &error));
+        CHECK(error == "Damaged layer table");
+    }
+
+    // Cut short inside the table, and among the chunks before it
+    for (int cut : {10, static_cast<int>(intact.size() - tableOffset) + 100}) {
+        writeAll(filename, intact.left(intact.size() - cut));
+        DocumentFile::Contents contents;
+        QString error;
+        CHECK(!DocumentFile::read(filename, contents, &error));
+        CHECK(error == "Truncated document file");
+    }
+
+    // Not even a whole header
+    writeAll(filename, intact.left(HeaderSize - 1));
+    DocumentFile::Contents contents;
+    CHECK(!DocumentFile::read(filename, contents));
+}
+
+void testSaveOverSource(const QTemporaryDir& dir)
+{
+    const auto original = makeDocument();
+    const QString filename = dir.filePath("mapped.kdoc");
+    CHECK(DocumentFile::write(*original, filename));
+
+    // Open it, change one tile and save over the file its tiles map, twice:
+    // the second save copies chunks that the first relocated
+    Document document(1, 1);
+    if (!CHECK(document.loadFromFile(filename))) return;
+    const auto paint = rasterAt(document.getLayers(), 1);
+    if (!CHECK(paint)) return;
+    for (int pass = 0; pass < 2; ++pass) {
+        paint->setPixel(TileSize + 3 + pass, 4, QColor(255, 0, 0));
+        if (!CHECK(document.saveToFile(filename))) return;
+
+        // The open document still reads its pixels, both the tiles that
+        // were copied from the old file and the changed one
+        CHECK(paint->tiles().pixel(TileSize + 3 + pass, 4) == qRgb(255, 0, 0));
+        const QRect tile(0, 0, TileSize, TileSize);
+        CHECK(paint->tiles().copy(tile) == rasterAt(original->getLayers(), 1)->tiles().copy(tile));
+
+        // And so does the new file
+        DocumentFile::Contents contents;
+        if (CHECK(DocumentFile::read(filename, contents))) {
+            checkContents("saved over the source", document, contents.layers);
+        }
+    }
+}
+
+} // namespace
+
+int main()
+{
+    QTemporaryDir dir;
+    if (!CHECK(dir.isValid())) return test::finish("document_file_test");
+
+    testRoundTrip(dir);
+    testDamage(dir);
+    testSaveOverSource(dir);
+    return test::finish("document_file_test");
+}
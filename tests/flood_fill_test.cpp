@@ -0,0 +1,195 @@
+// FloodFill against a naive single-threaded breadth-first fill (contiguous)
+// and a per-pixel threshold (non-contiguous), on images whose regions wind
+// across tile edges and whose right and bottom tiles are partial.
+
+#include "flood_fill.h"
+#include "selection_kernels.h"
+#include "test_support.h"
+#include <algorithm>
+#include <deque>
+#include <random>
+
+using namespace core;
+
+namespace {
+
+constexpr int TileSize = TileStorage::TileSize;
+
+QRgb grey(int value, int alpha = 255)
+{
+    value = std::clamp(value, 0, alpha);
+    return qRgba(value, value, value, alpha);
+}
+
+// A maze of walls whose corridors cross tile edges many times, over a
+// noisy background; the corridors hold values near the seed colour, so
+// tolerance and anti-aliasing decide how far fills leak into the walls
+QImage mazeImage(int width, int height, std::mt19937& random)
+{
+    QImage image(width, height, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            // Serpentine: horizontal corridors joined at alternate ends
+            const int band = y / 24;
+            const bool corridor = y % 24 < 14
+                || (band % 2 == 0 ? x >= width - 30 : x < 30);
+            int value = corridor ? 60 + static_cast<int>(random() % 24) : 200 + static_cast<int>(random() % 40);
+            // Islands inside the corridors, some straddling tile edges
+            if (corridor && (x / 40 + y / 40) % 5 == 0 && x % 40 < 8 && y % 24 >= 4 && y % 24 < 10) value = 120;
+            const int alpha = (x * 7 + y * 13) % 101 == 0 ? 128 : 255;   // Scattered translucent pixels
+            image.setPixel(x, y, grey(value * alpha / 255, alpha));
+        }
+    }
+    // A ring around a tile corner, only reachable from inside it
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const int dx = x - TileSize;
+            const int dy = y - TileSize;
+            const int d2 = dx * dx + dy * dy;
+            if (d2 >= 40 * 40 && d2 < 44 * 44) image.setPixel(x, y, grey(250));
+        }
+    }
+    return image;
+}
+
+std::array<uint8_t, 256> coverageTable(const FloodFill::Options& options)
+{
+    std::array<uint8_t, 256> table{};
+    for (int d = 0; d < 256; ++d) {
+        if (d <= options.tolerance) {
+            table[d] = 255;
+        } else if (options.antiAlias && options.tolerance > 0) {
+            const float ramp = 3.0f - 2.0f * d / options.tolerance;
+            table[d] = static_cast<uint8_t>(std::clamp(ramp, 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+    return table;
+}
+
+// Coverage per pixel, the slow way
+std::vector<uint8_t> reference(const QImage& image, const QPoint& seed, const FloodFill::Options& options)
+{
+    const int width = image.width();
+    const int height = image.height();
+    std::vector<uint8_t> result(static_cast<size_t>(width) * height, 0);
+    if (!image.rect().contains(seed)) return result;
+
+    const auto table = coverageTable(options);
+    const QRgb target = image.pixel(seed.x(), seed.y());
+    auto coverage = [&](int x, int y) { return table[blend::colorDistance(image.pixel(x, y), target)]; };
+
+    if (!options.contiguous) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                result[static_cast<size_t>(y) * width + x] = coverage(x, y);
+            }
+        }
+        return result;
+    }
+
+    std::vector<bool> visited(result.size(), false);
+    std::deque<QPoint> queue;
+    if (coverage(seed.x(), seed.y()) > 0) {
+        queue.push_back(seed);
+        visited[static_cast<size_t>(seed.y()) * width + seed.x()] = true;
+    }
+    while (!queue.empty()) {
+        const QPoint point = queue.front();
+        queue.pop_front();
+        result[static_cast<size_t>(point.y()) * width + point.x()] = coverage(point.x(), point.y());
+        const QPoint neighbours[] = {point + QPoint(1, 0), point - QPoint(1, 0),
+                                     point + QPoint(0, 1), point - QPoint(0, 1)};
+        for (const QPoint& next : neighbours) {
+            if (!image.rect().contains(next)) continue;
+            const size_t index = static_cast<size_t>(next.y()) * width + next.x();
+            if (visited[index] || coverage(next.x(), next.y()) == 0) continue;
+            visited[index] = true;
+            queue.push_back(next);
+        }
+    }
+    return result;
+}
+
+void compare(const Selection& actual, const std::vector<uint8_t>& expected, int width, int height,
+             const QPoint& seed, const FloodFill::Options& options)
+{
+    int mismatches = 0;
+    QPoint first;
+    QRect bounds;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const uint8_t value = expected[static_cast<size_t>(y) * width + x];
+            if (value) bounds |= QRect(x, y, 1, 1);
+            if (actual.value(x, y) != value && mismatches++ == 0) first = QPoint(x, y);
+        }
+    }
+    if (!CHECK(mismatches == 0) || !CHECK(actual.bounds() == bounds)) {
+        std::fprintf(stderr, "  seed (%d, %d) tolerance %d contiguous %d anti-alias %d: %d pixels differ,"
+                     " first at (%d, %d)\n", seed.x(), seed.y(), options.tolerance, options.contiguous,
+                     options.antiAlias, mismatches, first.x(), first.y());
+    }
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 random(25);
+
+    // Partial tiles on both the right and the bottom edge
+    const int width = 2 * TileSize + 131;
+    const int height = 2 * TileSize + 77;
+    const QImage image = mazeImage(width, height, random);
+    const TileStorage tiles(image);
+
+    const QPoint seeds[] = {
+        QPoint(20, 3),                              // Start of the serpentine
+        QPoint(width - 1, height - 1),              // In the partial corner tile
+        QPoint(TileSize, TileSize),                 // Inside the ring, on a tile corner
+        QPoint(TileSize + 42, TileSize),            // On the ring
+        QPoint(TileSize - 1, 5),                    // On a tile edge
+    };
+    for (const QPoint& seed : seeds) {
+        FloodFill fill(tiles, seed);
+        // One fill reused across options, as the tolerance slider does
+        for (bool antiAlias : {false, true}) {
+            for (int tolerance : {0, 12, 30, 90, 255}) {
+                for (bool contiguous : {true, false}) {
+                    FloodFill::Options options;
+                    options.tolerance = tolerance;
+                    options.antiAlias = antiAlias;
+                    options.contiguous = contiguous;
+                    compare(fill.select(options), reference(image, seed, options), width, height, seed, options);
+                }
+            }
+        }
+    }
+
+    // A fresh fill agrees with a reused one
+    {
+        FloodFill::Options options;
+        options.tolerance = 30;
+        FloodFill fill(tiles, seeds[0]);
+        compare(fill.select(options), reference(image, seeds[0], options), width, height, seeds[0], options);
+    }
+
+    // Uniform tiles are filled whole
+    {
+        const TileStorage blank(width, height, grey(128));
+        FloodFill fill(blank, QPoint(10, 10));
+        const Selection selection = fill.select(FloodFill::Options());
+        CHECK(selection.bounds() == QRect(0, 0, width, height));
+        CHECK(selection.coverage(selection.rect()) == Selection::Coverage::Full);
+        CHECK(fill.memoryUsage() == 0);
+    }
+
+    // A seed off the image selects nothing
+    {
+        FloodFill fill(tiles, QPoint(-1, 4));
+        CHECK(fill.select(FloodFill::Options()).isEmpty());
+        FloodFill beyond(tiles, QPoint(width, 0));
+        CHECK(beyond.select(FloodFill::Options()).isEmpty());
+    }
+
+    return test::finish("flood_fill_test");
+}
@@ -0,0 +1,154 @@
+// Morphology against brute force: every distance is the minimum over all
+// pixels of the plane, and grow, shrink and border apply the same mapping
+// to those distances as morphology.cpp documents.
+
+#include "morphology.h"
+#include "test_support.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+using namespace core;
+
+namespace {
+
+constexpr float Tolerance = 1e-3f;
+constexpr float Infinity = std::numeric_limits<float>::infinity();
+
+bool covered(float value) { return value >= 0.5f; }
+float clamp01(float value) { return std::clamp(value, 0.0f, 1.0f); }
+
+// Discs and specks with soft edges, some reaching the border of the plane
+AlphaPlane randomMask(const QRect& rect, std::mt19937& random, int discs)
+{
+    AlphaPlane plane(rect);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int i = 0; i < discs; ++i) {
+        const float cx = rect.left() + unit(random) * rect.width();
+        const float cy = rect.top() + unit(random) * rect.height();
+        const float radius = 1.0f + unit(random) * rect.width() / 6.0f;
+        for (int y = rect.top(); y <= rect.bottom(); ++y) {
+            for (int x = rect.left(); x <= rect.right(); ++x) {
+                const float d = std::hypot(x - cx, y - cy);
+                float& value = plane.row(y)[x];
+                value = std::max(value, clamp01(radius - d + 0.5f));
+            }
+        }
+    }
+    for (int i = 0; i < rect.width() * rect.height() / 200; ++i) {
+        const int x = rect.left() + static_cast<int>(random() % rect.width());
+        const int y = rect.top() + static_cast<int>(random() % rect.height());
+        plane.row(y)[x] = unit(random);
+    }
+    return plane;
+}
+
+// Distance from each pixel to the nearest pixel with covered(value) == want
+std::vector<float> bruteDistance(const AlphaPlane& plane, bool want)
+{
+    const QRect rect = plane.rect();
+    std::vector<QPoint> targets;
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            if (covered(plane.row(y)[x]) == want) targets.emplace_back(x, y);
+        }
+    }
+    std::vector<float> result;
+    result.reserve(static_cast<size_t>(rect.width()) * rect.height());
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            long long best = std::numeric_limits<long long>::max();
+            for (const QPoint& target : targets) {
+                const long long dx = x - target.x();
+                const long long dy = y - target.y();
+                best = std::min(best, dx * dx + dy * dy);
+            }
+            result.push_back(targets.empty() ? Infinity : static_cast<float>(std::sqrt(static_cast<double>(best))));
+        }
+    }
+    return result;
+}
+
+bool close(float a, float b)
+{
+    if (std::isinf(a) || std::isinf(b)) return a == b;
+    return std::fabs(a - b) <= Tolerance * std::max(1.0f, std::fabs(b));
+}
+
+// Compare a plane with expected values, printing the first mismatch
+void compare(const char* what, float radius, const AlphaPlane& actual, const std::vector<float>& expected)
+{
+    const QRect rect = actual.rect();
+    size_t i = 0;
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        for (int x = rect.left(); x <= rect.right(); ++x, ++i) {
+            if (!CHECK(close(actual.row(y)[x], expected[i]))) {
+                std::fprintf(stderr, "  %s radius %g at (%d, %d): got %g, expected %g\n",
+                             what, radius, x, y, actual.row(y)[x], expected[i]);
+                return;
+            }
+        }
+    }
+}
+
+void testMask(const AlphaPlane& mask, const std::vector<float>& radii)
+{
+    const std::vector<float> out = bruteDistance(mask, true);
+    const std::vector<float> in = bruteDistance(mask, false);
+    compare("distance", 0.0f, morphology::distance(mask), out);
+    compare("inverse distance", 0.0f, morphology::distance(mask, true), in);
+
+    const float* values = mask.data();
+    const size_t count = out.size();
+    for (float radius : radii) {
+        std::vector<float> grown(count), shrunk(count), border(count);
+        const float half = radius * 0.5f;
+        for (size_t i = 0; i < count; ++i) {
+            grown[i] = std::max(values[i], clamp01(radius + 1.0f - out[i]));
+            shrunk[i] = std::min(values[i], clamp01(in[i] - radius));
+            const float outer = covered(values[i]) ? 1.0f : clamp01(half + 1.0f - out[i]);
+            const float inner = covered(values[i]) ? clamp01(in[i] - half) : 0.0f;
+            border[i] = outer - inner;
+        }
+
+        AlphaPlane plane = mask;
+        morphology::grow(plane, radius);
+        compare("grow", radius, plane, grown);
+
+        plane = mask;
+        morphology::shrink(plane, radius);
+        compare("shrink", radius, plane, shrunk);
+
+        plane = mask;
+        morphology::border(plane, radius);
+        compare("border", radius, plane, border);
+    }
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 random(23);
+
+    // Small radii on masks of several shapes, one not at the origin
+    const QRect small[] = {QRect(0, 0, 37, 29), QRect(-20, 13, 64, 48), QRect(5, 5, 1, 40), QRect(0, 0, 90, 3)};
+    for (const QRect& rect : small) {
+        for (int trial = 0; trial < 3; ++trial) {
+            testMask(randomMask(rect, random, 1 + trial * 3), {0.5f, 1.0f, 2.5f, 4.0f});
+        }
+    }
+
+    // Large radii, up to far beyond the plane, where the envelope spans
+    // whole rows and every pixel is reached
+    const QRect large(0, 0, 150, 110);
+    testMask(randomMask(large, random, 2), {17.0f, 60.0f, 500.0f});
+    testMask(randomMask(large, random, 9), {31.5f, 200.0f});
+
+    // Degenerate planes: nothing covered, everything covered
+    testMask(AlphaPlane(QRect(0, 0, 20, 20), 0.0f), {3.0f});
+    testMask(AlphaPlane(QRect(0, 0, 20, 20), 1.0f), {3.0f});
+
+    return test::finish("morphology_test");
+}
@@ -0,0 +1,188 @@
+// Edits clipped to a selection against a dense reference: every pixel ends
+// up as the original mixed with the edited value by its coverage, through
+// each path of RasterLayer::WriteAccess (uniform tiles, wholly selected
+// tiles mapped in place, partly selected spans mixed from a copy, and
+// unselected tiles left alone).
+
+#include "layer.h"
+#include "point_operation.h"
+#include "test_support.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace core;
+
+namespace {
+
+constexpr int TileSize = TileStorage::TileSize;
+
+// Inverts colour, keeping premultiplied values valid
+QRgb invert(QRgb pixel)
+{
+    const int a = qAlpha(pixel);
+    return qRgba(a - qRed(pixel), a - qGreen(pixel), a - qBlue(pixel), a);
+}
+
+// The mix WriteAccess documents: dst + (src - dst) * coverage, with full
+// coverage taking the edited pixel exactly
+QRgb mix(QRgb dst, QRgb src, uint8_t coverage)
+{
+    const int weight = coverage + (coverage >> 7);
+    auto channel = [weight](int d, int s) { return d + (((s - d) * weight) >> 8); };
+    return qRgba(channel(qRed(dst), qRed(src)), channel(qGreen(dst), qGreen(src)),
+                 channel(qBlue(dst), qBlue(src)), channel(qAlpha(dst), qAlpha(src)));
+}
+
+// Uniform tiles with painted ones among them, partial tiles on the right
+// and at the bottom
+TileStorage makeTiles(std::mt19937& random)
+{
+    TileStorage tiles(2 * TileSize + 70, TileSize + 90, qRgba(40, 60, 20, 255));
+    const QPoint painted[] = {QPoint(0, 0), QPoint(0, 1), QPoint(1, 1), QPoint(2, 0)};
+    for (const QPoint& t : painted) {
+        QImage& image = tiles.detachTile(t.x(), t.y());
+        const QRect rect = tiles.tileRect(t.x(), t.y());
+        for (int y = 0; y < rect.height(); ++y) {
+            for (int x = 0; x < rect.width(); ++x) {
+                const int a = 64 + static_cast<int>(random() % 192);
+                image.setPixel(x, y, qRgba(static_cast<int>(random() % (a + 1)), static_cast<int>(random() % (a + 1)),
+                                           static_cast<int>(random() % (a + 1)), a));
+            }
+        }
+    }
+    return tiles;
+}
+
+// Tile (1, 0), uniform in the layer, wholly selected; a soft disc across
+// the tiles below it; a speck in tile (2, 1), so that tile (2, 0) lies in
+// the selection's bounds without any of it being selected
+Selection makeSelection(const QSize& size)
+{
+    Selection selection(size);
+    selection.combine(QRect(TileSize, 0, TileSize, TileSize));
+    const QPointF centre(TileSize + 10.5, TileSize + 40.5);
+    AlphaPlane disc(QRect(TileSize - 80, TileSize - 20, 180, 130));
+    for (int y = disc.rect().top(); y <= disc.rect().bottom(); ++y) {
+        for (int x = disc.rect().left(); x <= disc.rect().right(); ++x) {
+            const float d = std::hypot(x - centre.x(), y - centre.y());
+            disc.row(y)[x] = std::clamp((60.0f - d) / 20.0f, 0.0f, 1.0f);
+        }
+    }
+    selection.combine(disc, Selection::Operation::Add);
+    selection.combine(QRect(2 * TileSize + 10, TileSize + 10, 20, 20), Selection::Operation::Add);
+    return selection;
+}
+
+template <typename Edit>
+void compare(const char* what, const TileStorage& before, const RasterLayer& layer, const Selection& selection,
+             Edit edit)
+{
+    const QRect rect = before.rect();
+    for (int y = 0; y < rect.height(); ++y) {
+        for (int x = 0; x < rect.width(); ++x) {
+            const QRgb original = before.pixel(x, y);
+            const QRgb expected = mix(original, edit(original), selection.value(x, y));
+            const QRgb actual = layer.tiles().pixel(x, y);
+            if (!CHECK(actual == expected)) {
+                std::fprintf(stderr, "  %s at (%d, %d): got %08x, expected %08x\n", what, x, y, actual, expected);
+                return;
+            }
+        }
+    }
+}
+
+// Unselected tiles were never detached, wholly selected uniform ones stay
+// uniform
+void checkTiles(const char* what, const TileStorage& before, const RasterLayer& layer)
+{
+    const TileStorage& after = layer.tiles();
+    if (!CHECK(after.tileAt(2, 0).image().constBits() == before.tileAt(2, 0).image().constBits())) {
+        std::fprintf(stderr, "  %s: unselected tile detached\n", what);
+    }
+    if (!CHECK(after.tileAt(1, 0).isUniform())) {
+        std::fprintf(stderr, "  %s: selected uniform tile detached\n", what);
+    }
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 random(24);
+    const TileStorage tiles = makeTiles(random);
+    const Selection selection = makeSelection(tiles.size());
+
+    // mapPixels
+    {
+        RasterLayer layer(tiles);
+        {
+            RasterLayer::WriteAccess access = layer.beginWrite(layer.tiles().rect(), &selection);
+            CHECK(access.area() == selection.bounds());
+            access.mapPixels([](QRgb* pixels, int count) {
+                for (int i = 0; i < count; ++i) pixels[i] = invert(pixels[i]);
+            });
+        }
+        compare("mapPixels", tiles, layer, selection, invert);
+        checkTiles("mapPixels", tiles, layer);
+    }
+
+    // forEachTile, mixing by the clip it hands out
+    {
+        RasterLayer layer(tiles);
+        int visited = 0;
+        {
+            RasterLayer::WriteAccess access = layer.beginWrite(layer.tiles().rect(), &selection);
+            access.forEachTile([&](QRgb* pixels, const QRect& part, int stride, const uint8_t* clip, int clipStride) {
+                ++visited;
+                CHECK(selection.coverage(part) != Selection::Coverage::None);
+                if (!clip) CHECK(selection.coverage(part) == Selection::Coverage::Full);
+                for (int y = 0; y < part.height(); ++y) {
+                    for (int x = 0; x < part.width(); ++x) {
+                        const uint8_t coverage = clip ? clip[y * clipStride + x] : 255;
+                        CHECK(coverage == selection.value(part.left() + x, part.top() + y));
+                        QRgb& pixel = pixels[y * stride + x];
+                        pixel = mix(pixel, invert(pixel), coverage);
+                    }
+                }
+            });
+        }
+        CHECK(visited == 5);  // All but tile (2, 0)
+        compare("forEachTile", tiles, layer, selection, invert);
+        CHECK(layer.tiles().tileAt(2, 0).image().constBits() == tiles.tileAt(2, 0).image().constBits());
+    }
+
+    // adjust() clips to the layer's own selection
+    {
+        RasterLayer layer(tiles);
+        layer.select(selection);
+        const PointOperation operation = PointOperation::levels(20.0f, 220.0f, 1.4f);
+        layer.adjust(operation);
+        compare("adjust", tiles, layer, selection, [&operation](QRgb pixel) {
+            operation.applyRow(&pixel, 1);
+            return pixel;
+        });
+        checkTiles("adjust", tiles, layer);
+    }
+
+    // No selection, or one of another size, clips nothing
+    {
+        const Selection none(tiles.size());
+        const Selection other(QSize(10, 10));
+        for (const Selection* clip : {&none, &other}) {
+            RasterLayer layer(tiles);
+            {
+                RasterLayer::WriteAccess access = layer.beginWrite(QRect(-5, -5, 4000, 4000), clip);
+                CHECK(access.area() == tiles.rect());
+                access.mapPixels([](QRgb* pixels, int count) {
+                    for (int i = 0; i < count; ++i) pixels[i] = invert(pixels[i]);
+                });
+            }
+            Selection all(tiles.size());
+            all.selectAll();
+            compare("unclipped", tiles, layer, all, invert);
+        }
+    }
+
+    return test::finish("selection_clip_test");
+}
@@ -0,0 +1,374 @@
+// Selection against a dense reference: one byte per pixel of the canvas,
+// edited with the per-pixel definitions of every operation. A random
+// sequence of rectangles (tile-aligned, partial, covering everything or
+// nothing), soft planes and other selections drives both, so the
+// uniform-tile shortcuts meet every kind of tile.
+
+#include "morphology.h"
+#include "selection.h"
+#include "test_support.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace core;
+
+namespace {
+
+constexpr int TileSize = Selection::TileSize;
+using Operation = Selection::Operation;
+
+uint8_t toCoverage(float value)
+{
+    return static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+uint8_t combineValue(Operation op, uint8_t dst, uint8_t src)
+{
+    switch (op) {
+        case Operation::Replace: return src;
+        case Operation::Add: return std::max(dst, src);
+        case Operation::Intersect: return std::min(dst, src);
+        case Operation::Subtract: return dst > src ? static_cast<uint8_t>(dst - src) : 0;
+    }
+    return dst;
+}
+
+struct Dense {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> values;
+
+    Dense(int w, int h) : width(w), height(h), values(static_cast<size_t>(w) * h, 0) {}
+
+    uint8_t& at(int x, int y) { return values[static_cast<size_t>(y) * width + x]; }
+    uint8_t at(int x, int y) const { return values[static_cast<size_t>(y) * width + x]; }
+    QRect rect() const { return QRect(0, 0, width, height); }
+
+    // Apply `op` with the source value source(x, y) at every pixel
+    template <typename Source>
+    void combine(Operation op, Source source)
+    {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                at(x, y) = combineValue(op, at(x, y), source(x, y));
+            }
+        }
+    }
+
+    QRect bounds() const
+    {
+        QRect result;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (at(x, y)) result |= QRect(x, y, 1, 1);
+            }
+        }
+        return result;
+    }
+
+    // The canvas as a plane, grown by `margin` of unselected pixels
+    AlphaPlane plane(int margin) const
+    {
+        AlphaPlane result(rect().adjusted(-margin, -margin, margin, margin));
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                result.row(y)[x] = at(x, y) * (1.0f / 255.0f);
+            }
+        }
+        return result;
+    }
+
+    void assign(const AlphaPlane& plane)
+    {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                at(x, y) = toCoverage(plane.row(y)[x]);
+            }
+        }
+    }
+};
+
+// Every pixel within `tolerance`, and tight bounds
+bool matches(const Selection& selection, const Dense& dense, const char* step, int tolerance = 0)
+{
+    for (int y = 0; y < dense.height; ++y) {
+        for (int x = 0; x < dense.width; ++x) {
+            if (!CHECK(std::abs(selection.value(x, y) - dense.at(x, y)) <= tolerance)) {
+                std::fprintf(stderr, "  after %s at (%d, %d): got %d, expected %d\n", step, x, y,
+                             selection.value(x, y), dense.at(x, y));
+                return false;
+            }
+        }
+    }
+    if (tolerance == 0 && !CHECK(selection.bounds() == dense.bounds())) {
+        std::fprintf(stderr, "  after %s: bounds differ\n", step);
+        return false;
+    }
+    return true;
+}
+
+QRect randomRect(std::mt19937& random, const QSize& size)
+{
+    switch (random() % 6) {
+        case 0: {
+            // Whole tiles
+            const int tx = static_cast<int>(random() % 3);
+            const int ty = static_cast<int>(random() % 3);
+            return QRect(tx * TileSize, ty * TileSize, TileSize * (1 + random() % 2), TileSize);
+        }
+        case 1:
+            return QRect(-10, -10, size.width() + 20, size.height() + 20);
+        case 2:
+            return QRect(size.width() + 5, 0, 10, 10);  // Off the canvas
+        default: {
+            const int x = static_cast<int>(random() % size.width()) - 20;
+            const int y = static_cast<int>(random() % size.height()) - 20;
+            return QRect(x, y, 1 + static_cast<int>(random() % 400), 1 + static_cast<int>(random() % 300));
+        }
+    }
+}
+
+AlphaPlane randomDisc(std::mt19937& random, const QSize& size)
+{
+    const float cx = static_cast<float>(random() % size.width());
+    const float cy = static_cast<float>(random() % size.height());
+    const float radius = 10.0f + static_cast<float>(random() % 200);
+    const float soft = 1.0f + static_cast<float>(random() % 30);
+    const QRect rect = QRect(static_cast<int>(cx - radius - soft), static_cast<int>(cy - radius - soft),
+                             static_cast<int>(2 * (radius + soft)) + 2, static_cast<int>(2 * (radius + soft)) + 2);
+    AlphaPlane plane(rect);
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            const float d = std::hypot(x - cx, y - cy);
+            plane.row(y)[x] = std::clamp((radius + soft - d) / soft, 0.0f, 1.0f);
+        }
+    }
+    return plane;
+}
+
+Operation randomOperation(std::mt19937& random)
+{
+    return static_cast<Operation>(random() % 4);
+}
+
+void testCombine(std::mt19937& random)
+{
+    // Partial tiles on the right and at the bottom
+    const QSize size(2 * TileSize + 90, 2 * TileSize + 35);
+    Selection selection(size);
+    Dense dense(size.width(), size.height());
+    CHECK(selection.isEmpty());
+
+    for (int step = 0; step < 60; ++step) {
+        const Operation op = randomOperation(random);
+        switch (random() % 5) {
+            case 0:
+            case 1: {
+                const QRect rect = randomRect(random, size);
+                selection.combine(rect, op);
+                dense.combine(op, [&](int x, int y) -> uint8_t { return rect.contains(x, y) ? 255 : 0; });
+                matches(selection, dense, "combine(rect)");
+                break;
+            }
+            case 2:
+            case 3: {
+                const AlphaPlane plane = randomDisc(random, size);
+                selection.combine(plane, op);
+                dense.combine(op, [&](int x, int y) { return toCoverage(plane.value(x, y)); });
+                matches(selection, dense, "combine(plane)");
+                break;
+            }
+            default: {
+                // Another selection, itself made of a rectangle and a disc
+                Selection other(size);
+                Dense otherDense(size.width(), size.height());
+                const QRect rect = randomRect(random, size);
+                other.combine(rect);
+                otherDense.combine(Operation::Replace, [&](int x, int y) -> uint8_t { return rect.contains(x, y) ? 255 : 0; });
+                const AlphaPlane plane = randomDisc(random, size);
+                other.combine(plane, Operation::Add);
+                otherDense.combine(Operation::Add, [&](int x, int y) { return toCoverage(plane.value(x, y)); });
+                selection.combine(other, op);
+                dense.combine(op, [&](int x, int y) { return otherDense.at(x, y); });
+                matches(selection, dense, "combine(selection)");
+                break;
+            }
+        }
+
+        if (step % 10 == 9) {
+            selection.invert();
+            dense.combine(Operation::Replace, [&](int x, int y) { return static_cast<uint8_t>(255 - dense.at(x, y)); });
+            matches(selection, dense, "invert");
+        }
+    }
+
+    // Tile-aligned rectangles stay uniform whatever the operation
+    selection.clear();
+    selection.combine(QRect(0, 0, 2 * TileSize, TileSize));
+    selection.combine(QRect(TileSize, 0, TileSize, 2 * TileSize), Operation::Add);
+    selection.combine(QRect(0, 0, TileSize, TileSize), Operation::Subtract);
+    selection.combine(QRect(TileSize, TileSize, TileSize, TileSize), Operation::Intersect);
+    CHECK(selection.allocatedTileCount() == 0);
+    CHECK(selection.bounds() == QRect(TileSize, TileSize, TileSize, TileSize));
+
+    // Wholly selected or unselected tiles of a soft source are not stored
+    // as pixels either
+    AlphaPlane plane(QRect(-10, -10, 2 * TileSize + 10, 2 * TileSize + 10), 1.0f);
+    plane.row(TileSize + 10)[TileSize + 5] = 0.5f;
+    selection.combine(plane, Operation::Add);
+    CHECK(selection.allocatedTileCount() == 0);
+    selection.combine(plane, Operation::Replace);
+    CHECK(selection.allocatedTileCount() == 1);
+    CHECK(selection.value(TileSize + 5, TileSize + 10) == 128);
+
+    selection.selectAll();
+    CHECK(selection.allocatedTileCount() == 0);
+    CHECK(selection.bounds() == QRect(QPoint(0, 0), size));
+    selection.combine(QRect(QPoint(0, 0), size), Operation::Subtract);
+    CHECK(selection.isEmpty());
+    CHECK(selection.allocatedTileCount() == 0);
+}
+
+void testCoverage(std::mt19937& random)
+{
+    const QSize size(3 * TileSize + 10, 2 * TileSize + 100);
+    Selection selection(size);
+    selection.combine(QRect(0, 0, 2 * TileSize, TileSize));                 // Two full tiles
+    selection.combine(randomDisc(random, size), Operation::Add);
+    selection.combine(QRect(TileSize + 40, TileSize + 40, 30, 30), Operation::Subtract);
+    const Dense dense = [&] {
+        Dense d(size.width(), size.height());
+        d.combine(Operation::Replace, [&](int x, int y) { return selection.value(x, y); });
+        return d;
+    }();
+
+    for (int i = 0; i < 400; ++i) {
+        const QRect area = i < 300 ? randomRect(random, size)
+                                   : QRect(static_cast<int>(random() % (2 * TileSize)), static_cast<int>(random() % TileSize),
+                                           1 + static_cast<int>(random() % 40), 1 + static_cast<int>(random() % 40));
+        const QRect clipped = area & dense.rect();
+        bool none = true;
+        bool full = clipped == area;
+        for (int y = clipped.top(); y <= clipped.bottom(); ++y) {
+            for (int x = clipped.left(); x <= clipped.right(); ++x) {
+                none = none && dense.at(x, y) == 0;
+                full = full && dense.at(x, y) == 255;
+            }
+        }
+
+        // Decided from tiles, so only conservative in general: never None
+        // or Full wrongly, and exact inside the wholly selected tiles
+        const Selection::Coverage coverage = selection.coverage(area);
+        if (coverage == Selection::Coverage::None) CHECK(none);
+        if (coverage == Selection::Coverage::Full) CHECK(full);
+        if (coverage == Selection::Coverage::Partial) CHECK(!none || clipped.intersects(selection.bounds()));
+        if (full && QRect(0, 0, 2 * TileSize, TileSize).contains(area)) CHECK(coverage == Selection::Coverage::Full);
+        if (none && !clipped.intersects(selection.bounds())) CHECK(coverage == Selection::Coverage::None);
+    }
+
+    // copy() and forEachSpan() with areas hanging off the canvas
+    for (int i = 0; i < 50; ++i) {
+        const QRect area = randomRect(random, size);
+        const QImage image = selection.copy(area);
+        bool same = true;
+        for (int y = 0; y < area.height() && same; ++y) {
+            for (int x = 0; x < area.width() && same; ++x) {
+                const QPoint p(area.left() + x, area.top() + y);
+                const uint8_t expected = dense.rect().contains(p) ? dense.at(p.x(), p.y()) : 0;
+                same = image.constScanLine(y)[x] == expected;
+            }
+        }
+        CHECK(same);
+
+        int visited = 0;
+        selection.forEachSpan(area, [&](int x, int y, const uint8_t* values, int count) {
+            visited += count;
+            for (int i = 0; i < count; ++i) {
+                CHECK(values[i] == dense.at(x + i, y));
+            }
+        });
+        const QRect clipped = area & dense.rect();
+        CHECK(visited == (clipped.isEmpty() ? 0 : clipped.width() * clipped.height()));
+    }
+
+    // tileRows(): null only for wholly selected tiles
+    std::vector<uint8_t> buffer(static_cast<size_t>(TileSize) * TileSize);
+    for (int ty = 0; ty < selection.tilesY(); ++ty) {
+        for (int tx = 0; tx < selection.tilesX(); ++tx) {
+            int stride = 0;
+            const uint8_t* rows = selection.tileRows(tx, ty, buffer.data(), &stride);
+            const QRect rect = selection.tileRect(tx, ty);
+            bool same = true;
+            for (int y = rect.top(); y <= rect.bottom(); ++y) {
+                for (int x = rect.left(); x <= rect.right(); ++x) {
+                    const uint8_t value = rows ? rows[(y - rect.top()) * stride + (x - rect.left())] : 255;
+                    same = same && value == dense.at(x, y);
+                }
+            }
+            CHECK(same);
+        }
+    }
+}
+
+void testMorphology(std::mt19937& random)
+{
+    const QSize size(2 * TileSize + 60, TileSize + 120);
+    for (int trial = 0; trial < 3; ++trial) {
+        Selection selection(size);
+        Dense dense(size.width(), size.height());
+        // Touch the canvas edge, where beyond counts as unselected
+        const QRect edge(size.width() - 50, -5, 80, 120);
+        selection.combine(edge);
+        dense.combine(Operation::Replace, [&](int x, int y) -> uint8_t { return edge.contains(x, y) ? 255 : 0; });
+        const AlphaPlane disc = randomDisc(random, size);
+        selection.combine(disc, Operation::Add);
+        dense.combine(Operation::Add, [&](int x, int y) { return toCoverage(disc.value(x, y)); });
+
+        // grow: nothing beyond radius + 1 of the selection changes, so the
+        // whole canvas as a plane is the reference
+        const float radius = trial == 0 ? 1.5f : trial == 1 ? 12.0f : 140.0f;
+        Selection grown = selection;
+        grown.grow(radius);
+        AlphaPlane plane = dense.plane(0);
+        morphology::grow(plane, radius);
+        Dense grownDense = dense;
+        grownDense.assign(plane);
+        matches(grown, grownDense, "grow");
+
+        // shrink: the canvas with one unselected pixel all round
+        Selection shrunk = selection;
+        shrunk.shrink(radius / 3.0f);
+        plane = dense.plane(1);
+        morphology::shrink(plane, radius / 3.0f);
+        Dense shrunkDense = dense;
+        shrunkDense.assign(plane);
+        matches(shrunk, shrunkDense, "shrink");
+
+        // feather: blurred over the canvas with room for the blur to fade;
+        // the sums run over other extents, so allow a step of rounding
+        Selection feathered = selection;
+        feathered.feather(radius / 2.0f);
+        const float sigma = radius / 4.0f;
+        const int reach = blur::reach(sigma);
+        plane = dense.plane(reach);
+        blur::gaussian(plane, sigma);
+        Dense featheredDense = dense;
+        featheredDense.assign(plane);
+        matches(feathered, featheredDense, "feather", 1);
+
+        // The original is untouched: tiles are copy-on-write
+        matches(selection, dense, "copies");
+    }
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 random(24);
+    testCombine(random);
+    testCoverage(random);
+    testMorphology(random);
+    return test::finish("selection_test");
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdio>
+
+// The core tests are plain executables: checks report to stderr and the
+// process exits non-zero when any failed, which is all ctest needs
+
+namespace test {
+
+inline int& failureCount()
+{
+    static int count = 0;
+    return count;
+}
+
+inline bool check(bool ok, const char* expression, const char* file, int line)
+{
+    if (!ok) {
+        ++failureCount();
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    }
+    return ok;
+}
+
+// Exit status for main()
+inline int finish(const char* name)
+{
+    if (failureCount() > 0) {
+        std::fprintf(stderr, "%s: %d check(s) failed\n", name, failureCount());
+        return 1;
+    }
+    std::printf("%s: passed\n", name);
+    return 0;
+}
+
+} // namespace test
+
+// Evaluates to the condition, so callers can add context when it fails
+#define CHECK(condition) test::check(static_cast<bool>(condition), #condition, __FILE__, __LINE__)